@@ -0,0 +1,136 @@
+/*
+ * Copyright (c) 2022 - present, GitHub: @cubter
+ *
+ * See COPYING.txt in the project root for license information.
+ */
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <vector>
+
+namespace metasci
+{
+// Monotonic arena. Memory is handed out by bumping a pointer and is never
+// freed one by one; instead, the whole arena is reset at once (e.g. after a
+// batch of articles has been emitted). Blocks are kept across resets, so a
+// warmed-up arena doesn't call malloc at all.
+class monotonic_arena
+{
+public:
+    inline void  *allocate(size_t bytes, size_t align);
+    inline void   reset();
+    size_t        capacity() const { return total; }
+
+    monotonic_arena(size_t block_bytes = 1 << 20) : block_size(block_bytes) {};
+    monotonic_arena(const monotonic_arena &other) = delete;
+    monotonic_arena &operator=(const monotonic_arena &other) = delete;
+    ~monotonic_arena() {};
+
+private:
+    struct block
+    {
+        std::unique_ptr<char[]> data;
+        size_t                  size;
+    };
+
+    size_t              block_size;
+    std::vector<block>  blocks;
+    size_t              current = 0;    // block being filled
+    size_t              offset  = 0;    // first free byte in it
+    size_t              total   = 0;
+};
+
+inline void *monotonic_arena::allocate(size_t bytes, size_t align)
+{
+    while (current < blocks.size())
+    {
+        block &b = blocks[current];
+        uintptr_t base = reinterpret_cast<uintptr_t>(b.data.get());
+        size_t aligned = ((base + offset + align - 1) & ~(align - 1)) - base;
+
+        if (aligned + bytes <= b.size)
+        {
+            offset = aligned + bytes;
+            return b.data.get() + aligned;
+        }
+        // The rest of the block is wasted until the next reset.
+        ++current;
+        offset = 0;
+    }
+
+    // Oversized requests get a block of their own.
+    size_t size = std::max(block_size, bytes + align);
+    blocks.push_back(block{ std::unique_ptr<char[]>(new char[size]), size });
+    total += size;
+    current = blocks.size() - 1;
+    offset  = 0;
+
+    return allocate(bytes, align);
+};
+
+inline void monotonic_arena::reset()
+{
+    current = 0;
+    offset  = 0;
+};
+
+// STL allocator on top of the arena. deallocate() is a no-op: memory comes
+// back only when the arena is reset. A default-constructed allocator has no
+// arena and falls back to the global heap, so the containers using it work
+// outside of the parser as well.
+template<typename T>
+class arena_allocator
+{
+public:
+    using value_type = T;
+
+    template<typename U>
+    struct rebind { using other = arena_allocator<U>; };
+
+    T *allocate(size_t n)
+    {
+        if (arena == nullptr)
+        {
+            return static_cast<T *>(::operator new(n * sizeof(T)));
+        }
+        return static_cast<T *>(arena->allocate(n * sizeof(T), alignof(T)));
+    }
+    void deallocate(T *p, size_t)
+    {
+        if (arena == nullptr)
+        {
+            ::operator delete(p);
+        }
+    }
+
+    monotonic_arena *get_arena() const { return arena; }
+
+    arena_allocator() : arena(nullptr) {};
+    arena_allocator(monotonic_arena &from) : arena(&from) {};
+    template<typename U>
+    arena_allocator(const arena_allocator<U> &other) : arena(other.get_arena()) {}
+
+private:
+    monotonic_arena *arena;
+};
+
+template<typename T, typename U>
+bool operator==(const arena_allocator<T> &a, const arena_allocator<U> &b)
+{
+    return a.get_arena() == b.get_arena();
+}
+template<typename T, typename U>
+bool operator!=(const arena_allocator<T> &a, const arena_allocator<U> &b)
+{
+    return a.get_arena() != b.get_arena();
+}
+
+template<typename T>
+using arena_vector = std::vector<T, arena_allocator<T>>;
+}
+#endif
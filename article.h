@@ -4,16 +4,19 @@
  * See COPYING.txt in the project root for license information.
  */
 #ifndef ARTICLE_H
-    #define ARTICLE_H
-#endif
+#define ARTICLE_H
 
+#include "arena.h"
 #include "author.h"
+#include "compact_label.h"
 #include "journal.h"
 
 #include <iostream>
 #include <string>
 #include <vector>
 #include <functional>
+#include <atomic>
+#include <iterator>
 #include <memory>
 
 namespace metasci
@@ -51,8 +54,8 @@ private:
     static pub_type_id  max_id_;
 };
 
-publication_type::publication_type(string crossref_id) :
-    crossref_id(crossref_id) 
+publication_type::publication_type(string cr_id) :
+    crossref_id(cr_id) 
 {
     // Each time a new instance of the class is created, the class' max 
     // id is incremeted, and the instance receives an ID.
@@ -69,6 +72,7 @@ class subject
 {
 public:
     subject_id get_id() const { return id; };
+    string     get_title() const { return title; };
     
     inline bool operator==(const subject &other);
     subject     &operator=(const subject &other)    = default; 
@@ -76,6 +80,7 @@ public:
 
     subject() {};
     subject(string title);
+    subject(subject_id id, string title);   // restores a saved subject
     subject(const subject &other) = default; 
     subject(subject &&other)      = default; 
 
@@ -83,22 +88,38 @@ private:
     subject_id          id;  // my own id
     static subject_id   max_id_;
     string              title;
+
+public:
+    // The highest ID assigned so far; restored when resuming an ingest.
+    static subject_id   max_id()                    { return max_id_; }
+    static void         restore_max_id(subject_id m) { max_id_ = m; }
 };
 
 inline bool subject::operator==(const subject &other)
 {
     return title == other.title;
 };
-subject::subject(string title) :
-    title(title)  // titles are short, so no need to `move` them.
+subject::subject(string name) :
+    title(name)  // titles are short, so no need to `move` them.
 {
     // Each time a new instance of the class is created, the class' max 
     // id is incremeted, and the instance receives an ID.
     id = ++max_id_;
 };
+subject::subject(subject_id saved_id, string name) :
+    id(saved_id),
+    title(std::move(name))
+{
+    if (id > max_id_)
+    {
+        max_id_ = id;
+    }
+};
 
 template<typename T>
 using cref_vec = std::vector<std::reference_wrapper<const T>>;
+template<typename T>
+using arena_cref_vec = arena_vector<std::reference_wrapper<const T>>;
 
 class article
 {
@@ -108,29 +129,41 @@ public:
     // a builder class. However, in this case I've decided to stick to it,
     // since I've got a rel. simple inheritance in general and don't really see 
     // the need for the builder's inheritance here.
+    //
+    // The builder's containers allocate from the parser's arena (if it's 
+    // given one), since the builder lives for a single item only: their
+    // growth doesn't go to the heap. The article itself is on the heap, as
+    // it outlives the arena's batch; it receives exactly-sized copies of 
+    // the containers, i.e. a heap allocation per non-empty list, and the 
+    // strings, which are moved rather than copied, keep their own buffers.
     class builder
     {
     public:
         string      doi_b;
         string      title_b;         
-        pub_type_id type_b;        
-        date_vec    published_b;   
-        int32_t     score_b;
-        date_vec    issued_b;      
-        string      volume_b;
-        string      issue_b;
-        str_vec     ct_numbers_b;   
-        int32_t     ref_num_b;
-        int32_t     ref_by_num_b;
-        str_vec     references_b;
-        mutable cref_vec<journal>   journals_b;
-        std::vector<subject_id>     subjects_ids_b;
-        std::vector<author>         authors_b;
+        pub_type_id type_b = 0;        
+        arena_vector<date>      published_b;   
+        int32_t     score_b = 0;
+        arena_vector<date>      issued_b;      
+        compact_label volume_b;
+        compact_label issue_b;
+        arena_vector<string>    ct_numbers_b;   
+        int32_t     ref_num_b = 0;
+        int32_t     ref_by_num_b = 0;
+        int64_t     updated_b = 0;
+        arena_vector<string>    references_b;
+        mutable arena_cref_vec<journal> journals_b;
+        arena_vector<subject_id>        subjects_ids_b;
+        arena_vector<author>            authors_b;
 
         article build();
+        // Keeps the given ID, e.g. a stored article's, and leaves the IDs'
+        // counter alone.
+        article build(int32_t id);
 
         // builder's constructors
         builder();
+        builder(monotonic_arena &arena);
         builder(string title, 
             string doi, 
             cref_vec<journal> &&journals, 
@@ -142,17 +175,44 @@ public:
         ~builder() {};
     };
 
+    int32_t      get_id() const     { return id; };
     string       get_title() const  { return title; };
     string       get_doi() const    { return doi; };
+    const string &title_ref() const { return title; };
+    const string &doi_ref() const   { return doi; };
     pub_type_id  get_type() const   { return type; };
+    int32_t      get_score() const  { return score; };
+    compact_label get_volume() const { return volume; };
+    compact_label get_issue() const  { return issue; };
+    int32_t      get_ref_num() const    { return ref_num; };
+    int32_t      get_ref_by_num() const { return ref_by_num; };
+    int64_t      get_updated() const    { return updated; };
+    const date_vec &published_ref() const   { return published; };
+    const date_vec &issued_ref() const      { return issued; };
+    const str_vec  &ct_numbers_ref() const  { return ct_numbers; };
+    const str_vec  &references_ref() const  { return references; };
+    const std::vector<author_id>  &authors_ids_ref() const  { return authors_ids; };
+    const std::vector<subject_id> &subjects_ids_ref() const { return subjects_ids; };
+    const cref_vec<journal>       &journals_ref() const     { return journals; };
     std::vector<author>     get_authors() const         { return authors; };
+    const std::vector<author> &authors_ref() const      { return authors; };
+    std::vector<author_id>  get_authors_ids() const     { return authors_ids; };
+    inline std::vector<author> take_authors();
+    inline void set_authors_ids(std::vector<author_id> &&ids);
     std::vector<subject_id> get_subjects_ids() const    { return subjects_ids; };
     inline std::vector<journal> get_journals() const;
 
+    // The highest ID assigned so far; restored when resuming an ingest.
+    static int32_t  max_id()                { return max_id_; }
+    static void     restore_max_id(int32_t m) { max_id_ = m; }
+    // An updated version of an article already stored keeps its ID.
+    void            set_id(int32_t new_id)  { id = new_id; }
+
     article &operator=(article &&other)      = default;
     article &operator=(const article &other) = delete;
     
     article(builder &b);
+    article(builder &b, int32_t id);
     article(article &&other)        = default;
     article(const article &other)   = delete;
     article()                       = delete;
@@ -160,18 +220,20 @@ public:
 
 private:
     int32_t         id;          // my own id
-    static int32_t  max_id_;
+    // Articles may be built by several threads at once.
+    static std::atomic<int32_t> max_id_;
     string          doi;         // DOI -- a unique article's ID
     string          title;          
     pub_type_id     type;           
     date_vec        published;   // date of publication (online (pref.)/print)  
     int32_t         score;
     date_vec        issued;      // date of issue
-    string          volume;      // volume's number
-    string          issue;       // issue's number        
+    compact_label   volume;      // volume's number
+    compact_label   issue;       // issue's number        
     str_vec         ct_numbers;  // NCT IDs associated with the publication
     int32_t         ref_num;     // number of references
     int32_t         ref_by_num;  // No of times the article has been referenced
+    int64_t         updated;     // Crossref's last indexing, ms since epoch
     str_vec         references;  // list of references
     // The use of subjects' IDs instead of references to subjects is
     // exclusively due to the reason of space optimization: unlike journals, 
@@ -180,8 +242,11 @@ private:
     // article may have several authors. Unfortunately, it's impossible to say
     // whether two authors with the same full name are indeed the same person, 
     // unless the author has ORCID, which is far not always the case. Hence, 
-    // a vector with classes instead of references is used here.
+    // the authors are kept by value until the author resolution stage has 
+    // merged them (see author_resolver.h); afterwards, only the IDs of the
+    // deduplicated authors are kept.
     std::vector<author>     authors;
+    std::vector<author_id>  authors_ids;
     cref_vec<journal>       journals;  // references to journals
 };
 
@@ -198,14 +263,54 @@ inline std::vector<journal> article::get_journals() const
     return out;
 };
 
-// Builds an article from builder, calling builder's destructor afterwards. 
+// Hands the article's authors over to the author resolution stage.
+inline std::vector<author> article::take_authors()
+{
+    std::vector<author> out(std::move(authors));
+    authors.clear();
+    authors.shrink_to_fit();
+
+    return out;
+};
+// Sets the IDs of the resolved authors, in the original order.
+inline void article::set_authors_ids(std::vector<author_id> &&ids)
+{
+    authors_ids = std::move(ids);
+};
+
+// Builds an article from builder, with a new ID. The builder is left empty
+// afterwards.
 article article::builder::build()
 { 
-    article a(*this); 
-    this->~builder(); 
+    return build(++max_id_);
+};
+article article::builder::build(int32_t id)
+{ 
+    article a(*this, id); 
+
+    published_b.clear();
+    issued_b.clear();
+    ct_numbers_b.clear();
+    references_b.clear();
+    journals_b.clear();
+    subjects_ids_b.clear();
+    authors_b.clear();
 
     return a; 
 };
+// builder's default ctor; the containers use the heap.
+article::builder::builder()
+{};
+// builder's ctor with the containers allocating from the arena.
+article::builder::builder(monotonic_arena &arena) :
+    published_b(arena_allocator<date>(arena)),
+    issued_b(arena_allocator<date>(arena)),
+    ct_numbers_b(arena_allocator<string>(arena)),
+    references_b(arena_allocator<string>(arena)),
+    journals_b(arena_allocator<std::reference_wrapper<const journal>>(arena)),
+    subjects_ids_b(arena_allocator<subject_id>(arena)),
+    authors_b(arena_allocator<author>(arena))
+{};
 // builder's ctor with vectors as rvalues.
 article::builder::builder(string title, 
     string doi, 
@@ -213,8 +318,9 @@ article::builder::builder(string title,
     std::vector<author> &&authors) : 
     doi_b(std::move(doi)), 
     title_b(std::move(title)), 
-    journals_b(std::move(journals)),
-    authors_b(std::move(authors))
+    journals_b(journals.begin(), journals.end()),
+    authors_b(std::make_move_iterator(authors.begin()), 
+        std::make_move_iterator(authors.end()))
 {};
 // builder's ctor with vectors passed by reference.
 article::builder::builder(string title, 
@@ -223,29 +329,37 @@ article::builder::builder(string title,
     const std::vector<author> &authors) : 
     doi_b(std::move(doi)), 
     title_b(std::move(title)), 
-    journals_b(journals),
-    authors_b(authors)
+    journals_b(journals.begin(), journals.end()),
+    authors_b(authors.begin(), authors.end())
 {};
 // article's ctor.
 article::article(builder &b) : 
+    // Each time a new instance of the class is created, the class' max 
+    // id is incremeted, and the instance receives a new ID.
+    article(b, ++max_id_)
+{}
+// article's ctor, given the article's ID.
+article::article(builder &b, int32_t given_id) : 
+    id(given_id),
     doi(std::move(b.doi_b)), 
     title(std::move(b.title_b)), 
     type(b.type_b), 
-    published(std::move(b.published_b)),
+    published(b.published_b.begin(), b.published_b.end()),
     score(b.score_b), 
-    issued(std::move(b.issued_b)), 
+    issued(b.issued_b.begin(), b.issued_b.end()), 
     volume(b.volume_b), 
     issue(b.issue_b), 
-    ct_numbers(std::move(b.ct_numbers_b)), 
+    ct_numbers(std::make_move_iterator(b.ct_numbers_b.begin()), 
+        std::make_move_iterator(b.ct_numbers_b.end())), 
     ref_num(b.ref_num_b),
     ref_by_num(b.ref_by_num_b), 
-    journals(std::move(b.journals_b)),
-    authors(std::move(b.authors_b)),
-    subjects_ids(std::move(b.subjects_ids_b)),
-    references(std::move(b.references_b))
-{ 
-    // Each time a new instance of the class is created, the class' max 
-    // id is incremeted, and the instance receives a new ID.
-    id = ++max_id_;
+    updated(b.updated_b),
+    references(std::make_move_iterator(b.references_b.begin()), 
+        std::make_move_iterator(b.references_b.end())),
+    subjects_ids(b.subjects_ids_b.begin(), b.subjects_ids_b.end()),
+    authors(std::make_move_iterator(b.authors_b.begin()), 
+        std::make_move_iterator(b.authors_b.end())),
+    journals(b.journals_b.begin(), b.journals_b.end())
+{}
 }
-}
\ No newline at end of file
+#endif
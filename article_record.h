@@ -0,0 +1,369 @@
+/*
+ * Copyright (c) 2022 - present, GitHub: @cubter
+ *
+ * See COPYING.txt in the project root for license information.
+ */
+#ifndef ARTICLE_RECORD_H
+#define ARTICLE_RECORD_H
+
+#include "article.h"
+#include "compact_label.h"
+#include "dictionaries.h"
+
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace metasci
+{
+// Compact binary record of a parsed article, with all of its fields: the ID
+// and `updated` stamp first, integers as varints (zigzag for the signed
+// ones), strings & lists prefixed by their lengths. Volumes & issues that
+// aren't numbers are kept as strings, so a record doesn't depend on the
+// labels' pool of the process which wrote it. Authors, subjects & journals
+// are kept by their IDs, as in the ORC output: the entries themselves live
+// in the dictionaries, and decoding a record looks its journals up in
+// them. The journals' IDs follow the references, for sorting & joins; the
+// dates of issue and the clinical trials' numbers come last.
+namespace record
+{
+inline void put_varint(std::string &out, uint64_t v)
+{
+    while (v >= 0x80)
+    {
+        out += static_cast<char>(v | 0x80);
+        v >>= 7;
+    }
+    out += static_cast<char>(v);
+}
+
+inline void put_signed(std::string &out, int64_t v)
+{
+    put_varint(out, (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63));
+}
+
+inline void put_string(std::string &out, const std::string &s)
+{
+    put_varint(out, s.size());
+    out += s;
+}
+
+// Cursor over a record; throws std::runtime_error if it's truncated.
+struct reader
+{
+    const char *p;
+    const char *end;
+
+    uint64_t varint()
+    {
+        uint64_t v = 0;
+        for (int shift = 0; shift < 64; shift += 7)
+        {
+            if (p == end)
+            {
+                throw std::runtime_error("truncated record");
+            }
+            uint8_t b = static_cast<uint8_t>(*p++);
+            v |= uint64_t(b & 0x7f) << shift;
+            if ((b & 0x80) == 0)
+            {
+                return v;
+            }
+        }
+        throw std::runtime_error("malformed varint");
+    }
+
+    int64_t signed_varint()
+    {
+        uint64_t v = varint();
+        return static_cast<int64_t>((v >> 1) ^ (~(v & 1) + 1));
+    }
+
+    // A string without copying it: where it starts, and its length.
+    const char *string_ref(size_t &len)
+    {
+        uint64_t n = varint();
+        if (n > static_cast<uint64_t>(end - p))
+        {
+            throw std::runtime_error("truncated record");
+        }
+        const char *s = p;
+        len = static_cast<size_t>(n);
+        p += n;
+        return s;
+    }
+
+    void skip_string()
+    {
+        uint64_t n = varint();
+        if (n > static_cast<uint64_t>(end - p))
+        {
+            throw std::runtime_error("truncated record");
+        }
+        p += n;
+    }
+
+    std::string string()
+    {
+        uint64_t n = varint();
+        if (n > static_cast<uint64_t>(end - p))
+        {
+            throw std::runtime_error("truncated record");
+        }
+        std::string s(p, static_cast<size_t>(n));
+        p += n;
+        return s;
+    }
+};
+
+// A label: 0 -- empty, 1 -- number follows, 2 -- string follows.
+inline void put_label(std::string &out, compact_label l, const string_pool &labels)
+{
+    if (l.empty())
+    {
+        put_varint(out, 0);
+    }
+    else if (l.is_number())
+    {
+        put_varint(out, 1);
+        put_varint(out, static_cast<uint64_t>(l.get_number()));
+    }
+    else
+    {
+        put_varint(out, 2);
+        put_string(out, labels.get(l.get_string_id()));
+    }
+}
+
+inline void skip_label(reader &r)
+{
+    switch (r.varint())
+    {
+        case 0:  break;
+        case 1:  r.varint(); break;
+        default: r.skip_string(); break;
+    }
+}
+
+inline compact_label get_label(reader &r, string_pool &labels)
+{
+    switch (r.varint())
+    {
+        case 0:  return compact_label();
+        case 1:  return compact_label::encode(std::to_string(r.varint()), labels);
+        default: return compact_label::encode(r.string(), labels);
+    }
+}
+
+inline void put_dates(std::string &out, const date_vec &dates)
+{
+    put_varint(out, dates.size());
+    for (const date &d : dates)
+    {
+        put_varint(out, d.year);
+        put_varint(out, d.month);
+        put_varint(out, d.day);
+    }
+}
+
+inline void put_strings(std::string &out, const str_vec &strings)
+{
+    put_varint(out, strings.size());
+    for (const std::string &s : strings)
+    {
+        put_string(out, s);
+    }
+}
+
+template<typename Vec>
+void get_dates(reader &r, Vec &out)
+{
+    for (uint64_t n = r.varint(); n > 0; --n)
+    {
+        uint16_t y = static_cast<uint16_t>(r.varint());
+        uint8_t  m = static_cast<uint8_t>(r.varint());
+        uint8_t  d = static_cast<uint8_t>(r.varint());
+        out.push_back(date{ y, m, d });
+    }
+}
+
+template<typename Vec>
+void get_strings(reader &r, Vec &out)
+{
+    for (uint64_t n = r.varint(); n > 0; --n)
+    {
+        out.push_back(r.string());
+    }
+}
+}
+
+// Journals by their IDs, which records keep.
+using journal_index = std::unordered_map<int32_t, const journal *>;
+
+// Indexes the dictionaries' journals; the set's elements stay where they
+// are as it grows, so the index holds as long as no journal is erased.
+inline journal_index index_journals(const journal_uset &journals)
+{
+    journal_index index;
+    index.reserve(journals.size());
+    for (const journal &j : journals)
+    {
+        index.emplace(j.get_id(), &j);
+    }
+    return index;
+}
+
+// Appends the article's record to out.
+inline void encode_article(const article &a, const string_pool &labels,
+    std::string &out)
+{
+    using namespace record;
+
+    put_signed(out, a.get_id());
+    put_signed(out, a.get_updated());
+    put_string(out, a.doi_ref());
+    put_string(out, a.title_ref());
+    put_signed(out, a.get_type());
+    put_signed(out, a.get_score());
+    put_label(out, a.get_volume(), labels);
+    put_label(out, a.get_issue(), labels);
+    put_signed(out, a.get_ref_num());
+    put_signed(out, a.get_ref_by_num());
+
+    put_dates(out, a.published_ref());
+    put_varint(out, a.authors_ids_ref().size());
+    for (author_id id : a.authors_ids_ref())
+    {
+        put_signed(out, id);
+    }
+    put_varint(out, a.subjects_ids_ref().size());
+    for (subject_id id : a.subjects_ids_ref())
+    {
+        put_signed(out, id);
+    }
+    put_strings(out, a.references_ref());
+    put_varint(out, a.journals_ref().size());
+    for (const journal &j : a.journals_ref())
+    {
+        put_signed(out, j.get_id());
+    }
+    put_dates(out, a.issued_ref());
+    put_strings(out, a.ct_numbers_ref());
+}
+
+// The stored article's ID and `updated` stamp, which lead the record, so
+// that an upsert needn't decode the whole of it.
+inline void peek_article(const char *data, size_t len, int32_t &id,
+    int64_t &updated)
+{
+    record::reader r{ data, data + len };
+    id      = static_cast<int32_t>(r.signed_varint());
+    updated = r.signed_varint();
+}
+
+// The fields articles are sorted by: the DOI, the year of the first
+// publication date (0 if none) and the first journal's ID (0 if none).
+inline void peek_sort_fields(const char *data, size_t len, std::string &doi,
+    uint16_t &year, int32_t &journal_id)
+{
+    record::reader r{ data, data + len };
+    r.varint();                         // ID
+    r.varint();                         // updated
+    doi = r.string();
+    r.skip_string();                    // title
+    r.varint();                         // type
+    r.varint();                         // score
+    record::skip_label(r);              // volume
+    record::skip_label(r);              // issue
+    r.varint();                         // references' number
+    r.varint();                         // citations' number
+
+    year = 0;
+    for (uint64_t n = r.varint(), i = 0; i < n; ++i)
+    {
+        uint16_t y = static_cast<uint16_t>(r.varint());
+        r.varint();
+        r.varint();
+        if (i == 0)
+        {
+            year = y;
+        }
+    }
+    for (uint64_t n = r.varint(); n > 0; --n)
+    {
+        r.varint();                     // authors
+    }
+    for (uint64_t n = r.varint(); n > 0; --n)
+    {
+        r.varint();                     // subjects
+    }
+    for (uint64_t n = r.varint(); n > 0; --n)
+    {
+        r.skip_string();                // references
+    }
+
+    journal_id = 0;
+    if (r.varint() > 0)
+    {
+        journal_id = static_cast<int32_t>(r.signed_varint());
+    }
+}
+
+// Rebuilds an article from its record. The article keeps its stored ID, and
+// the IDs' counter is left as it is. Throws std::runtime_error if the record
+// is damaged or refers to a journal the index lacks.
+inline article decode_article(const char *data, size_t len, string_pool &labels,
+    const journal_index &journals)
+{
+    record::reader r{ data, data + len };
+    article::builder b;
+
+    int32_t id    = static_cast<int32_t>(r.signed_varint());
+    b.updated_b   = r.signed_varint();
+    b.doi_b       = r.string();
+    b.title_b     = r.string();
+    b.type_b      = static_cast<pub_type_id>(r.signed_varint());
+    b.score_b     = static_cast<int32_t>(r.signed_varint());
+    b.volume_b    = record::get_label(r, labels);
+    b.issue_b     = record::get_label(r, labels);
+    b.ref_num_b   = static_cast<int32_t>(r.signed_varint());
+    b.ref_by_num_b = static_cast<int32_t>(r.signed_varint());
+
+    record::get_dates(r, b.published_b);
+    std::vector<author_id> authors_ids;
+    for (uint64_t n = r.varint(); n > 0; --n)
+    {
+        authors_ids.push_back(static_cast<author_id>(r.signed_varint()));
+    }
+    for (uint64_t n = r.varint(); n > 0; --n)
+    {
+        b.subjects_ids_b.push_back(static_cast<subject_id>(r.signed_varint()));
+    }
+    record::get_strings(r, b.references_b);
+    for (uint64_t n = r.varint(); n > 0; --n)
+    {
+        int32_t journal_id = static_cast<int32_t>(r.signed_varint());
+        auto it = journals.find(journal_id);
+        if (it == journals.end())
+        {
+            throw std::runtime_error("record refers to an unknown journal " +
+                std::to_string(journal_id));
+        }
+        b.journals_b.push_back(std::cref(*it->second));
+    }
+    record::get_dates(r, b.issued_b);
+    record::get_strings(r, b.ct_numbers_b);
+    if (r.p != r.end)
+    {
+        throw std::runtime_error("malformed record");
+    }
+
+    article a = b.build(id);
+    a.set_authors_ids(std::move(authors_ids));
+
+    return a;
+}
+}
+#endif
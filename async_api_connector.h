@@ -0,0 +1,834 @@
+/*
+ * Copyright (c) 2022 - present, GitHub: @cubter
+ *
+ * See COPYING.txt in the project root for license information.
+ */
+#ifndef ASYNC_API_CONNECTOR_H
+#define ASYNC_API_CONNECTOR_H
+
+#include "content_cache.h"
+
+#include <curl/curl.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace metasci
+{
+// A page of works from Crossref's REST API. The response's "message" is an
+// envelope ({..., "items": [...]}) the parsers read as they read a dump
+// file; it's body[message_begin, message_begin + message_len). If error
+// isn't empty, the query has been given up, and the page carries nothing.
+struct api_page
+{
+    std::string query;
+    size_t      index = 0;          // in the query's sequence of pages
+    std::string body;
+    size_t      message_begin = 0;
+    size_t      message_len   = 0;
+    std::string error;
+};
+
+// Harvests works from Crossref's REST API with deep paging: every query
+// (e.g. https://api.crossref.org/works?filter=from-index-date:2024-01-01)
+// is walked from cursor=* on, each page giving the cursor of the next one.
+//
+// An event loop (libcurl's multi interface) runs in a thread of its own and
+// keeps up to in_flight requests going over a pool of keep-alive
+// connections. The pages of a single query can only be requested one after
+// another, but the next one is requested as soon as its cursor has arrived,
+// which is at the start of the current page's body; many queries are
+// walked at once. The bodies are collected in memory, and every complete
+// page is handed to the consumer, in the calling thread, in its query's
+// order. At most max_pages pages wait for the consumer; the loop stops
+// requesting more meanwhile. Up to max_queries queries are walked at once,
+// in the order given, the rest waiting for their turn: a cursor expires if
+// it isn't used for a while.
+//
+// Rate limits are honored: requests are paced to X-Rate-Limit-Limit per
+// X-Rate-Limit-Interval, in flight ones are capped by X-Concurrency-Limit,
+// and 429s & 5xx's are retried after Retry-After, or an exponential
+// backoff. A page is retried with the same cursor, so nothing's skipped.
+//
+// With a cache (see content_cache.h), every page is kept under its query,
+// rows and number, and a query walked to its end is recorded with its
+// number of pages. Such a query is replayed from the cache instead of
+// being requested: the cursors differ from one walk to another, so it's
+// the whole walk that's cached, not single requests. The loop hands the
+// cached pages over as the consumer makes room for them, going on with the
+// other queries meanwhile.
+class async_api_connector
+{
+public:
+    struct options
+    {
+        unsigned    in_flight    = 8;
+        unsigned    rows         = 1000;    // works per page; Crossref's max
+        unsigned    max_pages    = 16;      // pages waiting for the consumer
+        unsigned    max_retries  = 8;
+        unsigned    max_queries  = 0;       // walked at once; 0 for all
+        bool        paging       = true;    // false: a page per query
+        content_cache *cache     = nullptr;
+        long        timeout_s    = 300;
+        std::string user_agent   = "metaSci (https://github.com/cubter/metaSci)";
+    };
+
+    struct stats
+    {
+        size_t pages     = 0;
+        size_t requests  = 0;
+        size_t retries   = 0;
+        size_t throttled = 0;   // 429s
+        size_t bytes     = 0;
+        size_t cached    = 0;   // pages replayed from the cache
+    };
+
+    // Calls on_page(api_page &) for every page of every query, till each
+    // query's pages run out or it's given up. The consumer may move the
+    // body out of the page; pages of different queries come interleaved.
+    // Throws std::runtime_error if libcurl fails.
+    template<typename OnPage>
+    stats harvest(const std::vector<std::string> &queries, OnPage &&on_page);
+
+    // Whether the input is an API query rather than a file.
+    static bool is_url(const std::string &s)
+    {
+        return s.compare(0, 7, "http://") == 0 || s.compare(0, 8, "https://") == 0;
+    }
+
+    async_api_connector(const options &opts);
+    async_api_connector() : async_api_connector(options()) {};
+    async_api_connector(const async_api_connector &other) = delete;
+    async_api_connector &operator=(const async_api_connector &other) = delete;
+
+private:
+    using clock = std::chrono::steady_clock;
+
+    // A query's walk through its pages.
+    struct chain
+    {
+        std::string             query;
+        std::string             cursor = "*";   // of the page to request next
+        size_t                  next_page  = 0; // to request
+        size_t                  next_hand  = 0; // to hand over
+        bool                    can_request = true;
+        bool                    ended  = false; // seen the last page
+        bool                    failed = false;
+        bool                    replaying = false;  // from the cache
+        unsigned                outstanding = 0;
+        std::map<size_t, api_page> completed;   // ahead of next_hand
+    };
+
+    struct request
+    {
+        async_api_connector *owner;
+        chain               *c;
+        size_t              page;
+        std::string         cursor;
+        std::string         body;
+        unsigned            attempt = 0;
+        double              retry_after = -1;
+        clock::time_point   not_before;
+        CURL                *easy = nullptr;
+    };
+
+    static size_t on_body(char *data, size_t size, size_t n, void *user);
+    static size_t on_header(char *data, size_t size, size_t n, void *user);
+    static bool find_cursor(const std::string &body, std::string &cursor,
+        bool &last_page);
+    static bool find_message(const std::string &body, size_t &begin, size_t &len);
+
+    void run(std::vector<chain> &chains);
+    void start(request *r);
+    void finish(request *r, CURLcode code);
+    void notice_cursor(request *r);
+    void hand_over(api_page &&page);
+    bool waiting_for_consumer();
+    void wake_loop();
+    bool replay(chain &c);
+    void replay_pages(chain &c);
+    std::string cache_key(const chain &c, const char *what) const;
+
+    options     opts;
+
+    // Limits, as the server has announced them.
+    double              rate_limit     = 0;
+    double              rate_interval  = 1;
+    double              request_gap_s  = 0;
+    unsigned            concurrency    = 0;
+    clock::time_point   next_start;
+
+    CURLM                                   *multi = nullptr;
+    std::vector<CURL *>                     idle;
+    std::deque<std::unique_ptr<request>>    queued;     // to start, in order
+    std::vector<request *>                  live;       // running
+    unsigned                                running = 0;
+    stats                                   st;
+
+    // Pages for the consumer.
+    std::mutex              mutex;
+    std::condition_variable ready_cv;
+    std::deque<api_page>    ready;
+    bool                    loop_done = false;
+    bool                    stopping  = false;
+    std::exception_ptr      error;
+};
+
+async_api_connector::async_api_connector(const options &o) :
+    opts(o)
+{
+    opts.in_flight = std::max(1u, o.in_flight);
+    opts.max_pages = std::max(1u, o.max_pages);
+
+    static std::once_flag init;
+    std::call_once(init, []
+    {
+        curl_global_init(CURL_GLOBAL_DEFAULT);
+    });
+};
+
+template<typename OnPage>
+async_api_connector::stats async_api_connector::harvest(
+    const std::vector<std::string> &queries, OnPage &&on_page)
+{
+    std::vector<chain> chains(queries.size());
+    for (size_t i = 0; i < queries.size(); ++i)
+    {
+        chains[i].query = queries[i];
+    }
+
+    st        = stats();
+    loop_done = stopping = false;
+    error     = nullptr;
+    ready.clear();
+
+    std::thread loop([&]
+    {
+        try
+        {
+            run(chains);
+        }
+        catch(...)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            error = std::current_exception();
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        loop_done = true;
+        ready_cv.notify_all();
+    });
+
+    // The consumer's exceptions stop the loop, and are rethrown.
+    std::exception_ptr consumer_error;
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true)
+    {
+        ready_cv.wait(lock, [&] { return !ready.empty() || loop_done; });
+        if (ready.empty())
+        {
+            break;
+        }
+        api_page page = std::move(ready.front());
+        ready.pop_front();
+        if (ready.size() + 1 == opts.max_pages)
+        {
+            wake_loop();
+        }
+        lock.unlock();
+
+        try
+        {
+            on_page(page);
+        }
+        catch(...)
+        {
+            consumer_error = std::current_exception();
+        }
+
+        lock.lock();
+        if (consumer_error)
+        {
+            stopping = true;
+            wake_loop();
+            break;
+        }
+    }
+    lock.unlock();
+    loop.join();
+
+    if (consumer_error)
+    {
+        std::rethrow_exception(consumer_error);
+    }
+    if (error)
+    {
+        std::rethrow_exception(error);
+    }
+    return st;
+};
+
+// The cursor of the next page precedes the items in Crossref's responses,
+// which lets it be picked up early. A page whose items are [] is the last.
+inline bool async_api_connector::find_cursor(const std::string &body,
+    std::string &cursor, bool &last_page)
+{
+    auto value_of = [&](const char *key, size_t from) -> size_t
+    {
+        size_t pos = body.find(key, from);
+        if (pos == std::string::npos)
+        {
+            return pos;
+        }
+        pos += std::strlen(key);
+        while (pos < body.size() && (body[pos] == ' ' || body[pos] == ':' ||
+            body[pos] == '\n' || body[pos] == '\r' || body[pos] == '\t'))
+        {
+            ++pos;
+        }
+        return pos < body.size() ? pos : std::string::npos;
+    };
+
+    size_t c = value_of("\"next-cursor\"", 0);
+    if (c == std::string::npos || body[c] != '"')
+    {
+        return false;
+    }
+    size_t items = value_of("\"items\"", c);
+    if (items == std::string::npos || body[items] != '[')
+    {
+        return false;
+    }
+    size_t first = items + 1;
+    while (first < body.size() && (body[first] == ' ' || body[first] == '\n' ||
+        body[first] == '\r' || body[first] == '\t'))
+    {
+        ++first;
+    }
+    if (first == body.size())
+    {
+        return false;
+    }
+
+    cursor.clear();
+    for (size_t i = c + 1; i < items && body[i] != '"'; ++i)
+    {
+        // Escapes in a cursor are \/ at most.
+        if (body[i] == '\\' && i + 1 < items)
+        {
+            ++i;
+        }
+        cursor += body[i];
+    }
+    last_page = body[first] == ']';
+    return true;
+};
+
+// The response is {"status": "ok", ..., "message": {...}}: the message is
+// what follows "message": up to the response's closing brace.
+inline bool async_api_connector::find_message(const std::string &body,
+    size_t &begin, size_t &len)
+{
+    size_t pos = body.find("\"message\"");
+    while (pos != std::string::npos)
+    {
+        size_t b = pos + 9;
+        while (b < body.size() && (body[b] == ' ' || body[b] == '\n' ||
+            body[b] == '\r' || body[b] == '\t' || body[b] == ':'))
+        {
+            ++b;
+        }
+        if (b < body.size() && body[b] == '{')
+        {
+            size_t e = body.find_last_of('}');
+            if (e == std::string::npos || e <= b)
+            {
+                return false;
+            }
+            e = body.find_last_of('}', e - 1);
+            if (e == std::string::npos || e < b)
+            {
+                return false;
+            }
+            begin = b;
+            len   = e + 1 - b;
+            return true;
+        }
+        pos = body.find("\"message\"", pos + 9);
+    }
+    return false;
+};
+
+inline size_t async_api_connector::on_body(char *data, size_t size, size_t n,
+    void *user)
+{
+    request *r = static_cast<request *>(user);
+    r->body.append(data, size * n);
+
+    chain &c = *r->c;
+    if (r->owner->opts.paging && !c.can_request && !c.ended && r->page + 1 == c.next_page &&
+        r->body.size() - size * n < (size_t(1) << 16))
+    {
+        bool last_page;
+        if (find_cursor(r->body, c.cursor, last_page))
+        {
+            c.ended       = last_page;
+            c.can_request = !last_page;
+        }
+    }
+    return size * n;
+};
+
+inline size_t async_api_connector::on_header(char *data, size_t size,
+    size_t n, void *user)
+{
+    request *r = static_cast<request *>(user);
+    std::string line(data, size * n);
+    size_t colon = line.find(':');
+    if (colon == std::string::npos)
+    {
+        return size * n;
+    }
+    std::string name = line.substr(0, colon);
+    std::transform(name.begin(), name.end(), name.begin(), [](char ch)
+    {
+        return static_cast<char>(ch >= 'A' && ch <= 'Z' ? ch - 'A' + 'a' : ch);
+    });
+    const char *value = line.c_str() + colon + 1;
+
+    async_api_connector *self = r->owner;
+    if (name == "x-rate-limit-limit" || name == "x-rate-limit-interval")
+    {
+        // The interval is like "1s".
+        (name == "x-rate-limit-limit" ? self->rate_limit : self->rate_interval) =
+            std::atof(value);
+        if (self->rate_limit > 0 && self->rate_interval > 0)
+        {
+            self->request_gap_s = self->rate_interval / self->rate_limit;
+        }
+    }
+    else if (name == "x-concurrency-limit")
+    {
+        int limit = std::atoi(value);
+        self->concurrency = limit > 0 ? static_cast<unsigned>(limit) : 0;
+    }
+    else if (name == "retry-after")
+    {
+        r->retry_after = std::atof(value);
+    }
+    return size * n;
+};
+
+void async_api_connector::start(request *r)
+{
+    chain &c = *r->c;
+    if (idle.empty())
+    {
+        idle.push_back(curl_easy_init());
+        if (idle.back() == nullptr)
+        {
+            throw std::runtime_error("curl_easy_init failed");
+        }
+    }
+    r->easy = idle.back();
+    idle.pop_back();
+    r->body.clear();
+    r->retry_after = -1;
+
+    char *cursor = curl_easy_escape(r->easy, r->cursor.c_str(),
+        static_cast<int>(r->cursor.size()));
+    std::string url = c.query + (c.query.find('?') == std::string::npos ? '?' : '&') +
+        "rows=" + std::to_string(opts.rows) + (opts.paging ? "&cursor=" : "") +
+        (opts.paging ? cursor : "");
+    curl_free(cursor);
+
+    // The connection, the only expensive part, is kept by the multi handle.
+    curl_easy_reset(r->easy);
+    curl_easy_setopt(r->easy, CURLOPT_URL, url.c_str());
+    curl_easy_setopt(r->easy, CURLOPT_USERAGENT, opts.user_agent.c_str());
+    curl_easy_setopt(r->easy, CURLOPT_ACCEPT_ENCODING, "");
+    curl_easy_setopt(r->easy, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(r->easy, CURLOPT_TCP_KEEPALIVE, 1L);
+    curl_easy_setopt(r->easy, CURLOPT_TIMEOUT, opts.timeout_s);
+    curl_easy_setopt(r->easy, CURLOPT_WRITEFUNCTION, &async_api_connector::on_body);
+    curl_easy_setopt(r->easy, CURLOPT_WRITEDATA, r);
+    curl_easy_setopt(r->easy, CURLOPT_HEADERFUNCTION, &async_api_connector::on_header);
+    curl_easy_setopt(r->easy, CURLOPT_HEADERDATA, r);
+
+    CURLMcode code = curl_multi_add_handle(multi, r->easy);
+    if (code != CURLM_OK)
+    {
+        throw std::runtime_error(std::string("curl: ") + curl_multi_strerror(code));
+    }
+    ++running;
+    ++c.outstanding;
+    ++st.requests;
+    next_start = clock::now() + std::chrono::duration_cast<clock::duration>(
+        std::chrono::duration<double>(request_gap_s));
+};
+
+// A page whose cursor hasn't been seen while it was coming gets it looked
+// for in the whole body.
+void async_api_connector::notice_cursor(request *r)
+{
+    chain &c = *r->c;
+    if (c.can_request || c.ended || r->page + 1 != c.next_page)
+    {
+        return;
+    }
+    bool last_page;
+    if (!opts.paging || !find_cursor(r->body, c.cursor, last_page))
+    {
+        c.ended = true;     // a query without paging
+        return;
+    }
+    c.ended       = last_page;
+    c.can_request = !last_page;
+};
+
+void async_api_connector::finish(request *r, CURLcode code)
+{
+    chain &c = *r->c;
+    long status = 0;
+    curl_easy_getinfo(r->easy, CURLINFO_RESPONSE_CODE, &status);
+    curl_multi_remove_handle(multi, r->easy);
+    idle.push_back(r->easy);
+    r->easy = nullptr;
+    --running;
+    --c.outstanding;
+    st.bytes += r->body.size();
+
+    std::unique_ptr<request> owned(r);
+    if (c.failed)
+    {
+        return;
+    }
+
+    bool transient = code != CURLE_OK || status == 429 || status >= 500;
+    if (transient && r->attempt < opts.max_retries)
+    {
+        st.throttled += status == 429;
+        ++st.retries;
+        double wait = r->retry_after >= 0 ? r->retry_after :
+            0.5 * static_cast<double>(1u << std::min(r->attempt, 6u));
+        r->not_before = clock::now() + std::chrono::duration_cast<clock::duration>(
+            std::chrono::duration<double>(wait));
+        ++r->attempt;
+        queued.push_front(std::move(owned));
+        return;
+    }
+
+    api_page page;
+    page.query = c.query;
+    page.index = r->page;
+    if (code != CURLE_OK)
+    {
+        page.error = curl_easy_strerror(code);
+    }
+    else if (status != 200)
+    {
+        page.error = "HTTP " + std::to_string(status);
+    }
+    else if (!find_message(r->body, page.message_begin, page.message_len))
+    {
+        page.error = "no message in the response";
+    }
+    if (!page.error.empty())
+    {
+        c.failed = true;
+        c.completed.clear();
+        hand_over(std::move(page));
+        return;
+    }
+
+    notice_cursor(r);
+    if (opts.cache != nullptr)
+    {
+        // The cache is an aid only: if it can't be written, it's let be.
+        try
+        {
+            opts.cache->put(cache_key(c, std::to_string(page.index).c_str()), r->body);
+        }
+        catch(const std::exception &)
+        {
+        }
+    }
+    page.body = std::move(r->body);
+    c.completed.emplace(page.index, std::move(page));
+    while (!c.completed.empty() && c.completed.begin()->first == c.next_hand)
+    {
+        hand_over(std::move(c.completed.begin()->second));
+        c.completed.erase(c.completed.begin());
+        ++c.next_hand;
+    }
+
+    if (opts.cache != nullptr && c.ended && c.outstanding == 0 && c.completed.empty())
+    {
+        try
+        {
+            opts.cache->put(cache_key(c, "pages"), std::to_string(c.next_hand));
+        }
+        catch(const std::exception &)
+        {
+        }
+    }
+};
+
+inline std::string async_api_connector::cache_key(const chain &c,
+    const char *what) const
+{
+    return "GET " + c.query + " rows=" + std::to_string(opts.rows) +
+        (opts.paging ? " cursor " : " ") + what;
+};
+
+// Sets the query's walk to be replayed, if the cache has all of it.
+bool async_api_connector::replay(chain &c)
+{
+    std::string pages;
+    if (opts.cache == nullptr || !opts.cache->get(cache_key(c, "pages"), pages))
+    {
+        return false;
+    }
+    const size_t n = std::strtoull(pages.c_str(), nullptr, 10);
+    for (size_t i = 0; i < n; ++i)
+    {
+        if (!opts.cache->contains(cache_key(c, std::to_string(i).c_str())))
+        {
+            return false;
+        }
+    }
+
+    c.next_page   = n;
+    c.can_request = false;
+    c.replaying   = true;
+    return true;
+};
+
+// Hands the replayed query's pages over while the consumer has room for
+// them; the loop mustn't wait for it.
+void async_api_connector::replay_pages(chain &c)
+{
+    while (c.next_hand < c.next_page && !waiting_for_consumer())
+    {
+        api_page page;
+        page.query = c.query;
+        page.index = c.next_hand++;
+        if (!opts.cache->get(cache_key(c, std::to_string(page.index).c_str()),
+                page.body) ||
+            !find_message(page.body, page.message_begin, page.message_len))
+        {
+            page.body.clear();
+            page.error  = "damaged in the cache";
+            c.failed    = true;
+            c.replaying = false;
+            hand_over(std::move(page));
+            return;
+        }
+        hand_over(std::move(page));
+        ++st.cached;
+    }
+    if (c.next_hand == c.next_page)
+    {
+        c.ended     = true;
+        c.replaying = false;
+    }
+};
+
+void async_api_connector::hand_over(api_page &&page)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    ready.push_back(std::move(page));
+    ++st.pages;
+    ready_cv.notify_one();
+};
+
+bool async_api_connector::waiting_for_consumer()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return ready.size() >= opts.max_pages;
+};
+
+// Cuts the loop's wait short, once the consumer has made room or is
+// stopping it. Called with the mutex held, which guards multi against the
+// loop's cleanup.
+void async_api_connector::wake_loop()
+{
+    if (multi != nullptr)
+    {
+        curl_multi_wakeup(multi);
+    }
+};
+
+void async_api_connector::run(std::vector<chain> &chains)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        multi = curl_multi_init();
+    }
+    if (multi == nullptr)
+    {
+        throw std::runtime_error("curl_multi_init failed");
+    }
+    curl_multi_setopt(multi, CURLMOPT_MAX_HOST_CONNECTIONS,
+        static_cast<long>(opts.in_flight));
+    curl_multi_setopt(multi, CURLMOPT_MAXCONNECTS, static_cast<long>(opts.in_flight));
+
+    struct cleanup
+    {
+        async_api_connector *self;
+        ~cleanup()
+        {
+            for (request *r : self->live)
+            {
+                curl_multi_remove_handle(self->multi, r->easy);
+                curl_easy_cleanup(r->easy);
+                delete r;
+            }
+            self->live.clear();
+            self->queued.clear();
+            for (CURL *e : self->idle)
+            {
+                curl_easy_cleanup(e);
+            }
+            self->idle.clear();
+            CURLM *m;
+            {
+                std::lock_guard<std::mutex> lock(self->mutex);
+                m = self->multi;
+                self->multi = nullptr;
+            }
+            curl_multi_cleanup(m);
+            self->running = 0;
+        }
+    } on_exit{ this };
+
+    size_t next_chain = 0;     // to be started
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            if (stopping)
+            {
+                break;
+            }
+        }
+
+        // Chains are started as the ones before them end; replayed ones
+        // hold no cursor, so they don't count.
+        size_t active = static_cast<size_t>(std::count_if(chains.begin(),
+            chains.begin() + static_cast<std::ptrdiff_t>(next_chain),
+            [](const chain &c) { return !c.ended && !c.failed && !c.replaying; }));
+        while (next_chain < chains.size() &&
+            (opts.max_queries == 0 || active < opts.max_queries))
+        {
+            if (!replay(chains[next_chain++]))
+            {
+                ++active;
+            }
+        }
+
+        // The replayed chains' pages, in the chains' order.
+        size_t replaying = 0;
+        for (size_t i = 0; i < next_chain; ++i)
+        {
+            if (chains[i].replaying)
+            {
+                replay_pages(chains[i]);
+                replaying += chains[i].replaying;
+            }
+        }
+
+        // Chains whose next cursor has arrived queue their next page.
+        for (size_t i = 0; i < next_chain; ++i)
+        {
+            chain &c = chains[i];
+            if (c.can_request && !c.ended && !c.failed)
+            {
+                std::unique_ptr<request> r(new request());
+                r->owner  = this;
+                r->c      = &c;
+                r->page   = c.next_page++;
+                r->cursor = c.cursor;
+                c.can_request = false;
+                queued.push_back(std::move(r));
+            }
+        }
+
+        // Starts what the limits let start.
+        unsigned limit = concurrency > 0 ? std::min(concurrency, opts.in_flight) :
+            opts.in_flight;
+        auto now = clock::now();
+        auto wake = now + std::chrono::milliseconds(100);
+        bool full = waiting_for_consumer();
+        for (auto it = queued.begin(); it != queued.end() && running < limit && !full; )
+        {
+            request *r = it->get();
+            if (r->c->failed)
+            {
+                it = queued.erase(it);
+                continue;
+            }
+            if (r->not_before > now || next_start > now)
+            {
+                wake = std::min(wake, std::max(r->not_before, next_start));
+                ++it;
+                continue;
+            }
+            it->release();
+            it = queued.erase(it);
+            start(r);
+            live.push_back(r);
+            now = clock::now();
+        }
+
+        if (running == 0 && queued.empty() && active == 0 && replaying == 0 &&
+            next_chain == chains.size())
+        {
+            break;
+        }
+
+        int still_running = 0;
+        CURLMcode code = curl_multi_perform(multi, &still_running);
+        if (code != CURLM_OK)
+        {
+            throw std::runtime_error(std::string("curl: ") + curl_multi_strerror(code));
+        }
+
+        int left = 0;
+        while (CURLMsg *msg = curl_multi_info_read(multi, &left))
+        {
+            if (msg->msg != CURLMSG_DONE)
+            {
+                continue;
+            }
+            auto it = std::find_if(live.begin(), live.end(),
+                [&](request *r) { return r->easy == msg->easy_handle; });
+            request *r = *it;
+            live.erase(it);
+            finish(r, msg->data.result);
+        }
+
+        auto timeout = std::chrono::duration_cast<std::chrono::milliseconds>(
+            wake - clock::now()).count();
+        code = curl_multi_poll(multi, nullptr, 0,
+            static_cast<int>(std::max<long long>(0, std::min<long long>(timeout, 100))),
+            nullptr);
+        if (code != CURLM_OK)
+        {
+            throw std::runtime_error(std::string("curl: ") + curl_multi_strerror(code));
+        }
+    }
+};
+}
+#endif
@@ -3,6 +3,11 @@
  * 
  * See COPYING.txt in the project root for license information.
  */
+#ifndef AUTHOR_H
+#define AUTHOR_H
+
+#include "orcid.h"
+
 #include <iostream>
 #include <vector>
 
@@ -10,18 +15,31 @@ namespace metasci
 {
 using str_vec   = std::vector<std::string>;
 using string    = std::string;
+using author_id = int32_t;
 
 // author. 
 class author
 {
 public:
+    author_id   get_id() const { return id; }
+    inline void assign_id();
+    // A saved author keeps the ID it was given.
+    void        set_id(author_id new_id) { id = new_id; }
+    metasci::orcid get_orcid() const { return orcid; }
+    bool        has_orcid() const { return !orcid.empty(); }
+    bool        is_authenticated_orcid() const { return is_auth_orcid; }
     string      get_first_name() const { return first_name; }
     string      get_family_name() const { return family_name; }
     str_vec     get_affiliations() const { return affiliations; }
+    const str_vec &affiliations_ref() const { return affiliations; }
     inline void add_affiliation(string aff);
     inline void set_affiliations(str_vec &&aff);
     inline void set_affiliations(const str_vec &aff);
 
+    // The highest ID assigned so far; restored when resuming an ingest.
+    static int32_t  max_id()                { return max_id_; }
+    static void     restore_max_id(int32_t m) { max_id_ = m; }
+
     author   &operator=(author &&other)         = default;
     author   &operator=(const author &other)    = default; 
 
@@ -29,7 +47,7 @@ public:
     author(string first_name, string family_name);
     author(string first_name, 
         string family_name, 
-        string orcid, 
+        metasci::orcid orcid, 
         bool is_authenticated_orcid); 
     author(author &&other)      = default;
     author(const author &other) = default;  
@@ -43,13 +61,19 @@ private:
     // From here on, the max_id_ param. is to track the currently assigned IDs. 
     // Every time an instance of author is created, max_id_ is incremented.
     static int32_t  max_id_; 
-    string          orcid;  // unique author's ID; many authors lack it.
-    bool            is_auth_orcid;  // is the ORCID authenticated
+    metasci::orcid  orcid;  // unique author's ID; many authors lack it.
+    bool            is_auth_orcid = false;  // is the ORCID authenticated
     string          first_name;     
     string          family_name;
     str_vec         affiliations;   // list of affiliations
 };
 
+// Gives the author a new ID. Authors are only numbered once they've been 
+// resolved, since before that the same person may appear many times.
+inline void author::assign_id()
+{
+    id = ++max_id_;
+};
 // Adds an afiiliation to the list.
 inline void author::add_affiliation(string aff) 
 { 
@@ -66,19 +90,20 @@ inline void author::set_affiliations(const str_vec &aff)
 };
 
 // Constructor for an author having no ORCID.
-author::author(string first_name, 
-    string family_name) : 
-    first_name(std::move(first_name)), 
-    family_name(std::move(family_name)) 
+author::author(string first, 
+    string family) : 
+    first_name(std::move(first)), 
+    family_name(std::move(family)) 
 {};
 // Constructor for an author having ORCID.
-author::author(string first_name, 
-    string family_name, 
-    string orcid, 
+author::author(string first, 
+    string family, 
+    metasci::orcid id_orcid, 
     bool   is_authenticated_orcid) : 
-    first_name(std::move(first_name)), 
-    family_name(std::move(family_name)),
-    orcid(std::move(orcid)), 
-    is_auth_orcid(is_authenticated_orcid) 
+    orcid(id_orcid), 
+    is_auth_orcid(is_authenticated_orcid),
+    first_name(std::move(first)), 
+    family_name(std::move(family))
 {};
-}
\ No newline at end of file
+}
+#endif
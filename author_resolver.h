@@ -0,0 +1,603 @@
+/*
+ * Copyright (c) 2022 - present, GitHub: @cubter
+ *
+ * See COPYING.txt in the project root for license information.
+ */
+#ifndef AUTHOR_RESOLVER_H
+#define AUTHOR_RESOLVER_H
+
+#include "article.h"
+#include "author.h"
+#include "orcid.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstdint>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace metasci
+{
+// Author resolution stage.
+//
+// Every article comes out of the parser with its own copies of the authors.
+// The resolver merges them into a single table of distinct authors:
+//  - authors having ORCID are merged exactly, through a hash index on ORCID;
+//  - authors lacking ORCID are grouped into blocks by the normalized family
+//    name plus the first initial. Inside a block, two mentions are taken to
+//    be the same person if they share a co-author (by the co-author's block
+//    key) or an affiliation, unless their clusters would then hold two
+//    mentions from the same article: namesakes in an article are different
+//    people. Blocks are independent of each other, so they are processed in
+//    parallel.
+// Afterwards, each article only keeps the IDs of its deduplicated authors.
+//
+// The table and the blocks' features (which author has which co-author or
+// affiliation) are kept between calls, so that the batches of a run -- and,
+// restored from a checkpoint journal, the runs of an ingest -- are resolved
+// against the same authors: a mention sharing a feature with a known author
+// takes the known author's ID. Known authors are never merged with each
+// other, their IDs having been handed out already.
+class author_resolver
+{
+public:
+    // Resolves the articles' authors, adding the new ones to the table, and
+    // sets the articles' authors' IDs.
+    void resolve(std::vector<article> &articles);
+
+    // The distinct authors so far. IDs are handed out by author::assign_id(),
+    // so an author's ID is its position + 1, as long as the counter starts 
+    // from 0 or is restored along with the table.
+    const std::vector<author> &authors() const { return table; }
+
+    // Changes are only kept once asked for, e.g. by a checkpoint journal.
+    void track_changes() { tracking = true; }
+    // Calls on_change(const author &, const std::vector<string> &features)
+    // for every author added or changed since clear_changes(), with the
+    // features it's gained meanwhile; new authors come in their IDs' order.
+    template<typename F>
+    void for_each_change(F on_change) const;
+    inline void clear_changes();
+    // Puts back an author given by for_each_change(): a changed one, or a
+    // new one, whose ID has to be next. Throws std::runtime_error otherwise.
+    inline void restore(const author &a, const std::vector<string> &features);
+
+    // The features of the authors lacking ORCID, by position in the table,
+    // each author's sorted; an output's dictionary keeps them (see
+    // node_merge.h).
+    inline std::vector<std::vector<string>> features() const;
+    // The block an author lacking ORCID is resolved in.
+    static string block_key(const author &a);
+
+    author_resolver(unsigned threads = std::thread::hardware_concurrency());
+    ~author_resolver() {};
+
+private:
+    // A single occurrence of an author in an article.
+    struct mention
+    {
+        size_t  article_idx;
+        author  a;
+        string  block_key;
+    };
+    // A block's features: feature -> the known authors (positions in the
+    // table) having it. A feature is either a co-author's block key or a
+    // normalized affiliation.
+    using feature_index = std::unordered_map<string, std::vector<size_t>>;
+    // Where a block's mention goes: a known author, or the cluster of new
+    // ones represented by its first mention (an index in the block).
+    struct placement
+    {
+        size_t known;
+        size_t first;
+    };
+    struct block_result
+    {
+        std::vector<placement>              places;
+        std::vector<std::vector<string>>    features;   // by mention
+    };
+    // Union-find on a block's mentions and on the known authors they're
+    // linked to. The articles of a cluster and its known author, if any, are
+    // kept by its root, so that a union is refused on the roots: two 
+    // clusters having an article, or a known author each, stay apart.
+    struct clusters
+    {
+        static const size_t none = SIZE_MAX;
+
+        std::vector<size_t>                 parent;
+        std::vector<size_t>                 known;
+        std::vector<std::vector<size_t>>    articles;   // sorted
+
+        size_t add(size_t known_author, size_t article)
+        {
+            parent.push_back(parent.size());
+            known.push_back(known_author);
+            articles.push_back(article == none ? std::vector<size_t>() :
+                std::vector<size_t>{ article });
+            return parent.size() - 1;
+        }
+        size_t find(size_t x)
+        {
+            while (parent[x] != x)
+            {
+                parent[x] = parent[parent[x]];
+                x = parent[x];
+            }
+            return x;
+        }
+        inline void unite(size_t x, size_t y);
+    };
+
+    static string normalize(const string &s);
+    static bool   merge_affiliations(author &into, const author &from);
+
+    void resolve_block(const std::vector<size_t> &block,
+        const std::vector<mention> &mentions,
+        const std::vector<std::vector<size_t>> &article_mentions,
+        const feature_index *known, block_result &out) const;
+    void add_features(const string &key, size_t at,
+        const std::vector<string> &features);
+    void changed(size_t at);
+
+    unsigned threads;
+    std::vector<author> table;
+    // ORCID -> position in the table.
+    std::unordered_map<orcid, size_t, orcid_hasher> orcid_index;
+    // Block key -> the block's features.
+    std::unordered_map<string, feature_index>       blocks;
+
+    bool                tracking = false;
+    std::vector<size_t> changes;            // positions, in the order of change
+    std::vector<bool>   is_changed;         // by position
+    std::unordered_map<size_t, std::vector<string>> new_features;
+};
+
+author_resolver::author_resolver(unsigned n_threads) :
+    threads(n_threads == 0 ? 1 : n_threads)
+{};
+
+// The root having a known author stays the root; otherwise, the smaller
+// index does, so that results don't depend on the order, in which unions 
+// happen.
+inline void author_resolver::clusters::unite(size_t x, size_t y)
+{
+    x = find(x);
+    y = find(y);
+    if (x == y || (known[x] != none && known[y] != none))
+    {
+        return;
+    }
+
+    const std::vector<size_t> &ax = articles[x];
+    const std::vector<size_t> &ay = articles[y];
+    std::vector<size_t> both;
+    both.reserve(ax.size() + ay.size());
+    std::merge(ax.begin(), ax.end(), ay.begin(), ay.end(),
+        std::back_inserter(both));
+    if (std::adjacent_find(both.begin(), both.end()) != both.end())
+    {
+        return;     // namesakes of an article
+    }
+
+    if (known[y] != none || (known[x] == none && y < x))
+    {
+        std::swap(x, y);
+    }
+    parent[y]   = x;
+    articles[x] = std::move(both);
+    articles[y].clear();
+    articles[y].shrink_to_fit();
+};
+
+// Lowercases ASCII letters and drops everything that is neither a letter nor
+// a digit. Non-ASCII bytes (UTF-8) are kept as they are.
+string author_resolver::normalize(const string &s)
+{
+    string out;
+    out.reserve(s.size());
+
+    for (char ch : s)
+    {
+        unsigned char c = static_cast<unsigned char>(ch);
+        if (c >= 0x80 || std::isalnum(c))
+        {
+            out.push_back(static_cast<char>(std::tolower(c)));
+        }
+    }
+
+    return out;
+};
+
+// Block key: normalized family name + first initial. The initial is taken
+// as a whole UTF-8 code point.
+string author_resolver::block_key(const author &a)
+{
+    string key = normalize(a.get_family_name());
+    string given = normalize(a.get_first_name());
+    key.push_back('|');
+
+    if (!given.empty())
+    {
+        size_t len = 1;
+        unsigned char c = static_cast<unsigned char>(given[0]);
+
+        if      (c >= 0xF0) { len = 4; }
+        else if (c >= 0xE0) { len = 3; }
+        else if (c >= 0xC0) { len = 2; }
+
+        key.append(given, 0, len);
+    }
+
+    return key;
+};
+
+// Adds the affiliations the author doesn't have yet. True if there were any.
+bool author_resolver::merge_affiliations(author &into, const author &from)
+{
+    bool added = false;
+    for (const auto &aff : from.affiliations_ref())
+    {
+        const auto &known = into.affiliations_ref();
+
+        if (std::find(known.begin(), known.end(), aff) == known.end())
+        {
+            into.add_affiliation(aff);
+            added = true;
+        }
+    }
+    return added;
+};
+
+// Clusters a single block against its known authors (`known`, if the block
+// has any). Doesn't modify the resolver, so that blocks can be clustered in 
+// parallel.
+void author_resolver::resolve_block(const std::vector<size_t> &block,
+    const std::vector<mention> &mentions,
+    const std::vector<std::vector<size_t>> &article_mentions,
+    const feature_index *known, block_result &out) const
+{
+    clusters cl;
+    for (size_t i = 0; i < block.size(); ++i)
+    {
+        cl.add(clusters::none, mentions[block[i]].article_idx);
+    }
+    // The known authors linked to, once added to the clusters.
+    std::unordered_map<size_t, size_t> known_nodes;
+    // feature -> a node per cluster having it.
+    std::unordered_map<string, std::vector<size_t>> seen;
+
+    auto link = [&](const string &feature, size_t i)
+    {
+        auto res = seen.emplace(feature, std::vector<size_t>());
+        std::vector<size_t> &nodes = res.first->second;
+
+        if (res.second && known != nullptr)
+        {
+            auto it = known->find(feature);
+            if (it != known->end())
+            {
+                for (size_t at : it->second)
+                {
+                    auto k = known_nodes.emplace(at, 0);
+                    if (k.second)
+                    {
+                        k.first->second = cl.add(at, clusters::none);
+                    }
+                    nodes.push_back(k.first->second);
+                }
+            }
+        }
+        for (size_t n : nodes)
+        {
+            cl.unite(n, i);
+        }
+
+        for (size_t &n : nodes)
+        {
+            n = cl.find(n);
+        }
+        nodes.push_back(cl.find(i));
+        std::sort(nodes.begin(), nodes.end());
+        nodes.erase(std::unique(nodes.begin(), nodes.end()), nodes.end());
+    };
+
+    out.features.assign(block.size(), std::vector<string>());
+    for (size_t i = 0; i < block.size(); ++i)
+    {
+        const mention &m = mentions[block[i]];
+        std::vector<string> &features = out.features[i];
+
+        for (size_t co : article_mentions[m.article_idx])
+        {
+            if (mentions[co].block_key != m.block_key)
+            {
+                features.push_back("c:" + mentions[co].block_key);
+            }
+        }
+        for (const auto &aff : m.a.affiliations_ref())
+        {
+            string norm = normalize(aff);
+            if (!norm.empty())
+            {
+                features.push_back("a:" + norm);
+            }
+        }
+        std::sort(features.begin(), features.end());
+        features.erase(std::unique(features.begin(), features.end()),
+            features.end());
+
+        for (const string &f : features)
+        {
+            link(f, i);
+        }
+    }
+
+    out.places.resize(block.size());
+    for (size_t i = 0; i < block.size(); ++i)
+    {
+        size_t root = cl.find(i);
+        // Without a known author, the root is the cluster's first mention.
+        out.places[i] = placement{ cl.known[root], root };
+    }
+};
+
+// Records the features of the author at the position in the block's index.
+void author_resolver::add_features(const string &key, size_t at,
+    const std::vector<string> &features)
+{
+    feature_index &index = blocks[key];
+
+    for (const string &f : features)
+    {
+        std::vector<size_t> &having = index[f];
+        if (std::find(having.begin(), having.end(), at) != having.end())
+        {
+            continue;
+        }
+        having.push_back(at);
+        if (tracking)
+        {
+            changed(at);
+            new_features[at].push_back(f);
+        }
+    }
+};
+
+void author_resolver::changed(size_t at)
+{
+    if (!tracking)
+    {
+        return;
+    }
+    if (is_changed.size() <= at)
+    {
+        is_changed.resize(at + 1, false);
+    }
+    if (!is_changed[at])
+    {
+        is_changed[at] = true;
+        changes.push_back(at);
+    }
+};
+
+template<typename F>
+void author_resolver::for_each_change(F on_change) const
+{
+    static const std::vector<string> no_features;
+
+    for (size_t at : changes)
+    {
+        auto it = new_features.find(at);
+        on_change(table[at], it == new_features.end() ? no_features : it->second);
+    }
+};
+
+inline void author_resolver::clear_changes()
+{
+    changes.clear();
+    is_changed.clear();
+    new_features.clear();
+};
+
+inline void author_resolver::restore(const author &a,
+    const std::vector<string> &features)
+{
+    if (a.get_id() <= 0 || static_cast<size_t>(a.get_id()) > table.size() + 1)
+    {
+        throw std::runtime_error("author " + std::to_string(a.get_id()) +
+            " restored out of order");
+    }
+    const size_t at = static_cast<size_t>(a.get_id()) - 1;
+
+    if (at == table.size())
+    {
+        table.push_back(a);
+        if (a.has_orcid())
+        {
+            orcid_index.emplace(a.get_orcid(), at);
+        }
+    }
+    else
+    {
+        table[at] = a;
+    }
+
+    // Only the authors lacking ORCID are blocked.
+    if (!a.has_orcid())
+    {
+        const bool was_tracking = tracking;
+        tracking = false;
+        add_features(block_key(a), at, features);
+        tracking = was_tracking;
+    }
+};
+
+inline std::vector<std::vector<string>> author_resolver::features() const
+{
+    std::vector<std::vector<string>> out(table.size());
+    for (const auto &block : blocks)
+    {
+        for (const auto &feature : block.second)
+        {
+            for (size_t at : feature.second)
+            {
+                out[at].push_back(feature.first);
+            }
+        }
+    }
+    for (auto &f : out)
+    {
+        std::sort(f.begin(), f.end());
+    }
+    return out;
+};
+
+void author_resolver::resolve(std::vector<article> &articles)
+{
+    std::vector<mention>             mentions;
+    std::vector<std::vector<size_t>> article_mentions(articles.size());
+
+    for (size_t i = 0; i < articles.size(); ++i)
+    {
+        for (auto &a : articles[i].take_authors())
+        {
+            article_mentions[i].push_back(mentions.size());
+
+            string key = block_key(a);
+            mentions.push_back(mention{ i, std::move(a), std::move(key) });
+        }
+    }
+
+    // mention -> position in the table
+    std::vector<size_t> resolved(mentions.size());
+
+    // Exact merge by ORCID.
+    std::unordered_map<string, std::vector<size_t>> blocks_map;
+    std::vector<string> block_order;    // keeps the output deterministic
+
+    for (size_t i = 0; i < mentions.size(); ++i)
+    {
+        mention &m = mentions[i];
+
+        if (!m.a.has_orcid())
+        {
+            auto res = blocks_map.emplace(m.block_key, std::vector<size_t>{});
+            if (res.second)
+            {
+                block_order.push_back(m.block_key);
+            }
+            res.first->second.push_back(i);
+            continue;
+        }
+
+        auto res = orcid_index.emplace(m.a.get_orcid(), table.size());
+        if (res.second)
+        {
+            table.push_back(m.a);
+            table.back().assign_id();
+            changed(res.first->second);
+        }
+        else if (merge_affiliations(table[res.first->second], m.a))
+        {
+            changed(res.first->second);
+        }
+        resolved[i] = res.first->second;
+    }
+
+    std::vector<std::vector<size_t>> blocks_list;
+    blocks_list.reserve(block_order.size());
+    for (auto &key : block_order)
+    {
+        blocks_list.push_back(std::move(blocks_map[key]));
+    }
+    blocks_map.clear();
+
+    // Blocking for the authors without ORCID; blocks are handed out to the
+    // workers one by one. The known features are only read meanwhile.
+    std::vector<block_result> results(blocks_list.size());
+    std::atomic<size_t> next_block(0);
+
+    auto worker = [&]()
+    {
+        for (size_t b = next_block++; b < blocks_list.size(); b = next_block++)
+        {
+            auto it = blocks.find(block_order[b]);
+            resolve_block(blocks_list[b], mentions, article_mentions,
+                it == blocks.end() ? nullptr : &it->second, results[b]);
+        }
+    };
+
+    std::vector<std::thread> pool;
+    unsigned n_threads = static_cast<unsigned>(
+        std::min<size_t>(threads, blocks_list.size()));
+    for (unsigned t = 1; t < n_threads; ++t)
+    {
+        pool.emplace_back(worker);
+    }
+    worker();
+    for (auto &t : pool)
+    {
+        t.join();
+    }
+
+    // Each new cluster becomes a new author. Done sequentially, so that the
+    // IDs don't depend on the scheduling.
+    for (size_t b = 0; b < blocks_list.size(); ++b)
+    {
+        const auto &block  = blocks_list[b];
+        const auto &result = results[b];
+
+        for (size_t i = 0; i < block.size(); ++i)
+        {
+            mention &m = mentions[block[i]];
+            const placement &p = result.places[i];
+            size_t at;
+
+            if (p.known != clusters::none)
+            {
+                at = p.known;
+                if (merge_affiliations(table[at], m.a))
+                {
+                    changed(at);
+                }
+            }
+            else if (p.first == i)
+            {
+                at = table.size();
+                table.push_back(std::move(m.a));
+                table.back().assign_id();
+                changed(at);
+            }
+            else
+            {
+                // p.first < i, so the cluster's author already exists.
+                at = resolved[block[p.first]];
+                if (merge_affiliations(table[at], m.a))
+                {
+                    changed(at);
+                }
+            }
+            resolved[block[i]] = at;
+            add_features(block_order[b], at, result.features[i]);
+        }
+    }
+
+    for (size_t i = 0; i < articles.size(); ++i)
+    {
+        std::vector<author_id> ids;
+        ids.reserve(article_mentions[i].size());
+
+        for (size_t m : article_mentions[i])
+        {
+            ids.push_back(table[resolved[m]].get_id());
+        }
+        articles[i].set_authors_ids(std::move(ids));
+    }
+};
+}
+#endif
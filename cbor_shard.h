@@ -0,0 +1,609 @@
+/*
+ * Copyright (c) 2022 - present, GitHub: @cubter
+ *
+ * See COPYING.txt in the project root for license information.
+ */
+#ifndef CBOR_SHARD_H
+#define CBOR_SHARD_H
+
+#include "item_reader.h"
+
+#include <zstd/zstd.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace metasci
+{
+// Binary shards: Crossref's dump transcoded to CBOR once (see
+// transcode_to_cbor), and zstd-compressed, so that every later full
+// reprocess decodes binary values instead of scanning text. A shard is the
+// envelope, {"items": [ {...}, {...} ]}, the array being of indefinite
+// length; the items are kept whole, not only the fields the parser needs
+// today.
+//
+// Shards are recognised by the magic bytes, like gzip'ed ones: zstd's
+// frame, then a CBOR map, which no JSON text starts with.
+inline bool is_zstd(const char *data, size_t len)
+{
+    return len >= 4 && static_cast<unsigned char>(data[0]) == 0x28 &&
+        static_cast<unsigned char>(data[1]) == 0xb5 &&
+        static_cast<unsigned char>(data[2]) == 0x2f &&
+        static_cast<unsigned char>(data[3]) == 0xfd;
+}
+
+inline bool is_cbor(const char *data, size_t len)
+{
+    // Major type 5: a map.
+    return len >= 1 && (static_cast<unsigned char>(data[0]) >> 5) == 5;
+}
+
+// Decompresses a whole zstd file (one or more frames) into out. Returns
+// false if the data is corrupt or truncated.
+inline bool unzstd(const char *data, size_t len, std::string &out)
+{
+    ZSTD_DCtx *dctx = ZSTD_createDCtx();
+    if (dctx == nullptr)
+    {
+        return false;
+    }
+
+    unsigned long long size = ZSTD_getFrameContentSize(data, len);
+    out.clear();
+    out.resize(size != ZSTD_CONTENTSIZE_UNKNOWN && size != ZSTD_CONTENTSIZE_ERROR ?
+        static_cast<size_t>(size) : std::max<size_t>(len * 4, 1 << 16));
+
+    ZSTD_inBuffer  in  = { data, len, 0 };
+    ZSTD_outBuffer dst = { &out[0], out.size(), 0 };
+    size_t ret = 0;
+    while (in.pos < in.size)
+    {
+        if (dst.pos == dst.size)
+        {
+            out.resize(out.size() * 2);
+            dst.dst  = &out[0];
+            dst.size = out.size();
+        }
+        ret = ZSTD_decompressStream(dctx, &dst, &in);
+        if (ZSTD_isError(ret))
+        {
+            break;
+        }
+    }
+    // The last frame may still be flushing.
+    while (!ZSTD_isError(ret) && ret != 0 && dst.pos == dst.size)
+    {
+        out.resize(out.size() * 2);
+        dst.dst  = &out[0];
+        dst.size = out.size();
+        ret = ZSTD_decompressStream(dctx, &dst, &in);
+    }
+    ZSTD_freeDCtx(dctx);
+
+    out.resize(dst.pos);
+    return !ZSTD_isError(ret) && ret == 0;
+}
+
+// Compresses data into out as a single zstd frame.
+inline void zstd_compress(const std::string &data, int level, std::string &out)
+{
+    out.resize(ZSTD_compressBound(data.size()));
+    size_t n = ZSTD_compress(&out[0], out.size(), data.data(), data.size(), level);
+    if (ZSTD_isError(n))
+    {
+        throw std::runtime_error(std::string("zstd: ") + ZSTD_getErrorName(n));
+    }
+    out.resize(n);
+}
+
+// Transcodes a Crossref JSON file (the envelope, or items one after another)
+// into a CBOR shard, appended to out. Returns false if the input is
+// malformed; the items before the malformed one are kept.
+template<typename Json>
+bool transcode_to_cbor(const char *data, size_t len, item_reader::layout layout,
+    std::string &out)
+{
+    // {"items": [_ ...
+    out += static_cast<char>(0xa1);
+    out += static_cast<char>(0x65);
+    out += "items";
+    out += static_cast<char>(0x9f);
+
+    std::vector<std::pair<size_t, size_t>> items;
+    item_reader reader(layout);
+    bool ok = reader.find_items(data, len, items);
+
+    for (const auto &item : items)
+    {
+        Json j;
+        try
+        {
+            j = Json::parse(data + item.first, data + item.second);
+        }
+        catch(const std::exception &)
+        {
+            ok = false;
+            break;
+        }
+        Json::to_cbor(j, out);
+    }
+    // ... ]
+    out += static_cast<char>(0xff);
+
+    return ok;
+}
+
+namespace cbor_detail
+{
+// A CBOR decoder driving a SAX handler with nlohmann's interface. It reads
+// straight from the buffer: nlohmann's own binary_reader takes the input
+// byte by byte through its adapter, strings included, which makes it a few
+// times slower. It covers what nlohmann's writer produces, and indefinite
+// lengths; tags are skipped. The buffer has to hold a single data item.
+template<typename Json, typename Sax>
+class decoder
+{
+public:
+    // Returns false if the data is malformed, error telling why, or if the
+    // handler has stopped the decoding.
+    bool parse(std::string &error);
+
+    decoder(const char *data, size_t len, Sax &events) :
+        p(reinterpret_cast<const uint8_t *>(data)),
+        begin(p),
+        end(p + len),
+        sax(events) {};
+
+private:
+    using string_t = typename Json::string_t;
+
+    static const size_t max_depth = 512;
+
+    bool item(size_t depth);
+    bool argument(uint8_t info, uint64_t &n);
+    bool text(uint8_t info, string_t &s);
+    bool fail(const char *what)
+    {
+        message = what;
+        return false;
+    }
+
+    const uint8_t   *p;
+    const uint8_t   *begin;
+    const uint8_t   *end;
+    Sax             &sax;
+    std::string     message;
+    const string_t  no_text;
+};
+
+template<typename Json, typename Sax>
+bool decoder<Json, Sax>::parse(std::string &error)
+{
+    bool ok = item(0);
+    if (ok && p != end)
+    {
+        ok = fail("trailing bytes");
+    }
+    if (!ok && !message.empty())
+    {
+        error = "at byte " + std::to_string(p - begin) + ": " + message;
+    }
+    return ok;
+};
+
+// The argument of an item's head: its value, length or count.
+template<typename Json, typename Sax>
+inline bool decoder<Json, Sax>::argument(uint8_t info, uint64_t &n)
+{
+    if (info < 24)
+    {
+        n = info;
+        return true;
+    }
+    if (info > 27)
+    {
+        return fail("malformed head");
+    }
+    const size_t bytes = size_t(1) << (info - 24);
+    if (static_cast<size_t>(end - p) < bytes)
+    {
+        return fail("truncated");
+    }
+    n = 0;
+    for (size_t i = 0; i < bytes; ++i)
+    {
+        n = (n << 8) | *p++;
+    }
+    return true;
+};
+
+// A text string, definite or made of chunks; the head is read already.
+template<typename Json, typename Sax>
+bool decoder<Json, Sax>::text(uint8_t info, string_t &s)
+{
+    uint64_t n;
+    if (info != 31)
+    {
+        if (!argument(info, n))
+        {
+            return false;
+        }
+        if (n > static_cast<uint64_t>(end - p))
+        {
+            return fail("truncated");
+        }
+        s.assign(reinterpret_cast<const char *>(p), static_cast<size_t>(n));
+        p += n;
+        return true;
+    }
+
+    s.clear();
+    while (true)
+    {
+        if (p == end)
+        {
+            return fail("truncated");
+        }
+        uint8_t head = *p++;
+        if (head == 0xff)
+        {
+            return true;
+        }
+        if ((head >> 5) != 3 || (head & 31) == 31 || !argument(head & 31, n))
+        {
+            return message.empty() ? fail("malformed string's chunk") : false;
+        }
+        if (n > static_cast<uint64_t>(end - p))
+        {
+            return fail("truncated");
+        }
+        s.append(reinterpret_cast<const char *>(p), static_cast<size_t>(n));
+        p += n;
+    }
+};
+
+template<typename Json, typename Sax>
+bool decoder<Json, Sax>::item(size_t depth)
+{
+    using number_integer_t = typename Json::number_integer_t;
+    using number_float_t   = typename Json::number_float_t;
+
+    if (depth > max_depth)
+    {
+        return fail("nested too deep");
+    }
+    if (p == end)
+    {
+        return fail("truncated");
+    }
+    const uint8_t head  = *p++;
+    const uint8_t major = head >> 5;
+    const uint8_t info  = head & 31;
+    const bool    indefinite = info == 31 && major >= 2 && major <= 5;
+
+    uint64_t n = 0;
+    if (major != 3 && !indefinite && !argument(info, n))
+    {
+        return false;
+    }
+
+    switch (major)
+    {
+        case 0:
+            return sax.number_unsigned(n);
+        case 1:
+            return sax.number_integer(static_cast<number_integer_t>(-1) -
+                static_cast<number_integer_t>(n));
+        case 2:
+        {
+            if (indefinite)
+            {
+                return fail("indefinite byte string");
+            }
+            if (n > static_cast<uint64_t>(end - p))
+            {
+                return fail("truncated");
+            }
+            typename Json::binary_t bytes(std::vector<uint8_t>(p, p + n));
+            p += n;
+            return sax.binary(bytes);
+        }
+        case 3:
+        {
+            string_t s;
+            return text(info, s) && sax.string(s);
+        }
+        case 4:
+            if (!sax.start_array(indefinite ? std::numeric_limits<size_t>::max() :
+                static_cast<size_t>(n)))
+            {
+                return false;
+            }
+            while (indefinite ? (p != end && *p != 0xff) : n-- > 0)
+            {
+                if (!item(depth + 1))
+                {
+                    return false;
+                }
+            }
+            if (indefinite && p++ == end)
+            {
+                return fail("truncated");
+            }
+            return sax.end_array();
+        case 5:
+        {
+            if (!sax.start_object(indefinite ? std::numeric_limits<size_t>::max() :
+                static_cast<size_t>(n)))
+            {
+                return false;
+            }
+            string_t key;
+            while (indefinite ? (p != end && *p != 0xff) : n-- > 0)
+            {
+                if (p == end || (*p >> 5) != 3)
+                {
+                    return fail("a map's key isn't a string");
+                }
+                uint8_t key_info = *p++ & 31;
+                if (!text(key_info, key) || !sax.key(key) || !item(depth + 1))
+                {
+                    return false;
+                }
+            }
+            if (indefinite && p++ == end)
+            {
+                return fail("truncated");
+            }
+            return sax.end_object();
+        }
+        case 6:
+            return item(depth);
+        default:
+            switch (info)
+            {
+                case 20: return sax.boolean(false);
+                case 21: return sax.boolean(true);
+                case 22:
+                case 23: return sax.null();
+                case 25:
+                {
+                    // Half precision, as in RFC 8949's appendix D.
+                    const int exp  = static_cast<int>((n >> 10) & 0x1f);
+                    const int mant = static_cast<int>(n & 0x3ff);
+                    double v = exp == 0 ? std::ldexp(mant, -24) :
+                        exp != 31 ? std::ldexp(mant + 1024, exp - 25) :
+                        mant == 0 ? std::numeric_limits<double>::infinity() :
+                        std::numeric_limits<double>::quiet_NaN();
+                    return sax.number_float(static_cast<number_float_t>(
+                        (n & 0x8000) != 0 ? -v : v), no_text);
+                }
+                case 26:
+                {
+                    const uint32_t bits = static_cast<uint32_t>(n);
+                    float v;
+                    std::memcpy(&v, &bits, sizeof(v));
+                    return sax.number_float(static_cast<number_float_t>(v), no_text);
+                }
+                case 27:
+                {
+                    double v;
+                    std::memcpy(&v, &n, sizeof(v));
+                    return sax.number_float(static_cast<number_float_t>(v), no_text);
+                }
+                default:
+                    return fail("unsupported simple value");
+            }
+    }
+};
+}
+
+// Reads the items of a CBOR shard, the way item_reader does with text: only
+// the fields asked for are decoded into the item's DOM, the others are
+// skipped, however deep they are.
+template<typename Json>
+class cbor_item_reader
+{
+public:
+    // Calls on_item(Json &) for each item. Returns false if the shard is
+    // malformed or lacks "items"; error() tells why.
+    template<typename OnItem>
+    bool read(const char *data, size_t len, OnItem &&on_item);
+
+    const std::string &error() const { return message; }
+
+    cbor_item_reader(std::vector<std::string> wanted) :
+        fields(std::move(wanted)) {};
+
+private:
+    using string_t = typename Json::string_t;
+
+    template<typename OnItem>
+    class handler;
+
+    std::vector<std::string>    fields;
+    std::string                 message;
+};
+
+// The SAX handler. Depth is the number of containers open: the envelope is
+// at 1, the items' array at 2, an item at 3. A field's value is built in
+// place, the containers being open kept on a stack of their own.
+template<typename Json>
+template<typename OnItem>
+class cbor_item_reader<Json>::handler
+{
+public:
+    using number_integer_t  = typename Json::number_integer_t;
+    using number_unsigned_t = typename Json::number_unsigned_t;
+    using number_float_t    = typename Json::number_float_t;
+    using binary_t          = typename Json::binary_t;
+
+    // Values of the fields skipped aren't even constructed.
+    bool null()                                 { return value(nullptr); }
+    bool boolean(bool v)                        { return value(v); }
+    bool number_integer(number_integer_t v)     { return value(v); }
+    bool number_unsigned(number_unsigned_t v)   { return value(v); }
+    bool number_float(number_float_t v, const string_t &)
+    {
+        return value(v);
+    }
+    bool string(string_t &v)                    { return value(std::move(v)); }
+    bool binary(binary_t &v)
+    {
+        return slot == nullptr || value(Json::binary(std::move(v)));
+    }
+
+    bool start_object(size_t)                   { return start(Json::object(), true); }
+    bool start_array(size_t)                    { return start(Json::array(), false); }
+    bool end_object()                           { return end(); }
+    bool end_array()                            { return end(); }
+
+    bool key(string_t &k)
+    {
+        if (slot != nullptr)
+        {
+            pending_key = std::move(k);
+        }
+        else if (depth == 1)
+        {
+            in_items_key = k == "items";
+        }
+        else if (depth == 3 && in_items)
+        {
+            for (const std::string &f : owner.fields)
+            {
+                if (f == k)
+                {
+                    slot = &item[k];
+                    break;
+                }
+            }
+        }
+        return true;
+    }
+
+    bool found_items = false;
+
+    handler(cbor_item_reader &reader, OnItem &callback) :
+        owner(reader),
+        on_item(callback) {};
+
+private:
+    // Puts a value where the field's being built: the field itself, or
+    // the innermost container. Returns the value's place.
+    Json *place(Json &&v)
+    {
+        if (stack.empty())
+        {
+            *slot = std::move(v);
+            return slot;
+        }
+        Json &top = *stack.back();
+        if (top.is_array())
+        {
+            top.push_back(std::move(v));
+            return &top.back();
+        }
+        Json &at = top[pending_key];
+        at = std::move(v);
+        return &at;
+    }
+
+    template<typename V>
+    bool value(V &&v)
+    {
+        if (slot != nullptr)
+        {
+            place(Json(std::forward<V>(v)));
+            if (stack.empty())
+            {
+                slot = nullptr;
+            }
+        }
+        return true;
+    }
+
+    bool start(Json &&container, bool is_object)
+    {
+        ++depth;
+        if (slot != nullptr)
+        {
+            stack.push_back(place(std::move(container)));
+        }
+        else if (depth == 1 && !is_object)
+        {
+            owner.message = "not a shard: the envelope isn't a map";
+            return false;
+        }
+        else if (depth == 2 && in_items_key && !is_object)
+        {
+            in_items    = true;
+            found_items = true;
+        }
+        else if (depth == 3 && in_items && is_object)
+        {
+            item = Json::object();
+        }
+        return true;
+    }
+
+    bool end()
+    {
+        if (slot != nullptr)
+        {
+            stack.pop_back();
+            if (stack.empty())
+            {
+                slot = nullptr;
+            }
+        }
+        else if (depth == 3 && in_items)
+        {
+            on_item(item);
+        }
+        else if (depth == 2 && in_items)
+        {
+            in_items = false;
+        }
+        --depth;
+        return true;
+    }
+
+    cbor_item_reader    &owner;
+    OnItem              &on_item;
+
+    size_t              depth        = 0;
+    bool                in_items_key = false;
+    bool                in_items     = false;
+    Json                item;
+    Json                *slot        = nullptr;    // the field being built
+    std::vector<Json *> stack;
+    string_t            pending_key;
+};
+
+template<typename Json>
+template<typename OnItem>
+bool cbor_item_reader<Json>::read(const char *data, size_t len, OnItem &&on_item)
+{
+    message.clear();
+    handler<OnItem> h(*this, on_item);
+
+    cbor_detail::decoder<Json, handler<OnItem>> decoder(data, len, h);
+    bool ok = decoder.parse(message);
+    if (ok && !h.found_items)
+    {
+        message = "\"items\" missing";
+        ok = false;
+    }
+    return ok;
+};
+}
+#endif
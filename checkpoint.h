@@ -0,0 +1,410 @@
+/*
+ * Copyright (c) 2022 - present, GitHub: @cubter
+ *
+ * See COPYING.txt in the project root for license information.
+ */
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include "dictionaries.h"
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace metasci
+{
+// Identity of an input file: if either changes, the file is parsed anew.
+struct file_stamp
+{
+    uint64_t size     = 0;
+    int64_t  mtime_ns = 0;
+
+    bool operator==(const file_stamp &other) const
+    {
+        return size == other.size && mtime_ns == other.mtime_ns;
+    }
+};
+
+inline bool stamp_file(const std::string &path, file_stamp &stamp)
+{
+    struct stat st;
+    if (::stat(path.c_str(), &st) != 0)
+    {
+        return false;
+    }
+    stamp.size     = static_cast<uint64_t>(st.st_size);
+    stamp.mtime_ns = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 +
+        st.st_mtim.tv_nsec;
+
+    return true;
+}
+
+// Flushes a file (or a directory, after a rename in it) to the disk.
+inline void sync_path(const std::string &path)
+{
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        throw std::system_error(errno, std::generic_category(), path);
+    }
+    int r = ::fsync(fd);
+    int err = errno;
+    ::close(fd);
+    if (r != 0)
+    {
+        throw std::system_error(err, std::generic_category(), path);
+    }
+}
+
+// Journal of a resumable ingest. Once an input file has been parsed and its
+// output shard is safely on the disk, a record is appended to the journal
+// and fsync'ed. A record holds:
+//  - the input file's path & stamp, and the output shard it produced (a
+//    record made by log_dictionaries() has none);
+//  - what the file has added to the dictionaries (subjects, journals,
+//    labels), so that a restarted run gives the same IDs to the same names,
+//    and the authors the resolver has added or changed, with their new 
+//    features, so that later files' authors are resolved against them;
+//  - the high-water marks of all the IDs.
+//
+// The journal is line-based text, one field per tab; tabs, newlines and
+// backslashes in names are escaped. A record ends with an "end" line, and a
+// record without it (torn by a crash) is dropped on reopening.
+//
+// Opening the journal restores the dictionaries and the IDs' counters, so
+// it must be done before anything is parsed. Throws std::system_error on
+// I/O errors and std::runtime_error on a corrupt journal.
+class checkpoint_journal
+{
+public:
+    // True if the file has been completed with the same stamp.
+    inline bool is_done(const std::string &input, const file_stamp &stamp) const;
+
+    // Records the input file as completed. Call after the output has been
+    // synced to the disk.
+    inline void commit(const std::string &input, const file_stamp &stamp,
+        const std::string &output, size_t n_articles);
+
+    // Records what's been added to the dictionaries since the last record,
+    // and the IDs' high-water marks. Call before anything that refers to
+    // the new entries or IDs is made durable, e.g. the articles logged by an
+    // lsm_store.
+    inline void log_dictionaries();
+
+    size_t completed() const { return done.size(); }
+
+    inline checkpoint_journal(const std::string &path, dictionaries &dicts);
+    checkpoint_journal(const checkpoint_journal &other) = delete;
+    checkpoint_journal &operator=(const checkpoint_journal &other) = delete;
+    inline ~checkpoint_journal();
+
+private:
+    static inline std::string escape(const std::string &s);
+    static inline std::string unescape(const std::string &s);
+    static inline std::vector<std::string> split(const std::string &line);
+
+    inline void load();
+    inline void append(const std::string &input_line);
+
+    std::string     path;
+    dictionaries    &dicts;
+    int             fd = -1;
+
+    std::unordered_map<std::string, file_stamp> done;
+
+    // What's been recorded already; everything beyond is the next delta.
+    size_t          saved_subjects  = 0;
+    int32_t         saved_journal_id = 0;
+    size_t          saved_labels    = 0;
+};
+
+inline checkpoint_journal::checkpoint_journal(const std::string &file,
+    dictionaries &d) :
+    path(file),
+    dicts(d)
+{
+    load();
+    dicts.resolver.track_changes();
+
+    fd = ::open(path.c_str(), O_WRONLY | O_APPEND | O_CREAT, 0644);
+    if (fd < 0)
+    {
+        throw std::system_error(errno, std::generic_category(), path);
+    }
+};
+
+inline checkpoint_journal::~checkpoint_journal()
+{
+    if (fd >= 0)
+    {
+        ::close(fd);
+    }
+};
+
+inline void checkpoint_journal::load()
+{
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+    {
+        return;     // a fresh ingest
+    }
+
+    // Lines of the record being read; applied once its "end" is seen.
+    std::vector<std::vector<std::string>> record;
+    std::string line;
+    std::streamoff valid_end = 0;
+
+    while (std::getline(in, line))
+    {
+        if (in.eof())
+        {
+            break;  // no newline: the line's torn
+        }
+
+        std::vector<std::string> fields = split(line);
+        if (fields[0] != "end")
+        {
+            record.push_back(std::move(fields));
+            continue;
+        }
+
+        for (const auto &f : record)
+        {
+            const std::string &kind = f[0];
+
+            if (kind == "file" && f.size() == 6)
+            {
+                file_stamp stamp;
+                stamp.size     = std::stoull(f[2]);
+                stamp.mtime_ns = std::stoll(f[3]);
+                done[f[1]] = stamp;
+            }
+            else if (kind == "subject" && f.size() == 3)
+            {
+                dicts.subjects.emplace_back(
+                    static_cast<subject_id>(std::stoi(f[1])), f[2]);
+            }
+            else if (kind == "journal" && f.size() == 5)
+            {
+                dicts.journals.emplace(std::stoi(f[1]), f[2], std::stoi(f[3]), f[4]);
+            }
+            else if (kind == "label" && f.size() == 3)
+            {
+                if (dicts.labels.intern(f[2]) != std::stoul(f[1]))
+                {
+                    throw std::runtime_error(path + ": labels out of order");
+                }
+            }
+            else if (kind == "author" && f.size() >= 6 &&
+                f.size() - 6 >= std::stoul(f[5]))
+            {
+                // ID, ORCID (packed, shifted, | authenticated), given &
+                // family names, affiliations, then the new features.
+                const uint64_t packed = std::stoull(f[2]);
+                const auto     affs   = f.begin() + 6;
+                const auto     feats  = affs + static_cast<std::ptrdiff_t>(
+                    std::stoul(f[5]));
+
+                author a(f[3], f[4], orcid(packed >> 1), (packed & 1) != 0);
+                a.set_id(std::stoi(f[1]));
+                a.set_affiliations(str_vec(affs, feats));
+                dicts.resolver.restore(a, std::vector<std::string>(feats, f.end()));
+            }
+            else if (kind == "max" && f.size() == 6)
+            {
+                article::restore_max_id(std::stoi(f[1]));
+                author::restore_max_id(std::stoi(f[2]));
+                journal::restore_max_id(std::stoi(f[3]));
+                publisher::restore_max_id(std::stoi(f[4]));
+                subject::restore_max_id(static_cast<subject_id>(std::stoi(f[5])));
+            }
+            else
+            {
+                throw std::runtime_error(path + ": unknown record " + kind);
+            }
+        }
+        record.clear();
+        valid_end = in.tellg();
+    }
+
+    saved_subjects   = dicts.subjects.size();
+    saved_journal_id = journal::max_id();
+    saved_labels     = dicts.labels.size();
+
+    // Appending goes on after the last complete record.
+    in.close();
+    if (::truncate(path.c_str(), static_cast<off_t>(valid_end)) != 0)
+    {
+        throw std::system_error(errno, std::generic_category(), path);
+    }
+};
+
+inline bool checkpoint_journal::is_done(const std::string &input,
+    const file_stamp &stamp) const
+{
+    auto it = done.find(input);
+    return it != done.end() && it->second == stamp;
+};
+
+inline void checkpoint_journal::commit(const std::string &input,
+    const file_stamp &stamp, const std::string &output, size_t n_articles)
+{
+    std::ostringstream file;
+    file << "file\t" << escape(input) << '\t' << stamp.size << '\t'
+        << stamp.mtime_ns << '\t' << escape(output) << '\t' << n_articles << '\n';
+
+    append(file.str());
+    done[input] = stamp;
+};
+
+inline void checkpoint_journal::log_dictionaries()
+{
+    append(std::string());
+};
+
+// Appends a record with the given "file" line, if any, and the 
+// dictionaries' delta, and syncs it.
+inline void checkpoint_journal::append(const std::string &input_line)
+{
+    std::ostringstream rec;
+    rec << input_line;
+
+    for (size_t i = saved_subjects; i < dicts.subjects.size(); ++i)
+    {
+        const subject &s = dicts.subjects[i];
+        rec << "subject\t" << s.get_id() << '\t' << escape(s.get_title()) << '\n';
+    }
+    for (const journal &j : dicts.journals)
+    {
+        if (j.get_id() > saved_journal_id)
+        {
+            rec << "journal\t" << j.get_id() << '\t' << escape(j.get_title())
+                << '\t' << j.get_publisher_id() << '\t'
+                << escape(j.get_publisher_title()) << '\n';
+        }
+    }
+    for (size_t i = saved_labels; i < dicts.labels.size(); ++i)
+    {
+        rec << "label\t" << i << '\t'
+            << escape(dicts.labels.get(static_cast<uint32_t>(i))) << '\n';
+    }
+    dicts.resolver.for_each_change([&](const author &a,
+        const std::vector<std::string> &features)
+    {
+        rec << "author\t" << a.get_id() << '\t' 
+            << ((a.get_orcid().get_packed() << 1) | 
+                static_cast<uint64_t>(a.is_authenticated_orcid())) << '\t'
+            << escape(a.get_first_name()) << '\t' 
+            << escape(a.get_family_name()) << '\t'
+            << a.affiliations_ref().size();
+        for (const std::string &aff : a.affiliations_ref())
+        {
+            rec << '\t' << escape(aff);
+        }
+        for (const std::string &feature : features)
+        {
+            rec << '\t' << escape(feature);
+        }
+        rec << '\n';
+    });
+    rec << "max\t" << article::max_id() << '\t' << author::max_id() << '\t'
+        << journal::max_id() << '\t' << publisher::max_id() << '\t'
+        << subject::max_id() << '\n';
+    rec << "end\n";
+
+    const std::string s = rec.str();
+    size_t written = 0;
+    while (written < s.size())
+    {
+        ssize_t n = ::write(fd, s.data() + written, s.size() - written);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n < 0)
+        {
+            throw std::system_error(errno, std::generic_category(), path);
+        }
+        written += static_cast<size_t>(n);
+    }
+    if (::fsync(fd) != 0)
+    {
+        throw std::system_error(errno, std::generic_category(), path);
+    }
+
+    saved_subjects   = dicts.subjects.size();
+    saved_journal_id = journal::max_id();
+    saved_labels     = dicts.labels.size();
+    dicts.resolver.clear_changes();
+};
+
+inline std::string checkpoint_journal::escape(const std::string &s)
+{
+    std::string out;
+    out.reserve(s.size());
+    for (char c : s)
+    {
+        switch (c)
+        {
+            case '\\': out += "\\\\"; break;
+            case '\t': out += "\\t";  break;
+            case '\n': out += "\\n";  break;
+            case '\r': out += "\\r";  break;
+            default:   out += c;      break;
+        }
+    }
+    return out;
+};
+
+inline std::string checkpoint_journal::unescape(const std::string &s)
+{
+    std::string out;
+    out.reserve(s.size());
+    for (size_t i = 0; i < s.size(); ++i)
+    {
+        if (s[i] != '\\' || i + 1 == s.size())
+        {
+            out += s[i];
+            continue;
+        }
+        switch (s[++i])
+        {
+            case 't':  out += '\t'; break;
+            case 'n':  out += '\n'; break;
+            case 'r':  out += '\r'; break;
+            default:   out += s[i]; break;
+        }
+    }
+    return out;
+};
+
+inline std::vector<std::string> checkpoint_journal::split(const std::string &line)
+{
+    std::vector<std::string> fields;
+    size_t begin = 0;
+    while (true)
+    {
+        size_t tab = line.find('\t', begin);
+        fields.push_back(unescape(line.substr(begin, tab - begin)));
+        if (tab == std::string::npos)
+        {
+            break;
+        }
+        begin = tab + 1;
+    }
+    return fields;
+};
+}
+#endif
@@ -0,0 +1,129 @@
+/*
+ * Copyright (c) 2022 - present, GitHub: @cubter
+ *
+ * See COPYING.txt in the project root for license information.
+ */
+#ifndef COMPACT_LABEL_H
+#define COMPACT_LABEL_H
+
+#include <cstdint>
+#include <deque>
+#include <limits>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace metasci
+{
+using string = std::string;
+
+// Pool of interned strings: every distinct value is stored only once and is
+// referred to by its index. Values never move, so references stay valid.
+class string_pool
+{
+public:
+    inline uint32_t       intern(const string &s);
+    inline const string  &get(uint32_t id) const;
+    inline size_t         size() const;
+
+    string_pool() {};
+    string_pool(const string_pool &other) = delete;
+
+private:
+    mutable std::mutex                  mutex;
+    std::deque<string>                  values;
+    std::unordered_map<string, uint32_t> index;
+};
+
+inline uint32_t string_pool::intern(const string &s)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto res = index.emplace(s, static_cast<uint32_t>(values.size()));
+    if (res.second)
+    {
+        values.push_back(s);
+    }
+
+    return res.first->second;
+};
+inline const string &string_pool::get(uint32_t id) const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return values[id];
+};
+inline size_t string_pool::size() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return values.size();
+};
+
+// Volumes' and issues' numbers. Crossref gives them as strings, but they're
+// almost always small integers, so those are stored as such; the others
+// ("3-4", "Suppl 2") go to a string pool. The whole thing is 4 bytes:
+//  code >= 0   -- the number itself;
+//  code == -1  -- no value;
+//  code <  -1  -- the string with ID -code - 2 in the pool.
+class compact_label
+{
+public:
+    bool     empty() const      { return code == -1; }
+    bool     is_number() const  { return code >= 0; }
+    int32_t  get_number() const { return code; }
+    uint32_t get_string_id() const { return static_cast<uint32_t>(-(code + 2)); }
+    inline string to_string(const string_pool &pool) const;
+
+    static inline compact_label encode(const string &s, string_pool &pool);
+
+    compact_label() : code(-1) {};
+
+private:
+    explicit compact_label(int32_t value) : code(value) {};
+
+    int32_t code;
+};
+
+// Numbers with leading zeros ("01") are kept as strings, so that the value
+// is always restored as it was.
+inline compact_label compact_label::encode(const string &s, string_pool &pool)
+{
+    if (s.empty())
+    {
+        return compact_label{};
+    }
+
+    bool is_number = s.size() <= 9 && (s[0] != '0' || s.size() == 1);
+    int32_t value = 0;
+
+    for (size_t i = 0; is_number && i < s.size(); ++i)
+    {
+        if (s[i] < '0' || s[i] > '9')
+        {
+            is_number = false;
+        }
+        value = value * 10 + (s[i] - '0');
+    }
+
+    if (is_number)
+    {
+        return compact_label(value);
+    }
+
+    return compact_label(-static_cast<int32_t>(pool.intern(s)) - 2);
+};
+
+inline string compact_label::to_string(const string_pool &pool) const
+{
+    if (empty())
+    {
+        return string{};
+    }
+    if (is_number())
+    {
+        return std::to_string(code);
+    }
+
+    return pool.get(get_string_id());
+};
+}
+#endif
@@ -10,6 +10,9 @@
 // based on preprocessor directives, because the whole point of `try_emplace` 
 // is not to construct the value if the same key already exists -- and it's 
 // missing here, as the object is passed using `move` semantics.
+#ifndef CONDITIONAL_H
+#define CONDITIONAL_H
+
 #include <iostream>
 #include <unordered_map>
 
@@ -59,3 +62,4 @@ struct Emplacer
 };
 }
 }
+#endif
@@ -0,0 +1,360 @@
+/*
+ * Copyright (c) 2022 - present, GitHub: @cubter
+ *
+ * See COPYING.txt in the project root for license information.
+ */
+#ifndef CONTENT_CACHE_H
+#define CONTENT_CACHE_H
+
+#include <zstd/zstd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <unordered_map>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace metasci
+{
+// 128 bits of a content's hash, as 32 hex digits: 16 bytes a step, on two
+// lanes of multiply-rotate, finished with a murmur-style mix. Not
+// cryptographic; it only has to tell apart files and pages.
+inline std::string content_hash(const char *data, size_t len)
+{
+    auto rotl = [](uint64_t x, int r) { return (x << r) | (x >> (64 - r)); };
+    auto mix  = [](uint64_t x)
+    {
+        x ^= x >> 33;
+        x *= 0xff51afd7ed558ccdULL;
+        x ^= x >> 33;
+        x *= 0xc4ceb9fe1a85ec53ULL;
+        x ^= x >> 33;
+        return x;
+    };
+    const uint64_t k1 = 0x87c37b91114253d5ULL;
+    const uint64_t k2 = 0x4cf5ad432745937fULL;
+
+    uint64_t a = 0x9e3779b97f4a7c15ULL ^ len;
+    uint64_t b = 0x7f4a7c159e3779b9ULL;
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16)
+    {
+        uint64_t w0, w1;
+        std::memcpy(&w0, data + i, 8);
+        std::memcpy(&w1, data + i + 8, 8);
+        a = rotl(a ^ (w0 * k1), 31) * k2;
+        b = rotl(b ^ (w1 * k2), 33) * k1;
+        a += b;
+        b += a;
+    }
+    uint64_t tail[2] = { 0, 0 };
+    std::memcpy(tail, data + i, len - i);
+    a = mix(a ^ (tail[0] * k1));
+    b = mix(b ^ (tail[1] * k2) ^ a);
+    a += b;
+
+    char hex[33];
+    std::snprintf(hex, sizeof(hex), "%016llx%016llx",
+        static_cast<unsigned long long>(a), static_cast<unsigned long long>(b));
+    return hex;
+}
+
+// An on-disk cache of raw inputs (API pages, decompressed dump shards), so
+// that re-runs spend CPU only, not the network or gunzip.
+//
+// An entry's file is named by the hash of its key, and holds the key
+// itself, which is checked on reading, and the content, zstd-compressed.
+// Keys are whatever identifies the content: a request's URL & parameters,
+// or a file's content_hash(). Entries are written aside and renamed, so a
+// crash leaves no half-written entry behind.
+//
+// The cache is capped at max_bytes (compressed). Reading an entry touches
+// its file's mtime, which is thus the time of its last use; once the cap is
+// exceeded, the least recently used entries are evicted, till the cache is
+// down to 90% of the cap. The entries are listed from the directory on
+// opening, so the cache works across runs; it's safe to use from several
+// threads.
+class content_cache
+{
+public:
+    struct options
+    {
+        size_t  max_bytes  = size_t(4) << 30;
+        int     zstd_level = 3;
+    };
+
+    // Returns false if the key isn't cached, or its entry is damaged.
+    bool get(const std::string &key, std::string &out);
+    bool contains(const std::string &key) const;
+    // Throws std::system_error if the entry can't be written.
+    void put(const std::string &key, const char *data, size_t len);
+    void put(const std::string &key, const std::string &data)
+    {
+        put(key, data.data(), data.size());
+    }
+
+    size_t size() const { return total; }
+    size_t hits() const { return n_hits; }
+
+    // Creates the directory if need be. Throws std::system_error.
+    content_cache(const std::string &directory, const options &o);
+    explicit content_cache(const std::string &directory) :
+        content_cache(directory, options()) {};
+    content_cache(const content_cache &other) = delete;
+    content_cache &operator=(const content_cache &other) = delete;
+
+private:
+    struct entry
+    {
+        size_t  bytes;
+        int64_t used;       // ns
+    };
+
+    std::string path_of(const std::string &name) const;
+    void evict();
+
+    static int64_t now_ns()
+    {
+        return static_cast<int64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count());
+    }
+
+    std::string     dir;
+    options         opts;
+
+    std::mutex                              mutex;
+    std::unordered_map<std::string, entry>  entries;    // by name
+    size_t                                  total  = 0;
+    size_t                                  n_hits = 0;
+    std::atomic<uint64_t>                   n_tmp{ 0 };
+};
+
+content_cache::content_cache(const std::string &directory, const options &o) :
+    dir(directory),
+    opts(o)
+{
+    if (::mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST)
+    {
+        throw std::system_error(errno, std::generic_category(), dir);
+    }
+
+    DIR *d = ::opendir(dir.c_str());
+    if (d == nullptr)
+    {
+        throw std::system_error(errno, std::generic_category(), dir);
+    }
+    while (dirent *e = ::readdir(d))
+    {
+        std::string name = e->d_name;
+        struct stat st;
+        if (name.size() != 36 || name.compare(32, 4, ".zst") != 0 ||
+            ::stat(path_of(name.substr(0, 32)).c_str(), &st) != 0)
+        {
+            // Leftovers of interrupted writes go, unless they may be
+            // another process's writes still.
+            if (name.find(".zst.tmp.") != std::string::npos &&
+                ::stat((dir + '/' + name).c_str(), &st) == 0 &&
+                st.st_mtime + 3600 < std::time(nullptr))
+            {
+                std::remove((dir + '/' + name).c_str());
+            }
+            continue;
+        }
+        int64_t used = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 +
+            st.st_mtim.tv_nsec;
+        entries[name.substr(0, 32)] = entry{ static_cast<size_t>(st.st_size), used };
+        total += static_cast<size_t>(st.st_size);
+    }
+    ::closedir(d);
+};
+
+inline std::string content_cache::path_of(const std::string &name) const
+{
+    return dir + '/' + name + ".zst";
+};
+
+inline bool content_cache::contains(const std::string &key) const
+{
+    return ::access(path_of(content_hash(key.data(), key.size())).c_str(), R_OK) == 0;
+};
+
+// An entry: the key's length (4 bytes), the content's, (8 bytes), the key,
+// then the compressed content.
+bool content_cache::get(const std::string &key, std::string &out)
+{
+    const std::string name = content_hash(key.data(), key.size());
+    const std::string path = path_of(name);
+
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return false;
+    }
+    struct stat st;
+    std::string file;
+    if (::fstat(fd, &st) == 0)
+    {
+        file.resize(static_cast<size_t>(st.st_size));
+        size_t done = 0;
+        while (done < file.size())
+        {
+            ssize_t n = ::read(fd, &file[done], file.size() - done);
+            if (n < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (n <= 0)
+            {
+                break;
+            }
+            done += static_cast<size_t>(n);
+        }
+        file.resize(done);
+    }
+    // The last use, for the eviction.
+    ::futimens(fd, nullptr);
+    ::close(fd);
+
+    uint32_t key_len;
+    uint64_t raw;
+    if (file.size() < 12)
+    {
+        return false;
+    }
+    std::memcpy(&key_len, file.data(), 4);
+    std::memcpy(&raw, file.data() + 4, 8);
+    if (file.size() < 12 + static_cast<size_t>(key_len) || key_len != key.size() ||
+        file.compare(12, key_len, key) != 0)
+    {
+        return false;
+    }
+
+    size_t at = 12 + key_len;
+    if (ZSTD_getFrameContentSize(file.data() + at, file.size() - at) != raw)
+    {
+        return false;
+    }
+    out.resize(static_cast<size_t>(raw));
+    size_t n = ZSTD_decompress(&out[0], out.size(), file.data() + at, file.size() - at);
+    if (ZSTD_isError(n) || n != raw)
+    {
+        out.clear();
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = entries.find(name);
+    if (it != entries.end())
+    {
+        it->second.used = now_ns();
+    }
+    ++n_hits;
+    return true;
+};
+
+void content_cache::put(const std::string &key, const char *data, size_t len)
+{
+    const std::string name = content_hash(key.data(), key.size());
+    const std::string path = path_of(name);
+    const std::string tmp  = path + ".tmp." + std::to_string(::getpid()) + '.' +
+        std::to_string(n_tmp++);
+
+    std::string file(12 + key.size() + ZSTD_compressBound(len), '\0');
+    uint32_t key_len = static_cast<uint32_t>(key.size());
+    uint64_t raw     = len;
+    std::memcpy(&file[0], &key_len, 4);
+    std::memcpy(&file[4], &raw, 8);
+    std::memcpy(&file[12], key.data(), key.size());
+
+    size_t at = 12 + key.size();
+    size_t n  = ZSTD_compress(&file[at], file.size() - at, data, len, opts.zstd_level);
+    if (ZSTD_isError(n))
+    {
+        throw std::runtime_error(std::string("zstd: ") + ZSTD_getErrorName(n));
+    }
+    file.resize(at + n);
+
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        throw std::system_error(errno, std::generic_category(), tmp);
+    }
+    size_t done = 0;
+    while (done < file.size())
+    {
+        ssize_t w = ::write(fd, file.data() + done, file.size() - done);
+        if (w < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (w < 0)
+        {
+            int err = errno;
+            ::close(fd);
+            std::remove(tmp.c_str());
+            throw std::system_error(err, std::generic_category(), tmp);
+        }
+        done += static_cast<size_t>(w);
+    }
+    ::close(fd);
+    if (std::rename(tmp.c_str(), path.c_str()) != 0)
+    {
+        int err = errno;
+        std::remove(tmp.c_str());
+        throw std::system_error(err, std::generic_category(), path);
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = entries.find(name);
+    if (it != entries.end())
+    {
+        total -= it->second.bytes;
+    }
+    entries[name] = entry{ file.size(), now_ns() };
+    total += file.size();
+
+    if (total > opts.max_bytes)
+    {
+        evict();
+    }
+};
+
+// Called with the mutex held.
+void content_cache::evict()
+{
+    std::vector<std::pair<int64_t, std::string>> by_use;
+    by_use.reserve(entries.size());
+    for (const auto &e : entries)
+    {
+        by_use.emplace_back(e.second.used, e.first);
+    }
+    std::sort(by_use.begin(), by_use.end());
+
+    const size_t goal = opts.max_bytes / 10 * 9;
+    for (const auto &u : by_use)
+    {
+        if (total <= goal)
+        {
+            break;
+        }
+        std::remove(path_of(u.second).c_str());
+        total -= entries[u.second].bytes;
+        entries.erase(u.second);
+    }
+};
+}
+#endif
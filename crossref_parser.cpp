@@ -4,12 +4,35 @@
  * See COPYING.txt in the project root for license information.
  */
 
-// #include "async_api_connector.h"
+#include "async_api_connector.h"
+#include "arena.h"
 #include "article.h"
+#include "author_resolver.h"
+#include "cbor_shard.h"
+#include "checkpoint.h"
+#include "compact_label.h"
 #include "conditional.h"
+#include "content_cache.h"
+#include "dataset_updater.h"
+#include "dictionaries.h"
+#include "doi.h"
+#include "doi_dedup.h"
+#include "external_sort.h"
+#include "fast_json.h"
+#include "gzip.h"
+#include "gzip_index.h"
+#include "harvest_planner.h"
+#include "lsm_store.h"
+#include "item_parser.h"
+#include "item_reader.h"
 #include "log.h"
-
-#define JSON_DIAGNOSTICS 1
+#include "mapped_file.h"
+#include "node_merge.h"
+#include "orc_sink.h"
+#include "output_dictionary.h"
+#include "parsed_cache.h"
+#include "seekable_zstd.h"
+#include "shard_reader.h"
 
 #include <nlohmann/json.hpp>
 #include <iostream>
@@ -18,6 +41,22 @@
 #include <vector>
 #include <unordered_set>
 #include <regex>
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+
+#include <cstdio>
+#include <unordered_map>
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <mutex>
+#include <thread>
 
 using author                = metasci::author;
 using article               = metasci::article;
@@ -32,10 +71,11 @@ using subject_vec           = std::vector<subject>;
 using pub_type_vec          = std::vector<publication_type>;
 using publisher             = metasci::publisher;
 using json_log_vec          = std::vector<metasci::json_log>;
-using json                  = nlohmann::json;
+using string_pool           = metasci::string_pool;
+using json                  = metasci::fast_json;
 using article_vec           = std::vector<article>;
-using journal_uset          = 
-    std::unordered_set<journal, journal_hasher, journal_comparator>;
+using journal_uset          = metasci::journal_uset;
+using dictionaries          = metasci::dictionaries;
 
 using std::endl;
 using std::cout;
@@ -43,24 +83,61 @@ using std::cerr;
 
 // Setting currently assigned max IDs
 int32_t journal::max_id_                        = 0;
-int32_t article::max_id_                        = 0;
+std::atomic<int32_t> article::max_id_{0};
 int32_t publisher::max_id_                      = 0;
 int32_t author::max_id_                         = 0;
 metasci::subject_id subject::max_id_            = 0;
 metasci::pub_type_id publication_type::max_id_ = 0;
 
+// How the input is parsed; set from the command line.
+struct parse_options
+{
+    bool     use_dom     = false;
+    bool     use_jsonl   = false;
+    unsigned threads     = 1;
+    unsigned queue_depth = 64;      // shards being read at once
+    unsigned requests    = 8;       // API's requests in flight
+};
+
 void usage(int argc);
-void parse_crossref_json(json &crossref_json,
-    json_log_vec  &json_logs, 
-    journal_uset  &journals,
-    article_vec   &articles, 
-    subject_vec   &subjects,
-    pub_type_vec  &publication_types);
+bool list_shards(const string &dir, std::vector<string> &paths);
+bool unpack(const char *data, size_t len, string &out, 
+    metasci::content_cache *cache, unsigned threads);
+bool transcode(const string &input, const string &out_dir, 
+    const parse_options &opts, bool seekable);
+bool index_shards(const string &input, const parse_options &opts);
+bool merge_nodes(const string &nodes_dir, const string &orc_path, 
+    size_t memory_bytes, dictionaries &dicts);
+bool extract_items(const string &dois_path, const string &input,
+    const string &out_path);
+bool load_parsed(const string &key, metasci::content_cache *cache,
+    json_log_vec &json_logs, dictionaries &dicts, article_vec &articles);
+void save_parsed(const string &key, metasci::content_cache *cache,
+    const article_vec &articles, size_t first, 
+    const json_log_vec &json_logs, size_t first_log, dictionaries &dicts);
+bool write_articles(article_vec &articles, const string &orc_path, 
+    dictionaries &dicts);
+bool write_deduplicated(metasci::doi_deduplicator &dedup, 
+    const string &orc_path, const string &sort_by, size_t memory_bytes,
+    metasci::node_spec node, dictionaries &dicts);
+bool upsert_into_store(article_vec &articles, metasci::lsm_store &store,
+    metasci::checkpoint_journal &journal, const string &delta, 
+    const metasci::file_stamp &delta_stamp, const string &orc_path, 
+    dictionaries &dicts);
+template<typename Json>
+bool parse_input(const char *data, size_t len,
+    const parse_options   &opts,
+    json_log_vec          &json_logs, 
+    dictionaries          &dicts,
+    article_vec           &articles,
+    metasci::mapped_file  *source);
 
 int main(int argc, char const *argv[])
 {
+    dictionaries dicts;
+
     // List of current pulication types
-    std::vector<publication_type> publication_types
+    dicts.publication_types = std::vector<publication_type>
     {
         { "book_section"        },
         { "monograph"           },
@@ -93,403 +170,1541 @@ int main(int argc, char const *argv[])
         { "standard_series"     }
     };
 
-    std::ifstream inf(argv[1]);
-    if (!inf)
+    // --dom parses the whole file into a DOM first, which is slower, but 
+    // tolerates whatever layout the file has.
+    // --jsonl reads JSON Lines, one item per line, instead of the envelope.
+    // -j N parses a single file in N threads.
+    // -q N keeps N shards being read at once, when the input is a directory.
+    // -r N keeps N requests in flight, when the input is an API's query 
+    // (https://api.crossref.org/works?...; see async_api_connector.h).
+    // --from <date> [--until <date>] harvests the works indexed in the 
+    // period, cut into date ranges walked in parallel, up to -r of them at
+    // once (see harvest_planner.h); until is today by default.
+    // --cache <dir> keeps the API's pages and the shards' decompressed 
+    // contents in dir, so that re-runs neither download nor gunzip them 
+    // again (see content_cache.h); --cache-mb N caps it at N MB. The input
+    // files' parsed articles are kept too, so that unchanged files aren't
+    // parsed again either (see parsed_cache.h).
+    // --transcode converts the input file or shards into binary shards 
+    // (zstd'ed CBOR; see cbor_shard.h) in the output directory, instead of 
+    // parsing them. Binary shards are parsed like any other input, only 
+    // faster, so a dump is worth transcoding once if it's reprocessed often.
+    // --seekable re-packs them into seekable shards instead (JSON Lines in
+    // independent zstd frames; see seekable_zstd.h), whose frames are 
+    // decompressed in -j threads, and which --index & --extract support.
+    // --index builds a random-access index beside each gzip'ed (or seekable)
+    // shard of the input (see gzip_index.h); --extract <dois> then writes the
+    // items with the DOIs listed in the file, one per line, as JSON Lines to
+    // the output (extracted.jsonl by default), decompressing only around them.
+    // --checkpoint <journal> makes an ingest of a directory resumable: each
+    // shard gets an output file of its own, and the completed ones are
+    // skipped on a restart (see checkpoint.h).
+    // --update upserts the input, a delta, by DOI into the dataset given as
+    // the output directory (see dataset_updater.h).
+    // --store <dir> upserts the input by DOI into the record store in dir 
+    // (see lsm_store.h); given an output, the whole store is then exported 
+    // to it.
+    // -m N keeps up to N MB of articles in memory while deduplicating them
+    // by DOI, which the output is otherwise (see doi_dedup.h), or sorting.
+    // --sort doi | year sorts the output by DOI, or by the publication's 
+    // year and journal (see external_sort.h).
+    // --shard i/N ingests only the part of the input directory which falls
+    // to node i of N, and writes the node's dictionary beside the output;
+    // --merge then merges the nodes' outputs, found in the input directory,
+    // into the output (see node_merge.h).
+    parse_options opts;
+    string        checkpoint_path;
+    string        store_path;
+    bool          update = false;
+    bool          merge = false;
+    string        shard_spec;
+    size_t        dedup_mb = 1024;
+    string        sort_by;
+    string        harvest_from;
+    string        harvest_until;
+    string        cache_path;
+    size_t        cache_mb = 4096;
+    bool          transcode_only = false;
+    bool          seekable = false;
+    bool          index_only = false;
+    string        extract_path;
+
+    while (argc > 1 && argv[1][0] == '-')
     {
-        cerr << "Couldn't open Crossref's json file. Aborting" << endl;
-        return 1;
+        string option = argv[1];
+        if (option == "--dom")
+        {
+            opts.use_dom = true;
+        }
+        else if (option == "--jsonl")
+        {
+            opts.use_jsonl = true;
+        }
+        else if (option == "--update")
+        {
+            update = true;
+        }
+        else if (option == "--merge")
+        {
+            merge = true;
+        }
+        else if (option == "--transcode")
+        {
+            transcode_only = true;
+        }
+        else if (option == "--seekable")
+        {
+            transcode_only = seekable = true;
+        }
+        else if (option == "--index")
+        {
+            index_only = true;
+        }
+        else if ((option == "--checkpoint" || option == "--store") && argc > 2)
+        {
+            (option == "--store" ? store_path : checkpoint_path) = argv[2];
+            --argc;
+            ++argv;
+        }
+        else if ((option == "-j" || option == "-q" || option == "-r") && argc > 2)
+        {
+            unsigned n = static_cast<unsigned>(std::max(1, std::atoi(argv[2])));
+            (option == "-j" ? opts.threads : option == "-q" ? opts.queue_depth : 
+                opts.requests) = n;
+            --argc;
+            ++argv;
+        }
+        else if (option == "--sort" && argc > 2 && 
+            (string(argv[2]) == "doi" || string(argv[2]) == "year"))
+        {
+            sort_by = argv[2];
+            --argc;
+            ++argv;
+        }
+        else if ((option == "--from" || option == "--until" || 
+            option == "--cache" || option == "--extract" || 
+            option == "--shard") && argc > 2)
+        {
+            (option == "--from" ? harvest_from : option == "--until" ? 
+                harvest_until : option == "--cache" ? cache_path : 
+                option == "--extract" ? extract_path : shard_spec) = argv[2];
+            --argc;
+            ++argv;
+        }
+        else if ((option == "-m" || option == "--cache-mb") && argc > 2)
+        {
+            (option == "-m" ? dedup_mb : cache_mb) = 
+                static_cast<size_t>(std::max(1, std::atoi(argv[2])));
+            --argc;
+            ++argv;
+        }
+        else
+        {
+            usage(0);
+            return 1;
+        }
+        --argc;
+        ++argv;
     }
 
-    std::ofstream json_log_file("json_parser.log");
-    if (!json_log_file)
+    if (argc < 2 || argc > 3)
     {
-        cerr << "Couldn't open/create json_parser.log. Aborting" << endl;
+        usage(argc);
         return 1;
     }
+    string orc_path = argc == 3 ? argv[2] : "articles.orc";
 
-    json crossref_json;
-    try
+    if (transcode_only)
     {
-        crossref_json = json::parse(inf);
+        if (argc != 3)
+        {
+            cerr << (seekable ? "--seekable" : "--transcode") 
+                << " needs an output directory. Aborting" << endl;
+            return 1;
+        }
+        return transcode(argv[1], argv[2], opts, seekable) ? 0 : 1;
     }
-    catch(const std::exception& e)
+    if (merge)
     {
-        cerr << e.what() << '\n';
-        return 1;
+        return merge_nodes(argv[1], orc_path, dedup_mb << 20, dicts) ? 0 : 1;
     }
 
-    std::vector<article>    articles;
-    std::vector<author>     authors;
-    std::vector<subject>    subjects;
-    journal_uset            journals;
-    json_log_vec            json_logs;
-
-
-    parse_crossref_json(crossref_json, json_logs, journals, articles, subjects, 
-        publication_types);
-
-    return 0;
-}
-
-void usage(int argc)
-{
-    if (argc != 2)
+    metasci::node_spec node;
+    if (!shard_spec.empty())
     {
-        cerr << "Wrong input. Usage: crossref_download <file_name>" << endl;
+        if (!metasci::parse_node_spec(shard_spec, node))
+        {
+            cerr << "--shard takes i/N, 0 <= i < N. Aborting" << endl;
+            return 1;
+        }
+        if (!checkpoint_path.empty() || update || !store_path.empty())
+        {
+            cerr << "--shard can't be used with --checkpoint, --update or "
+                "--store. Aborting" << endl;
+            return 1;
+        }
+    }
+    if (index_only)
+    {
+        return index_shards(argv[1], opts) ? 0 : 1;
+    }
+    if (!extract_path.empty())
+    {
+        return extract_items(extract_path, argv[1], 
+            argc == 3 ? argv[2] : "extracted.jsonl") ? 0 : 1;
     }
-}
-
-// Parses Crossref's JSONs.
-void parse_crossref_json(json &crossref_json,
-    json_log_vec  &json_logs, 
-    journal_uset  &journals,
-    article_vec   &articles, 
-    subject_vec   &subjects,
-    pub_type_vec  &publication_types)
-{
-    json items; // the highest level structure
 
-    try
+    // A query is harvested anew every time, so it's never "applied already".
+    const bool is_url = metasci::async_api_connector::is_url(argv[1]);
+    if (is_url && opts.use_jsonl)
+    {
+        cerr << "--jsonl can't be used with an API's query. Aborting" << endl;
+        return 1;
+    }
+    if (!is_url && (!harvest_from.empty() || !harvest_until.empty()))
     {
-        items = crossref_json.at("items");
+        cerr << "--from & --until need an API's query. Aborting" << endl;
+        return 1;
     }
-    catch(const json::exception &e)
+    if (harvest_from.empty() && !harvest_until.empty())
     {
-        json_logs.emplace_back(e.id, e.what(), "items missing");
-        return;
+        cerr << "--until needs --from. Aborting" << endl;
+        return 1;
+    }
+
+    std::ofstream json_log_file("json_parser.log");
+    if (!json_log_file)
+    {
+        cerr << "Couldn't open/create json_parser.log. Aborting" << endl;
+        return 1;
     }
 
-    for (auto &item : items)
-    {   
-        string title;
-        string doi;
-        string publisher;
-        metasci::cref_vec<journal>  journal_refs;
-        std::vector<author>         authors;
+    std::vector<article>    articles;
+    json_log_vec            json_logs;
 
+    std::unique_ptr<metasci::content_cache> cache;
+    if (!cache_path.empty())
+    {
+        metasci::content_cache::options cache_opts;
+        cache_opts.max_bytes = cache_mb << 20;
         try
         {
-            // Nlohmann's JSON lib. supports implicit conversions, so 
-            // item.at("title").at(0) will be converted to string.
-            title = std::move(item.at("title").at(0));
+            cache.reset(new metasci::content_cache(cache_path, cache_opts));
         }
-        catch(const json::exception &e)
+        catch(const std::exception &e)
         {
-            json_logs.emplace_back(e.id, e.what(), "title missing.");
-            return;
+            cerr << "Couldn't open the cache: " << e.what() << ". Aborting" 
+                << endl;
+            return 1;
         }
+    }
+
+    // The dataset's journal keeps the dictionaries & IDs across updates, 
+    // and records the deltas applied.
+    std::unique_ptr<metasci::dataset_updater>    updater;
+    std::unique_ptr<metasci::checkpoint_journal> update_journal;
+    metasci::file_stamp                          delta_stamp;
 
+    if (update)
+    {
+        if (argc != 3 || !checkpoint_path.empty())
+        {
+            cerr << "--update needs the dataset's directory as the output, "
+                "and can't be combined with --checkpoint. Aborting" << endl;
+            return 1;
+        }
         try
         {
-            doi = std::move(item.at("DOI"));
+            updater.reset(new metasci::dataset_updater(orc_path, dicts));
+            update_journal.reset(new metasci::checkpoint_journal(
+                orc_path + "/journal", dicts));
         }
-        catch(const json::exception &e)
+        catch(const std::exception &e)
         {
-            json_logs.emplace_back(e.id, e.what(), "title: " + title);
-            return;
+            cerr << "Couldn't open the dataset: " << e.what() 
+                << ". Aborting" << endl;
+            return 1;
         }
 
+        metasci::stamp_file(argv[1], delta_stamp);
+        if (!is_url && update_journal->is_done(argv[1], delta_stamp))
+        {
+            cerr << argv[1] << " has been applied already" << endl;
+            return 0;
+        }
+    }
+
+    // The store's journal plays the same part as the dataset's.
+    std::unique_ptr<metasci::lsm_store> store;
+
+    if (!store_path.empty())
+    {
+        if (update || !checkpoint_path.empty())
+        {
+            cerr << "--store can't be combined with --update or --checkpoint. "
+                "Aborting" << endl;
+            return 1;
+        }
         try
         {
-            publisher = std::move(item.at("publisher"));
+            store.reset(new metasci::lsm_store(store_path));
+            update_journal.reset(new metasci::checkpoint_journal(
+                store_path + "/journal", dicts));
         }
-        catch(const json::exception &e)
+        catch(const std::exception &e)
         {
-            json_logs.emplace_back(e.id, std::move(e.what()), "title: " + title);
-            return;
+            cerr << "Couldn't open the store: " << e.what() 
+                << ". Aborting" << endl;
+            return 1;
         }
 
-        // journals' titles. 
-        try
+        metasci::stamp_file(argv[1], delta_stamp);
+        if (!is_url && update_journal->is_done(argv[1], delta_stamp))
         {
-            json container_titles = item.at("container-title");
+            cerr << argv[1] << " has been applied already" << endl;
+            return 0;
+        }
+    }
 
-            for (auto &ct : container_titles)
-            {
-                journal j(std::move(ct), std::move(publisher));
+    // A directory is a dump cut into shards (Crossref's are gzip'ed). The
+    // shards are read asynchronously, many at once, and parsed one by one as
+    // they arrive.
+    std::vector<string> shards;
+    bool is_dir = list_shards(argv[1], shards);
 
-                metasci::cond::Emplacer<journal_uset, journal_uset::iterator, journal> emp;
+    if (!checkpoint_path.empty() && !is_dir)
+    {
+        cerr << "--checkpoint needs a directory of shards. Aborting" << endl;
+        return 1;
+    }
 
-                auto emplace_res = emp.emplace_to(journals, std::forward<journal>(j));
-                
-                journal_refs.emplace_back(*emplace_res.first);
-            }
-        }
-        catch(const json::type_error &e)
+    // A node keeps its part of the shards only.
+    if (!shard_spec.empty())
+    {
+        if (!is_dir)
         {
-            json_logs.emplace_back(e.id, std::move(e.what()), "title: " + title);
+            cerr << "--shard needs a directory of shards. Aborting" << endl;
+            return 1;
         }
-        // There will be a lot out of range errors, since many elements may be 
-        // absent in the concrete json file. I don't need to catch them -- I'm 
-        // only interested in type errors, -- hence the body is empty. Same 
-        // applies below
-        catch(const json::exception &e)
-        { }
 
+        const size_t all = shards.size();
+        shards.erase(std::remove_if(shards.begin(), shards.end(), 
+            [&](const string &path) 
+            { 
+                return metasci::node_of(path, node.nodes) != node.node; 
+            }), shards.end());
+        cerr << "Node " << node.node << " of " << node.nodes << ": " 
+            << shards.size() << " of " << all << " shards" << endl;
+    }
+
+    // With a checkpoint, orc_path is the directory of the output shards.
+    // The journal restores the dictionaries, so it's opened before any 
+    // parsing, and the files it has recorded aren't even read.
+    std::unique_ptr<metasci::checkpoint_journal> ckpt;
+    std::unordered_map<string, metasci::file_stamp> stamps;
+    bool failed = false;
+    // Some shard, malformed, was left out of the journal for the next run.
+    bool incomplete = false;
+
+    if (!checkpoint_path.empty())
+    {
         try
         {
-            json    local_authors = item.at("author");    
-            string  orcid; 
-            bool    is_auth_orcid;
+            ckpt.reset(new metasci::checkpoint_journal(checkpoint_path, dicts));
+        }
+        catch(const std::exception &e)
+        {
+            cerr << "Couldn't open the checkpoint: " << e.what() 
+                << ". Aborting" << endl;
+            return 1;
+        }
+
+        if (::mkdir(orc_path.c_str(), 0755) != 0 && errno != EEXIST)
+        {
+            cerr << "Couldn't create " << orc_path << ". Aborting" << endl;
+            return 1;
+        }
 
-            for (const auto &local_author : local_authors)
+        std::vector<string> pending;
+        for (auto &path : shards)
+        {
+            metasci::file_stamp stamp;
+            if (metasci::stamp_file(path, stamp) && ckpt->is_done(path, stamp))
             {
-                try
-                {        
-                    // ORCID is an author's unique ID. Many authors lack it.
-                    auto cut_orcid = [&](string s) 
-                    {  
-                        return string{s.begin() + s.find_first_not_of("http://orcid.org/"), s.end()};
-                    };
-
-                    orcid = cut_orcid(local_author.at("ORCID"));
-                    is_auth_orcid = local_author.at("authenticated-orcid");
+                continue;
+            }
+            stamps[path] = stamp;
+            pending.push_back(std::move(path));
+        }
+        cerr << "Resuming: " << shards.size() - pending.size() << " of " 
+            << shards.size() << " shards done" << endl;
+        shards = std::move(pending);
+    }
+
+    // Otherwise, the articles are deduplicated by DOI on their way to the 
+    // output. Shards are handed over to it one by one, with the authors 
+    // resolved, so that they can be spilled to the disk.
+    std::unique_ptr<metasci::doi_deduplicator> dedup;
+
+    if (!ckpt && !store && !update)
+    {
+        dedup.reset(new metasci::doi_deduplicator(orc_path + ".spill", 
+            dicts, dedup_mb << 20));
+    }
+
+    if (is_dir)
+    {
+        metasci::shard_reader reader(opts.queue_depth);
+        string unpacked;
+        article_vec shard_articles;
+
+        reader.read(shards, [&](metasci::shard &s)
+        {
+            // After a failure to record progress, the rest is left for 
+            // the next run.
+            if (failed)
+            {
+                return;
+            }
+            if (s.error != 0)
+            {
+                cerr << "Couldn't read " << s.path << ": " 
+                    << std::strerror(s.error) << endl;
+                return;
+            }
+
+            article_vec &out = ckpt || dedup ? shard_articles : articles;
+            const size_t first     = out.size();
+            const size_t first_log = json_logs.size();
+            const string parsed_key = cache ? metasci::parsed_cache_key(
+                s.data.data(), s.data.size(), opts.use_jsonl ? "jsonl" : "json") : 
+                string();
+
+            if (!load_parsed(parsed_key, cache.get(), json_logs, dicts, out))
+            {
+                const string *text = &s.data;
+                // Seekable shards are JSON Lines, whatever the options say.
+                parse_options text_opts = opts;
+                text_opts.use_jsonl |= metasci::is_seekable_zstd(s.data.data(), 
+                    s.data.size());
+                if (metasci::is_gzip(s.data.data(), s.data.size()) ||
+                    metasci::is_zstd(s.data.data(), s.data.size()))
+                {
+                    if (!unpack(s.data.data(), s.data.size(), unpacked, cache.get(),
+                        opts.threads))
+                    {
+                        cerr << "Corrupt compressed file " << s.path << endl;
+                        return;
+                    }
+                    text = &unpacked;
+                }
+
+                if (!parse_input<json>(text->data(), text->size(), text_opts, json_logs, 
+                    dicts, out, nullptr))
+                {
+                    cerr << "Malformed shard " << s.path << endl;
+                    if (ckpt)
+                    {
+                        // What it has given isn't written, nor is it
+                        // recorded as done, so it's parsed anew next time.
+                        shard_articles.clear();
+                        incomplete = true;
+                        return;
+                    }
                 }
-                catch(const json::type_error &e)
+                else
                 {
-                    json_logs.emplace_back(e.id, std::move(e.what()), 
-                        "title: " + title);
-                }    
-                catch(const json::exception &e) 
-                { }   
-
-                authors.emplace_back(std::move(local_author.at("given")), 
-                    std::move(local_author.at("family")), 
-                    std::move(orcid), 
-                    is_auth_orcid);
-                
-                // author's affiliations; often left empty.
+                    save_parsed(parsed_key, cache.get(), out, first, json_logs, 
+                        first_log, dicts);
+                }
+            }
+
+            if (dedup)
+            {
                 try
-                {                   
-                    authors.back().set_affiliations(
-                        std::move(local_author.at("affiliation")));  
+                {
+                    dicts.resolver.resolve(shard_articles);
+                    dedup->add(std::move(shard_articles));
                 }
-                catch(const json::type_error &e)
+                catch(const std::exception &e)
+                {
+                    cerr << "Couldn't spill articles: " << e.what() << endl;
+                    failed = true;
+                }
+                shard_articles.clear();
+                return;
+            }
+            if (!ckpt)
+            {
+                return;
+            }
+
+            // The shard's output is written aside and renamed once it's on 
+            // the disk, and only then is the shard recorded as done.
+            string name   = s.path.substr(s.path.rfind('/') + 1);
+            string output = orc_path + '/' + name + ".orc";
+            size_t n      = shard_articles.size();
+
+            try
+            {
+                if (!write_articles(shard_articles, output, dicts))
                 {
-                    json_logs.emplace_back(e.id, std::move(e.what()), 
-                        "title: " + title);
-                }   
-                catch(const json::exception &e) 
-                { } 
+                    throw std::runtime_error("couldn't write " + output);
+                }
+                metasci::sync_path(orc_path);
+                ckpt->commit(s.path, stamps[s.path], output, n);
+            }
+            catch(const std::exception &e)
+            {
+                cerr << "Couldn't checkpoint " << s.path << ": " << e.what() 
+                    << endl;
+                failed = true;
             }
+            shard_articles.clear();
+        });
+
+        if (ckpt || failed)
+        {
+            return failed || incomplete ? 1 : 0;
         }
-        catch(const json::type_error &e)
+    }
+    else if (is_url)
+    {
+        // The pages are parsed one by one as they arrive, like the shards.
+        metasci::async_api_connector::options api_opts;
+        api_opts.in_flight   = opts.requests;
+        api_opts.max_queries = opts.requests;
+        api_opts.cache       = cache.get();
+        metasci::async_api_connector connector(api_opts);
+        article_vec page_articles;
+
+        try
         {
-            json_logs.emplace_back(e.id, std::move(e.what()), 
-                "title: " + title);
-        }   
-        catch(const json::exception &e) 
-        { }
+            std::vector<string> queries{ argv[1] };
+            if (!harvest_from.empty())
+            {
+                metasci::harvest_planner planner(api_opts);
+                auto partitions = planner.plan(argv[1], harvest_from, 
+                    harvest_until.empty() ? planner.today() : harvest_until);
 
-        auto article_b = article::builder(std::move(title), 
-            std::move(doi), 
-            std::move(journal_refs), 
-            std::move(authors));
+                size_t works = 0;
+                queries.clear();
+                for (const auto &p : partitions)
+                {
+                    queries.push_back(p.query);
+                    works += p.works;
+                }
+                cerr << "Harvesting " << works << " works in " 
+                    << partitions.size() << " date ranges" << endl;
+            }
 
-        try
+            auto st = connector.harvest(queries, [&](metasci::api_page &page)
+            {
+                if (!page.error.empty())
+                {
+                    cerr << "Gave up on " << page.query << " at page " 
+                        << page.index << ": " << page.error << endl;
+                    failed = true;
+                    return;
+                }
+
+                article_vec &out = dedup ? page_articles : articles;
+                if (!parse_input<json>(page.body.data() + page.message_begin, 
+                    page.message_len, opts, json_logs, dicts, out, nullptr))
+                {
+                    cerr << "Malformed page " << page.index << " of " 
+                        << page.query << endl;
+                }
+                if (dedup)
+                {
+                    dicts.resolver.resolve(page_articles);
+                    dedup->add(std::move(page_articles));
+                    page_articles.clear();
+                }
+            });
+
+            cerr << "Harvested " << st.pages << " pages (" << (st.bytes >> 20) 
+                << " MB) in " << st.requests << " requests, " << st.retries 
+                << " retried (" << st.throttled << " throttled); " << st.cached
+                << " pages from the cache" << endl;
+        }
+        catch(const std::exception &e)
         {
-            // Issues are short (usually, numbers encoded as strings), so no 
-            // need to "move" them.
-            article_b.issue_b = item.at("issue");
+            cerr << "Couldn't harvest " << argv[1] << ": " << e.what() << endl;
+            return 1;
         }
-        catch(const json::type_error &e)
+
+        if (failed)
         {
-            json_logs.emplace_back(e.id, std::move(e.what()), 
-                "title: " + title);
+            return 1;
         }
-        catch(const json::exception &e) 
-        { }
-		
+    }
+    else
+    {
+        // The file is mapped into memory rather than read through a stream;
+        // all the parsers see it as a single buffer.
+        std::unique_ptr<metasci::mapped_file> input;
         try
         {
-            // Volumes are short strings as well.
-            article_b.volume_b = item.at("volume");
+            input.reset(new metasci::mapped_file(argv[1]));
         }
-        catch(const json::type_error &e)
+        catch(const std::system_error &e)
         {
-            json_logs.emplace_back(e.id, std::move(e.what()), 
-                "title: " + title);
+            cerr << "Couldn't open Crossref's json file: " << e.what() 
+                << ". Aborting" << endl;
+            return 1;
         }
-        catch(const json::exception &e) 
-        { }
-        
-        try
+
+        const string parsed_key = cache ? metasci::parsed_cache_key(
+            input->data(), input->size(), opts.use_jsonl ? "jsonl" : "json") : 
+            string();
+        const size_t first     = articles.size();
+        const size_t first_log = json_logs.size();
+
+        bool ok = true;
+        if (!load_parsed(parsed_key, cache.get(), json_logs, dicts, articles))
         {
-            // Types are also short.
-            string type = item.at("type");
-            
-            auto it = std::find(publication_types.begin(),  
-                publication_types.end(), type);
-            
-            if (it != publication_types.end())
+            if (metasci::is_gzip(input->data(), input->size()) ||
+                metasci::is_zstd(input->data(), input->size()))
             {
-                article_b.type_b = it->get_id();
+                // Seekable shards are JSON Lines, whatever the options say.
+                parse_options text_opts = opts;
+                text_opts.use_jsonl |= metasci::is_seekable_zstd(input->data(), 
+                    input->size());
+                string unpacked;
+                ok = unpack(input->data(), input->size(), unpacked, cache.get(),
+                        opts.threads) &&
+                    parse_input<json>(unpacked.data(), unpacked.size(), text_opts, 
+                        json_logs, dicts, articles, nullptr);
+            }
+            else
+            {
+                ok = parse_input<json>(input->data(), input->size(), opts, 
+                    json_logs, dicts, articles, input.get());
+            }
+            if (ok)
+            {
+                save_parsed(parsed_key, cache.get(), articles, first, json_logs, 
+                    first_log, dicts);
             }
         }
-        catch(const json::type_error &e)
+        input.reset();
+
+        if (!ok)
         {
-            json_logs.emplace_back(e.id, std::move(e.what()), 
-                "title: " + title);
+            cerr << "Malformed Crossref's json file; parsed " 
+                << articles.size() << " items" << endl;
+            if (opts.use_dom)
+            {
+                return 1;
+            }
         }
-        catch(const json::exception &e) 
-        { }
-		
+    }
+
+    if (update)
+    {
+        dicts.resolver.resolve(articles);
+
         try
         {
-            article_b.ref_by_num_b = item.at("is-referenced-by-count");
+            // The new entries & IDs are recorded before any segment or the 
+            // index refers to them.
+            update_journal->log_dictionaries();
+            auto st = updater->upsert(std::move(articles));
+            update_journal->commit(argv[1], delta_stamp, orc_path, st.upserted);
+
+            cerr << "Upserted " << st.upserted << " of " << st.received 
+                << " articles (" << st.stale << " stale) into " 
+                << st.partitions << " partitions, merging the segments of " 
+                << st.merges << endl;
         }
-        catch(const json::type_error &e)
+        catch(const std::exception &e)
         {
-            json_logs.emplace_back(e.id, std::move(e.what()), 
-                "title: " + title);
+            cerr << "Couldn't update " << orc_path << ": " << e.what() << endl;
+            return 1;
         }
-        catch(const json::exception &e) 
-        { }
-		
-        try
+        return 0;
+    }
+
+    if (store)
+    {
+        return upsert_into_store(articles, *store, *update_journal, argv[1], 
+            delta_stamp, argc == 3 ? orc_path : string(), dicts) ? 0 : 1;
+    }
+
+    try
+    {
+        dicts.resolver.resolve(articles);
+        dedup->add(std::move(articles));
+    }
+    catch(const std::exception &e)
+    {
+        cerr << "Couldn't spill articles: " << e.what() << endl;
+        return 1;
+    }
+
+    if (!write_deduplicated(*dedup, orc_path, sort_by, dedup_mb << 20, node, 
+        dicts))
+    {
+        return 1;
+    }
+    return 0;
+}
+
+// Sort key of an article's record: the lowercased DOI, or the year and the
+// journal's ID, big-endian, followed by the DOI.
+string sort_key(const char *rec, size_t len, const string &sort_by)
+{
+    string   doi;
+    uint16_t year;
+    int32_t  journal_id;
+    metasci::peek_sort_fields(rec, len, doi, year, journal_id);
+
+    string key;
+    if (sort_by == "year")
+    {
+        uint32_t j = static_cast<uint32_t>(journal_id);
+        const unsigned char prefix[6] = {
+            static_cast<unsigned char>(year >> 8), static_cast<unsigned char>(year),
+            static_cast<unsigned char>(j >> 24), static_cast<unsigned char>(j >> 16),
+            static_cast<unsigned char>(j >> 8), static_cast<unsigned char>(j) };
+        key.assign(reinterpret_cast<const char *>(prefix), sizeof(prefix));
+    }
+    key += metasci::normalize_doi(doi.data(), doi.size());
+
+    return key;
+}
+
+// Writes out the newest version of every DOI: a partition at a time, or, if
+// sort_by isn't empty, through an external sort. The output's dictionary,
+// which tells the node the output comes from, goes beside it.
+bool write_deduplicated(metasci::doi_deduplicator &dedup, 
+    const string &orc_path, const string &sort_by, size_t memory_bytes,
+    metasci::node_spec node, dictionaries &dicts)
+{
+    try
+    {
+        metasci::orc_sink sink(orc_path, dicts.labels);
+        metasci::doi_deduplicator::stats st;
+
+        if (sort_by.empty())
         {
-            article_b.ref_num_b = item.at("references-count");
+            st = dedup.finish([&](article_vec &articles)
+            {
+                sink.write(articles);
+            });
         }
-        catch(const json::type_error &e)
+        else
         {
-            json_logs.emplace_back(e.id, std::move(e.what()), 
-                "title: " + title);
+            metasci::external_sorter sorter(orc_path + ".sort", memory_bytes);
+            st = dedup.finish_records([&](const char *rec, size_t len)
+            {
+                sorter.add(sort_key(rec, len, sort_by), rec, len);
+            });
+
+            // Sorted records stream into the ORC file a batch at a time.
+            const metasci::journal_index journals = 
+                metasci::index_journals(dicts.journals);
+            article_vec batch;
+            sorter.finish([&](const char *rec, size_t len)
+            {
+                batch.push_back(metasci::decode_article(rec, len, dicts.labels,
+                    journals));
+                if (batch.size() == 100000)
+                {
+                    sink.write(batch);
+                    batch.clear();
+                }
+            });
+            sink.write(batch);
         }
-        catch(const json::exception &e) 
-        { }
+        sink.close();
+        const metasci::output_dictionary dict(dicts, sink.ids(), node);
+        dict.save(metasci::output_dictionary::path_of(orc_path));
 
-        try
+        cerr << "Wrote " << st.unique << " articles with distinct DOIs of " 
+            << st.received << " parsed, by " << dict.authors.size() << " authors";
+        if (st.spills > 0)
+        {
+            cerr << " (spilled " << st.spills << " times)";
+        }
+        cerr << endl;
+    }
+    catch(const std::exception &e)
+    {
+        cerr << "Couldn't write " << orc_path << ": " << e.what() << endl;
+        return false;
+    }
+
+    return true;
+}
+
+// Upserts the articles into the store: an article replaces the stored one 
+// only if it's newer, and keeps its ID. The dictionaries' new entries go to
+// the journal before the articles go to the store's log, and once the log 
+// has been synced, the delta is recorded as applied. If orc_path isn't 
+// empty, the whole store is then written to it, with its dictionary.
+bool upsert_into_store(article_vec &articles, metasci::lsm_store &store,
+    metasci::checkpoint_journal &store_journal, const string &delta, 
+    const metasci::file_stamp &delta_stamp, const string &orc_path, 
+    dictionaries &dicts)
+{
+    dicts.resolver.resolve(articles);
+
+    size_t upserted = 0;
+    try
+    {
+        store_journal.log_dictionaries();
+
+        string stored;
+        for (auto &a : articles)
         {
-            auto issued = item.at("issued").at("date-parts");
+            string key = metasci::normalize_doi(
+                a.doi_ref().data(), a.doi_ref().size());
 
-            for (auto &el : issued)
+            if (store.get(key, stored))
             {
-                article_b.issued_b.emplace_back(date{el.at(0), el.at(1), el.at(2)});
+                int32_t id;
+                int64_t updated;
+                metasci::peek_article(stored.data(), stored.size(), id, updated);
+                if (updated >= a.get_updated())
+                {
+                    continue;
+                }
+                a.set_id(id);
             }
+
+            string record;
+            metasci::encode_article(a, dicts.labels, record);
+            store.put(key, std::move(record));
+            ++upserted;
         }
-        catch(const json::type_error &e)
+        store.sync();
+        store_journal.commit(delta, delta_stamp, "", upserted);
+    }
+    catch(const std::exception &e)
+    {
+        cerr << "Couldn't update the store: " << e.what() << endl;
+        return false;
+    }
+    cerr << "Upserted " << upserted << " of " << articles.size() 
+        << " articles" << endl;
+
+    if (orc_path.empty())
+    {
+        return true;
+    }
+
+    // The store is exported in its keys' order, a batch at a time.
+    try
+    {
+        metasci::orc_sink sink(orc_path, dicts.labels);
+        const metasci::journal_index journals = 
+            metasci::index_journals(dicts.journals);
+        article_vec batch;
+        store.scan([&](const string &, const string &record)
         {
-            json_logs.emplace_back(e.id, std::move(e.what()), 
-                "title: " + title);
-        }
-        catch(const json::exception &e) 
-        { }
-    
-        try
-        {           
-            json score = item.at("score");
-            if (!score.is_null()) 
+            batch.push_back(metasci::decode_article(record.data(), 
+                record.size(), dicts.labels, journals));
+            if (batch.size() == 100000)
             {
-                article_b.score_b = score;
-            } 
-        }
-        catch(const json::type_error &e)
+                sink.write(batch);
+                batch.clear();
+            }
+        });
+        sink.write(batch);
+        sink.close();
+        metasci::output_dictionary(dicts, sink.ids())
+            .save(metasci::output_dictionary::path_of(orc_path));
+    }
+    catch(const std::exception &e)
+    {
+        cerr << "Couldn't write " << orc_path << ": " << e.what() << endl;
+        return false;
+    }
+
+    return true;
+}
+
+// Resolves the articles' authors against the run's table of authors, and 
+// writes the articles out with their dictionary. The file is written aside
+// and renamed once it's on the disk, so orc_path's directory is all that's
+// left to sync.
+bool write_articles(article_vec &articles, const string &orc_path, 
+    dictionaries &dicts)
+{
+    dicts.resolver.resolve(articles);
+
+    const string tmp = orc_path + ".tmp";
+    try
+    {
+        metasci::orc_sink sink(tmp, dicts.labels);
+        sink.write(articles);
+        sink.close();
+        metasci::sync_path(tmp);
+        if (std::rename(tmp.c_str(), orc_path.c_str()) != 0)
         {
-            json_logs.emplace_back(e.id, std::move(e.what()), 
-                "title: " + title);
+            throw std::system_error(errno, std::generic_category(), orc_path);
         }
-        catch(const json::exception &e) 
-        { }
+        metasci::output_dictionary(dicts, sink.ids())
+            .save(metasci::output_dictionary::path_of(orc_path));
+    }
+    catch(const std::exception &e)
+    {
+        cerr << "Couldn't write " << orc_path << ": " << e.what() << endl;
+        return false;
+    }
+
+    return true;
+}
+
+void usage(int argc)
+{
+    if (argc < 2 || argc > 3)
+    {
+        cerr << "Wrong input. Usage: crossref_download [--dom | --jsonl] "
+            "[--transcode | --seekable | --index | --extract <dois>] [-j <threads>] [-q <queue_depth>] [-r <requests>] "
+            "[--from <date> [--until <date>]] [--cache <dir> [--cache-mb <MB>]] "
+            "[-m <MB>] [--sort doi | year] "
+            "[--checkpoint <journal> | "
+            "--update | --store <dir>] [--shard <i/N> | --merge] "
+            "<file_name | shards_dir | api_query_url> "
+            "[<output.orc | output_dir>]" << endl;
+    }
+}
+
+// Decompresses a gzip'ed input, through the cache if there's one, which
+// keeps the decompressed data under the hash of the compressed. Binary 
+// shards, zstd'ed, decompress fast enough to bypass the cache; seekable ones
+// are decompressed frame by frame, in the given number of threads.
+bool unpack(const char *data, size_t len, string &out, 
+    metasci::content_cache *cache, unsigned threads)
+{
+    std::vector<metasci::zstd_frame> frames;
+    if (metasci::read_seek_table(data, len, frames))
+    {
+        out.resize(frames.empty() ? 0 : static_cast<size_t>(
+            frames.back().d_offset + frames.back().d_size));
+
+        std::atomic<size_t> next{0};
+        std::atomic<bool>   ok{true};
+        metasci::run_in_threads(static_cast<unsigned>(std::min<size_t>(threads, 
+            frames.size())), [&]
+        {
+            for (size_t i = next++; i < frames.size(); i = next++)
+            {
+                const metasci::zstd_frame &f = frames[i];
+                if (!metasci::unzstd_frame(data + f.c_offset, f, 
+                    &out[0] + f.d_offset))
+                {
+                    ok = false;
+                }
+            }
+        });
+        return ok;
+    }
+    if (metasci::is_zstd(data, len))
+    {
+        return metasci::unzstd(data, len, out);
+    }
 
+    string key;
+    if (cache != nullptr)
+    {
+        key = "gunzip " + metasci::content_hash(data, len);
+        if (cache->get(key, out))
+        {
+            return true;
+        }
+    }
+    if (!metasci::gunzip(data, len, out))
+    {
+        return false;
+    }
+    if (cache != nullptr)
+    {
         try
         {
-            // The full list of subjects is not provided by Crossref; hence, 
-            // it's updated during the parsing.
-            json local_subjects = item.at("subject");
+            cache->put(key, out);
+        }
+        catch(const std::exception &e)
+        {
+            cerr << "Couldn't cache a shard: " << e.what() << endl;
+        }
+    }
+    return true;
+}
+
+// Loads what parsing an input file has yielded before, if the cache has it.
+// A damaged entry is as good as none: the file is parsed again.
+bool load_parsed(const string &key, metasci::content_cache *cache,
+    json_log_vec &json_logs, dictionaries &dicts, article_vec &articles)
+{
+    string entry;
+    if (cache == nullptr || !cache->get(key, entry))
+    {
+        return false;
+    }
+    try
+    {
+        metasci::decode_parsed(entry.data(), entry.size(), dicts, articles, 
+            json_logs);
+    }
+    catch(const std::exception &e)
+    {
+        cerr << "Couldn't load a parsed file from the cache: " << e.what() << endl;
+        return false;
+    }
+    return true;
+}
+
+// Caches what parsing an input file has yielded: the articles from first
+// on, and the warnings from first_log on.
+void save_parsed(const string &key, metasci::content_cache *cache,
+    const article_vec &articles, size_t first, 
+    const json_log_vec &json_logs, size_t first_log, dictionaries &dicts)
+{
+    if (cache == nullptr)
+    {
+        return;
+    }
+    string entry;
+    metasci::encode_parsed(articles.data() + first, 
+        articles.data() + articles.size(), json_logs.data() + first_log, 
+        json_logs.data() + json_logs.size(), dicts, entry);
+    try
+    {
+        cache->put(key, entry);
+    }
+    catch(const std::exception &e)
+    {
+        cerr << "Couldn't cache a parsed file: " << e.what() << endl;
+    }
+}
+
+// Transcodes the input file, or the shards in the input directory, into 
+// binary shards in out_dir, opts.threads at a time; shard.json.gz becomes 
+// shard.cbor.zst, or shard.jsonl.zst if they're to be seekable. A shard is
+// written aside and renamed once it's complete. Returns false if any of the
+// files couldn't be transcoded.
+bool transcode(const string &input, const string &out_dir, 
+    const parse_options &opts, bool seekable)
+{
+    std::vector<string> paths;
+    if (!list_shards(input, paths))
+    {
+        paths.push_back(input);
+    }
+    if (::mkdir(out_dir.c_str(), 0755) != 0 && errno != EEXIST)
+    {
+        cerr << "Couldn't create " << out_dir << endl;
+        return false;
+    }
 
-            for (auto &local_subject : local_subjects)
+    const metasci::item_reader::layout layout = opts.use_jsonl ? 
+        metasci::item_reader::bare : metasci::item_reader::envelope;
+    std::atomic<size_t> next{0};
+    std::atomic<size_t> done{0};
+    std::mutex          cerr_mutex;
+
+    metasci::run_in_threads(static_cast<unsigned>(std::min<size_t>(opts.threads, 
+        paths.size())), [&]
+    {
+        string text, cbor, packed;
+        for (size_t i = next++; i < paths.size(); i = next++)
+        {
+            const string &path = paths[i];
+            string name = path.substr(path.rfind('/') + 1);
+            for (const char *ext : { ".gz", ".jsonl", ".json" })
             {
-                string local_subject_str = local_subject; 
+                size_t n = std::strlen(ext);
+                if (name.size() > n && name.compare(name.size() - n, n, ext) == 0)
+                {
+                    name.resize(name.size() - n);
+                }
+            }
+            const string out_path = out_dir + '/' + name + 
+                (seekable ? ".jsonl.zst" : ".cbor.zst");
 
-                auto it = std::find(subjects.begin(), subjects.end(), 
-                    local_subject_str);
+            try
+            {
+                metasci::mapped_file in(path);
+                const char *data = in.data();
+                size_t      len  = in.size();
+                if (metasci::is_gzip(data, len))
+                {
+                    if (!metasci::gunzip(data, len, text))
+                    {
+                        throw std::runtime_error("corrupt gzip file");
+                    }
+                    data = text.data();
+                    len  = text.size();
+                }
 
-                // If there already exists such subject in the global pool of 
-                // subjects, add its ID to the article builder's subject list,
-                if (it != subjects.end())
+                packed.clear();
+                if (seekable)
                 {
-                    article_b.subjects_ids_b.push_back(it->get_id());
+                    if (!metasci::pack_seekable(data, len, layout, 
+                        metasci::seekable_options(), packed))
+                    {
+                        throw std::runtime_error("malformed JSON");
+                    }
                 }
-                // otherwise, firstly, add a new subject to the pool.
                 else
                 {
-                    subjects.emplace_back(local_subject_str);
-                    article_b.subjects_ids_b.push_back(subjects.back().get_id()); 
+                    cbor.clear();
+                    if (!metasci::transcode_to_cbor<json>(data, len, layout, cbor))
+                    {
+                        throw std::runtime_error("malformed JSON");
+                    }
+                    metasci::zstd_compress(cbor, 9, packed);
                 }
-            }      
+
+                const string tmp = out_path + ".tmp";
+                std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+                out.write(packed.data(), static_cast<std::streamsize>(packed.size()));
+                out.close();
+                if (!out || std::rename(tmp.c_str(), out_path.c_str()) != 0)
+                {
+                    std::remove(tmp.c_str());
+                    throw std::runtime_error("couldn't write " + out_path);
+                }
+                ++done;
+            }
+            catch(const std::exception &e)
+            {
+                std::lock_guard<std::mutex> lock(cerr_mutex);
+                cerr << "Couldn't transcode " << path << ": " << e.what() << endl;
+            }
         }
-        catch(const json::type_error &e)
+    });
+
+    cerr << "Transcoded " << done << " of " << paths.size() << " files into " 
+        << out_dir << endl;
+    return done == paths.size();
+}
+
+// Of the rows which share a DOI across the nodes' outputs, all but the 
+// newest one (the earliest node's, if they're as new): by the node, the 
+// rows' positions in its output, from 1. The DOIs go through an external
+// sort, so that they needn't fit in memory.
+std::vector<metasci::id_set> superseded_rows(const std::vector<string> &outputs,
+    const string &spill_dir, size_t memory_bytes)
+{
+    auto put_be = [](string &out, uint64_t v, int bytes)
+    {
+        while (bytes-- > 0)
         {
-            json_logs.emplace_back(e.id, std::move(e.what()), 
-                "title: " + title);
+            out += static_cast<char>(v >> (bytes * 8));
         }
-        catch(const json::exception &e) 
-        { }
-        
-        try
-        {
-            // Clinical trial number is nothing else than NCT ID. 
-            json ct_nums = item.at("clinical-trial-number");
+    };
+
+    // Keyed by the DOI, then the newest first, then the node; the record
+    // is the node, the row and the DOI.
+    metasci::external_sorter sorter(spill_dir, memory_bytes);
+    string key, rec;
+    for (size_t n = 0; n < outputs.size(); ++n)
+    {
+        uint64_t row = 0;
+        metasci::orc_sink::scan_dois(outputs[n], 
+            [&](const char *doi, size_t len, int64_t updated)
+            {
+                key = metasci::normalize_doi(doi, len);
+                const size_t doi_len = key.size();
+                key += '\0';
+                put_be(key, ~(static_cast<uint64_t>(updated) ^ (1ull << 63)), 8);
+                put_be(key, n, 4);
+
+                rec.clear();
+                put_be(rec, n, 4);
+                put_be(rec, ++row, 8);
+                rec.append(key, 0, doi_len);
+                sorter.add(key, rec.data(), rec.size());
+            });
+    }
 
-            std::move(ct_nums.begin(), ct_nums.end(), 
-                std::back_inserter(article_b.ct_numbers_b));         
+    std::vector<metasci::id_set> superseded(outputs.size());
+    string last;
+    sorter.finish([&](const char *r, size_t len)
+    {
+        const auto *u = reinterpret_cast<const unsigned char *>(r);
+        uint64_t node = 0, row = 0;
+        for (int i = 0; i < 4; ++i)
+        {
+            node = node << 8 | u[i];
         }
-        catch(const json::type_error &e)
+        for (int i = 4; i < 12; ++i)
         {
-            json_logs.emplace_back(e.id, std::move(e.what()), 
-                "title: " + title);
+            row = row << 8 | u[i];
         }
-        catch(const json::exception &e) 
-        { }
-		
-		// I prefer the date of online publication if it's present, since, 
-        // well, it's an online era.
-        try
+        if (last.size() == len - 12 && last.compare(0, last.size(), r + 12, len - 12) == 0)
+        {
+            superseded[node].insert(static_cast<int64_t>(row));
+        }
+        else
         {
-            bool is_published = item.contains("published-online"); 
-            // published-online is an array, so there may be several dates. 
-            // Note: I'm not sure what that means in practice.
-            json published_dates; 
+            last.assign(r + 12, len - 12);
+        }
+    });
+
+    return superseded;
+}
 
-            if (!is_published)
+// Merges the outputs of all the nodes of a multi-node ingest, lying in 
+// nodes_dir with their dictionaries, into orc_path, and writes the merged
+// dictionary beside it. A DOI found on several nodes keeps its newest row.
+// Returns false if a node's output is missing, or any file couldn't be read
+// or written.
+bool merge_nodes(const string &nodes_dir, const string &orc_path, 
+    size_t memory_bytes, dictionaries &dicts)
+{
+    std::vector<string> paths;
+    if (!list_shards(nodes_dir, paths))
+    {
+        cerr << "--merge needs the directory of the nodes' outputs" << endl;
+        return false;
+    }
+
+    // The nodes' outputs, by the node.
+    std::vector<metasci::output_dictionary> nodes;
+    std::vector<string>                   outputs;
+    try
+    {
+        std::vector<std::pair<metasci::output_dictionary, string>> found;
+        for (const string &path : paths)
+        {
+            if (metasci::output_dictionary::is_dictionary(path))
             {
-                published_dates = item.at("published-print").at("date-parts");
+                found.emplace_back(metasci::output_dictionary::load(path), 
+                    path.substr(0, path.size() - 5));
             }
-            else
+        }
+        std::sort(found.begin(), found.end(), [](const auto &a, const auto &b)
+        {
+            return a.first.spec.node < b.first.spec.node;
+        });
+        for (size_t i = 0; i < found.size(); ++i)
+        {
+            if (found[i].first.spec.node != i || 
+                found[i].first.spec.nodes != found.size())
             {
-                published_dates = item.at("published-online").at("date-parts");
+                throw std::runtime_error("expected the outputs of " + 
+                    std::to_string(found[i].first.spec.nodes) + 
+                    " nodes, each one once; found " + std::to_string(found.size()));
             }
+            nodes.push_back(std::move(found[i].first));
+            outputs.push_back(std::move(found[i].second));
+        }
+        if (nodes.empty())
+        {
+            throw std::runtime_error("no node's output in " + nodes_dir);
+        }
+    }
+    catch(const std::exception &e)
+    {
+        cerr << "Couldn't merge: " << e.what() << endl;
+        return false;
+    }
+
+    metasci::output_dictionary          merged;
+    std::vector<metasci::node_remap>  remaps;
+    uint64_t rows = 0, dropped = 0;
+    try
+    {
+        metasci::merge_dictionaries(nodes, merged, remaps);
+        const std::vector<metasci::id_set> superseded = 
+            superseded_rows(outputs, orc_path + ".sort", memory_bytes);
+
+        using id_kind = metasci::orc_sink::id_kind;
+        metasci::orc_sink sink(orc_path, dicts.labels);
+        for (size_t n = 0; n < nodes.size(); ++n)
+        {
+            const metasci::node_remap &remap = remaps[n];
+            const metasci::id_set     &drop  = superseded[n];
+            int64_t row = 0;
+            rows += sink.copy_from(outputs[n], [&](const char *, size_t) 
+                { 
+                    bool superseded_row = drop.contains(++row);
+                    dropped += superseded_row;
+                    return superseded_row; 
+                }, 
+                [&remap](id_kind kind, int64_t id)
+                {
+                    return kind == id_kind::article_ids ? id + remap.article_offset :
+                        kind == id_kind::author_ids ? remap.author(id) : 
+                        kind == id_kind::subject_ids ? remap.subject(id) : 
+                        remap.journal(id);
+                });
+        }
+        sink.close();
+        // Only what the rows kept refer to.
+        merged.keep_only(sink.ids());
+        merged.save(metasci::output_dictionary::path_of(orc_path));
+    }
+    catch(const std::exception &e)
+    {
+        cerr << "Couldn't merge into " << orc_path << ": " << e.what() << endl;
+        return false;
+    }
+
+    cerr << "Merged " << rows << " articles of " << nodes.size() << " nodes ("
+        << dropped << " older duplicates dropped; " << merged.authors.size() << " authors, " << merged.journals.size() 
+        << " journals, " << merged.subjects.size() << " subjects) into " 
+        << orc_path << endl;
+    return true;
+}
 
-            for (auto &pd : published_dates)
+// Builds the index of the input file, or of each gzip'ed or seekable shard
+// in the input directory, opts.threads at a time. Returns false if any of them couldn't
+// be indexed.
+bool index_shards(const string &input, const parse_options &opts)
+{
+    std::vector<string> paths;
+    if (!list_shards(input, paths))
+    {
+        paths.push_back(input);
+    }
+
+    std::atomic<size_t> next{0};
+    std::atomic<size_t> done{0};
+    std::atomic<size_t> items{0};
+    std::atomic<size_t> skipped{0};
+    std::mutex          cerr_mutex;
+
+    metasci::run_in_threads(static_cast<unsigned>(std::min<size_t>(opts.threads, 
+        paths.size())), [&]
+    {
+        for (size_t i = next++; i < paths.size(); i = next++)
+        {
+            const string &path = paths[i];
+            try
+            {
+                metasci::mapped_file in(path);
+                if (!metasci::is_gzip(in.data(), in.size()) &&
+                    !metasci::is_seekable_zstd(in.data(), in.size()))
+                {
+                    // Plain shards are read whole anyway.
+                    ++skipped;
+                    continue;
+                }
+                metasci::file_stamp stamp;
+                metasci::stamp_file(path, stamp);
+                metasci::gzip_index index = metasci::gzip_index::build(in.data(), 
+                    in.size(), stamp, metasci::gzip_index::options());
+                index.save(metasci::gzip_index::path_of(path));
+                items += index.items();
+                ++done;
+            }
+            catch(const std::exception &e)
             {
-                article_b.published_b.emplace_back(date{pd.at(0), pd.at(1), pd.at(2)});
+                std::lock_guard<std::mutex> lock(cerr_mutex);
+                cerr << "Couldn't index " << path << ": " << e.what() << endl;
             }
         }
-        catch(const json::type_error &e)
+    });
+
+    cerr << "Indexed " << done << " of " << paths.size() - skipped 
+        << " gzip'ed or seekable shards (" << items << " items)" << endl;
+    return done + skipped == paths.size();
+}
+
+// Writes the items with the DOIs listed in dois_path to out_path, one per
+// line, looking them up in the indexes of the input file, or of the shards
+// in the input directory. Returns false if the DOIs or the output couldn't
+// be read or written, or a shard or its index couldn't be.
+bool extract_items(const string &dois_path, const string &input, 
+    const string &out_path)
+{
+    std::ifstream dois_in(dois_path);
+    if (!dois_in)
+    {
+        cerr << "Couldn't read " << dois_path << endl;
+        return false;
+    }
+    std::vector<string> dois;
+    for (string line; std::getline(dois_in, line); )
+    {
+        while (!line.empty() && std::isspace(static_cast<unsigned char>(line.back())))
         {
-            json_logs.emplace_back(e.id, std::move(e.what()), 
-                "title: " + title);
+            line.pop_back();
         }
-        catch(const json::exception &e) 
-        { }
-		
-        try
+        if (!line.empty())
         {
-            json references = item.at("reference"); // list of references
+            dois.push_back(std::move(line));
+        }
+    }
 
-            for (auto &el : references)
+    std::vector<string> paths;
+    if (!list_shards(input, paths))
+    {
+        paths.push_back(input);
+    }
+
+    auto lower = [](string s)
+    {
+        std::transform(s.begin(), s.end(), s.begin(), 
+            [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+        return s;
+    };
+
+    std::ofstream out(out_path, std::ios::binary | std::ios::trunc);
+    std::vector<bool> found(dois.size(), false);
+    bool ok = true;
+    metasci::item_reader reader(metasci::item_reader::bare);
+    string item, doi;
+
+    for (const string &path : paths)
+    {
+        metasci::file_stamp  stamp;
+        metasci::gzip_index  index;
+        if (!metasci::stamp_file(path, stamp) || 
+            !metasci::gzip_index::load(metasci::gzip_index::path_of(path), stamp, 
+                index))
+        {
+            cerr << path << " has no index, or a stale one; run --index" << endl;
+            ok = false;
+            continue;
+        }
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+        {
+            cerr << "Couldn't open " << path << endl;
+            ok = false;
+            continue;
+        }
+
+        for (size_t i = 0; i < dois.size(); ++i)
+        {
+            if (found[i])
             {
-                article_b.references_b.emplace_back(el.at("DOI"));   
-            }            
+                continue;
+            }
+            for (const auto &at : index.find(dois[i]))
+            {
+                if (!index.extract(fd, at, item))
+                {
+                    cerr << "Couldn't extract " << dois[i] << " from " << path 
+                        << endl;
+                    ok = false;
+                    break;
+                }
+                // The hash may collide.
+                bool match = false;
+                reader.read(item.data(), item.size(), 
+                    [&](const metasci::item_view &view)
+                {
+                    match = metasci::gzip_index::item_doi(view, doi) && 
+                        lower(doi) == lower(dois[i]);
+                });
+                if (match)
+                {
+                    out << item << '\n';
+                    found[i] = true;
+                    break;
+                }
+            }
         }
-        catch(const json::type_error &e)
+        ::close(fd);
+    }
+
+    out.close();
+    if (!out)
+    {
+        cerr << "Couldn't write " << out_path << endl;
+        return false;
+    }
+    cerr << "Extracted " << std::count(found.begin(), found.end(), true) << " of " 
+        << dois.size() << " DOIs into " << out_path << endl;
+    return ok;
+}
+
+// If path is a directory, lists the regular files in it (hidden ones
+// excepted) in lexicographic order, and returns true.
+bool list_shards(const string &path, std::vector<string> &paths)
+{
+    DIR *dir = ::opendir(path.c_str());
+    if (dir == nullptr)
+    {
+        return false;
+    }
+
+    while (const dirent *entry = ::readdir(dir))
+    {
+        if (entry->d_name[0] == '.')
+        {
+            continue;
+        }
+
+        // Shards' indexes lie beside them.
+        string file = path + '/' + entry->d_name;
+        struct stat st;
+        if (::stat(file.c_str(), &st) == 0 && S_ISREG(st.st_mode) && 
+            !metasci::gzip_index::is_index(file))
         {
-            json_logs.emplace_back(e.id, std::move(e.what()), 
-                "title: " + title);
+            paths.push_back(std::move(file));
         }
-        catch(const json::exception &e) 
-        { }
-        
-        articles.push_back(std::move(article_b.build()));
-    }  
+    }
+    ::closedir(dir);
+
+    std::sort(paths.begin(), paths.end());
+
+    return true;
+}
+
+// Parses a whole input file, lying in memory, the way the options say. If
+// the buffer is a mapped file, it may be released along the way. Returns
+// false if the input is malformed; what could be parsed is kept all the same.
+template<typename Json>
+bool parse_input(const char *data, size_t len,
+    const parse_options   &opts,
+    json_log_vec          &json_logs, 
+    dictionaries          &dicts,
+    article_vec           &articles,
+    metasci::mapped_file  *source)
+{
+    // Binary shards have a layout of their own, whatever the options say.
+    if (metasci::is_cbor(data, len))
+    {
+        return metasci::parse_crossref_cbor<Json>(data, len, json_logs, dicts, 
+            articles);
+    }
+
+    if (opts.use_jsonl)
+    {
+        size_t malformed = metasci::parse_crossref_jsonl<Json>(data, len, 
+            opts.threads, json_logs, dicts, articles);
+        if (malformed > 0)
+        {
+            cerr << "Skipped " << malformed << " malformed lines" << endl;
+        }
+        return true;
+    }
+
+    if (opts.use_dom)
+    {
+        Json crossref_json;
+        try
+        {
+            crossref_json = Json::parse(data, data + len);
+        }
+        catch(const std::exception& e)
+        {
+            cerr << e.what() << '\n';
+            return false;
+        }
+        // The DOM owns copies of everything.
+        if (source != nullptr)
+        {
+            source->release(len);
+        }
+
+        metasci::parse_crossref_json(crossref_json, json_logs, dicts, articles);
+        return true;
+    }
+
+    return opts.threads > 1 ?
+        metasci::parse_crossref_buffer_parallel<Json>(data, len, opts.threads, 
+            json_logs, dicts, articles) :
+        metasci::parse_crossref_buffer<Json>(data, len, json_logs, dicts, 
+            articles, source);
 }
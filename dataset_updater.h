@@ -0,0 +1,377 @@
+/*
+ * Copyright (c) 2022 - present, GitHub: @cubter
+ *
+ * See COPYING.txt in the project root for license information.
+ */
+#ifndef DATASET_UPDATER_H
+#define DATASET_UPDATER_H
+
+#include "article.h"
+#include "article_record.h"
+#include "checkpoint.h"
+#include "compact_label.h"
+#include "dictionaries.h"
+#include "doi.h"
+#include "lsm_store.h"
+#include "orc_sink.h"
+#include "output_dictionary.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+namespace metasci
+{
+// Dataset kept up to date by incremental upserts keyed by DOI.
+//
+// The articles are spread over a fixed number of partitions by a hash of
+// the (lowercased) DOI. A partition is a few ORC files, its segments, each
+// with its dictionary (see output_dictionary.h). An upsert doesn't rewrite
+// what's there: it writes the newer articles falling to a partition as a
+// new segment, numbered by the upsert's generation. A DOI's current row is
+// thus the one in the newest segment of its partition holding it; the rows
+// of older segments for that DOI are superseded, and whoever reads the 
+// dataset has to skip them.
+//
+// Once a partition has more than max_segments segments, its newest ones are
+// merged, taking in older ones as long as each is no bigger than the newer
+// ones taken so far together (as lsm_store compacts its runs), so that a
+// row is rewritten a logarithmic number of times rather than on every
+// upsert. The merge drops the superseded rows, and takes the place of the
+// newest segment merged.
+//
+// Which articles are newer is told by the index, an lsm_store of every
+// DOI's `updated` stamp and article's ID, so that it doesn't take reading
+// the ORC files. A replaced article keeps the ID it had.
+//
+// Segments are written aside, synced and renamed, and only then does the
+// index take their articles. A crash before that leaves segments whose
+// articles the index doesn't know of, which the re-run of the update 
+// writes again in a newer segment, superseding them; a crash while merging
+// leaves segments whose rows the merge superseded.
+//
+// The updater doesn't record the dictionaries, nor the IDs' counters, which
+// the segments and the index refer to: that's up to the caller, before the
+// upsert (see checkpoint_journal::log_dictionaries). Otherwise, a crash
+// after the index is synced loses them, and the next update gives out IDs
+// that are stored already.
+class dataset_updater
+{
+public:
+    struct stats
+    {
+        size_t received     = 0;    // articles in the delta
+        size_t upserted     = 0;    // newer than what's stored, or new
+        size_t stale        = 0;    // not newer than what's stored, or
+                                    // superseded within the delta
+        size_t partitions   = 0;    // partitions given a new segment
+        size_t merges       = 0;    // partitions whose segments were merged
+    };
+
+    // Upserts the articles, whose authors must have been resolved already.
+    // The articles are consumed. Throws std::system_error or orc's 
+    // exceptions on I/O errors, std::runtime_error if the index is damaged.
+    stats upsert(std::vector<article> &&articles);
+
+    // Throws std::system_error if the dataset can't be opened, and
+    // std::runtime_error if it was made with fewer partitions.
+    dataset_updater(const std::string &dir, const dictionaries &dicts,
+        uint32_t n_partitions = 256, size_t max_segments = 4);
+
+private:
+    struct entry
+    {
+        int64_t updated;
+        int32_t id;
+    };
+    struct segment
+    {
+        uint64_t generation;
+        uint64_t bytes;
+    };
+
+    void list_segments();
+    std::string segment_path(uint32_t p, uint64_t generation) const;
+    void write_segment(uint32_t p, uint64_t generation, 
+        const std::vector<article> &articles);
+    void merge_segments(uint32_t p);
+    bool find(const std::string &doi, entry &e) const;
+
+    std::string                         dir;
+    const dictionaries                  &dicts;
+    uint32_t                            n_partitions;
+    size_t                              max_segments;
+    std::unique_ptr<lsm_store>          index;
+    std::vector<std::vector<segment>>   segments;   // by partition, oldest first
+    uint64_t                            next_generation = 1;
+};
+
+dataset_updater::dataset_updater(const std::string &directory,
+    const dictionaries &d, uint32_t partitions, size_t segment_limit) :
+    dir(directory),
+    dicts(d),
+    n_partitions(partitions == 0 ? 1 : partitions),
+    max_segments(std::max<size_t>(segment_limit, 1)),
+    segments(this->n_partitions)
+{
+    if (::mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST)
+    {
+        throw std::system_error(errno, std::generic_category(), dir);
+    }
+    index.reset(new lsm_store(dir + "/index"));
+    list_segments();
+};
+
+std::string dataset_updater::segment_path(uint32_t p, uint64_t generation) const
+{
+    char name[48];
+    std::snprintf(name, sizeof(name), "/part-%05u-%08llu.orc", p, 
+        static_cast<unsigned long long>(generation));
+    return dir + name;
+};
+
+// Finds the segments, and removes what an interrupted upsert left aside.
+void dataset_updater::list_segments()
+{
+    DIR *d = ::opendir(dir.c_str());
+    if (d == nullptr)
+    {
+        throw std::system_error(errno, std::generic_category(), dir);
+    }
+    while (const dirent *e = ::readdir(d))
+    {
+        const std::string name = e->d_name;
+        if (name.size() > 4 && name.compare(name.size() - 4, 4, ".tmp") == 0)
+        {
+            std::remove((dir + '/' + name).c_str());
+            continue;
+        }
+
+        unsigned            p;
+        unsigned long long  generation;
+        int                 end = 0;
+        if (std::sscanf(name.c_str(), "part-%5u-%8llu.orc%n", &p, &generation, 
+            &end) != 2 || static_cast<size_t>(end) != name.size())
+        {
+            continue;
+        }
+        if (p >= n_partitions)
+        {
+            ::closedir(d);
+            throw std::runtime_error(dir + " has more than " + 
+                std::to_string(n_partitions) + " partitions");
+        }
+
+        struct stat st;
+        if (::stat((dir + '/' + name).c_str(), &st) != 0)
+        {
+            int err = errno;
+            ::closedir(d);
+            throw std::system_error(err, std::generic_category(), name);
+        }
+        segments[p].push_back(segment{ generation, 
+            static_cast<uint64_t>(st.st_size) });
+        next_generation = std::max<uint64_t>(next_generation, generation + 1);
+    }
+    ::closedir(d);
+
+    for (auto &segs : segments)
+    {
+        std::sort(segs.begin(), segs.end(), [](const segment &a, const segment &b)
+        {
+            return a.generation < b.generation;
+        });
+    }
+};
+
+// An index entry: the `updated` stamp and the ID, as signed varints.
+bool dataset_updater::find(const std::string &doi, entry &e) const
+{
+    std::string value;
+    if (!index->get(doi, value))
+    {
+        return false;
+    }
+
+    record::reader r{ value.data(), value.data() + value.size() };
+    e.updated = r.signed_varint();
+    int64_t id = r.signed_varint();
+    if (r.p != r.end || id <= 0 || id > INT32_MAX)
+    {
+        throw std::runtime_error("damaged index entry of " + doi);
+    }
+    e.id = static_cast<int32_t>(id);
+    return true;
+};
+
+dataset_updater::stats dataset_updater::upsert(std::vector<article> &&articles)
+{
+    stats st;
+    st.received = articles.size();
+
+    // The newest version of every DOI in the delta; on a tie, the later.
+    std::unordered_map<std::string, size_t> newest;
+    for (size_t i = 0; i < articles.size(); ++i)
+    {
+        auto res = newest.emplace(normalize_doi(articles[i].doi_ref().data(),
+            articles[i].doi_ref().size()), i);
+        if (!res.second)
+        {
+            ++st.stale;
+            if (articles[i].get_updated() >= 
+                articles[res.first->second].get_updated())
+            {
+                res.first->second = i;
+            }
+        }
+    }
+
+    // The ones newer than what's stored, in the order they came in.
+    std::vector<std::pair<size_t, const std::string *>> newer;
+    for (const auto &d : newest)
+    {
+        article &a = articles[d.second];
+        entry   stored;
+        if (find(d.first, stored))
+        {
+            if (stored.updated >= a.get_updated())
+            {
+                ++st.stale;
+                continue;
+            }
+            a.set_id(stored.id);
+        }
+        newer.emplace_back(d.second, &d.first);
+    }
+    std::sort(newer.begin(), newer.end());
+    st.upserted = newer.size();
+    if (newer.empty())
+    {
+        return st;
+    }
+
+    std::map<uint32_t, std::vector<article>> by_partition;
+    for (const auto &n : newer)
+    {
+        by_partition[partition_of(*n.second, n_partitions)].push_back(
+            std::move(articles[n.first]));
+    }
+
+    const uint64_t generation = next_generation++;
+    for (const auto &part : by_partition)
+    {
+        write_segment(part.first, generation, part.second);
+    }
+    sync_path(dir);
+    st.partitions = by_partition.size();
+
+    for (const auto &part : by_partition)
+    {
+        for (const article &a : part.second)
+        {
+            std::string value;
+            record::put_signed(value, a.get_updated());
+            record::put_signed(value, a.get_id());
+            index->put(normalize_doi(a.doi_ref().data(), a.doi_ref().size()), 
+                std::move(value));
+        }
+    }
+    index->sync();
+
+    for (const auto &part : by_partition)
+    {
+        if (segments[part.first].size() > max_segments)
+        {
+            merge_segments(part.first);
+            ++st.merges;
+        }
+    }
+
+    return st;
+};
+
+void dataset_updater::write_segment(uint32_t p, uint64_t generation,
+    const std::vector<article> &articles)
+{
+    const std::string path = segment_path(p, generation);
+    const std::string tmp  = path + ".tmp";
+
+    orc_sink sink(tmp, dicts.labels);
+    sink.write(articles);
+    sink.close();
+    sync_path(tmp);
+    if (std::rename(tmp.c_str(), path.c_str()) != 0)
+    {
+        throw std::system_error(errno, std::generic_category(), path);
+    }
+    output_dictionary(dicts, sink.ids()).save(output_dictionary::path_of(path));
+
+    struct stat st;
+    segments[p].push_back(segment{ generation, 
+        ::stat(path.c_str(), &st) == 0 ? static_cast<uint64_t>(st.st_size) : 0 });
+};
+
+// Merges the partition's newest segments into the newest one's place: the
+// rows are copied newest segment first, each DOI's first row only.
+void dataset_updater::merge_segments(uint32_t p)
+{
+    std::vector<segment> &segs = segments[p];
+
+    size_t   first = segs.size() - 1;
+    uint64_t taken = segs[first].bytes;
+    while (first > 0 && (segs[first - 1].bytes <= taken || 
+        first == segs.size() - 1))
+    {
+        taken += segs[--first].bytes;
+    }
+
+    const uint64_t    generation = segs.back().generation;
+    const std::string path       = segment_path(p, generation);
+    const std::string tmp        = path + ".tmp";
+
+    std::unordered_set<std::string> seen;
+    orc_sink sink(tmp, dicts.labels);
+    for (size_t i = segs.size(); i-- > first; )
+    {
+        sink.copy_from(segment_path(p, segs[i].generation), 
+            [&](const char *doi, size_t len)
+            {
+                return !seen.insert(normalize_doi(doi, len)).second;
+            });
+    }
+    sink.close();
+    sync_path(tmp);
+    if (std::rename(tmp.c_str(), path.c_str()) != 0)
+    {
+        throw std::system_error(errno, std::generic_category(), path);
+    }
+    output_dictionary(dicts, sink.ids()).save(output_dictionary::path_of(path));
+
+    for (size_t i = first; i + 1 < segs.size(); ++i)
+    {
+        const std::string merged = segment_path(p, segs[i].generation);
+        std::remove(merged.c_str());
+        std::remove(output_dictionary::path_of(merged).c_str());
+    }
+    sync_path(dir);
+
+    struct stat st;
+    segs.erase(segs.begin() + static_cast<std::ptrdiff_t>(first), segs.end());
+    segs.push_back(segment{ generation, 
+        ::stat(path.c_str(), &st) == 0 ? static_cast<uint64_t>(st.st_size) : 0 });
+};
+}
+#endif
@@ -0,0 +1,39 @@
+/*
+ * Copyright (c) 2022 - present, GitHub: @cubter
+ *
+ * See COPYING.txt in the project root for license information.
+ */
+#ifndef DICTIONARIES_H
+#define DICTIONARIES_H
+
+#include "article.h"
+#include "author_resolver.h"
+#include "compact_label.h"
+#include "journal.h"
+
+#include <mutex>
+#include <unordered_set>
+#include <vector>
+
+namespace metasci
+{
+using journal_uset = std::unordered_set<journal, journal_hasher, journal_comparator>;
+
+// Entities shared by all the articles, which the articles refer to by
+// reference or by ID. They're filled in during the parsing, except for the
+// authors, which the resolver adds once the articles are parsed.
+struct dictionaries
+{
+    journal_uset                    journals;
+    std::vector<subject>            subjects;
+    std::vector<publication_type>   publication_types;
+    string_pool                     labels;  // volumes' & issues' non-numeric values
+    author_resolver                 resolver;   // the authors' table
+
+    // Guards journals & subjects when several threads parse at once. The
+    // labels' pool has a lock of its own, and publication types are never
+    // modified during the parsing.
+    std::mutex                      mutex;
+};
+}
+#endif
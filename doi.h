@@ -0,0 +1,41 @@
+/*
+ * Copyright (c) 2022 - present, GitHub: @cubter
+ *
+ * See COPYING.txt in the project root for license information.
+ */
+#ifndef DOI_H
+#define DOI_H
+
+#include <cctype>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace metasci
+{
+// The form DOIs are compared, keyed and partitioned by. DOIs are
+// case-insensitive.
+inline std::string normalize_doi(const char *doi, size_t len)
+{
+    std::string out(doi, len);
+    for (char &c : out)
+    {
+        c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+    }
+    return out;
+}
+
+// Partition of a normalized DOI, out of n. FNV-1a: partitions must stay the
+// same across runs & platforms, which std::hash doesn't promise.
+inline uint32_t partition_of(const std::string &doi, uint32_t n)
+{
+    uint32_t h = 2166136261u;
+    for (char c : doi)
+    {
+        h ^= static_cast<unsigned char>(c);
+        h *= 16777619u;
+    }
+    return h % n;
+}
+}
+#endif
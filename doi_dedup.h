@@ -0,0 +1,645 @@
+/*
+ * Copyright (c) 2022 - present, GitHub: @cubter
+ *
+ * See COPYING.txt in the project root for license information.
+ */
+#ifndef DOI_DEDUP_H
+#define DOI_DEDUP_H
+
+#include "article.h"
+#include "article_record.h"
+#include "compact_label.h"
+#include "dictionaries.h"
+#include "doi.h"
+#include "string_sort.h"
+
+#include <zstd/zstd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace metasci
+{
+// Cross-file DOI deduplication stage: of all the versions of a DOI (the
+// same work comes in several dump files and API pages), only the newest by
+// `updated` is kept; on a tie, the one which came last.
+//
+// The articles are encoded as records (see article_record.h) and
+// hash-partitioned by DOI, so that all versions of a DOI land in the same
+// partition. Records are buffered in memory, and once the buffers hold
+// memory_bytes, every partition's buffer is compressed and appended to the
+// partition's spill file, in frames of whole entries.
+//
+// At the end, a spilled partition larger than a thread's share of memory
+// (memory_bytes / threads) is split by another hash of the DOI, a frame at a
+// time, into as many parts as it takes; a part still too large is split
+// again, up to a few levels deep. The partitions, or their parts, are then
+// deduplicated independently, a round of `threads` at a time, and handed
+// over in order; a part's articles keep the order they came in. Spill files
+// are read a frame at a time, straight into the entries, so a part takes
+// about its decompressed size in memory, whatever the corpus' size.
+class doi_deduplicator
+{
+public:
+    struct stats
+    {
+        size_t received = 0;
+        size_t unique   = 0;
+        size_t spills   = 0;    // times the buffers went to the disk
+    };
+
+    // Takes the articles, whose authors must have been resolved already.
+    // Throws std::system_error if spilling fails.
+    void add(std::vector<article> &&articles);
+
+    // Deduplicates the partitions, calling on_articles(std::vector<article> &)
+    // for each in turn, or for each part of a split one; can only be done
+    // once. Throws std::system_error or std::runtime_error if spilled data 
+    // can't be read back.
+    template<typename F>
+    stats finish(F on_articles);
+
+    // The same, but calls on_record(const char *, size_t) for every kept
+    // article's record, undecoded.
+    template<typename F>
+    stats finish_records(F on_record);
+
+    // The spill directory is only created if need be.
+    doi_deduplicator(const std::string &spill_dir, dictionaries &dicts,
+        size_t memory_bytes = size_t(1) << 30, uint32_t n_partitions = 64,
+        unsigned threads = std::thread::hardware_concurrency());
+    doi_deduplicator(const doi_deduplicator &other) = delete;
+    // Removes the spill files.
+    ~doi_deduplicator();
+
+private:
+    // A partition's newest versions, as records in its entries, in the
+    // order they came in.
+    struct survivors
+    {
+        std::string                                     entries;
+        std::vector<std::pair<const char *, size_t>>    kept;
+    };
+
+    // What's deduplicated in one go: a partition's buffer, if nothing was
+    // spilled, else a spill file.
+    struct unit
+    {
+        std::string path;
+        uint32_t    partition;
+    };
+
+    void spill();
+    void append_frames(const std::string &path, const std::string &entries);
+    template<typename F>
+    void for_each_frame(const std::string &path, F f) const;
+    void decompress(const std::string &path, const char *frame, size_t n,
+        char *out, size_t raw) const;
+    void plan_units();
+    void split(const std::string &path, uint64_t raw, unsigned level);
+    void load_unit(size_t u, std::string &entries);
+    void select_unit(size_t u, survivors &out);
+    template<typename T, typename Work, typename Hand>
+    void in_rounds(Work work, Hand hand);
+    std::string spill_path(uint32_t p) const;
+    static size_t entry_size(const char *p, const char *end);
+    static uint32_t sub_partition(const char *key, size_t len, unsigned level,
+        uint32_t n);
+
+    // Spill files are written in frames of whole entries, of this size or
+    // a single entry's.
+    static const size_t     frame_bytes     = size_t(8) << 20;
+    // Parts splitting no more: a single DOI's versions can't be split.
+    static const unsigned   max_split_level = 3;
+
+    std::string     spill_dir;
+    dictionaries    &dicts;
+    size_t          memory_bytes;
+    uint32_t        n_partitions;
+    unsigned        threads;
+
+    // Entries: normalized DOI, sequence number, record.
+    std::vector<std::string>    buffers;
+    std::vector<uint64_t>       sizes;      // by partition, spilled or not
+    size_t                      buffered = 0;
+    uint64_t                    seq      = 0;
+    bool                        spilled  = false;
+    std::vector<unit>           units;
+    std::vector<std::string>    parts;      // the files splitting made
+    stats                       st;
+};
+
+doi_deduplicator::doi_deduplicator(const std::string &spill_to,
+    dictionaries &d, size_t memory, uint32_t partitions,
+    unsigned n_threads) :
+    spill_dir(spill_to),
+    dicts(d),
+    memory_bytes(memory),
+    n_partitions(partitions == 0 ? 1 : partitions),
+    threads(n_threads == 0 ? 1 : n_threads),
+    buffers(this->n_partitions),
+    sizes(this->n_partitions, 0)
+{};
+
+doi_deduplicator::~doi_deduplicator()
+{
+    if (!spilled)
+    {
+        return;
+    }
+    for (uint32_t p = 0; p < n_partitions; ++p)
+    {
+        std::remove(spill_path(p).c_str());
+    }
+    for (const std::string &part : parts)
+    {
+        std::remove(part.c_str());
+    }
+    ::rmdir(spill_dir.c_str());
+};
+
+std::string doi_deduplicator::spill_path(uint32_t p) const
+{
+    char name[32];
+    std::snprintf(name, sizeof(name), "/part-%05u.spill", p);
+    return spill_dir + name;
+};
+
+void doi_deduplicator::add(std::vector<article> &&articles)
+{
+    std::string key;
+    std::string rec;
+
+    for (const article &a : articles)
+    {
+        key = normalize_doi(a.doi_ref().data(), a.doi_ref().size());
+        rec.clear();
+        encode_article(a, dicts.labels, rec);
+
+        uint32_t    p   = partition_of(key, n_partitions);
+        std::string &buf = buffers[p];
+        size_t before = buf.size();
+        record::put_string(buf, key);
+        record::put_varint(buf, seq++);
+        record::put_string(buf, rec);
+        buffered += buf.size() - before;
+        sizes[p] += buf.size() - before;
+    }
+    st.received += articles.size();
+    articles.clear();
+
+    if (buffered >= memory_bytes)
+    {
+        spill();
+    }
+};
+
+// A spill file is a sequence of zstd frames, each preceded by its size and
+// the size it decompresses to.
+void doi_deduplicator::spill()
+{
+    if (!spilled && ::mkdir(spill_dir.c_str(), 0755) != 0 && errno != EEXIST)
+    {
+        throw std::system_error(errno, std::generic_category(), spill_dir);
+    }
+    spilled = true;
+
+    for (uint32_t p = 0; p < n_partitions; ++p)
+    {
+        std::string &buf = buffers[p];
+        if (buf.empty())
+        {
+            continue;
+        }
+        append_frames(spill_path(p), buf);
+
+        buf.clear();
+        buf.shrink_to_fit();
+    }
+    buffered = 0;
+    ++st.spills;
+};
+
+// Cuts the entries into frames of about frame_bytes, between entries, so
+// that a frame can be split on its own.
+void doi_deduplicator::append_frames(const std::string &path,
+    const std::string &entries)
+{
+    std::ofstream out(path, std::ios::binary | std::ios::app);
+    std::string frame;
+    std::string header;
+
+    const char *p   = entries.data();
+    const char *end = p + entries.size();
+    while (p != end)
+    {
+        const char *cut = p;
+        while (cut != end && (cut == p || 
+            static_cast<size_t>(cut - p) < frame_bytes))
+        {
+            cut += entry_size(cut, end);
+        }
+        const size_t raw = static_cast<size_t>(cut - p);
+
+        frame.resize(ZSTD_compressBound(raw));
+        size_t n = ZSTD_compress(&frame[0], frame.size(), p, raw, 1);
+        if (ZSTD_isError(n))
+        {
+            throw std::runtime_error(std::string("zstd: ") + ZSTD_getErrorName(n));
+        }
+
+        header.clear();
+        record::put_varint(header, n);
+        record::put_varint(header, raw);
+        out.write(header.data(), static_cast<std::streamsize>(header.size()));
+        out.write(frame.data(), static_cast<std::streamsize>(n));
+        p = cut;
+    }
+
+    out.close();
+    if (!out)
+    {
+        throw std::system_error(EIO, std::generic_category(), path);
+    }
+};
+
+// Calls f(frame, size, decompressed_size) for every frame of a spill file, 
+// holding one frame at a time.
+template<typename F>
+void doi_deduplicator::for_each_frame(const std::string &path, F f) const
+{
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+    {
+        throw std::system_error(errno, std::generic_category(), path);
+    }
+
+    auto varint = [&](uint64_t &v)
+    {
+        v = 0;
+        for (int shift = 0; shift < 64; shift += 7)
+        {
+            int c = in.get();
+            if (c == std::char_traits<char>::eof())
+            {
+                return false;
+            }
+            v |= uint64_t(c & 0x7f) << shift;
+            if ((c & 0x80) == 0)
+            {
+                return true;
+            }
+        }
+        return false;
+    };
+
+    std::string frame;
+    uint64_t    n, raw;
+    while (in.peek() != std::char_traits<char>::eof())
+    {
+        if (!varint(n) || !varint(raw) || n > ZSTD_compressBound(raw))
+        {
+            throw std::runtime_error(path + ": truncated");
+        }
+        frame.resize(static_cast<size_t>(n));
+        in.read(&frame[0], static_cast<std::streamsize>(n));
+        if (static_cast<uint64_t>(in.gcount()) != n)
+        {
+            throw std::runtime_error(path + ": truncated");
+        }
+        f(frame.data(), static_cast<size_t>(n), static_cast<size_t>(raw));
+    }
+};
+
+void doi_deduplicator::decompress(const std::string &path, const char *frame, 
+    size_t n, char *out, size_t raw) const
+{
+    size_t res = ZSTD_decompress(out, raw, frame, n);
+    if (ZSTD_isError(res) || res != raw)
+    {
+        throw std::runtime_error(path + ": corrupt");
+    }
+};
+
+// The size of the entry at p.
+size_t doi_deduplicator::entry_size(const char *p, const char *end)
+{
+    record::reader r{ p, end };
+    r.skip_string();
+    r.varint();
+    r.skip_string();
+    return static_cast<size_t>(r.p - p);
+};
+
+// FNV-1a, seeded by the level, so that a part's DOIs spread over its parts
+// rather than all landing in one.
+uint32_t doi_deduplicator::sub_partition(const char *key, size_t len, 
+    unsigned level, uint32_t n)
+{
+    uint64_t h = 14695981039346656037ull ^ (uint64_t(level) * 0x9e3779b97f4a7c15ull);
+    for (size_t i = 0; i < len; ++i)
+    {
+        h ^= static_cast<unsigned char>(key[i]);
+        h *= 1099511628211ull;
+    }
+    return static_cast<uint32_t>((h ^ (h >> 32)) % n);
+};
+
+// What's deduplicated in one go: the buffers, if they've held everything,
+// else the spill files, the rest of the buffers having been spilled too, 
+// the large ones split.
+void doi_deduplicator::plan_units()
+{
+    units.clear();
+    if (!spilled)
+    {
+        for (uint32_t p = 0; p < n_partitions; ++p)
+        {
+            units.push_back(unit{ std::string(), p });
+        }
+        return;
+    }
+
+    spill();
+    for (uint32_t p = 0; p < n_partitions; ++p)
+    {
+        if (sizes[p] > 0)
+        {
+            split(spill_path(p), sizes[p], 0);
+        }
+    }
+};
+
+// Splits a spill file holding raw bytes of entries into parts fitting a
+// thread's share of memory, which become units; one fitting already
+// becomes a unit as it is. The entries are held until they take half the
+// memory, then appended to the parts' files, and the file is removed.
+void doi_deduplicator::split(const std::string &path, uint64_t raw, 
+    unsigned level)
+{
+    const uint64_t share = std::max<uint64_t>(memory_bytes / threads, 1);
+    if (raw <= share || level == max_split_level)
+    {
+        units.push_back(unit{ path, 0 });
+        return;
+    }
+
+    const uint32_t n = static_cast<uint32_t>(std::min<uint64_t>(
+        raw / share + 1, 4096));
+    std::vector<std::string>    held(n);
+    std::vector<uint64_t>       part_sizes(n, 0);
+    size_t                      held_bytes = 0;
+
+    const size_t first_part = parts.size();
+    for (uint32_t i = 0; i < n; ++i)
+    {
+        parts.push_back(path + '.' + std::to_string(i));
+    }
+    auto flush = [&]
+    {
+        for (uint32_t i = 0; i < n; ++i)
+        {
+            if (!held[i].empty())
+            {
+                append_frames(parts[first_part + i], held[i]);
+                part_sizes[i] += held[i].size();
+                held[i].clear();
+            }
+        }
+        held_bytes = 0;
+    };
+
+    std::string entries;
+    for_each_frame(path, [&](const char *frame, size_t len, size_t raw_len)
+    {
+        entries.resize(raw_len);
+        decompress(path, frame, len, &entries[0], raw_len);
+
+        record::reader r{ entries.data(), entries.data() + entries.size() };
+        while (r.p != r.end)
+        {
+            const char *start = r.p;
+            size_t      key_len;
+            const char *key = r.string_ref(key_len);
+            r.varint();
+            r.skip_string();
+
+            held[sub_partition(key, key_len, level, n)].append(start, 
+                static_cast<size_t>(r.p - start));
+            held_bytes += static_cast<size_t>(r.p - start);
+        }
+        if (held_bytes >= memory_bytes / 2)
+        {
+            flush();
+        }
+    });
+    flush();
+    std::remove(path.c_str());
+
+    for (uint32_t i = 0; i < n; ++i)
+    {
+        if (part_sizes[i] > 0)
+        {
+            // A copy: splitting it adds to parts.
+            const std::string part = parts[first_part + i];
+            split(part, part_sizes[i], level + 1);
+        }
+    }
+};
+
+// All of a unit's entries, in the order they were spilled; the buffer or
+// the file is let go.
+void doi_deduplicator::load_unit(size_t u, std::string &entries)
+{
+    entries.clear();
+
+    const unit &un = units[u];
+    if (un.path.empty())
+    {
+        entries.swap(buffers[un.partition]);
+        return;
+    }
+
+    for_each_frame(un.path, [&](const char *frame, size_t n, size_t raw)
+    {
+        size_t at = entries.size();
+        entries.resize(at + raw);
+        decompress(un.path, frame, n, &entries[at], raw);
+    });
+    std::remove(un.path.c_str());
+};
+
+void doi_deduplicator::select_unit(size_t u, survivors &out)
+{
+    struct version
+    {
+        const char  *key;
+        size_t      key_len;
+        uint64_t    seq;
+        int64_t     updated;
+        const char  *rec;
+        size_t      len;
+    };
+
+    load_unit(u, out.entries);
+    const std::string &entries = out.entries;
+
+    std::vector<version> versions;
+    record::reader r{ entries.data(), entries.data() + entries.size() };
+    while (r.p != r.end)
+    {
+        version v;
+        v.key = r.string_ref(v.key_len);
+        v.seq = r.varint();
+        v.rec = r.string_ref(v.len);
+
+        int32_t id;
+        peek_article(v.rec, v.len, id, v.updated);
+        versions.push_back(v);
+    }
+
+    // The versions of a DOI end up next to each other, in the order they
+    // came in, the sort being stable.
+    string_sort(versions.data(), versions.data() + versions.size(),
+        [](const version &v)
+        {
+            return std::pair<const char *, size_t>(v.key, v.key_len);
+        });
+
+    std::vector<version> kept;
+    for (size_t i = 0; i < versions.size(); )
+    {
+        size_t newest = i;
+        size_t j = i + 1;
+        while (j < versions.size() && versions[j].key_len == versions[i].key_len &&
+            std::memcmp(versions[j].key, versions[i].key, versions[i].key_len) == 0)
+        {
+            if (versions[j].updated > versions[newest].updated ||
+                (versions[j].updated == versions[newest].updated &&
+                 versions[j].seq > versions[newest].seq))
+            {
+                newest = j;
+            }
+            ++j;
+        }
+        kept.push_back(versions[newest]);
+        i = j;
+    }
+    std::sort(kept.begin(), kept.end(),
+        [](const version &a, const version &b) { return a.seq < b.seq; });
+
+    out.kept.reserve(kept.size());
+    for (const version &v : kept)
+    {
+        out.kept.emplace_back(v.rec, v.len);
+    }
+};
+
+// A round of `threads` units at a time: work(u, T &) runs in parallel,
+// then hand(T &) is called for each unit in order.
+template<typename T, typename Work, typename Hand>
+void doi_deduplicator::in_rounds(Work work, Hand hand)
+{
+    plan_units();
+
+    for (size_t first = 0; first < units.size(); first += threads)
+    {
+        size_t last = std::min(units.size(), first + threads);
+        std::vector<T>                  out(last - first);
+        std::vector<std::exception_ptr> errors(last - first);
+        std::vector<std::thread>        pool;
+
+        for (size_t u = first; u < last; ++u)
+        {
+            pool.emplace_back([&, u]
+            {
+                try
+                {
+                    work(u, out[u - first]);
+                }
+                catch(...)
+                {
+                    errors[u - first] = std::current_exception();
+                }
+            });
+        }
+        for (auto &t : pool)
+        {
+            t.join();
+        }
+
+        for (size_t i = 0; i < last - first; ++i)
+        {
+            if (errors[i])
+            {
+                std::rethrow_exception(errors[i]);
+            }
+        }
+        for (T &o : out)
+        {
+            hand(o);
+        }
+    }
+};
+
+template<typename F>
+doi_deduplicator::stats doi_deduplicator::finish(F on_articles)
+{
+    const journal_index journals = index_journals(dicts.journals);
+
+    in_rounds<std::vector<article>>([&](size_t u, std::vector<article> &out)
+    {
+        survivors s;
+        select_unit(u, s);
+        out.reserve(s.kept.size());
+        for (const auto &rec : s.kept)
+        {
+            out.push_back(decode_article(rec.first, rec.second, dicts.labels,
+                journals));
+        }
+    },
+    [&](std::vector<article> &articles)
+    {
+        st.unique += articles.size();
+        on_articles(articles);
+    });
+
+    return st;
+};
+
+template<typename F>
+doi_deduplicator::stats doi_deduplicator::finish_records(F on_record)
+{
+    in_rounds<survivors>([&](size_t u, survivors &out)
+    {
+        select_unit(u, out);
+    },
+    [&](survivors &s)
+    {
+        st.unique += s.kept.size();
+        for (const auto &rec : s.kept)
+        {
+            on_record(rec.first, rec.second);
+        }
+        s = survivors();
+    });
+
+    return st;
+};
+}
+#endif
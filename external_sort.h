@@ -0,0 +1,508 @@
+/*
+ * Copyright (c) 2022 - present, GitHub: @cubter
+ *
+ * See COPYING.txt in the project root for license information.
+ */
+#ifndef EXTERNAL_SORT_H
+#define EXTERNAL_SORT_H
+
+#include "article_record.h"
+#include "string_sort.h"
+
+#include <zstd/zstd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace metasci
+{
+// External merge sort of records by byte-wise ordered keys, for sorting more
+// articles than fit in memory.
+//
+// Records are buffered in memory. Once the buffer holds memory_bytes, it's
+// cut into one slice per thread, and the slices are sorted and spilled in
+// parallel, each as a run file of zstd-compressed blocks. Sorting is an
+// MSD radix sort of the keys (see string_sort.h). finish() merges the runs
+// with a loser tree, taking a single comparison per level for every record;
+// if nothing was spilled, the buffer is just sorted in memory, by all the
+// threads. Records with equal keys come out in the order they were added.
+//
+// A merge keeps a file open per run, so at most max_fan_in runs are merged
+// at once: while there are more, consecutive groups of them are merged into
+// longer runs first.
+class external_sorter
+{
+public:
+    struct stats
+    {
+        size_t records = 0;
+        size_t runs    = 0;
+    };
+
+    // Throws std::system_error if spilling fails.
+    void add(const std::string &key, const char *rec, size_t len);
+
+    // Calls on_record(const char *, size_t) for every record in the keys'
+    // order. Throws std::system_error or std::runtime_error if a run can't
+    // be read back.
+    template<typename F>
+    stats finish(F on_record);
+
+    // The spill directory is only created if need be.
+    external_sorter(const std::string &spill_dir,
+        size_t memory_bytes = size_t(1) << 30,
+        unsigned threads = std::thread::hardware_concurrency(),
+        size_t max_fan_in = 256);
+    external_sorter(const external_sorter &other) = delete;
+    // Removes the runs.
+    ~external_sorter();
+
+private:
+    // A buffered record: where the entry is in the buffer.
+    struct item
+    {
+        size_t      offset;
+        uint32_t    key_len;
+        uint32_t    rec_len;
+    };
+
+    // Reads a run back, a block at a time.
+    struct run_cursor
+    {
+        std::ifstream   in;
+        std::string     block;
+        std::string     compressed;
+        record::reader  r{ nullptr, nullptr };
+        const char      *key = nullptr;
+        size_t          key_len = 0;
+        const char      *rec = nullptr;
+        size_t          rec_len = 0;
+        bool            done = false;
+
+        // Throws std::runtime_error if the run is damaged.
+        void next();
+    };
+
+    // Writes a run, a block at a time.
+    struct run_writer
+    {
+        std::string     path;
+        std::ofstream   out;
+        std::string     block;
+        std::string     compressed;
+        std::string     header;
+
+        explicit run_writer(const std::string &path);
+        void add(const char *key, size_t key_len, const char *rec, size_t rec_len);
+        // Throws std::system_error.
+        void close();
+
+    private:
+        void flush_block();
+    };
+
+    void sort_items(item *first, item *last, unsigned n_threads) const;
+    void spill();
+    void write_run(const item *first, const item *last, const std::string &path) const;
+    // Merges the runs, calling on_entry(const run_cursor &) for every entry;
+    // equal keys go in the order of runs.
+    template<typename F>
+    void merge_runs(const std::vector<size_t> &ids, F on_entry) const;
+    std::string run_path(size_t i) const;
+
+    std::string     spill_dir;
+    size_t          memory_bytes;
+    unsigned        threads;
+    size_t          max_fan_in;
+
+    std::string         buffer;     // keys & records, back to back
+    std::vector<item>   items;
+    size_t              n_runs = 0;
+    stats               st;
+};
+
+external_sorter::external_sorter(const std::string &spill_to,
+    size_t memory, unsigned n_threads, size_t fan_in) :
+    spill_dir(spill_to),
+    memory_bytes(memory),
+    threads(n_threads == 0 ? 1 : n_threads),
+    max_fan_in(std::max<size_t>(2, fan_in))
+{};
+
+external_sorter::~external_sorter()
+{
+    if (n_runs == 0)
+    {
+        return;
+    }
+    for (size_t i = 0; i < n_runs; ++i)
+    {
+        std::remove(run_path(i).c_str());
+    }
+    ::rmdir(spill_dir.c_str());
+};
+
+std::string external_sorter::run_path(size_t i) const
+{
+    char name[32];
+    std::snprintf(name, sizeof(name), "/run-%06zu.sort", i);
+    return spill_dir + name;
+};
+
+void external_sorter::add(const std::string &key, const char *rec, size_t len)
+{
+    items.push_back(item{ buffer.size(),
+        static_cast<uint32_t>(key.size()), static_cast<uint32_t>(len) });
+    buffer += key;
+    buffer.append(rec, len);
+    ++st.records;
+
+    if (buffer.size() + items.size() * sizeof(item) >= memory_bytes)
+    {
+        spill();
+    }
+};
+
+// Items are added in order, so the stable sort keeps equal keys' order.
+void external_sorter::sort_items(item *first, item *last, unsigned n_threads) const
+{
+    const char *base = buffer.data();
+    string_sort(first, last, [base](const item &i)
+    {
+        return std::pair<const char *, size_t>(base + i.offset, i.key_len);
+    },
+    n_threads);
+};
+
+// A run: blocks of entries (key, record), each block compressed on its own
+// and preceded by its size and the size it decompresses to.
+external_sorter::run_writer::run_writer(const std::string &file) :
+    path(file),
+    out(file, std::ios::binary | std::ios::trunc)
+{};
+
+void external_sorter::run_writer::add(const char *key, size_t key_len,
+    const char *rec, size_t rec_len)
+{
+    record::put_varint(block, key_len);
+    block.append(key, key_len);
+    record::put_varint(block, rec_len);
+    block.append(rec, rec_len);
+
+    if (block.size() >= (size_t(1) << 18))
+    {
+        flush_block();
+    }
+};
+
+void external_sorter::run_writer::flush_block()
+{
+    compressed.resize(ZSTD_compressBound(block.size()));
+    size_t n = ZSTD_compress(&compressed[0], compressed.size(),
+        block.data(), block.size(), 1);
+    if (ZSTD_isError(n))
+    {
+        throw std::runtime_error(std::string("zstd: ") + ZSTD_getErrorName(n));
+    }
+    header.clear();
+    record::put_varint(header, n);
+    record::put_varint(header, block.size());
+    out.write(header.data(), static_cast<std::streamsize>(header.size()));
+    out.write(compressed.data(), static_cast<std::streamsize>(n));
+    block.clear();
+};
+
+void external_sorter::run_writer::close()
+{
+    if (!block.empty())
+    {
+        flush_block();
+    }
+    out.close();
+    if (!out)
+    {
+        throw std::system_error(EIO, std::generic_category(), path);
+    }
+};
+
+void external_sorter::write_run(const item *first, const item *last,
+    const std::string &path) const
+{
+    run_writer w(path);
+    for (const item *i = first; i != last; ++i)
+    {
+        const char *key = buffer.data() + i->offset;
+        w.add(key, i->key_len, key + i->key_len, i->rec_len);
+    }
+    w.close();
+};
+
+void external_sorter::spill()
+{
+    if (items.empty())
+    {
+        return;
+    }
+    if (n_runs == 0 && ::mkdir(spill_dir.c_str(), 0755) != 0 && errno != EEXIST)
+    {
+        throw std::system_error(errno, std::generic_category(), spill_dir);
+    }
+
+    // A slice per thread, each becoming a run; tiny slices aren't worth it.
+    size_t n_slices = std::min<size_t>(threads,
+        std::max<size_t>(1, items.size() / 4096));
+    size_t per_slice = (items.size() + n_slices - 1) / n_slices;
+
+    std::vector<std::thread>        pool;
+    std::vector<std::exception_ptr> errors(n_slices);
+    for (size_t s = 0; s < n_slices; ++s)
+    {
+        item *first = items.data() + std::min(items.size(), s * per_slice);
+        item *last  = items.data() + std::min(items.size(), (s + 1) * per_slice);
+        std::string path = run_path(n_runs + s);
+
+        pool.emplace_back([this, first, last, path, &errors, s]
+        {
+            try
+            {
+                sort_items(first, last, 1);
+                write_run(first, last, path);
+            }
+            catch(...)
+            {
+                errors[s] = std::current_exception();
+            }
+        });
+    }
+    for (auto &t : pool)
+    {
+        t.join();
+    }
+    n_runs += n_slices;
+
+    for (auto &e : errors)
+    {
+        if (e)
+        {
+            std::rethrow_exception(e);
+        }
+    }
+
+    buffer.clear();
+    items.clear();
+};
+
+void external_sorter::run_cursor::next()
+{
+    while (r.p == r.end)
+    {
+        char header[20];
+        size_t h = 0;
+
+        // Sizes' varints, a byte at a time.
+        for (int v = 0; v < 2; ++v)
+        {
+            do
+            {
+                if (h == sizeof(header))
+                {
+                    throw std::runtime_error("corrupt run");
+                }
+                if (!in.get(header[h]))
+                {
+                    if (h == 0)
+                    {
+                        done = true;
+                        return;
+                    }
+                    throw std::runtime_error("truncated run");
+                }
+            }
+            while (static_cast<unsigned char>(header[h++]) & 0x80);
+        }
+        record::reader hr{ header, header + h };
+        size_t n   = static_cast<size_t>(hr.varint());
+        size_t raw = static_cast<size_t>(hr.varint());
+
+        compressed.resize(n);
+        if (!in.read(&compressed[0], static_cast<std::streamsize>(n)))
+        {
+            throw std::runtime_error("truncated run");
+        }
+        // The frame tells its size too; a damaged header mustn't make the
+        // block any larger.
+        if (ZSTD_getFrameContentSize(compressed.data(), n) != raw)
+        {
+            throw std::runtime_error("corrupt run");
+        }
+        block.resize(raw);
+        size_t res = ZSTD_decompress(&block[0], raw, compressed.data(), n);
+        if (ZSTD_isError(res) || res != raw)
+        {
+            throw std::runtime_error("corrupt run");
+        }
+        r = record::reader{ block.data(), block.data() + block.size() };
+    }
+
+    // The lengths are checked against what's left of the block.
+    try
+    {
+        key = r.string_ref(key_len);
+        rec = r.string_ref(rec_len);
+    }
+    catch(const std::runtime_error &)
+    {
+        throw std::runtime_error("corrupt run");
+    }
+};
+
+template<typename F>
+void external_sorter::merge_runs(const std::vector<size_t> &ids, F on_entry) const
+{
+    const size_t k = ids.size();
+    std::vector<std::unique_ptr<run_cursor>> runs;
+    for (size_t i = 0; i < k; ++i)
+    {
+        const std::string path = run_path(ids[i]);
+        runs.emplace_back(new run_cursor());
+        runs[i]->in.open(path, std::ios::binary);
+        if (!runs[i]->in)
+        {
+            throw std::system_error(errno, std::generic_category(), path);
+        }
+        runs[i]->next();
+    }
+
+    // Whether run a's record goes before run b's; a finished run goes last,
+    // equal keys go in the runs' order.
+    auto less = [&](size_t a, size_t b)
+    {
+        const run_cursor &x = *runs[a];
+        const run_cursor &y = *runs[b];
+        if (x.done || y.done)
+        {
+            return !x.done && y.done ? true : (x.done == y.done && a < b);
+        }
+        int c = std::memcmp(x.key, y.key, std::min(x.key_len, y.key_len));
+        if (c != 0)
+        {
+            return c < 0;
+        }
+        return x.key_len != y.key_len ? x.key_len < y.key_len : a < b;
+    };
+
+    // Loser tree: the leaves are the runs (nodes k..2k-1), every inner node
+    // keeps the loser of the match played there, and tree[0] the winner.
+    std::vector<size_t> tree(k);
+    std::vector<size_t> winners(2 * k);
+    for (size_t i = 0; i < k; ++i)
+    {
+        winners[k + i] = i;
+    }
+    for (size_t node = k - 1; node >= 1; --node)
+    {
+        size_t a = winners[2 * node];
+        size_t b = winners[2 * node + 1];
+        bool a_wins = less(a, b);
+        winners[node] = a_wins ? a : b;
+        tree[node]    = a_wins ? b : a;
+    }
+    tree[0] = k == 1 ? 0 : winners[1];
+
+    while (!runs[tree[0]]->done)
+    {
+        size_t w = tree[0];
+        on_entry(*runs[w]);
+        runs[w]->next();
+
+        // Replays the matches on the way from the winner's leaf to the root.
+        for (size_t node = (k + w) / 2; node >= 1; node /= 2)
+        {
+            if (less(tree[node], w))
+            {
+                std::swap(tree[node], w);
+            }
+        }
+        tree[0] = w;
+    }
+};
+
+template<typename F>
+external_sorter::stats external_sorter::finish(F on_record)
+{
+    if (n_runs == 0)
+    {
+        sort_items(items.data(), items.data() + items.size(), threads);
+        for (const item &i : items)
+        {
+            on_record(static_cast<const char *>(buffer.data() + i.offset + i.key_len),
+                static_cast<size_t>(i.rec_len));
+        }
+        buffer.clear();
+        items.clear();
+        return st;
+    }
+
+    spill();
+    st.runs = n_runs;
+
+    // Merges groups of runs into longer ones until a merge can take them all;
+    // the groups are consecutive, so that equal keys keep their order.
+    std::vector<size_t> live(n_runs);
+    for (size_t i = 0; i < n_runs; ++i)
+    {
+        live[i] = i;
+    }
+    while (live.size() > max_fan_in)
+    {
+        std::vector<size_t> merged;
+        for (size_t g = 0; g < live.size(); g += max_fan_in)
+        {
+            std::vector<size_t> group(live.begin() + static_cast<std::ptrdiff_t>(g),
+                live.begin() + static_cast<std::ptrdiff_t>(
+                    std::min(live.size(), g + max_fan_in)));
+            if (group.size() == 1)
+            {
+                merged.push_back(group[0]);
+                continue;
+            }
+
+            size_t out = n_runs++;
+            run_writer w(run_path(out));
+            merge_runs(group, [&w](const run_cursor &c)
+            {
+                w.add(c.key, c.key_len, c.rec, c.rec_len);
+            });
+            w.close();
+            for (size_t i : group)
+            {
+                std::remove(run_path(i).c_str());
+            }
+            merged.push_back(out);
+        }
+        live.swap(merged);
+    }
+
+    merge_runs(live, [&on_record](const run_cursor &c)
+    {
+        on_record(c.rec, c.rec_len);
+    });
+    return st;
+};
+}
+#endif
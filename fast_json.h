@@ -0,0 +1,473 @@
+/*
+ * Copyright (c) 2022 - present, GitHub: @cubter
+ *
+ * See COPYING.txt in the project root for license information.
+ */
+#ifndef FAST_JSON_H
+#define FAST_JSON_H
+
+#include <nlohmann/json.hpp>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <initializer_list>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace metasci
+{
+// JSON DOM type for the parts of the pipeline that still need a DOM.
+//
+// nlohmann's default json stores objects in std::map: one node allocation
+// per key, and a pointer chase per comparison on lookup. Crossref's items
+// are objects with a few dozen keys each, so here they're kept in a sorted
+// vector instead (flat_map), and all the DOM's nodes come from size-class
+// pools (pool_allocator). Keys stay sorted, so objects are iterated & dumped
+// in the same order as with std::map.
+
+// Thread-local pools of fixed-size blocks, by powers of two from 16 bytes to
+// 4 KB; bigger requests go to the heap. Blocks are cut out of 64 KB chunks
+// aligned to their size, so that a block's chunk is found from its address.
+// A thread keeps at most two chunks' worth of free blocks per size; beyond
+// that, and when the thread exits, freed blocks go back to their chunks, in
+// a depot shared by the threads. Refills take a chunk's free blocks from the
+// depot before a new chunk is allocated, and a chunk whose blocks are all
+// back is given back to the system. So DOMs may be passed between threads,
+// and the blocks a thread frees for another don't pile up.
+class block_pool
+{
+public:
+    static inline void *allocate(size_t bytes);
+    static inline void  deallocate(void *p, size_t bytes);
+
+private:
+    static const size_t min_shift   = 4;
+    static const size_t n_classes   = 9;        // 16 B .. 4 KB
+    static const size_t chunk_size  = 64 * 1024;
+
+    struct free_block
+    {
+        free_block *next;
+    };
+    // At the start of every chunk, ahead of its blocks.
+    struct chunk
+    {
+        chunk       *prev;
+        chunk       *next;
+        free_block  *free;      // its blocks in the depot
+        size_t      n_free;     // none if the chunk isn't in the depot
+    };
+    // The chunks having blocks in the depot, by class.
+    struct depot
+    {
+        std::mutex  mutex;
+        chunk       *heads[n_classes] = {};
+    };
+    struct free_lists
+    {
+        free_block  *heads[n_classes]  = {};
+        size_t      counts[n_classes] = {};
+        bool        exited = false;
+    };
+    // Gives a thread's free blocks back to the depot as the thread exits.
+    struct flusher
+    {
+        free_lists *lists;
+        inline ~flusher();
+    };
+
+    static inline size_t  size_class(size_t bytes);
+    static inline size_t  blocks_per_chunk(size_t cls);
+    static inline void    refill(free_lists &lists, size_t cls);
+    // Returns the blocks of the list, which are of class cls, to the depot.
+    static inline void    give_back(free_block *list, size_t cls);
+    static chunk         *chunk_of(void *p)
+    {
+        return reinterpret_cast<chunk *>(
+            reinterpret_cast<uintptr_t>(p) & ~uintptr_t(chunk_size - 1));
+    }
+    static size_t         first_block(size_t cls)
+    {
+        size_t block_size = size_t(1) << (cls + min_shift);
+        return (sizeof(chunk) + block_size - 1) & ~(block_size - 1);
+    }
+    static depot         &shared()
+    {
+        // Never destroyed, as threads may exit after the static objects are.
+        static depot *d = new depot();
+        return *d;
+    }
+    static free_lists    &local()
+    {
+        // The lists are trivially destructible, so they stay usable once
+        // the flusher has run.
+        static thread_local free_lists  lists;
+        static thread_local flusher     f{ &lists };
+        return *f.lists;
+    }
+};
+
+inline size_t block_pool::size_class(size_t bytes)
+{
+    size_t cls = 0;
+    while ((size_t(1) << (cls + min_shift)) < bytes)
+    {
+        ++cls;
+    }
+    return cls;
+};
+
+inline size_t block_pool::blocks_per_chunk(size_t cls)
+{
+    return (chunk_size - first_block(cls)) >> (cls + min_shift);
+};
+
+inline void block_pool::refill(free_lists &lists, size_t cls)
+{
+    depot &d = shared();
+    {
+        std::lock_guard<std::mutex> lock(d.mutex);
+        chunk *c = d.heads[cls];
+        if (c != nullptr)
+        {
+            d.heads[cls] = c->next;
+            if (c->next != nullptr)
+            {
+                c->next->prev = nullptr;
+            }
+            lists.heads[cls]  = c->free;
+            lists.counts[cls] = c->n_free;
+            c->free   = nullptr;
+            c->n_free = 0;
+            return;
+        }
+    }
+
+    void *mem = nullptr;
+    if (::posix_memalign(&mem, chunk_size, chunk_size) != 0)
+    {
+        throw std::bad_alloc();
+    }
+    char *c = static_cast<char *>(mem);
+    new (c) chunk{ nullptr, nullptr, nullptr, 0 };
+
+    size_t block_size = size_t(1) << (cls + min_shift);
+    for (size_t off = first_block(cls); off + block_size <= chunk_size; off += block_size)
+    {
+        free_block *b = reinterpret_cast<free_block *>(c + off);
+        b->next = lists.heads[cls];
+        lists.heads[cls] = b;
+    }
+    lists.counts[cls] = blocks_per_chunk(cls);
+};
+
+inline void block_pool::give_back(free_block *list, size_t cls)
+{
+    depot &d = shared();
+    std::lock_guard<std::mutex> lock(d.mutex);
+    while (list != nullptr)
+    {
+        free_block *b = list;
+        list = b->next;
+
+        chunk *c = chunk_of(b);
+        b->next = c->free;
+        c->free = b;
+        if (c->n_free++ == 0)
+        {
+            c->prev = nullptr;
+            c->next = d.heads[cls];
+            if (c->next != nullptr)
+            {
+                c->next->prev = c;
+            }
+            d.heads[cls] = c;
+        }
+        if (c->n_free == blocks_per_chunk(cls))
+        {
+            (c->prev != nullptr ? c->prev->next : d.heads[cls]) = c->next;
+            if (c->next != nullptr)
+            {
+                c->next->prev = c->prev;
+            }
+            std::free(c);
+        }
+    }
+};
+
+inline block_pool::flusher::~flusher()
+{
+    for (size_t cls = 0; cls < n_classes; ++cls)
+    {
+        give_back(lists->heads[cls], cls);
+        lists->heads[cls]  = nullptr;
+        lists->counts[cls] = 0;
+    }
+    lists->exited = true;
+};
+
+inline void *block_pool::allocate(size_t bytes)
+{
+    size_t cls = size_class(bytes);
+    if (cls >= n_classes)
+    {
+        return ::operator new(bytes);
+    }
+
+    free_lists &lists = local();
+    if (lists.heads[cls] == nullptr)
+    {
+        refill(lists, cls);
+    }
+
+    free_block *b = lists.heads[cls];
+    lists.heads[cls] = b->next;
+    --lists.counts[cls];
+
+    return b;
+};
+
+inline void block_pool::deallocate(void *p, size_t bytes)
+{
+    size_t cls = size_class(bytes);
+    if (cls >= n_classes)
+    {
+        ::operator delete(p);
+        return;
+    }
+
+    free_lists &lists = local();
+    free_block *b = static_cast<free_block *>(p);
+    if (lists.exited)
+    {
+        b->next = nullptr;
+        give_back(b, cls);
+        return;
+    }
+    b->next = lists.heads[cls];
+    lists.heads[cls] = b;
+
+    // Keeps a chunk's worth, and gives the rest back.
+    size_t keep = blocks_per_chunk(cls);
+    if (++lists.counts[cls] > 2 * keep)
+    {
+        free_block *last = lists.heads[cls];
+        for (size_t i = 1; i < keep; ++i)
+        {
+            last = last->next;
+        }
+        give_back(last->next, cls);
+        last->next = nullptr;
+        lists.counts[cls] = keep;
+    }
+};
+
+// Stateless STL allocator on top of block_pool.
+template<typename T>
+class pool_allocator
+{
+public:
+    using value_type = T;
+
+    template<typename U>
+    struct rebind { using other = pool_allocator<U>; };
+
+    T *allocate(size_t n)
+    {
+        return static_cast<T *>(block_pool::allocate(n * sizeof(T)));
+    }
+    void deallocate(T *p, size_t n)
+    {
+        block_pool::deallocate(p, n * sizeof(T));
+    }
+
+    pool_allocator() {};
+    template<typename U>
+    pool_allocator(const pool_allocator<U> &) {}
+};
+
+template<typename T, typename U>
+bool operator==(const pool_allocator<T> &, const pool_allocator<U> &) { return true; }
+template<typename T, typename U>
+bool operator!=(const pool_allocator<T> &, const pool_allocator<U> &) { return false; }
+
+// Map kept as a vector sorted by key. Has just enough of std::map's interface
+// for nlohmann::basic_json. Unlike std::map, insertions & erasures invalidate
+// iterators, which basic_json takes into account (it treats containers having
+// `capacity` like its own vector-based ordered_map).
+template<class Key, class T, class Compare = std::less<Key>,
+    class Allocator = std::allocator<std::pair<const Key, T>>>
+class flat_map
+{
+public:
+    using key_type          = Key;
+    using mapped_type       = T;
+    using value_type        = std::pair<Key, T>;
+    using key_compare       = Compare;
+    using allocator_type    = typename std::allocator_traits<Allocator>::
+        template rebind_alloc<value_type>;
+private:
+    using container         = std::vector<value_type, allocator_type>;
+public:
+    using size_type         = typename container::size_type;
+    using difference_type   = typename container::difference_type;
+    using reference         = value_type &;
+    using const_reference   = const value_type &;
+    using iterator          = typename container::iterator;
+    using const_iterator    = typename container::const_iterator;
+
+    iterator        begin()         { return data.begin(); }
+    iterator        end()           { return data.end(); }
+    const_iterator  begin() const   { return data.begin(); }
+    const_iterator  end() const     { return data.end(); }
+    const_iterator  cbegin() const  { return data.cbegin(); }
+    const_iterator  cend() const    { return data.cend(); }
+
+    bool      empty() const     { return data.empty(); }
+    size_type size() const      { return data.size(); }
+    size_type max_size() const  { return data.max_size(); }
+    size_type capacity() const  { return data.capacity(); }
+    void      clear()           { data.clear(); }
+    void      reserve(size_type n) { data.reserve(n); }
+
+    iterator find(const Key &key)
+    {
+        auto it = lower_bound(key);
+        return (it != data.end() && !comp(key, it->first)) ? it : data.end();
+    }
+    const_iterator find(const Key &key) const
+    {
+        auto it = lower_bound(key);
+        return (it != data.end() && !comp(key, it->first)) ? it : data.end();
+    }
+    size_type count(const Key &key) const { return find(key) != end() ? 1 : 0; }
+
+    T &at(const Key &key)
+    {
+        auto it = find(key);
+        if (it == data.end())
+        {
+            throw std::out_of_range("key not found");
+        }
+        return it->second;
+    }
+    const T &at(const Key &key) const
+    {
+        auto it = find(key);
+        if (it == data.end())
+        {
+            throw std::out_of_range("key not found");
+        }
+        return it->second;
+    }
+    T &operator[](const Key &key)
+    {
+        return emplace(key, T{}).first->second;
+    }
+
+    template<typename K, typename... Args>
+    std::pair<iterator, bool> emplace(K &&key, Args &&...args)
+    {
+        // Objects are mostly parsed with their keys in the same order, so
+        // appending is tried first.
+        if (data.empty() || comp(data.back().first, key))
+        {
+            data.emplace_back(std::piecewise_construct,
+                std::forward_as_tuple(std::forward<K>(key)),
+                std::forward_as_tuple(std::forward<Args>(args)...));
+            return { data.end() - 1, true };
+        }
+
+        auto it = lower_bound(key);
+        if (!comp(key, it->first))
+        {
+            return { it, false };
+        }
+        it = data.emplace(it, std::piecewise_construct,
+            std::forward_as_tuple(std::forward<K>(key)),
+            std::forward_as_tuple(std::forward<Args>(args)...));
+        return { it, true };
+    }
+    std::pair<iterator, bool> insert(const value_type &value)
+    {
+        return emplace(value.first, value.second);
+    }
+    template<typename InputIt>
+    void insert(InputIt first, InputIt last)
+    {
+        for (; first != last; ++first)
+        {
+            emplace(first->first, first->second);
+        }
+    }
+
+    iterator erase(const_iterator pos) { return data.erase(pos); }
+    iterator erase(iterator pos)       { return data.erase(pos); }
+    iterator erase(const_iterator first, const_iterator last)
+    {
+        return data.erase(first, last);
+    }
+    size_type erase(const Key &key)
+    {
+        auto it = find(key);
+        if (it == data.end())
+        {
+            return 0;
+        }
+        data.erase(it);
+        return 1;
+    }
+
+    flat_map() {};
+    explicit flat_map(const Allocator &alloc) : data(allocator_type(alloc)) {};
+    template<typename InputIt>
+    flat_map(InputIt first, InputIt last, const Allocator &alloc = Allocator()) :
+        data(allocator_type(alloc))
+    {
+        insert(first, last);
+    }
+    flat_map(std::initializer_list<value_type> init,
+        const Allocator &alloc = Allocator()) :
+        data(allocator_type(alloc))
+    {
+        insert(init.begin(), init.end());
+    };
+    flat_map(const flat_map &other)     = default;
+    flat_map(flat_map &&other)          = default;
+    flat_map &operator=(const flat_map &other) = default;
+    flat_map &operator=(flat_map &&other)      = default;
+
+    // basic_json compares objects with these; lacking them, it would convert
+    // the maps to basic_json and call itself.
+    friend bool operator==(const flat_map &a, const flat_map &b) { return a.data == b.data; }
+    friend bool operator!=(const flat_map &a, const flat_map &b) { return a.data != b.data; }
+    friend bool operator<(const flat_map &a, const flat_map &b)  { return a.data < b.data; }
+
+private:
+    iterator lower_bound(const Key &key)
+    {
+        return std::lower_bound(data.begin(), data.end(), key,
+            [this](const value_type &v, const Key &k) { return comp(v.first, k); });
+    }
+    const_iterator lower_bound(const Key &key) const
+    {
+        return std::lower_bound(data.begin(), data.end(), key,
+            [this](const value_type &v, const Key &k) { return comp(v.first, k); });
+    }
+
+    container   data;
+    Compare     comp;
+};
+
+using fast_json = nlohmann::basic_json<flat_map, std::vector, std::string, bool,
+    std::int64_t, std::uint64_t, double, pool_allocator>;
+}
+#endif
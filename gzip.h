@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) 2022 - present, GitHub: @cubter
+ *
+ * See COPYING.txt in the project root for license information.
+ */
+#ifndef GZIP_H
+#define GZIP_H
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <string>
+
+namespace metasci
+{
+// Crossref's dump comes as gzip'ed shards. They're recognised by the magic
+// bytes rather than by the extension.
+inline bool is_gzip(const char *data, size_t len)
+{
+    return len >= 2 && static_cast<unsigned char>(data[0]) == 0x1f &&
+        static_cast<unsigned char>(data[1]) == 0x8b;
+}
+
+// Decompresses a whole gzip file (one or more concatenated members) into
+// out. Returns false if the data is corrupt or truncated.
+inline bool gunzip(const char *data, size_t len, std::string &out)
+{
+    z_stream zs{};
+    if (inflateInit2(&zs, 15 + 16) != Z_OK)
+    {
+        return false;
+    }
+
+    // JSON usually shrinks 5-10 times.
+    out.clear();
+    out.resize(std::max<size_t>(len * 4, 1 << 16));
+
+    size_t in_done  = 0;
+    size_t out_done = 0;
+    int    ret      = Z_OK;
+
+    while (true)
+    {
+        if (out_done == out.size())
+        {
+            out.resize(out.size() * 2);
+        }
+
+        // zlib's counters are 32-bit.
+        uInt in_chunk  = static_cast<uInt>(std::min<size_t>(len - in_done, 1u << 30));
+        uInt out_chunk = static_cast<uInt>(std::min<size_t>(out.size() - out_done, 1u << 30));
+
+        zs.next_in   = reinterpret_cast<Bytef *>(const_cast<char *>(data + in_done));
+        zs.avail_in  = in_chunk;
+        zs.next_out  = reinterpret_cast<Bytef *>(&out[out_done]);
+        zs.avail_out = out_chunk;
+
+        ret = inflate(&zs, Z_NO_FLUSH);
+
+        in_done  += in_chunk - zs.avail_in;
+        out_done += out_chunk - zs.avail_out;
+
+        if (ret == Z_STREAM_END)
+        {
+            // Another member may follow.
+            if (in_done == len)
+            {
+                break;
+            }
+            inflateReset(&zs);
+        }
+        else if (ret == Z_BUF_ERROR && zs.avail_out > 0)
+        {
+            // Out of input in the middle of a member.
+            break;
+        }
+        else if (ret != Z_OK && ret != Z_BUF_ERROR)
+        {
+            break;
+        }
+    }
+
+    inflateEnd(&zs);
+    out.resize(out_done);
+
+    return ret == Z_STREAM_END;
+}
+}
+#endif
@@ -0,0 +1,599 @@
+/*
+ * Copyright (c) 2022 - present, GitHub: @cubter
+ *
+ * See COPYING.txt in the project root for license information.
+ */
+#ifndef GZIP_INDEX_H
+#define GZIP_INDEX_H
+
+#include "checkpoint.h"
+#include "item_reader.h"
+#include "seekable_zstd.h"
+
+#include <nlohmann/json.hpp>
+#include <zlib.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace metasci
+{
+// Random access into a gzip'ed shard, through an index kept beside it
+// (shard.json.gz.idx), so that a handful of items can be re-extracted
+// without decompressing the whole shard.
+//
+// Deflate can't be entered at an arbitrary point, but it can at a block's
+// boundary, given the bit offset there and the 32 KB of output preceding it,
+// which back-references may reach (the window). While the index is built,
+// the shard is decompressed once, and such checkpoints are taken every span
+// bytes of output (after zlib's examples/zran.c); the windows are kept
+// compressed. The items are found in the output, and every item's DOI
+// (lowercased, hashed) is recorded with the item's offset & length there.
+//
+// Extracting an item then decompresses from the checkpoint preceding it, a
+// span at most. The index records the shard's size & mtime, and isn't used
+// once the shard's changed.
+//
+// Seekable shards (see seekable_zstd.h) are indexed alike, their frames
+// standing for the checkpoints: an item is extracted from its frame alone.
+class gzip_index
+{
+public:
+    struct options
+    {
+        size_t  span = size_t(1) << 20;
+    };
+
+    // Where an item lies in the decompressed shard.
+    struct location
+    {
+        uint64_t offset;
+        uint32_t length;
+    };
+
+    // Builds the index of a gzip'ed or seekable shard lying in memory. Throws
+    // std::runtime_error if the shard is corrupt, or isn't Crossref's JSON.
+    static gzip_index build(const char *data, size_t len, const file_stamp &stamp,
+        const options &opts);
+
+    // Writes the index aside, then renames it to path. Throws
+    // std::system_error.
+    void save(const std::string &path) const;
+    // Returns false if there's no index at path, or it's damaged, or it's
+    // been built for another version of the shard.
+    static bool load(const std::string &path, const file_stamp &stamp,
+        gzip_index &out);
+
+    // The items whose DOI may be doi; a hash collision is possible, so
+    // the items are to be checked.
+    std::vector<location> find(const std::string &doi) const;
+
+    // Decompresses an item from the shard open as fd. Returns false if the
+    // shard can't be read, or is corrupt.
+    bool extract(int fd, const location &at, std::string &out) const;
+
+    size_t items() const { return entries.size(); }
+
+    static std::string path_of(const std::string &shard) { return shard + ".idx"; }
+    static bool is_index(const std::string &path)
+    {
+        return path.size() > 4 && path.compare(path.size() - 4, 4, ".idx") == 0;
+    }
+
+    // The DOI of an item, unescaped. Returns false if it has none.
+    static bool item_doi(const item_view &item, std::string &doi);
+    // FNV-1a of the lowercased DOI: DOIs are case-insensitive.
+    static uint64_t doi_hash(const std::string &doi);
+
+private:
+    static const size_t window_size = 32768;
+
+    void inflate_all(const char *data, size_t len, const options &opts,
+        std::string &out);
+
+    struct checkpoint
+    {
+        uint64_t    out;        // offset in the decompressed shard
+        uint64_t    in;         // offset of the next byte in the shard
+        uint8_t     bits;       // bits of the byte before in, yet unused
+        std::string window;     // compressed; none at the shard's start
+    };
+
+    struct entry
+    {
+        uint64_t    hash;
+        uint64_t    offset;
+        uint32_t    length;
+    };
+
+    file_stamp              stamp;
+    bool                    seekable = false;
+    // A seekable shard's have no windows, and the last one is its end.
+    std::vector<checkpoint> checkpoints;
+    std::vector<entry>      entries;        // by hash
+};
+
+inline uint64_t gzip_index::doi_hash(const std::string &doi)
+{
+    uint64_t h = 14695981039346656037ull;
+    for (char c : doi)
+    {
+        h ^= static_cast<unsigned char>(std::tolower(static_cast<unsigned char>(c)));
+        h *= 1099511628211ull;
+    }
+    return h;
+};
+
+inline bool gzip_index::item_doi(const item_view &item, std::string &doi)
+{
+    for (const field_span &f : item.fields)
+    {
+        if (!f.key_is("DOI") || f.value_len < 2 || f.value[0] != '"')
+        {
+            continue;
+        }
+        if (std::memchr(f.value, '\\', f.value_len) == nullptr)
+        {
+            doi.assign(f.value + 1, f.value_len - 2);
+            return true;
+        }
+        try
+        {
+            doi = nlohmann::json::parse(f.value, f.value + f.value_len).get<std::string>();
+            return true;
+        }
+        catch(const std::exception &)
+        {
+            return false;
+        }
+    }
+    return false;
+};
+
+gzip_index gzip_index::build(const char *data, size_t len, const file_stamp &stamp,
+    const options &opts)
+{
+    gzip_index index;
+    index.stamp = stamp;
+
+    std::string out;
+    std::vector<zstd_frame> frames;
+    if (read_seek_table(data, len, frames))
+    {
+        index.seekable = true;
+        out.resize(frames.empty() ? 0 : static_cast<size_t>(
+            frames.back().d_offset + frames.back().d_size));
+        for (const zstd_frame &f : frames)
+        {
+            if (!unzstd_frame(data + f.c_offset, f, &out[0] + f.d_offset))
+            {
+                throw std::runtime_error("corrupt zstd frame");
+            }
+            index.checkpoints.push_back(checkpoint{ f.d_offset, f.c_offset, 0,
+                std::string() });
+        }
+        index.checkpoints.push_back(checkpoint{ out.size(),
+            frames.empty() ? 0 : frames.back().c_offset + frames.back().c_size, 0,
+            std::string() });
+    }
+    else
+    {
+        index.inflate_all(data, len, opts, out);
+    }
+
+    item_reader reader(index.seekable ? item_reader::bare : item_reader::envelope);
+    std::string doi;
+    bool ok = reader.read(out.data(), out.size(), [&](const item_view &item)
+    {
+        if (item_doi(item, doi))
+        {
+            index.entries.push_back(entry{ doi_hash(doi),
+                static_cast<uint64_t>(item.begin - out.data()),
+                static_cast<uint32_t>(item.size) });
+        }
+    });
+    if (!ok)
+    {
+        throw std::runtime_error("malformed JSON or \"items\" missing");
+    }
+
+    std::sort(index.entries.begin(), index.entries.end(),
+        [](const entry &a, const entry &b)
+        {
+            return a.hash < b.hash || (a.hash == b.hash && a.offset < b.offset);
+        });
+    return index;
+};
+
+// Decompresses a gzip'ed shard into out, taking the checkpoints on the way.
+void gzip_index::inflate_all(const char *data, size_t len, const options &opts,
+    std::string &out)
+{
+    checkpoints.push_back(checkpoint{ 0, 0, 0, std::string() });
+
+    z_stream zs{};
+    if (inflateInit2(&zs, 15 + 16) != Z_OK)
+    {
+        throw std::runtime_error("zlib: out of memory");
+    }
+
+    out.assign(std::max<size_t>(len * 4, 1 << 16), '\0');
+    size_t in_done  = 0;
+    size_t out_done = 0;
+    int    ret      = Z_OK;
+
+    while (true)
+    {
+        if (out_done == out.size())
+        {
+            out.resize(out.size() * 2);
+        }
+        uInt in_chunk  = static_cast<uInt>(std::min<size_t>(len - in_done, 1u << 30));
+        uInt out_chunk = static_cast<uInt>(std::min<size_t>(out.size() - out_done, 1u << 30));
+
+        zs.next_in   = reinterpret_cast<Bytef *>(const_cast<char *>(data + in_done));
+        zs.avail_in  = in_chunk;
+        zs.next_out  = reinterpret_cast<Bytef *>(&out[out_done]);
+        zs.avail_out = out_chunk;
+
+        // Z_BLOCK stops at every deflate block's end.
+        ret = inflate(&zs, Z_BLOCK);
+
+        in_done  += in_chunk - zs.avail_in;
+        out_done += out_chunk - zs.avail_out;
+
+        if (ret == Z_STREAM_END)
+        {
+            // Another member may follow.
+            if (in_done == len)
+            {
+                break;
+            }
+            inflateReset(&zs);
+            continue;
+        }
+        if (ret == Z_BUF_ERROR && zs.avail_out > 0)
+        {
+            break;
+        }
+        if (ret != Z_OK && ret != Z_BUF_ERROR)
+        {
+            break;
+        }
+
+        // At a block's end, and not the member's last block.
+        if ((zs.data_type & 128) != 0 && (zs.data_type & 64) == 0 &&
+            out_done - checkpoints.back().out >= opts.span)
+        {
+            size_t w = out_done < window_size ? out_done : window_size;
+            uLongf packed_len = compressBound(static_cast<uLong>(w));
+            std::string packed(packed_len, '\0');
+            compress2(reinterpret_cast<Bytef *>(&packed[0]), &packed_len,
+                reinterpret_cast<const Bytef *>(out.data() + out_done - w),
+                static_cast<uLong>(w), Z_BEST_SPEED);
+            packed.resize(packed_len);
+
+            checkpoints.push_back(checkpoint{ out_done, in_done,
+                static_cast<uint8_t>(zs.data_type & 7), std::move(packed) });
+        }
+    }
+    inflateEnd(&zs);
+
+    if (ret != Z_STREAM_END)
+    {
+        throw std::runtime_error("corrupt gzip file");
+    }
+    out.resize(out_done);
+};
+
+inline std::vector<gzip_index::location> gzip_index::find(const std::string &doi) const
+{
+    const uint64_t h = doi_hash(doi);
+    auto it = std::lower_bound(entries.begin(), entries.end(), h,
+        [](const entry &e, uint64_t v) { return e.hash < v; });
+
+    std::vector<location> found;
+    for (; it != entries.end() && it->hash == h; ++it)
+    {
+        found.push_back(location{ it->offset, it->length });
+    }
+    return found;
+};
+
+bool gzip_index::extract(int fd, const location &at, std::string &out) const
+{
+    // The last checkpoint before the item.
+    auto cp = std::upper_bound(checkpoints.begin(), checkpoints.end(), at.offset,
+        [](uint64_t v, const checkpoint &c) { return v < c.out; });
+    if (cp == checkpoints.begin() || (seekable && cp == checkpoints.end()))
+    {
+        return false;
+    }
+    --cp;
+
+    if (seekable)
+    {
+        // The frame's end is the next checkpoint.
+        const auto next = cp + 1;
+        const zstd_frame f{ cp->in, cp->out,
+            static_cast<uint32_t>(next->in - cp->in),
+            static_cast<uint32_t>(next->out - cp->out) };
+        if (at.offset + at.length > next->out)
+        {
+            return false;
+        }
+        std::string frame(f.c_size, '\0');
+        std::string lines(f.d_size, '\0');
+        size_t done = 0;
+        while (done < frame.size())
+        {
+            ssize_t n = ::pread(fd, &frame[done], frame.size() - done,
+                static_cast<off_t>(f.c_offset + done));
+            if (n <= 0)
+            {
+                return false;
+            }
+            done += static_cast<size_t>(n);
+        }
+        if (!unzstd_frame(frame.data(), f, &lines[0]))
+        {
+            return false;
+        }
+        out.assign(lines, static_cast<size_t>(at.offset - cp->out), at.length);
+        return true;
+    }
+
+    z_stream zs{};
+    const bool from_start = cp->window.empty();
+    if (inflateInit2(&zs, from_start ? 15 + 16 : -15) != Z_OK)
+    {
+        return false;
+    }
+
+    uint64_t in_pos = cp->in;
+    int ret = Z_OK;
+    if (!from_start)
+    {
+        std::string window(window_size, '\0');
+        uLongf window_len = window_size;
+        unsigned char prev;
+        if (uncompress(reinterpret_cast<Bytef *>(&window[0]), &window_len,
+                reinterpret_cast<const Bytef *>(cp->window.data()),
+                static_cast<uLong>(cp->window.size())) != Z_OK ||
+            (cp->bits != 0 && ::pread(fd, &prev, 1,
+                static_cast<off_t>(in_pos - 1)) != 1))
+        {
+            inflateEnd(&zs);
+            return false;
+        }
+        if (cp->bits != 0)
+        {
+            inflatePrime(&zs, cp->bits, prev >> (8 - cp->bits));
+        }
+        inflateSetDictionary(&zs, reinterpret_cast<const Bytef *>(window.data()),
+            static_cast<uInt>(window_len));
+    }
+
+    // Decompresses into a scratch buffer up to the item, then into out.
+    uint64_t    out_pos = cp->out;
+    size_t      skip_trailer = 0;
+    char        in_buf[1 << 16];
+    char        scratch[1 << 16];
+    size_t      in_avail = 0;
+    const char *in_next  = in_buf;
+
+    out.clear();
+    out.reserve(at.length);
+
+    while (out.size() < at.length)
+    {
+        if (in_avail == 0)
+        {
+            ssize_t n = ::pread(fd, in_buf, sizeof(in_buf), static_cast<off_t>(in_pos));
+            if (n <= 0)
+            {
+                break;
+            }
+            in_pos  += static_cast<uint64_t>(n);
+            in_avail = static_cast<size_t>(n);
+            in_next  = in_buf;
+        }
+        if (skip_trailer > 0)
+        {
+            size_t n = std::min(skip_trailer, in_avail);
+            skip_trailer -= n;
+            in_avail     -= n;
+            in_next      += n;
+            continue;
+        }
+
+        const uint64_t to_item = at.offset > out_pos ? at.offset - out_pos : 0;
+        char *dst = to_item > 0 ? scratch : nullptr;
+        size_t room = to_item > 0 ? std::min<uint64_t>(to_item, sizeof(scratch)) :
+            at.length - out.size();
+        const size_t had = out.size();
+        if (dst == nullptr)
+        {
+            out.resize(had + room);
+            dst = &out[had];
+        }
+
+        zs.next_in   = reinterpret_cast<Bytef *>(const_cast<char *>(in_next));
+        zs.avail_in  = static_cast<uInt>(in_avail);
+        zs.next_out  = reinterpret_cast<Bytef *>(dst);
+        zs.avail_out = static_cast<uInt>(room);
+
+        ret = inflate(&zs, Z_NO_FLUSH);
+
+        const size_t produced = room - zs.avail_out;
+        in_next  = reinterpret_cast<const char *>(zs.next_in);
+        in_avail = zs.avail_in;
+        out_pos += produced;
+        if (to_item == 0)
+        {
+            out.resize(had + produced);
+        }
+
+        if (ret == Z_STREAM_END)
+        {
+            // The next member, if any: a raw stream leaves the member's
+            // trailer to skip, a gzip one has read it.
+            if (!from_start)
+            {
+                skip_trailer = 8;
+            }
+            inflateReset2(&zs, 15 + 16);
+            continue;
+        }
+        if (ret != Z_OK && ret != Z_BUF_ERROR)
+        {
+            break;
+        }
+    }
+    inflateEnd(&zs);
+
+    return out.size() == at.length;
+};
+
+// The index file: a magic, the shard's stamp, whether it's seekable, the
+// checkpoints, then the entries, all in the host's byte order.
+void gzip_index::save(const std::string &path) const
+{
+    std::string buf = "MSGZIDX2";
+    auto put = [&buf](const void *p, size_t n)
+    {
+        buf.append(static_cast<const char *>(p), n);
+    };
+
+    put(&stamp.size, 8);
+    put(&stamp.mtime_ns, 8);
+    buf += static_cast<char>(seekable);
+    uint64_t n = checkpoints.size();
+    put(&n, 8);
+    for (const checkpoint &c : checkpoints)
+    {
+        uint32_t w = static_cast<uint32_t>(c.window.size());
+        put(&c.out, 8);
+        put(&c.in, 8);
+        put(&c.bits, 1);
+        put(&w, 4);
+        put(c.window.data(), w);
+    }
+    n = entries.size();
+    put(&n, 8);
+    for (const entry &e : entries)
+    {
+        put(&e.hash, 8);
+        put(&e.offset, 8);
+        put(&e.length, 4);
+    }
+
+    const std::string tmp = path + ".tmp";
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        throw std::system_error(errno, std::generic_category(), tmp);
+    }
+    size_t done = 0;
+    while (done < buf.size())
+    {
+        ssize_t w = ::write(fd, buf.data() + done, buf.size() - done);
+        if (w < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (w < 0)
+        {
+            int err = errno;
+            ::close(fd);
+            std::remove(tmp.c_str());
+            throw std::system_error(err, std::generic_category(), tmp);
+        }
+        done += static_cast<size_t>(w);
+    }
+    ::close(fd);
+    if (std::rename(tmp.c_str(), path.c_str()) != 0)
+    {
+        int err = errno;
+        std::remove(tmp.c_str());
+        throw std::system_error(err, std::generic_category(), path);
+    }
+};
+
+bool gzip_index::load(const std::string &path, const file_stamp &stamp,
+    gzip_index &out)
+{
+    std::ifstream in(path, std::ios::binary);
+    std::ostringstream contents;
+    contents << in.rdbuf();
+    std::string buf = contents.str();
+
+    size_t at = 0;
+    auto get = [&](void *p, size_t n)
+    {
+        if (buf.size() - at < n)
+        {
+            return false;
+        }
+        std::memcpy(p, buf.data() + at, n);
+        at += n;
+        return true;
+    };
+
+    gzip_index index;
+    uint64_t n;
+    uint8_t seekable;
+    if (buf.compare(0, 8, "MSGZIDX2") != 0)
+    {
+        return false;
+    }
+    at = 8;
+    if (!get(&index.stamp.size, 8) || !get(&index.stamp.mtime_ns, 8) ||
+        !(index.stamp == stamp) || !get(&seekable, 1) || !get(&n, 8))
+    {
+        return false;
+    }
+    index.seekable = seekable != 0;
+    for (; n > 0; --n)
+    {
+        checkpoint c;
+        uint32_t w;
+        if (!get(&c.out, 8) || !get(&c.in, 8) || !get(&c.bits, 1) || !get(&w, 4) ||
+            buf.size() - at < w)
+        {
+            return false;
+        }
+        c.window.assign(buf, at, w);
+        at += w;
+        index.checkpoints.push_back(std::move(c));
+    }
+    if (!get(&n, 8) || (buf.size() - at) / 20 != n || index.checkpoints.empty())
+    {
+        return false;
+    }
+    index.entries.resize(static_cast<size_t>(n));
+    for (entry &e : index.entries)
+    {
+        get(&e.hash, 8);
+        get(&e.offset, 8);
+        get(&e.length, 4);
+    }
+
+    out = std::move(index);
+    return true;
+};
+}
+#endif
@@ -0,0 +1,244 @@
+/*
+ * Copyright (c) 2022 - present, GitHub: @cubter
+ *
+ * See COPYING.txt in the project root for license information.
+ */
+#ifndef HARVEST_PLANNER_H
+#define HARVEST_PLANNER_H
+
+#include "async_api_connector.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace metasci
+{
+// A query's share of the harvest: the works indexed in [from, until].
+struct harvest_partition
+{
+    std::string query;
+    std::string from;
+    std::string until;
+    size_t      works = 0;
+};
+
+// Plans a harvest of many cursors instead of one. A cursor's pages can only
+// be fetched one after another, however many connections there are, so the
+// requested period is cut into date ranges (from-index-date &
+// until-index-date filters), each walked by a cursor of its own.
+//
+// The ranges are sized by the works in them: the whole period is counted
+// first (rows=0 queries, which cost a request each), and every range
+// holding more than target_works is cut into as many equal ranges as it
+// needs, max_split at most, which are counted in turn, all at once. A day
+// is never cut: it's the filters' resolution. Empty ranges are dropped.
+class harvest_planner
+{
+public:
+    struct options
+    {
+        size_t      target_works = 100000;
+        unsigned    max_split    = 16;
+    };
+
+    // The partitions of query over [from, until], dates being YYYY-MM-DD,
+    // in the dates' order. Throws std::invalid_argument if a date is bad,
+    // std::runtime_error if counting fails.
+    std::vector<harvest_partition> plan(const std::string &query,
+        const std::string &from, const std::string &until);
+
+    // The query, with the works restricted to those indexed in [from, until].
+    static std::string with_index_dates(const std::string &query,
+        const std::string &from, const std::string &until);
+
+    // Days since 1970-01-01, and back.
+    static bool parse_date(const std::string &s, int64_t &day);
+    static std::string format_date(int64_t day);
+    static std::string today();
+
+    // Counting goes with the same limits as the harvest itself.
+    harvest_planner(const async_api_connector::options &api_opts,
+        const options &o);
+    explicit harvest_planner(const async_api_connector::options &api_opts) :
+        harvest_planner(api_opts, options()) {};
+
+private:
+    static async_api_connector::options counting(async_api_connector::options o);
+
+    options             opts;
+    async_api_connector counter;
+};
+
+inline async_api_connector::options harvest_planner::counting(
+    async_api_connector::options o)
+{
+    o.rows        = 0;
+    o.paging      = false;
+    o.max_queries = 0;
+    return o;
+};
+
+harvest_planner::harvest_planner(const async_api_connector::options &api_opts,
+    const options &o) :
+    opts(o),
+    counter(counting(api_opts))
+{
+    opts.target_works = std::max<size_t>(1, o.target_works);
+    opts.max_split    = std::max(2u, o.max_split);
+};
+
+// The civil calendar's conversions, after H. Hinnant's days_from_civil.
+inline bool harvest_planner::parse_date(const std::string &s, int64_t &day)
+{
+    int y, m, d;
+    char tail;
+    if (std::sscanf(s.c_str(), "%4d-%2d-%2d%c", &y, &m, &d, &tail) != 3 ||
+        m < 1 || m > 12 || d < 1 || d > 31)
+    {
+        return false;
+    }
+    y -= m <= 2;
+    int64_t era = (y >= 0 ? y : y - 399) / 400;
+    int64_t yoe = y - era * 400;
+    int64_t doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    int64_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    day = era * 146097 + doe - 719468;
+    return true;
+};
+
+inline std::string harvest_planner::format_date(int64_t day)
+{
+    day += 719468;
+    int64_t era = (day >= 0 ? day : day - 146096) / 146097;
+    int64_t doe = day - era * 146097;
+    int64_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    int64_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    int64_t mp  = (5 * doy + 2) / 153;
+    int64_t d   = doy - (153 * mp + 2) / 5 + 1;
+    int64_t m   = mp < 10 ? mp + 3 : mp - 9;
+    int64_t y   = yoe + era * 400 + (m <= 2);
+
+    char out[32];
+    std::snprintf(out, sizeof(out), "%04d-%02d-%02d", static_cast<int>(y),
+        static_cast<int>(m), static_cast<int>(d));
+    return out;
+};
+
+inline std::string harvest_planner::today()
+{
+    return format_date(static_cast<int64_t>(std::time(nullptr)) / 86400);
+};
+
+// The dates go into the query's filter, if it has one.
+inline std::string harvest_planner::with_index_dates(const std::string &query,
+    const std::string &from, const std::string &until)
+{
+    std::string dates = "from-index-date:" + from + ",until-index-date:" + until;
+
+    size_t q = query.find('?');
+    size_t f = q == std::string::npos ? q : query.find("filter=", q);
+    while (f != std::string::npos && query[f - 1] != '?' && query[f - 1] != '&')
+    {
+        f = query.find("filter=", f + 7);
+    }
+    if (f == std::string::npos)
+    {
+        return query + (q == std::string::npos ? '?' : '&') + "filter=" + dates;
+    }
+    size_t end = query.find('&', f);
+    if (end == std::string::npos)
+    {
+        end = query.size();
+    }
+    return query.substr(0, end) + ',' + dates + query.substr(end);
+};
+
+std::vector<harvest_partition> harvest_planner::plan(const std::string &query,
+    const std::string &from, const std::string &until)
+{
+    struct range
+    {
+        int64_t first;
+        int64_t last;
+    };
+
+    int64_t first, last;
+    if (!parse_date(from, first) || !parse_date(until, last) || last < first)
+    {
+        throw std::invalid_argument("bad dates: " + from + " .. " + until);
+    }
+
+    std::vector<harvest_partition>  planned;
+    std::vector<range>              pending{ range{ first, last } };
+
+    while (!pending.empty())
+    {
+        std::vector<std::string> queries;
+        for (const range &r : pending)
+        {
+            queries.push_back(with_index_dates(query, format_date(r.first),
+                format_date(r.last)));
+        }
+
+        std::vector<size_t> counts(pending.size(), 0);
+        counter.harvest(queries, [&](api_page &page)
+        {
+            if (!page.error.empty())
+            {
+                throw std::runtime_error("couldn't count " + page.query +
+                    ": " + page.error);
+            }
+            size_t i = static_cast<size_t>(std::find(queries.begin(),
+                queries.end(), page.query) - queries.begin());
+            size_t at = page.body.find("\"total-results\"");
+            if (i == queries.size() || at == std::string::npos)
+            {
+                throw std::runtime_error("no count for " + page.query);
+            }
+            at = page.body.find(':', at);
+            counts[i] = std::strtoull(page.body.c_str() + at + 1, nullptr, 10);
+        });
+
+        std::vector<range> next;
+        for (size_t i = 0; i < pending.size(); ++i)
+        {
+            const range r    = pending[i];
+            const int64_t days = r.last - r.first + 1;
+            if (counts[i] == 0)
+            {
+                continue;
+            }
+            if (counts[i] <= opts.target_works || days == 1)
+            {
+                planned.push_back(harvest_partition{ queries[i],
+                    format_date(r.first), format_date(r.last), counts[i] });
+                continue;
+            }
+
+            int64_t pieces = static_cast<int64_t>(std::min<size_t>(opts.max_split,
+                (counts[i] + opts.target_works - 1) / opts.target_works));
+            pieces = std::min(pieces, days);
+            for (int64_t p = 0; p < pieces; ++p)
+            {
+                next.push_back(range{ r.first + days * p / pieces,
+                    r.first + days * (p + 1) / pieces - 1 });
+            }
+        }
+        pending = std::move(next);
+    }
+
+    std::sort(planned.begin(), planned.end(),
+        [](const harvest_partition &a, const harvest_partition &b)
+        {
+            return a.from < b.from;
+        });
+    return planned;
+};
+}
+#endif
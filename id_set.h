@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) 2022 - present, GitHub: @cubter
+ *
+ * See COPYING.txt in the project root for license information.
+ */
+#ifndef ID_SET_H
+#define ID_SET_H
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+namespace metasci
+{
+// Set of positive IDs: a bitmap, plus the list of its words in use, so that
+// the few IDs a small output refers to are listed without going over all
+// the IDs handed out so far.
+class id_set
+{
+public:
+    void insert(int64_t id)
+    {
+        if (id <= 0)
+        {
+            return;
+        }
+        const size_t w = static_cast<size_t>(id) >> 6;
+        if (w >= words.size())
+        {
+            words.resize(std::max(w + 1, words.size() * 2), 0);
+        }
+        if (words[w] == 0)
+        {
+            used.push_back(w);
+        }
+        words[w] |= uint64_t(1) << (id & 63);
+    }
+
+    bool contains(int64_t id) const
+    {
+        const size_t w = static_cast<size_t>(id) >> 6;
+        return id > 0 && w < words.size() &&
+            (words[w] & (uint64_t(1) << (id & 63))) != 0;
+    }
+
+    bool empty() const { return used.empty(); }
+
+    // Calls f(int64_t id) for every ID, in ascending order.
+    template<typename F>
+    void for_each(F f) const
+    {
+        std::vector<size_t> in_order(used);
+        std::sort(in_order.begin(), in_order.end());
+        for (size_t w : in_order)
+        {
+            for (uint64_t bits = words[w]; bits != 0; bits &= bits - 1)
+            {
+                f(static_cast<int64_t>(w << 6) + __builtin_ctzll(bits));
+            }
+        }
+    }
+
+private:
+    std::vector<uint64_t>   words;
+    std::vector<size_t>     used;
+};
+
+// The IDs an output's rows refer to, which its dictionary is to hold.
+struct referred_ids
+{
+    int64_t max_article_id = 0;
+    id_set  authors;
+    id_set  subjects;
+    id_set  journals;
+};
+}
+#endif
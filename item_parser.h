@@ -0,0 +1,807 @@
+/*
+ * Copyright (c) 2022 - present, GitHub: @cubter
+ *
+ * See COPYING.txt in the project root for license information.
+ */
+#ifndef ITEM_PARSER_H
+#define ITEM_PARSER_H
+
+#include "arena.h"
+#include "article.h"
+#include "cbor_shard.h"
+#include "compact_label.h"
+#include "conditional.h"
+#include "dictionaries.h"
+#include "item_reader.h"
+#include "journal.h"
+#include "log.h"
+#include "mapped_file.h"
+#include "orcid.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace metasci
+{
+// Crossref's items into articles: from a DOM of the whole input, from the
+// text (in one thread or several), from a binary shard, or from JSON Lines.
+// The parsers add the names they meet to the dictionaries, and log what's
+// wrong with an item in json_logs; an item lacking a mandatory field is
+// skipped.
+
+template<typename Worker>
+void run_in_threads(unsigned threads, Worker &&worker);
+template<typename Json>
+void item_to_json(const item_view &view, Json &item);
+template<typename Json>
+bool parse_crossref_item(Json &item,
+    std::vector<json_log>   &json_logs,
+    dictionaries            &dicts,
+    std::vector<article>    &articles,
+    monotonic_arena         &arena);
+
+// Item's fields the parser uses; the scanner skips all the others.
+const char *const crossref_item_fields[] =
+{
+    "title", "DOI", "publisher", "container-title", "author", "issue", 
+    "volume", "type", "is-referenced-by-count", "references-count", "issued",
+    "score", "subject", "clinical-trial-number", "published-online", 
+    "published-print", "reference", "indexed", "deposited"
+};
+
+// Parses Crossref's JSONs. Works with any nlohmann::basic_json; main() uses
+// fast_json (see fast_json.h).
+template<typename Json>
+void parse_crossref_json(Json &crossref_json,
+    std::vector<json_log>   &json_logs,
+    dictionaries            &dicts,
+    std::vector<article>    &articles)
+{
+    Json *items; // the highest level structure
+
+    try
+    {
+        items = &crossref_json.at("items");
+    }
+    catch(const typename Json::exception &e)
+    {
+        json_logs.emplace_back(e.id, e.what(), "items missing");
+        return;
+    }
+
+    // Per-item temporaries (the builder's containers) are allocated from the
+    // arena, which is reset in bulk once a batch of articles is emitted. 
+    // Subtrees of the DOM are only ever referenced, never copied, and the
+    // strings are moved out of it.
+    const size_t batch_items = 1024;
+    monotonic_arena arena;
+    size_t in_batch = 0;
+
+    for (auto &item : *items)
+    {   
+        if (in_batch++ == batch_items)
+        {
+            arena.reset();
+            in_batch = 1;
+        }
+
+        parse_crossref_item(item, json_logs, dicts, articles, arena);
+    }
+}
+
+// Parses Crossref's JSON straight from the buffer. The items are found by the
+// structural scanner (see item_reader.h), and only the fields the parser 
+// needs are parsed into a small DOM; the rest are skipped without parsing.
+// If the buffer is a mapped file, the parsed part of it is released after
+// each batch of items: the articles keep no references into the buffer.
+template<typename Json>
+bool parse_crossref_buffer(const char *data, size_t len,
+    std::vector<json_log>   &json_logs,
+    dictionaries            &dicts,
+    std::vector<article>    &articles,
+    mapped_file             *source = nullptr)
+{
+    const size_t batch_items = 1024;
+    monotonic_arena arena;
+    size_t in_batch = 0;
+
+    item_reader reader;
+
+    bool ok = reader.read(data, len, [&](const item_view &view)
+    {
+        if (in_batch++ == batch_items)
+        {
+            arena.reset();
+            in_batch = 1;
+
+            if (source != nullptr)
+            {
+                source->release(static_cast<size_t>(view.begin - data));
+            }
+        }
+
+        Json item = Json::object();
+        try
+        {
+            item_to_json(view, item);
+        }
+        catch(const typename Json::exception &e)
+        {
+            json_logs.emplace_back(e.id, e.what(), 
+                "item at byte " + std::to_string(view.begin - data));
+            return;
+        }
+
+        parse_crossref_item(item, json_logs, dicts, articles, arena);
+    });
+
+    if (!ok)
+    {
+        json_logs.emplace_back(log_code::malformed_input, 
+            "malformed JSON or \"items\" missing", "");
+    }
+
+    return ok;
+}
+
+// Parses a binary shard (see cbor_shard.h). The items' fields the parser 
+// needs are decoded into a small DOM, the others are skipped, as with the 
+// text; the decoding itself is cheaper, there being no text to scan.
+template<typename Json>
+bool parse_crossref_cbor(const char *data, size_t len,
+    std::vector<json_log>   &json_logs,
+    dictionaries            &dicts,
+    std::vector<article>    &articles)
+{
+    const size_t batch_items = 1024;
+    monotonic_arena arena;
+    size_t in_batch = 0;
+
+    cbor_item_reader<Json> reader(std::vector<string>(
+        std::begin(crossref_item_fields), std::end(crossref_item_fields)));
+
+    bool ok = reader.read(data, len, [&](Json &item)
+    {
+        if (in_batch++ == batch_items)
+        {
+            arena.reset();
+            in_batch = 1;
+        }
+
+        parse_crossref_item(item, json_logs, dicts, articles, arena);
+    });
+
+    if (!ok)
+    {
+        json_logs.emplace_back(log_code::malformed_input, 
+            "malformed binary shard: " + reader.error(), "");
+    }
+
+    return ok;
+}
+
+// Same as parse_crossref_buffer, but in several threads. The items' 
+// boundaries are found first (a single pass of the structural scanner), then
+// contiguous ranges of items are handed out to the workers, each parsing its
+// range into a batch of articles of its own. The batches are merged in the 
+// file's order, so the only difference from the single-threaded parsing is
+// that the articles' IDs follow the order in which they've been parsed.
+template<typename Json>
+bool parse_crossref_buffer_parallel(const char *data, size_t len,
+    unsigned                threads,
+    std::vector<json_log>   &json_logs,
+    dictionaries            &dicts,
+    std::vector<article>    &articles)
+{
+    std::vector<std::pair<size_t, size_t>> items;
+    item_reader splitter;
+
+    bool ok = splitter.find_items(data, len, items);
+
+    // Several ranges per thread even out the differences in items' sizes.
+    const size_t n_ranges = std::min<size_t>(items.size(), threads * 8);
+    std::vector<std::vector<article>>  range_articles(n_ranges);
+    std::vector<std::vector<json_log>> range_logs(n_ranges);
+    std::atomic<size_t>       next_range(0);
+
+    auto worker = [&]()
+    {
+        const size_t batch_items = 1024;
+        monotonic_arena arena;
+        size_t in_batch = 0;
+
+        // A range of items is cut out of the envelope's array, so it's read
+        // as a list of objects.
+        item_reader reader(item_reader::list);
+
+        for (size_t r = next_range++; r < n_ranges; r = next_range++)
+        {
+            size_t first  = items.size() * r / n_ranges;
+            size_t last   = items.size() * (r + 1) / n_ranges;
+            size_t offset = items[first].first;
+
+            reader.read(data + offset, items[last - 1].second - offset, 
+                [&](const item_view &view)
+            {
+                if (in_batch++ == batch_items)
+                {
+                    arena.reset();
+                    in_batch = 1;
+                }
+
+                Json item = Json::object();
+                try
+                {
+                    item_to_json(view, item);
+                }
+                catch(const typename Json::exception &e)
+                {
+                    range_logs[r].emplace_back(e.id, e.what(), 
+                        "item at byte " + std::to_string(view.begin - data));
+                    return;
+                }
+
+                parse_crossref_item(item, range_logs[r], dicts, 
+                    range_articles[r], arena);
+            });
+        }
+    };
+
+    run_in_threads(threads, worker);
+
+    for (size_t r = 0; r < n_ranges; ++r)
+    {
+        std::move(range_articles[r].begin(), range_articles[r].end(), 
+            std::back_inserter(articles));
+        std::move(range_logs[r].begin(), range_logs[r].end(), 
+            std::back_inserter(json_logs));
+    }
+    // After the items' logs, as parse_crossref_buffer has it.
+    if (!ok)
+    {
+        json_logs.emplace_back(log_code::malformed_input, 
+            "malformed JSON or \"items\" missing", "");
+    }
+
+    return ok;
+}
+
+// Cuts JSON Lines into at most n_chunks chunks of about the same size, on
+// the lines' boundaries. Returns the chunks' bounds: 0, the ends of all the
+// chunks but the last, each right after a newline, and len.
+inline std::vector<size_t> jsonl_chunks(const char *data, size_t len,
+    size_t n_chunks)
+{
+    std::vector<size_t> bounds{ 0 };
+
+    for (size_t c = 1; c < n_chunks && len > 0; ++c)
+    {
+        size_t pos = std::max(bounds.back(), len * c / n_chunks);
+        const void *nl = std::memchr(data + pos, '\n', len - pos);
+        if (nl == nullptr)
+        {
+            break;
+        }
+        bounds.push_back(static_cast<size_t>(
+            static_cast<const char *>(nl) - data) + 1);
+    }
+    bounds.push_back(len);
+
+    return bounds;
+}
+
+// Parses JSON Lines: one item per line, empty lines allowed. The file is cut
+// into chunks on line boundaries, and the chunks are parsed in several 
+// threads, the same way as parse_crossref_buffer_parallel does. A malformed
+// line is logged and skipped. Returns the number of such lines.
+template<typename Json>
+size_t parse_crossref_jsonl(const char *data, size_t len,
+    unsigned                threads,
+    std::vector<json_log>   &json_logs,
+    dictionaries            &dicts,
+    std::vector<article>    &articles)
+{
+    const std::vector<size_t> bounds = jsonl_chunks(data, len, threads * 8);
+    const size_t n_ranges = bounds.size() - 1;
+    std::vector<std::vector<article>>  range_articles(n_ranges);
+    std::vector<std::vector<json_log>> range_logs(n_ranges);
+    std::atomic<size_t>       next_range(0);
+    std::atomic<size_t>       malformed(0);
+
+    auto worker = [&]()
+    {
+        const size_t batch_items = 1024;
+        monotonic_arena arena;
+        size_t in_batch = 0;
+
+        item_reader reader(item_reader::bare);
+        item_view   line_item;
+        size_t               items_in_line;
+
+        for (size_t r = next_range++; r < n_ranges; r = next_range++)
+        {
+            for (size_t begin = bounds[r], end; begin < bounds[r + 1]; 
+                begin = end + 1)
+            {
+                const void *nl = std::memchr(data + begin, '\n', 
+                    bounds[r + 1] - begin);
+                end = nl != nullptr ? 
+                    static_cast<size_t>(static_cast<const char *>(nl) - data) :
+                    bounds[r + 1];
+
+                // Blank lines are fine.
+                size_t first = begin;
+                while (first < end && std::isspace(
+                    static_cast<unsigned char>(data[first])))
+                {
+                    ++first;
+                }
+                if (first == end)
+                {
+                    continue;
+                }
+
+                // The item is kept until the whole line turns out to be
+                // well-formed.
+                items_in_line = 0;
+                bool ok = reader.read(data + begin, end - begin, 
+                    [&](const item_view &view)
+                {
+                    line_item = view;
+                    ++items_in_line;
+                });
+
+                Json item = Json::object();
+                try
+                {
+                    if (!ok || items_in_line != 1)
+                    {
+                        throw std::invalid_argument("not a single JSON object");
+                    }
+                    item_to_json(line_item, item);
+                }
+                catch(const std::exception &e)
+                {
+                    ++malformed;
+                    range_logs[r].emplace_back(log_code::malformed_input, 
+                        string("malformed line: ") + e.what(), 
+                        "line at byte " + std::to_string(begin));
+                    continue;
+                }
+
+                if (in_batch++ == batch_items)
+                {
+                    arena.reset();
+                    in_batch = 1;
+                }
+                parse_crossref_item(item, range_logs[r], dicts, 
+                    range_articles[r], arena);
+            }
+        }
+    };
+
+    run_in_threads(threads, worker);
+
+    for (size_t r = 0; r < n_ranges; ++r)
+    {
+        std::move(range_articles[r].begin(), range_articles[r].end(), 
+            std::back_inserter(articles));
+        std::move(range_logs[r].begin(), range_logs[r].end(), 
+            std::back_inserter(json_logs));
+    }
+
+    return malformed;
+}
+
+// Runs the worker in the given number of threads, the calling one included,
+// and waits for all of them to finish.
+template<typename Worker>
+void run_in_threads(unsigned threads, Worker &&worker)
+{
+    std::vector<std::thread> pool;
+    for (unsigned t = 1; t < threads; ++t)
+    {
+        pool.emplace_back(std::ref(worker));
+    }
+    worker();
+    for (auto &t : pool)
+    {
+        t.join();
+    }
+}
+
+// Parses the item's fields the parser needs into a DOM; throws if any of them
+// is malformed.
+template<typename Json>
+void item_to_json(const item_view &view, Json &item)
+{
+    for (const auto &field : view.fields)
+    {
+        for (const char *wanted : crossref_item_fields)
+        {
+            if (field.key_is(wanted))
+            {
+                item[wanted] = Json::parse(field.value, 
+                    field.value + field.value_len);
+                break;
+            }
+        }
+    }
+}
+
+// Parses a single Crossref item into an article. Returns false if the item 
+// lacks the mandatory fields (title, DOI, publisher) and has been skipped.
+template<typename Json>
+bool parse_crossref_item(Json &item,
+    std::vector<json_log>   &json_logs,
+    dictionaries            &dicts,
+    std::vector<article>    &articles,
+    monotonic_arena         &arena)
+{
+    string title;
+    string doi;
+    string publisher_title;
+    article::builder article_b(arena);
+
+    try
+    {
+        title = std::move(item.at("title").at(0).template get_ref<string &>());
+    }
+    catch(const typename Json::exception &e)
+    {
+        json_logs.emplace_back(e.id, e.what(), "title missing.");
+        return false;
+    }
+
+    try
+    {
+        doi = std::move(item.at("DOI").template get_ref<string &>());
+    }
+    catch(const typename Json::exception &e)
+    {
+        json_logs.emplace_back(e.id, e.what(), "title: " + title);
+        return false;
+    }
+
+    try
+    {
+        publisher_title = std::move(item.at("publisher").template get_ref<string &>());
+    }
+    catch(const typename Json::exception &e)
+    {
+        json_logs.emplace_back(e.id, std::move(e.what()), "title: " + title);
+        return false;
+    }
+
+    // journals' titles. 
+    try
+    {
+        const Json &container_titles = item.at("container-title");
+
+        for (auto &ct : container_titles)
+        {
+            // Journals (and publishers) are shared by all the parsing threads.
+            std::lock_guard<std::mutex> lock(dicts.mutex);
+            journal j(ct.template get_ref<const string &>(), publisher_title);
+
+            cond::Emplacer<journal_uset, journal_uset::iterator, journal> emp;
+
+            auto emplace_res = emp.emplace_to(dicts.journals, std::forward<journal>(j));
+            
+            article_b.journals_b.emplace_back(*emplace_res.first);
+        }
+    }
+    catch(const typename Json::type_error &e)
+    {
+        json_logs.emplace_back(e.id, std::move(e.what()), "title: " + title);
+    }
+    // There will be a lot out of range errors, since many elements may be 
+    // absent in the concrete json file. I don't need to catch them -- I'm 
+    // only interested in type errors, -- hence the body is empty. Same 
+    // applies below
+    catch(const typename Json::exception &e)
+    { }
+
+    try
+    {
+        const Json &local_authors = item.at("author");    
+
+        for (const auto &local_author : local_authors)
+        {
+            orcid  orcid; 
+            bool            is_auth_orcid = false;
+
+            try
+            {        
+                // ORCID is an author's unique ID. Many authors lack it.
+                // Crossref gives it as a URL; malformed ones and those 
+                // with a wrong check digit are logged and dropped.
+                const string &orcid_url = 
+                    local_author.at("ORCID").template get_ref<const string &>();
+
+                if (!orcid::parse(orcid_url, orcid))
+                {
+                    json_logs.emplace_back(log_code::invalid_orcid,
+                        "invalid ORCID: " + orcid_url, "title: " + title);
+                }
+                is_auth_orcid = local_author.at("authenticated-orcid");
+            }
+            catch(const typename Json::type_error &e)
+            {
+                json_logs.emplace_back(e.id, std::move(e.what()), 
+                    "title: " + title);
+            }    
+            catch(const typename Json::exception &e) 
+            { }   
+
+            article_b.authors_b.emplace_back(
+                local_author.at("given").template get_ref<const string &>(), 
+                local_author.at("family").template get_ref<const string &>(), 
+                orcid, 
+                is_auth_orcid);
+            
+            // author's affiliations; often left empty.
+            try
+            {                   
+                article_b.authors_b.back().set_affiliations(
+                    std::move(local_author.at("affiliation")));  
+            }
+            catch(const typename Json::type_error &e)
+            {
+                json_logs.emplace_back(e.id, std::move(e.what()), 
+                    "title: " + title);
+            }   
+            catch(const typename Json::exception &e) 
+            { } 
+        }
+    }
+    catch(const typename Json::type_error &e)
+    {
+        json_logs.emplace_back(e.id, std::move(e.what()), 
+            "title: " + title);
+    }   
+    catch(const typename Json::exception &e) 
+    { }
+
+    try
+    {
+        // Issues are short (usually, numbers encoded as strings), so 
+        // they're stored as numbers whenever possible.
+        article_b.issue_b = compact_label::encode(
+            item.at("issue").template get_ref<const string &>(), dicts.labels);
+    }
+    catch(const typename Json::type_error &e)
+    {
+        json_logs.emplace_back(e.id, std::move(e.what()), 
+            "title: " + title);
+    }
+    catch(const typename Json::exception &e) 
+    { }
+		
+    try
+    {
+        // Volumes are short strings as well.
+        article_b.volume_b = compact_label::encode(
+            item.at("volume").template get_ref<const string &>(), dicts.labels);
+    }
+    catch(const typename Json::type_error &e)
+    {
+        json_logs.emplace_back(e.id, std::move(e.what()), 
+            "title: " + title);
+    }
+    catch(const typename Json::exception &e) 
+    { }
+    
+    try
+    {
+        // Types are also short.
+        const string &type = item.at("type").template get_ref<const string &>();
+        
+        auto it = std::find(dicts.publication_types.begin(),  
+            dicts.publication_types.end(), type);
+        
+        if (it != dicts.publication_types.end())
+        {
+            article_b.type_b = it->get_id();
+        }
+    }
+    catch(const typename Json::type_error &e)
+    {
+        json_logs.emplace_back(e.id, std::move(e.what()), 
+            "title: " + title);
+    }
+    catch(const typename Json::exception &e) 
+    { }
+		
+    try
+    {
+        article_b.ref_by_num_b = item.at("is-referenced-by-count");
+    }
+    catch(const typename Json::type_error &e)
+    {
+        json_logs.emplace_back(e.id, std::move(e.what()), 
+            "title: " + title);
+    }
+    catch(const typename Json::exception &e) 
+    { }
+		
+    try
+    {
+        article_b.ref_num_b = item.at("references-count");
+    }
+    catch(const typename Json::type_error &e)
+    {
+        json_logs.emplace_back(e.id, std::move(e.what()), 
+            "title: " + title);
+    }
+    catch(const typename Json::exception &e) 
+    { }
+
+    try
+    {
+        const Json &issued = item.at("issued").at("date-parts");
+
+        for (auto &el : issued)
+        {
+            article_b.issued_b.emplace_back(date{el.at(0), el.at(1), el.at(2)});
+        }
+    }
+    catch(const typename Json::type_error &e)
+    {
+        json_logs.emplace_back(e.id, std::move(e.what()), 
+            "title: " + title);
+    }
+    catch(const typename Json::exception &e) 
+    { }
+
+    try
+    {
+        // When the record was last changed; tells the newer version of an
+        // article from the older one in incremental updates. Crossref bumps
+        // `indexed` whenever the record changes, `deposited` only when the
+        // publisher deposits it anew.
+        const Json &stamp = item.contains("indexed") ? 
+            item.at("indexed") : item.at("deposited");
+        article_b.updated_b = stamp.at("timestamp");
+    }
+    catch(const typename Json::type_error &e)
+    {
+        json_logs.emplace_back(e.id, std::move(e.what()), 
+            "title: " + title);
+    }
+    catch(const typename Json::exception &e) 
+    { }
+
+    try
+    {           
+        const Json &score = item.at("score");
+        if (!score.is_null()) 
+        {
+            article_b.score_b = score;
+        } 
+    }
+    catch(const typename Json::type_error &e)
+    {
+        json_logs.emplace_back(e.id, std::move(e.what()), 
+            "title: " + title);
+    }
+    catch(const typename Json::exception &e) 
+    { }
+
+    try
+    {
+        // The full list of subjects is not provided by Crossref; hence, 
+        // it's updated during the parsing.
+        const Json &local_subjects = item.at("subject");
+
+        for (auto &local_subject : local_subjects)
+        {
+            const string &local_subject_str = 
+                local_subject.template get_ref<const string &>(); 
+
+            std::lock_guard<std::mutex> lock(dicts.mutex);
+            auto &subjects = dicts.subjects;
+            auto it = std::find(subjects.begin(), subjects.end(), 
+                local_subject_str);
+
+            // If there already exists such subject in the global pool of 
+            // subjects, add its ID to the article builder's subject list,
+            if (it != subjects.end())
+            {
+                article_b.subjects_ids_b.push_back(it->get_id());
+            }
+            // otherwise, firstly, add a new subject to the pool.
+            else
+            {
+                subjects.emplace_back(local_subject_str);
+                article_b.subjects_ids_b.push_back(subjects.back().get_id()); 
+            }
+        }      
+    }
+    catch(const typename Json::type_error &e)
+    {
+        json_logs.emplace_back(e.id, std::move(e.what()), 
+            "title: " + title);
+    }
+    catch(const typename Json::exception &e) 
+    { }
+    
+    try
+    {
+        // Clinical trial number is nothing else than NCT ID. 
+        Json &ct_nums = item.at("clinical-trial-number");
+
+        for (auto &ct_num : ct_nums)
+        {
+            article_b.ct_numbers_b.push_back(
+                std::move(ct_num.template get_ref<string &>()));
+        }
+    }
+    catch(const typename Json::type_error &e)
+    {
+        json_logs.emplace_back(e.id, std::move(e.what()), 
+            "title: " + title);
+    }
+    catch(const typename Json::exception &e) 
+    { }
+		
+		// I prefer the date of online publication if it's present, since, 
+    // well, it's an online era.
+    try
+    {
+        bool is_published = item.contains("published-online"); 
+        // published-online is an array, so there may be several dates. 
+        // Note: I'm not sure what that means in practice.
+        const Json &published_dates = is_published ? 
+            item.at("published-online").at("date-parts") : 
+            item.at("published-print").at("date-parts");
+
+        for (auto &pd : published_dates)
+        {
+            article_b.published_b.emplace_back(date{pd.at(0), pd.at(1), pd.at(2)});
+        }
+    }
+    catch(const typename Json::type_error &e)
+    {
+        json_logs.emplace_back(e.id, std::move(e.what()), 
+            "title: " + title);
+    }
+    catch(const typename Json::exception &e) 
+    { }
+		
+    try
+    {
+        Json &references = item.at("reference"); // list of references
+
+        for (auto &el : references)
+        {
+            article_b.references_b.push_back(
+                std::move(el.at("DOI").template get_ref<string &>()));   
+        }            
+    }
+    catch(const typename Json::type_error &e)
+    {
+        json_logs.emplace_back(e.id, std::move(e.what()), 
+            "title: " + title);
+    }
+    catch(const typename Json::exception &e) 
+    { }
+    
+    article_b.title_b   = std::move(title);
+    article_b.doi_b     = std::move(doi);
+    articles.push_back(article_b.build());
+
+    return true;
+}
+}
+#endif
@@ -0,0 +1,277 @@
+/*
+ * Copyright (c) 2022 - present, GitHub: @cubter
+ *
+ * See COPYING.txt in the project root for license information.
+ */
+#ifndef ITEM_READER_H
+#define ITEM_READER_H
+
+#include "structural_scanner.h"
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace metasci
+{
+// A top-level field of an item: raw key and raw JSON value, both pointing
+// into the input buffer. The key is unescaped only if it needs to be, which
+// is never the case for Crossref.
+struct field_span
+{
+    const char  *key;
+    size_t      key_len;
+    const char  *value;
+    size_t      value_len;
+
+    bool key_is(const char *k) const
+    {
+        return std::strlen(k) == key_len && std::memcmp(key, k, key_len) == 0;
+    }
+};
+
+// An item (a single work) found in the input.
+struct item_view
+{
+    const char              *begin;
+    size_t                  size;
+    std::vector<field_span> fields;
+};
+
+// Finds the items in a Crossref file on top of the structural scanner and
+// cuts them into top-level fields without parsing any value, so the parser
+// jumps straight to the values it needs.
+//
+// Layouts:
+//  - envelope: {"items": [ {...}, {...} ], ...} -- the way Crossref's dumps
+//    come (the other top-level keys are skipped);
+//  - bare: one or more objects one after another (a single item, JSON Lines
+//    etc.); each top-level object is an item;
+//  - list: objects separated by commas, as a range of items cut out of an
+//    envelope's array is.
+// Only blanks may lie between the top-level values, besides a list's commas.
+class item_reader
+{
+public:
+    enum layout { envelope, bare, list };
+
+    // Calls on_item(const item_view &) for each item. Returns false if the
+    // input isn't well-formed, ends in the middle of an item, or the envelope
+    // lacks "items".
+    template<typename OnItem>
+    bool read(const char *data, size_t len, OnItem &&on_item);
+
+    // Only finds the items' boundaries, without cutting them into fields.
+    // Used to split a file between several threads.
+    bool find_items(const char *data, size_t len,
+        std::vector<std::pair<size_t, size_t>> &items);
+
+    item_reader(layout l = envelope) : items_layout(l) {};
+
+private:
+    template<typename OnItem>
+    bool run(const char *data, size_t len, bool cut_fields, OnItem &&on_item);
+
+    static bool is_space(char c)
+    {
+        return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+    }
+    static bool is_blank(const char *first, const char *last)
+    {
+        for (; first != last; ++first)
+        {
+            if (!is_space(*first))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    layout              items_layout;
+    structural_scanner  scanner;
+};
+
+template<typename OnItem>
+bool item_reader::read(const char *data, size_t len, OnItem &&on_item)
+{
+    return run(data, len, true, on_item);
+};
+
+inline bool item_reader::find_items(const char *data, size_t len,
+    std::vector<std::pair<size_t, size_t>> &items)
+{
+    return run(data, len, false, [&](const item_view &item)
+    {
+        size_t begin = static_cast<size_t>(item.begin - data);
+        items.emplace_back(begin, begin + item.size);
+    });
+};
+
+template<typename OnItem>
+bool item_reader::run(const char *data, size_t len, bool cut_fields,
+    OnItem &&on_item)
+{
+    // Nesting of the containers, '{' or '['. Crossref's items are shallow.
+    std::vector<char> stack;
+    stack.reserve(32);
+
+    // Depth (size of the stack) of an item's own object.
+    const size_t item_depth = items_layout == envelope ? 3 : 1;
+
+    bool    in_string     = false;
+    bool    expect_key    = false;
+    bool    in_items      = items_layout != envelope;
+    bool    found_items   = items_layout != envelope;
+    bool    well_formed   = true;
+    size_t  string_begin  = 0;
+    const char *key       = nullptr;   // current field of the item
+    size_t  key_len       = 0;
+    const char *top_key   = nullptr;   // current key of the envelope
+    size_t  top_key_len   = 0;
+    size_t  value_begin   = 0;
+    // Where the last top-level value, or a list's comma after it, ends, and
+    // whether a value ends there.
+    size_t  top_end       = 0;
+    bool    after_value   = false;
+
+    item_view item;
+    item.begin = nullptr;
+
+    auto end_field = [&](size_t end)
+    {
+        if (!cut_fields || key == nullptr)
+        {
+            return;
+        }
+        size_t b = value_begin, e = end;
+        while (b < e && is_space(data[b]))     { ++b; }
+        while (e > b && is_space(data[e - 1])) { --e; }
+
+        item.fields.push_back(field_span{ key, key_len, data + b, e - b });
+        key = nullptr;
+    };
+
+    scanner.scan(data, len, [&](size_t pos, char c)
+    {
+        if (stack.empty() && c != '{' && c != '[' &&
+            !(c == ',' && items_layout == list && after_value &&
+                is_blank(data + top_end, data + pos)))
+        {
+            well_formed = false;
+            return false;
+        }
+
+        if (c == '"')
+        {
+            if (!in_string)
+            {
+                in_string = true;
+                string_begin = pos + 1;
+            }
+            else
+            {
+                in_string = false;
+                if (expect_key && in_items && stack.size() == item_depth)
+                {
+                    key     = data + string_begin;
+                    key_len = pos - string_begin;
+                }
+                else if (expect_key && items_layout == envelope && stack.size() == 1)
+                {
+                    top_key     = data + string_begin;
+                    top_key_len = pos - string_begin;
+                }
+            }
+            return true;
+        }
+
+        switch (c)
+        {
+            case ':':
+                expect_key  = false;
+                if (stack.size() == item_depth)
+                {
+                    value_begin = pos + 1;
+                }
+                break;
+
+            case ',':
+                if (stack.empty())
+                {
+                    top_end     = pos + 1;
+                    after_value = false;
+                    break;
+                }
+                if (stack.size() == item_depth && in_items)
+                {
+                    end_field(pos);
+                }
+                expect_key = !stack.empty() && stack.back() == '{';
+                break;
+
+            case '{':
+            case '[':
+                // Only the bare layout has values one after another.
+                if (stack.empty() && (!is_blank(data + top_end, data + pos) ||
+                    (after_value && items_layout != bare)))
+                {
+                    well_formed = false;
+                    return false;
+                }
+                // "items": [ -- the array of the works.
+                if (c == '[' && items_layout == envelope && stack.size() == 1 &&
+                    top_key_len == 5 && std::memcmp(top_key, "items", 5) == 0)
+                {
+                    in_items = found_items = true;
+                }
+                if (c == '{' && in_items && stack.size() == item_depth - 1)
+                {
+                    item.begin = data + pos;
+                    item.fields.clear();
+                    key = nullptr;
+                }
+                stack.push_back(c);
+                expect_key = c == '{';
+                break;
+
+            case '}':
+            case ']':
+                if (stack.empty() || stack.back() != (c == '}' ? '{' : '['))
+                {
+                    well_formed = false;
+                    return false;
+                }
+                if (stack.size() == item_depth && in_items && c == '}')
+                {
+                    end_field(pos);
+                    item.size = pos + 1 - static_cast<size_t>(item.begin - data);
+                    on_item(static_cast<const item_view &>(item));
+                    item.begin = nullptr;
+                }
+                if (c == ']' && items_layout == envelope && stack.size() == 2)
+                {
+                    in_items = false;
+                }
+                stack.pop_back();
+                expect_key = false;
+                if (stack.empty())
+                {
+                    top_end     = pos + 1;
+                    after_value = true;
+                }
+                break;
+
+            default:
+                break;
+        }
+
+        return true;
+    });
+
+    return well_formed && found_items && stack.empty() && !in_string &&
+        is_blank(data + top_end, data + len) &&
+        (after_value || top_end == 0);
+};
+}
+#endif
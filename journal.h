@@ -3,6 +3,9 @@
  * 
  * See COPYING.txt in the project root for license information.
  */
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
 #include <iostream>
 #include <vector>
 
@@ -15,13 +18,19 @@ using string    = std::string;
 class publisher
 {
 public:
-    string get_title() const { return title; };
+    string  get_title() const { return title; };
+    int32_t get_id() const { return id; };
+
+    // The highest ID assigned so far; restored when resuming an ingest.
+    static int32_t  max_id()                { return max_id_; }
+    static void     restore_max_id(int32_t m) { max_id_ = m; }
     
     publisher &operator=(publisher &&other)      = default;
     publisher &operator=(const publisher &other) = default;
 
     publisher() {};
     publisher(string title);
+    publisher(int32_t id, string title);    // restores a saved publisher
     publisher(publisher &&other)        = default;
     publisher(const publisher &other)   = default;
     virtual ~publisher() {};
@@ -32,13 +41,17 @@ private:
     string          title;
 };
 
-publisher::publisher(string title) : 
-    title(std::move(title)) 
+publisher::publisher(string name) : 
+    title(std::move(name)) 
 { 
     // Each time a new instance of the class is created, the class' max 
     // id is incremeted, and the instance receives an ID.
     id = ++max_id_; 
 };
+publisher::publisher(int32_t saved_id, string name) :
+    id(saved_id),
+    title(std::move(name))
+{ };
 
 // A journal is a child of a publisher. No journal can have more than one 
 // publisher.
@@ -48,12 +61,20 @@ public:
 
     inline string get_title() const           { return title; }
     inline string get_publisher_title() const { return publisher::get_title(); }
+    inline int32_t get_id() const             { return id; }
+    inline int32_t get_publisher_id() const   { return publisher::get_id(); }
+
+    static int32_t  max_id()                { return max_id_; }
+    static void     restore_max_id(int32_t m) { max_id_ = m; }
     
     journal &operator=(journal &&other)         = default;
     journal &operator=(const journal &other)    = default;
 
     journal() {};
     journal(string title, string publisher_title);
+    // Restores a saved journal.
+    journal(int32_t id, string title, int32_t publisher_id, 
+        string publisher_title);
     journal(journal &&other)        = default;
     journal(const journal &other)   = default;
     virtual ~journal() {};
@@ -63,14 +84,20 @@ private:
     string          title;
 };
 
-journal::journal(string title, string publisher_title) :
-    title(std::move(title)), 
-    publisher(std::move(publisher_title)) 
+journal::journal(string name, string publisher_title) :
+    publisher(std::move(publisher_title)),
+    title(std::move(name))
 { 
     // Each time a new instance of the class is created, the class' max 
     // id is incremeted, and the instance receives an ID.
     id = ++max_id_; 
 };
+journal::journal(int32_t saved_id, string name, int32_t publisher_id, 
+    string publisher_title) :
+    publisher(publisher_id, std::move(publisher_title)),
+    id(saved_id),
+    title(std::move(name))
+{ };
 // Hasher & comparator to enable creation of unordered sets.
 struct journal_hasher
 {
@@ -87,4 +114,5 @@ struct journal_comparator
     }
 };
 
-}
\ No newline at end of file
+}
+#endif
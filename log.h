@@ -3,6 +3,9 @@
  * 
  * See COPYING.txt in the project root for license information.
  */
+#ifndef LOG_H
+#define LOG_H
+
 #include <string>
 #include <iostream>
 #include <fstream>
@@ -11,6 +14,14 @@ using string = std::string;
 
 namespace metasci
 {
+// Message codes of my own. nlohmann's exceptions' IDs are below 600, so these
+// start from 1000 to be told apart in the log.
+namespace log_code
+{
+const int16_t invalid_orcid   = 1000;
+const int16_t malformed_input = 1001;
+}
+
 class log
 {
 public:
@@ -32,20 +43,23 @@ public:
     void write(std::ofstream &of)   { of << message << '|' << context << '\n'; }
     void write(std::ostream &os)    { os << message << '|' << context << '\n'; }
     int16_t get_message_code() const { return message_code; }
+    const string &message_ref() const { return message; }
+    const string &context_ref() const { return context; }
 
     json_log(int16_t code, string message);
     json_log(int16_t code, string message, string context);
     virtual ~json_log() {};
 };
 
-json_log::json_log(int16_t message_code, string message):
-    message_code(message_code),
-    message(std::move(message))
+json_log::json_log(int16_t code, string text):
+    message_code(code),
+    message(std::move(text))
 {};
 
-json_log::json_log(int16_t message_code, string message, string context):
-    message_code(message_code),
-    message(std::move(message)),        
-    context(std::move(context))
+json_log::json_log(int16_t code, string text, string where):
+    message_code(code),
+    message(std::move(text)),        
+    context(std::move(where))
 {};
-}
\ No newline at end of file
+}
+#endif
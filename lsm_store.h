@@ -0,0 +1,1089 @@
+/*
+ * Copyright (c) 2022 - present, GitHub: @cubter
+ *
+ * See COPYING.txt in the project root for license information.
+ */
+#ifndef LSM_STORE_H
+#define LSM_STORE_H
+
+#include "article_record.h"
+#include "checkpoint.h"
+#include "string_sort.h"
+#include "wal.h"
+
+#include <zstd/zstd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace metasci
+{
+// Immutable sorted run of records: zstd-compressed blocks of
+// (key, value) pairs in key order, then a bloom filter of the keys, the
+// blocks' index (first key, offset, sizes) and a fixed-size footer.
+// The bloom filter and the index are kept in memory; a lookup the filter
+// doesn't reject reads & decompresses a single block.
+class lsm_run
+{
+public:
+    struct block_ref
+    {
+        std::string first_key;
+        uint64_t    offset;
+        uint32_t    size;
+        uint32_t    raw_size;
+    };
+
+    bool may_contain(const std::string &key) const;
+    bool get(const std::string &key, std::string &value) const;
+    void read_block(size_t i, std::string &raw) const;
+
+    size_t              blocks() const      { return index.size(); }
+    uint64_t            file_size() const   { return size; }
+    const std::string  &path() const        { return file_path; }
+
+    static inline uint64_t hash(const std::string &key);
+
+    // Throws std::system_error on I/O errors, std::runtime_error if the
+    // file isn't a run or is corrupt.
+    explicit lsm_run(const std::string &path);
+    lsm_run(const lsm_run &other) = delete;
+    lsm_run &operator=(const lsm_run &other) = delete;
+    ~lsm_run();
+
+private:
+    struct footer
+    {
+        uint64_t bloom_offset;
+        uint64_t index_offset;
+        uint64_t n_keys;
+        uint32_t n_hashes;
+        uint32_t version;
+        uint64_t magic;
+    };
+    static const uint64_t magic = 0x4e55524943534d4dull;   // "MMSCIRUN"
+
+    friend class lsm_run_writer;
+
+    std::string             file_path;
+    int                     fd = -1;
+    uint64_t                size = 0;
+    std::vector<block_ref>  index;
+    std::vector<uint64_t>   bloom;
+    uint32_t                n_hashes = 0;
+};
+
+// Writes a run; the keys must come in ascending order.
+class lsm_run_writer
+{
+public:
+    void add(const std::string &key, const std::string &value);
+
+    // Writes the filter, index & footer, and syncs the file.
+    void finish();
+
+    lsm_run_writer(const std::string &path, size_t block_bytes,
+        int zstd_level, unsigned bloom_bits);
+    lsm_run_writer(const lsm_run_writer &other) = delete;
+
+private:
+    void flush_block();
+    void write(const char *data, size_t len);
+
+    std::string     path;
+    std::ofstream   out;
+    size_t          block_bytes;
+    int             zstd_level;
+    unsigned        bloom_bits;
+
+    std::string     block;
+    std::string     block_first_key;
+    std::string     compressed;
+    uint64_t        offset = 0;
+
+    std::vector<lsm_run::block_ref> index;
+    std::vector<uint64_t>           hashes;
+};
+
+// Embedded log-structured store of records keyed by DOI, made for a high
+// rate of upserts with an occasional full scan.
+//
+// Records go to a memtable, a hash map in memory. Once it's grown to
+// memtable_bytes, it's frozen and a background thread sorts its keys (see
+// string_sort.h) and writes it out as a new run, while a fresh memtable takes the writes; if the previous one is
+// still being written by then, put() waits. A lookup goes from the newest
+// data to the oldest, so the latest put() of a key wins.
+//
+// Compaction, in the same thread, keeps the number of runs at max_runs:
+// it merges the newest runs, taking in older ones as long as each is no
+// bigger than the newer ones taken so far together, so runs grow
+// geometrically and a record is rewritten a logarithmic number of times.
+//
+// The runs in use are listed by the MANIFEST file, replaced atomically;
+// files it doesn't list are leftovers of an interrupted flush or
+// compaction, and are removed on opening.
+//
+// Every memtable has a write-ahead log of its puts (see wal.h), which goes
+// once the memtable's run is in the MANIFEST. On opening, the logs left
+// are replayed and written out as a run. A put is durable once sync() has
+// returned; the puts made meanwhile by all the threads are synced together.
+// Without the log, what hasn't been flushed is lost on a crash.
+class lsm_store
+{
+public:
+    struct options
+    {
+        size_t      memtable_bytes  = size_t(64) << 20;
+        size_t      block_bytes     = size_t(64) << 10;     // uncompressed
+        int         zstd_level      = 3;
+        size_t      max_runs        = 4;
+        unsigned    bloom_bits      = 10;                   // per key
+        bool        wal             = true;
+        write_ahead_log::options    wal_options;
+    };
+
+    // Throws whatever the background thread's last flush failed with.
+    void put(const std::string &key, std::string &&value);
+    bool get(const std::string &key, std::string &value) const;
+
+    // Makes the puts made so far durable, in the log.
+    void sync();
+
+    // Writes the memtable out and waits till it's done.
+    void flush();
+
+    // Flushes, then calls on_record(key, value) for every key in ascending
+    // order, with its latest value.
+    template<typename F>
+    void scan(F on_record);
+
+    size_t runs() const;
+
+    // Throws std::system_error or std::runtime_error if the store can't be
+    // opened.
+    lsm_store(const std::string &directory, const options &o);
+    explicit lsm_store(const std::string &directory) :
+        lsm_store(directory, options()) {};
+    lsm_store(const lsm_store &other) = delete;
+    lsm_store &operator=(const lsm_store &other) = delete;
+    ~lsm_store();
+
+private:
+    using run_ptr   = std::shared_ptr<const lsm_run>;
+    using memtable  = std::unordered_map<std::string, std::string>;
+
+    // Calls on_record(key, value) for every key in the runs, given newest
+    // first, with the value from the newest run that has it.
+    template<typename F>
+    static void merge(const std::vector<run_ptr> &runs, F on_record);
+
+    void freeze(std::unique_lock<std::mutex> &lock);
+    void write_memtable(const memtable &m, const std::string &path) const;
+    void background();
+    void compact(std::unique_lock<std::mutex> &lock);
+    void load_manifest();
+    void replay_logs();
+    void save_manifest();
+    std::string run_path(uint64_t number) const;
+    std::string wal_path(uint64_t number) const;
+    void check_error() const;
+
+    std::string     dir;
+    options         opts;
+
+    mutable std::mutex          mutex;
+    std::condition_variable     work_cv;
+    std::condition_variable     done_cv;
+
+    memtable                        mem;
+    size_t                          mem_bytes = 0;
+    std::shared_ptr<const memtable> frozen;     // being written out
+    std::vector<run_ptr>            runs_;      // newest first
+    uint64_t                        next_run = 1;   // runs' & logs' numbers
+
+    std::shared_ptr<write_ahead_log>    wal;
+    uint64_t                            wal_number    = 0;
+    uint64_t                            frozen_wal    = 0;
+    uint64_t                            first_wal     = 0;  // older ones are obsolete
+    bool                            stopping = false;
+    std::exception_ptr              error;
+
+    std::thread     worker;
+};
+
+// FNV-1a, then mixed, since the bloom filter derives all its probes from it.
+inline uint64_t lsm_run::hash(const std::string &key)
+{
+    uint64_t h = 14695981039346656037ull;
+    for (char c : key)
+    {
+        h ^= static_cast<unsigned char>(c);
+        h *= 1099511628211ull;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    return h;
+};
+
+lsm_run::lsm_run(const std::string &path) :
+    file_path(path)
+{
+    fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        throw std::system_error(errno, std::generic_category(), path);
+    }
+
+    auto read_at = [&](char *buf, size_t len, uint64_t at)
+    {
+        while (len > 0)
+        {
+            ssize_t n = ::pread(fd, buf, len, static_cast<off_t>(at));
+            if (n < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (n <= 0)
+            {
+                ::close(fd);
+                throw std::system_error(n < 0 ? errno : EIO,
+                    std::generic_category(), path);
+            }
+            buf += n;
+            len -= static_cast<size_t>(n);
+            at  += static_cast<uint64_t>(n);
+        }
+    };
+
+    struct stat st;
+    footer f;
+    if (::fstat(fd, &st) != 0 || static_cast<uint64_t>(st.st_size) < sizeof(f))
+    {
+        ::close(fd);
+        throw std::runtime_error(path + ": not a run");
+    }
+    size = static_cast<uint64_t>(st.st_size);
+
+    read_at(reinterpret_cast<char *>(&f), sizeof(f), size - sizeof(f));
+    if (f.magic != magic || f.bloom_offset > f.index_offset ||
+        f.index_offset > size - sizeof(f))
+    {
+        ::close(fd);
+        throw std::runtime_error(path + ": not a run");
+    }
+
+    bloom.resize((f.index_offset - f.bloom_offset) / sizeof(uint64_t));
+    read_at(reinterpret_cast<char *>(bloom.data()),
+        bloom.size() * sizeof(uint64_t), f.bloom_offset);
+    n_hashes = f.n_hashes;
+
+    std::string idx(size - sizeof(f) - f.index_offset, '\0');
+    read_at(&idx[0], idx.size(), f.index_offset);
+    try
+    {
+        record::reader r{ idx.data(), idx.data() + idx.size() };
+        for (uint64_t n = r.varint(); n > 0; --n)
+        {
+            block_ref b;
+            b.first_key = r.string();
+            b.offset    = r.varint();
+            b.size      = static_cast<uint32_t>(r.varint());
+            b.raw_size  = static_cast<uint32_t>(r.varint());
+            index.push_back(std::move(b));
+        }
+    }
+    catch(const std::runtime_error &)
+    {
+        ::close(fd);
+        throw std::runtime_error(path + ": corrupt index");
+    }
+};
+
+lsm_run::~lsm_run()
+{
+    if (fd >= 0)
+    {
+        ::close(fd);
+    }
+};
+
+bool lsm_run::may_contain(const std::string &key) const
+{
+    if (bloom.empty())
+    {
+        return false;
+    }
+
+    const uint64_t n_bits = bloom.size() * 64;
+    uint64_t h     = hash(key);
+    uint64_t delta = (h >> 33) | (h << 31);
+    for (uint32_t i = 0; i < n_hashes; ++i)
+    {
+        uint64_t bit = h % n_bits;
+        if ((bloom[bit / 64] & (uint64_t(1) << (bit % 64))) == 0)
+        {
+            return false;
+        }
+        h += delta;
+    }
+    return true;
+};
+
+void lsm_run::read_block(size_t i, std::string &raw) const
+{
+    const block_ref &b = index[i];
+    std::string compressed(b.size, '\0');
+
+    size_t done = 0;
+    while (done < compressed.size())
+    {
+        ssize_t n = ::pread(fd, &compressed[done], compressed.size() - done,
+            static_cast<off_t>(b.offset + done));
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            throw std::system_error(n < 0 ? errno : EIO,
+                std::generic_category(), file_path);
+        }
+        done += static_cast<size_t>(n);
+    }
+
+    raw.resize(b.raw_size);
+    size_t res = ZSTD_decompress(&raw[0], raw.size(), compressed.data(),
+        compressed.size());
+    if (ZSTD_isError(res) || res != raw.size())
+    {
+        throw std::runtime_error(file_path + ": corrupt block");
+    }
+};
+
+bool lsm_run::get(const std::string &key, std::string &value) const
+{
+    if (!may_contain(key))
+    {
+        return false;
+    }
+
+    // The last block starting at or before the key.
+    auto it = std::upper_bound(index.begin(), index.end(), key,
+        [](const std::string &k, const block_ref &b) { return k < b.first_key; });
+    if (it == index.begin())
+    {
+        return false;
+    }
+
+    std::string raw;
+    read_block(static_cast<size_t>(it - index.begin() - 1), raw);
+
+    record::reader r{ raw.data(), raw.data() + raw.size() };
+    while (r.p != r.end)
+    {
+        std::string k = r.string();
+        uint64_t len  = r.varint();
+        if (k == key)
+        {
+            value.assign(r.p, static_cast<size_t>(len));
+            return true;
+        }
+        if (k > key)
+        {
+            break;
+        }
+        r.p += len;
+    }
+    return false;
+};
+
+lsm_run_writer::lsm_run_writer(const std::string &file, size_t block_len,
+    int level, unsigned bits_per_key) :
+    path(file),
+    out(file, std::ios::binary | std::ios::trunc),
+    block_bytes(block_len),
+    zstd_level(level),
+    bloom_bits(bits_per_key)
+{
+    if (!out)
+    {
+        throw std::system_error(errno, std::generic_category(), path);
+    }
+};
+
+void lsm_run_writer::add(const std::string &key, const std::string &value)
+{
+    if (block.empty())
+    {
+        block_first_key = key;
+    }
+    record::put_string(block, key);
+    record::put_string(block, value);
+    hashes.push_back(lsm_run::hash(key));
+
+    if (block.size() >= block_bytes)
+    {
+        flush_block();
+    }
+};
+
+void lsm_run_writer::flush_block()
+{
+    if (block.empty())
+    {
+        return;
+    }
+
+    compressed.resize(ZSTD_compressBound(block.size()));
+    size_t n = ZSTD_compress(&compressed[0], compressed.size(), block.data(),
+        block.size(), zstd_level);
+    if (ZSTD_isError(n))
+    {
+        throw std::runtime_error(path + ": " + ZSTD_getErrorName(n));
+    }
+    write(compressed.data(), n);
+
+    index.push_back(lsm_run::block_ref{ block_first_key, offset,
+        static_cast<uint32_t>(n), static_cast<uint32_t>(block.size()) });
+    offset += n;
+    block.clear();
+};
+
+void lsm_run_writer::write(const char *data, size_t len)
+{
+    out.write(data, static_cast<std::streamsize>(len));
+    if (!out)
+    {
+        throw std::system_error(EIO, std::generic_category(), path);
+    }
+};
+
+void lsm_run_writer::finish()
+{
+    flush_block();
+
+    // ~0.7 * bits per key probes is what minimises false positives: about
+    // 1% at 10 bits per key.
+    lsm_run::footer f;
+    f.n_keys   = hashes.size();
+    f.n_hashes = std::max(1u, bloom_bits * 7 / 10);
+    f.version  = 1;
+    f.magic    = lsm_run::magic;
+
+    std::vector<uint64_t> bloom((hashes.size() * bloom_bits + 63) / 64);
+    const uint64_t n_bits = bloom.size() * 64;
+    for (uint64_t h : hashes)
+    {
+        uint64_t delta = (h >> 33) | (h << 31);
+        for (uint32_t i = 0; i < f.n_hashes; ++i)
+        {
+            uint64_t bit = h % n_bits;
+            bloom[bit / 64] |= uint64_t(1) << (bit % 64);
+            h += delta;
+        }
+    }
+    f.bloom_offset = offset;
+    write(reinterpret_cast<const char *>(bloom.data()),
+        bloom.size() * sizeof(uint64_t));
+    offset += bloom.size() * sizeof(uint64_t);
+
+    std::string idx;
+    record::put_varint(idx, index.size());
+    for (const auto &b : index)
+    {
+        record::put_string(idx, b.first_key);
+        record::put_varint(idx, b.offset);
+        record::put_varint(idx, b.size);
+        record::put_varint(idx, b.raw_size);
+    }
+    f.index_offset = offset;
+    write(idx.data(), idx.size());
+    write(reinterpret_cast<const char *>(&f), sizeof(f));
+
+    out.close();
+    if (!out)
+    {
+        throw std::system_error(EIO, std::generic_category(), path);
+    }
+    sync_path(path);
+};
+
+lsm_store::lsm_store(const std::string &directory, const options &o) :
+    dir(directory),
+    opts(o)
+{
+    if (::mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST)
+    {
+        throw std::system_error(errno, std::generic_category(), dir);
+    }
+    load_manifest();
+    replay_logs();
+
+    if (opts.wal)
+    {
+        wal_number = next_run++;
+        wal = std::make_shared<write_ahead_log>(wal_path(wal_number),
+            opts.wal_options);
+    }
+
+    worker = std::thread(&lsm_store::background, this);
+};
+
+lsm_store::~lsm_store()
+{
+    try
+    {
+        flush();
+    }
+    catch(const std::exception &)
+    {
+        // Reported by the last put() or flush() the owner made, if any.
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    work_cv.notify_all();
+    worker.join();
+
+    // All of it is in the runs now, unless the flush has failed.
+    if (wal && !error)
+    {
+        wal.reset();
+        std::remove(wal_path(wal_number).c_str());
+    }
+};
+
+std::string lsm_store::run_path(uint64_t number) const
+{
+    char name[32];
+    std::snprintf(name, sizeof(name), "/run-%06llu.sst",
+        static_cast<unsigned long long>(number));
+    return dir + name;
+};
+
+std::string lsm_store::wal_path(uint64_t number) const
+{
+    char name[32];
+    std::snprintf(name, sizeof(name), "/wal-%06llu.log",
+        static_cast<unsigned long long>(number));
+    return dir + name;
+};
+
+void lsm_store::check_error() const
+{
+    if (error)
+    {
+        std::rethrow_exception(error);
+    }
+};
+
+void lsm_store::put(const std::string &key, std::string &&value)
+{
+    std::string entry;
+    if (opts.wal)
+    {
+        record::put_string(entry, key);
+        record::put_string(entry, value);
+    }
+
+    std::unique_lock<std::mutex> lock(mutex);
+    check_error();
+
+    if (wal)
+    {
+        wal->append(entry);
+    }
+
+    auto res = mem.emplace(key, std::string());
+    if (res.second)
+    {
+        mem_bytes += key.size() + sizeof(memtable::value_type);
+    }
+    mem_bytes = mem_bytes - res.first->second.size() + value.size();
+    res.first->second = std::move(value);
+
+    if (mem_bytes >= opts.memtable_bytes)
+    {
+        freeze(lock);
+    }
+};
+
+// Writes a memtable out as a run, in its keys' order.
+void lsm_store::write_memtable(const memtable &m, const std::string &path) const
+{
+    std::vector<const memtable::value_type *> entries;
+    entries.reserve(m.size());
+    for (const auto &kv : m)
+    {
+        entries.push_back(&kv);
+    }
+    string_sort(entries.data(), entries.data() + entries.size(),
+        [](const memtable::value_type *kv)
+        {
+            return std::pair<const char *, size_t>(kv->first.data(), kv->first.size());
+        });
+
+    lsm_run_writer w(path, opts.block_bytes, opts.zstd_level, opts.bloom_bits);
+    for (const memtable::value_type *kv : entries)
+    {
+        w.add(kv->first, kv->second);
+    }
+    w.finish();
+};
+
+// Hands the memtable over to the background thread, with its log.
+void lsm_store::freeze(std::unique_lock<std::mutex> &lock)
+{
+    // The previous memtable must be out before this one is frozen.
+    done_cv.wait(lock, [&] { return !frozen || error; });
+    check_error();
+
+    // The new log's records mustn't get to the disk before the old one's.
+    if (wal)
+    {
+        wal->sync();
+        frozen_wal = wal_number;
+        wal_number = next_run++;
+        wal = std::make_shared<write_ahead_log>(wal_path(wal_number),
+            opts.wal_options);
+    }
+
+    frozen = std::make_shared<const memtable>(std::move(mem));
+    mem.clear();
+    mem_bytes = 0;
+    work_cv.notify_one();
+};
+
+bool lsm_store::get(const std::string &key, std::string &value) const
+{
+    std::vector<run_ptr> snapshot;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        auto it = mem.find(key);
+        if (it != mem.end())
+        {
+            value = it->second;
+            return true;
+        }
+        if (frozen)
+        {
+            it = frozen->find(key);
+            if (it != frozen->end())
+            {
+                value = it->second;
+                return true;
+            }
+        }
+        snapshot = runs_;
+    }
+
+    for (const run_ptr &r : snapshot)
+    {
+        if (r->get(key, value))
+        {
+            return true;
+        }
+    }
+    return false;
+};
+
+void lsm_store::sync()
+{
+    std::shared_ptr<write_ahead_log> log;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        check_error();
+        log = wal;
+    }
+    // A log replaced meanwhile has been synced already.
+    if (log)
+    {
+        log->sync();
+    }
+};
+
+void lsm_store::flush()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    check_error();
+
+    if (!mem.empty())
+    {
+        freeze(lock);
+    }
+    done_cv.wait(lock, [&] { return !frozen || error; });
+    check_error();
+};
+
+size_t lsm_store::runs() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return runs_.size();
+};
+
+template<typename F>
+void lsm_store::scan(F on_record)
+{
+    flush();
+
+    std::vector<run_ptr> snapshot;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        snapshot = runs_;
+    }
+    merge(snapshot, on_record);
+};
+
+template<typename F>
+void lsm_store::merge(const std::vector<run_ptr> &runs, F on_record)
+{
+    struct cursor
+    {
+        const lsm_run  *run;
+        size_t          block = 0;
+        std::string     raw;
+        record::reader  r{ nullptr, nullptr };
+        std::string     key;
+        std::string     value;
+
+        bool next()
+        {
+            while (r.p == r.end)
+            {
+                if (block == run->blocks())
+                {
+                    return false;
+                }
+                run->read_block(block++, raw);
+                r = record::reader{ raw.data(), raw.data() + raw.size() };
+            }
+            key   = r.string();
+            value = r.string();
+            return true;
+        }
+    };
+
+    std::vector<cursor> cursors(runs.size());
+    for (size_t i = 0; i < runs.size(); ++i)
+    {
+        cursors[i].run = runs[i].get();
+    }
+
+    // The smallest key on top; of equal keys, the newest run's.
+    auto later = [&](size_t a, size_t b)
+    {
+        int c = cursors[a].key.compare(cursors[b].key);
+        return c != 0 ? c > 0 : a > b;
+    };
+    std::priority_queue<size_t, std::vector<size_t>, decltype(later)> heap(later);
+    for (size_t i = 0; i < cursors.size(); ++i)
+    {
+        if (cursors[i].next())
+        {
+            heap.push(i);
+        }
+    }
+
+    while (!heap.empty())
+    {
+        size_t top = heap.top();
+        heap.pop();
+        on_record(static_cast<const std::string &>(cursors[top].key),
+            static_cast<const std::string &>(cursors[top].value));
+
+        // Older versions of the key.
+        while (!heap.empty() && cursors[heap.top()].key == cursors[top].key)
+        {
+            size_t i = heap.top();
+            heap.pop();
+            if (cursors[i].next())
+            {
+                heap.push(i);
+            }
+        }
+        if (cursors[top].next())
+        {
+            heap.push(top);
+        }
+    }
+};
+
+void lsm_store::background()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+
+    while (true)
+    {
+        work_cv.wait(lock, [&]
+        {
+            return stopping || (!error && (frozen || runs_.size() > opts.max_runs));
+        });
+
+        if (frozen && !error)
+        {
+            std::shared_ptr<const memtable> m = frozen;
+            std::string path = run_path(next_run++);
+            uint64_t    log  = frozen_wal;
+            lock.unlock();
+
+            run_ptr written;
+            std::exception_ptr failure;
+            try
+            {
+                write_memtable(*m, path);
+                written = std::make_shared<const lsm_run>(path);
+            }
+            catch(...)
+            {
+                failure = std::current_exception();
+            }
+
+            lock.lock();
+            if (!failure)
+            {
+                runs_.insert(runs_.begin(), written);
+                if (wal)
+                {
+                    first_wal = log + 1;
+                }
+                try
+                {
+                    save_manifest();
+                    if (wal)
+                    {
+                        std::remove(wal_path(log).c_str());
+                    }
+                }
+                catch(...)
+                {
+                    failure = std::current_exception();
+                }
+            }
+            error  = failure;
+            frozen.reset();
+            done_cv.notify_all();
+        }
+        else if (stopping)
+        {
+            break;
+        }
+        else if (!error)
+        {
+            compact(lock);
+        }
+    }
+};
+
+// Called with the lock held; releases it while merging.
+void lsm_store::compact(std::unique_lock<std::mutex> &lock)
+{
+    size_t   k     = 1;
+    uint64_t total = runs_[0]->file_size();
+    while (k < runs_.size() && (k < 2 || runs_[k]->file_size() <= total))
+    {
+        total += runs_[k]->file_size();
+        ++k;
+    }
+    std::vector<run_ptr> inputs(runs_.begin(), runs_.begin() +
+        static_cast<std::ptrdiff_t>(k));
+    std::string path = run_path(next_run++);
+    lock.unlock();
+
+    run_ptr merged;
+    try
+    {
+        lsm_run_writer w(path, opts.block_bytes, opts.zstd_level,
+            opts.bloom_bits);
+        merge(inputs, [&](const std::string &key, const std::string &value)
+        {
+            w.add(key, value);
+        });
+        w.finish();
+        merged = std::make_shared<const lsm_run>(path);
+    }
+    catch(...)
+    {
+        lock.lock();
+        error = std::current_exception();
+        done_cv.notify_all();
+        return;
+    }
+
+    lock.lock();
+    // Runs flushed meanwhile went in front of the inputs.
+    auto first = std::find(runs_.begin(), runs_.end(), inputs[0]);
+    first = runs_.erase(first, first + static_cast<std::ptrdiff_t>(k));
+    runs_.insert(first, merged);
+    try
+    {
+        save_manifest();
+    }
+    catch(...)
+    {
+        error = std::current_exception();
+        done_cv.notify_all();
+        return;
+    }
+
+    // Lookups still holding the inputs keep their files open.
+    for (const run_ptr &r : inputs)
+    {
+        std::remove(r->path().c_str());
+    }
+};
+
+// MANIFEST: "next <number>", "log <number>" (the first log in use), then
+// the runs' file names, newest first.
+void lsm_store::load_manifest()
+{
+    std::ifstream in(dir + "/MANIFEST");
+    std::string line;
+    std::vector<std::string> live;
+
+    if (in && std::getline(in, line) && line.compare(0, 5, "next ") == 0)
+    {
+        next_run = std::stoull(line.substr(5));
+        while (std::getline(in, line))
+        {
+            if (line.compare(0, 4, "log ") == 0)
+            {
+                first_wal = std::stoull(line.substr(4));
+            }
+            else if (!line.empty())
+            {
+                runs_.push_back(std::make_shared<const lsm_run>(dir + '/' + line));
+                live.push_back(line);
+            }
+        }
+    }
+
+    DIR *d = ::opendir(dir.c_str());
+    if (d == nullptr)
+    {
+        throw std::system_error(errno, std::generic_category(), dir);
+    }
+    while (const dirent *entry = ::readdir(d))
+    {
+        std::string name = entry->d_name;
+        bool is_run = name.compare(0, 4, "run-") == 0 &&
+            std::find(live.begin(), live.end(), name) == live.end();
+        if (is_run || name == "MANIFEST.tmp")
+        {
+            std::remove((dir + '/' + name).c_str());
+        }
+    }
+    ::closedir(d);
+};
+
+// Replays the logs of the memtables that weren't written out, and writes
+// what they hold out as a run. The obsolete logs are removed.
+void lsm_store::replay_logs()
+{
+    std::vector<uint64_t> logs;
+
+    DIR *d = ::opendir(dir.c_str());
+    if (d == nullptr)
+    {
+        throw std::system_error(errno, std::generic_category(), dir);
+    }
+    while (const dirent *entry = ::readdir(d))
+    {
+        std::string name = entry->d_name;
+        if (name.compare(0, 4, "wal-") != 0)
+        {
+            continue;
+        }
+        uint64_t n = std::stoull(name.substr(4));
+        if (n < first_wal)
+        {
+            std::remove((dir + '/' + name).c_str());
+        }
+        else
+        {
+            logs.push_back(n);
+        }
+    }
+    ::closedir(d);
+
+    std::sort(logs.begin(), logs.end());
+    for (uint64_t n : logs)
+    {
+        write_ahead_log::replay(wal_path(n), [&](const char *data, size_t len)
+        {
+            record::reader r{ data, data + len };
+            std::string key = r.string();
+            mem[key] = r.string();
+        });
+        next_run = std::max(next_run, n + 1);
+    }
+
+    if (!mem.empty())
+    {
+        std::string path = run_path(next_run++);
+        write_memtable(mem, path);
+        runs_.insert(runs_.begin(), std::make_shared<const lsm_run>(path));
+        mem.clear();
+    }
+    if (!logs.empty())
+    {
+        first_wal = next_run;
+        save_manifest();
+        for (uint64_t n : logs)
+        {
+            std::remove(wal_path(n).c_str());
+        }
+    }
+};
+
+// Called with the lock held.
+void lsm_store::save_manifest()
+{
+    const std::string path = dir + "/MANIFEST";
+    {
+        std::ofstream out(path + ".tmp", std::ios::trunc);
+        out << "next " << next_run << '\n';
+        out << "log " << first_wal << '\n';
+        for (const run_ptr &r : runs_)
+        {
+            out << r->path().substr(dir.size() + 1) << '\n';
+        }
+        out.close();
+        if (!out)
+        {
+            throw std::system_error(EIO, std::generic_category(), path);
+        }
+    }
+    sync_path(path + ".tmp");
+    if (std::rename((path + ".tmp").c_str(), path.c_str()) != 0)
+    {
+        throw std::system_error(errno, std::generic_category(), path);
+    }
+    sync_path(dir);
+};
+}
+#endif
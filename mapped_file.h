@@ -0,0 +1,177 @@
+/*
+ * Copyright (c) 2022 - present, GitHub: @cubter
+ *
+ * See COPYING.txt in the project root for license information.
+ */
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <system_error>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace metasci
+{
+// Read-only memory mapping of a whole file. The file's contents are seen as
+// a single contiguous buffer without being copied through stream buffers.
+// Throws std::system_error if the file can't be opened or mapped.
+//
+// The file is expected to be read front to back, so the kernel is asked for
+// aggressive readahead. Big files are mapped at a huge page boundary and
+// marked for transparent huge pages, which the kernel honours where the file
+// system supports them and ignores otherwise.
+//
+// release() gives the already parsed beginning of the file back: the pages
+// are unmapped and dropped from the page cache, so a multi-GB file doesn't
+// hold all of its pages until the end of the parsing.
+class mapped_file
+{
+public:
+    const char *data() const { return begin; }
+    size_t      size() const { return length; }
+
+    // Releases the whole pages lying before offset. Nothing before it may
+    // be accessed afterwards. Not thread-safe.
+    inline void release(size_t offset);
+
+    inline mapped_file(const std::string &path);
+    mapped_file(const mapped_file &other) = delete;
+    mapped_file &operator=(const mapped_file &other) = delete;
+    inline ~mapped_file();
+
+private:
+    static const size_t huge_page_size = size_t(2) << 20;
+
+    inline const char *map_aligned(int fd, size_t align);
+
+    int         fd       = -1;
+    const char  *begin   = nullptr;
+    size_t      length   = 0;
+    size_t      released = 0;   // bytes unmapped from the front
+    size_t      page_size;
+};
+
+inline mapped_file::mapped_file(const std::string &path) :
+    page_size(static_cast<size_t>(::sysconf(_SC_PAGESIZE)))
+{
+    fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        throw std::system_error(errno, std::generic_category(), path);
+    }
+
+    struct stat st;
+    if (::fstat(fd, &st) != 0)
+    {
+        int err = errno;
+        ::close(fd);
+        throw std::system_error(err, std::generic_category(), path);
+    }
+    length = static_cast<size_t>(st.st_size);
+
+    // mmap refuses empty mappings; an empty file is simply an empty buffer.
+    if (length == 0)
+    {
+        return;
+    }
+
+    begin = map_aligned(fd, length >= huge_page_size ? huge_page_size : 0);
+    if (begin == nullptr)
+    {
+        int err = errno;
+        ::close(fd);
+        throw std::system_error(err, std::generic_category(), path);
+    }
+
+    void *p = const_cast<char *>(begin);
+    ::madvise(p, length, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+    if (length >= huge_page_size)
+    {
+        ::madvise(p, length, MADV_HUGEPAGE);
+    }
+#endif
+    ::posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+};
+
+// Maps the file at an address aligned to `align` (if it isn't 0): a region
+// bigger by `align` is reserved, the file is mapped over its aligned part,
+// and the slack is given back. Returns nullptr on failure.
+inline const char *mapped_file::map_aligned(int file, size_t align)
+{
+    if (align == 0)
+    {
+        void *p = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, file, 0);
+        return p == MAP_FAILED ? nullptr : static_cast<const char *>(p);
+    }
+
+    size_t reserved = length + align;
+    void *r = ::mmap(nullptr, reserved, PROT_NONE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (r == MAP_FAILED)
+    {
+        return map_aligned(file, 0);
+    }
+
+    uintptr_t base    = reinterpret_cast<uintptr_t>(r);
+    uintptr_t aligned = (base + align - 1) & ~(uintptr_t(align) - 1);
+    char *at = reinterpret_cast<char *>(aligned);
+
+    void *p = ::mmap(at, length, PROT_READ, MAP_PRIVATE | MAP_FIXED, file, 0);
+    if (p == MAP_FAILED)
+    {
+        ::munmap(r, reserved);
+        return map_aligned(file, 0);
+    }
+
+    // Slack before and after the mapping, the latter rounded to pages.
+    size_t head = aligned - base;
+    size_t used = (length + page_size - 1) & ~(page_size - 1);
+    if (head > 0)
+    {
+        ::munmap(r, head);
+    }
+    if (head + used < reserved)
+    {
+        ::munmap(at + used, reserved - head - used);
+    }
+
+    return at;
+};
+
+inline void mapped_file::release(size_t offset)
+{
+    size_t upto = (offset < length ? offset : length) & ~(page_size - 1);
+    if (upto <= released)
+    {
+        return;
+    }
+
+    ::munmap(const_cast<char *>(begin) + released, upto - released);
+    // Unmapping only drops this mapping's references; the page cache keeps
+    // the pages unless told otherwise.
+    ::posix_fadvise(fd, static_cast<off_t>(released),
+        static_cast<off_t>(upto - released), POSIX_FADV_DONTNEED);
+    released = upto;
+};
+
+inline mapped_file::~mapped_file()
+{
+    if (begin != nullptr && released < length)
+    {
+        ::munmap(const_cast<char *>(begin) + released, length - released);
+    }
+    if (fd >= 0)
+    {
+        ::close(fd);
+    }
+};
+}
+#endif
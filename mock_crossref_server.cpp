@@ -0,0 +1,565 @@
+/*
+ * Copyright (c) 2022 - present, GitHub: @cubter
+ *
+ * See COPYING.txt in the project root for license information.
+ */
+
+// A stand-in for Crossref's REST API, for testing the harvester (see
+// async_api_connector.h) offline. It replays the works of recorded pages or
+// dump files ({"items": [...]} or {"message": {"items": [...]}}), paging
+// through them with cursors the way /works does: cursor=* starts from the
+// first work, every page tells the cursor of the next one, and a page
+// without items ends the walk. The from-index-date & until-index-date
+// filters are applied; rows=0 only counts the works.
+//
+// Rate limiting is imitated: the responses announce the limits, and the
+// requests above the limit are refused with 429. Latency can be added to
+// every response, to see what keeping many requests in flight buys.
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using std::string;
+using std::cerr;
+using std::endl;
+using clock_type = std::chrono::steady_clock;
+
+struct server_options
+{
+    int         port        = 8080;
+    unsigned    rate_limit  = 50;   // requests per second
+    unsigned    concurrency = 0;    // announced only; 0 is none
+    unsigned    latency_ms  = 0;
+    unsigned    max_rows    = 1000;
+};
+
+// A work, with the date it was indexed on (YYYY-MM-DD), if it has one.
+struct work
+{
+    string json;
+    string indexed;
+};
+
+// A client's connection: requests are served one at a time, in order.
+struct connection
+{
+    int                     fd;
+    string                  in;
+    string                  out;
+    size_t                  sent = 0;
+    clock_type::time_point  ready_at;   // of the response in out
+    bool                    closing = false;
+};
+
+void usage();
+bool load_items(const string &path, std::vector<work> &items);
+string indexed_date(const string &item);
+void list_files(const string &path, std::vector<string> &files);
+string url_decode(const string &s);
+string query_param(const string &target, const string &name);
+const std::vector<size_t> &select(const std::vector<work> &items,
+    const string &filter);
+string respond(const string &request, const std::vector<work> &items,
+    const server_options &opts, bool throttled, bool &keep_alive);
+
+int main(int argc, char const *argv[])
+{
+    // -p N listens on port N.
+    // -r N announces, and enforces, a limit of N requests per second.
+    // -c N announces a limit of N concurrent requests.
+    // -l N delays every response by N ms.
+    server_options opts;
+
+    while (argc > 1 && argv[1][0] == '-')
+    {
+        string option = argv[1];
+        if (argc < 3 || (option != "-p" && option != "-r" && option != "-c" &&
+            option != "-l"))
+        {
+            usage();
+            return 1;
+        }
+        int n = std::max(0, std::atoi(argv[2]));
+        if (option == "-p")
+        {
+            opts.port = n;
+        }
+        else
+        {
+            (option == "-r" ? opts.rate_limit : option == "-c" ?
+                opts.concurrency : opts.latency_ms) = static_cast<unsigned>(n);
+        }
+        argc -= 2;
+        argv += 2;
+    }
+    if (argc < 2)
+    {
+        usage();
+        return 1;
+    }
+
+    std::vector<string> files;
+    for (int i = 1; i < argc; ++i)
+    {
+        list_files(argv[i], files);
+    }
+    std::vector<work> items;
+    for (const string &f : files)
+    {
+        if (!load_items(f, items))
+        {
+            cerr << "No items in " << f << ". Skipping" << endl;
+        }
+    }
+
+    int listener = ::socket(AF_INET, SOCK_STREAM, 0);
+    int on = 1;
+    ::setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    sockaddr_in addr{};
+    addr.sin_family      = AF_INET;
+    addr.sin_port        = htons(static_cast<uint16_t>(opts.port));
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (::bind(listener, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 ||
+        ::listen(listener, 128) != 0)
+    {
+        cerr << "Couldn't listen on port " << opts.port << ": "
+            << std::strerror(errno) << endl;
+        return 1;
+    }
+    ::fcntl(listener, F_SETFL, O_NONBLOCK);
+    std::signal(SIGPIPE, SIG_IGN);
+
+    cerr << "Serving " << items.size() << " works from " << files.size()
+        << " files on http://127.0.0.1:" << opts.port << "/works" << endl;
+
+    std::vector<connection>  conns;
+    std::vector<pollfd>      fds;
+    clock_type::time_point   window = clock_type::now();
+    unsigned                 in_window = 0;
+
+    while (true)
+    {
+        // Wakes up for the earliest delayed response, if any.
+        auto now = clock_type::now();
+        int timeout = -1;
+        fds.assign(1, pollfd{ listener, POLLIN, 0 });
+        for (const connection &c : conns)
+        {
+            short events = POLLIN;
+            if (c.sent < c.out.size())
+            {
+                if (c.ready_at <= now)
+                {
+                    events |= POLLOUT;
+                }
+                else
+                {
+                    int ms = static_cast<int>(std::chrono::duration_cast<
+                        std::chrono::milliseconds>(c.ready_at - now).count()) + 1;
+                    timeout = timeout < 0 ? ms : std::min(timeout, ms);
+                }
+            }
+            fds.push_back(pollfd{ c.fd, events, 0 });
+        }
+
+        if (::poll(fds.data(), fds.size(), timeout) < 0 && errno != EINTR)
+        {
+            cerr << "poll: " << std::strerror(errno) << endl;
+            return 1;
+        }
+
+        for (size_t i = 0; i < conns.size(); ++i)
+        {
+            connection &c = conns[i];
+            short revents = fds[i + 1].revents;
+            bool  dead    = (revents & (POLLERR | POLLHUP)) && !(revents & POLLIN);
+
+            if (revents & POLLIN)
+            {
+                char buf[1 << 14];
+                ssize_t n = ::read(c.fd, buf, sizeof(buf));
+                if (n > 0)
+                {
+                    c.in.append(buf, static_cast<size_t>(n));
+                }
+                else if (n == 0 || errno != EAGAIN)
+                {
+                    dead = true;
+                }
+            }
+
+            if (revents & POLLOUT)
+            {
+                ssize_t n = ::write(c.fd, c.out.data() + c.sent, c.out.size() - c.sent);
+                if (n > 0)
+                {
+                    c.sent += static_cast<size_t>(n);
+                }
+                else if (errno != EAGAIN)
+                {
+                    dead = true;
+                }
+                if (c.sent == c.out.size())
+                {
+                    c.out.clear();
+                    c.sent = 0;
+                    dead = dead || c.closing;
+                }
+            }
+
+            // The next request, once the previous response has gone.
+            size_t end = c.in.find("\r\n\r\n");
+            if (!dead && c.out.empty() && end != string::npos)
+            {
+                now = clock_type::now();
+                if (now - window >= std::chrono::seconds(1))
+                {
+                    window    = now;
+                    in_window = 0;
+                }
+                bool throttled = opts.rate_limit > 0 && ++in_window > opts.rate_limit;
+
+                bool keep_alive;
+                c.out = respond(c.in.substr(0, end), items, opts, throttled, keep_alive);
+                c.in.erase(0, end + 4);
+                c.closing  = !keep_alive;
+                c.ready_at = now + std::chrono::milliseconds(opts.latency_ms);
+            }
+
+            if (dead)
+            {
+                ::close(c.fd);
+                conns.erase(conns.begin() + static_cast<std::ptrdiff_t>(i));
+                fds.erase(fds.begin() + static_cast<std::ptrdiff_t>(i) + 1);
+                --i;
+            }
+        }
+
+        // New connections, polled from the next round on.
+        if (fds[0].revents & POLLIN)
+        {
+            int fd;
+            while ((fd = ::accept(listener, nullptr, nullptr)) >= 0)
+            {
+                ::fcntl(fd, F_SETFL, O_NONBLOCK);
+                ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+                conns.push_back(connection{ fd, string(), string(), 0,
+                    clock_type::now(), false });
+            }
+        }
+    }
+}
+
+void usage()
+{
+    cerr << "Usage: mock_crossref_server [-p <port>] [-r <requests_per_s>] "
+        "[-c <concurrency>] [-l <latency_ms>] <file | dir>..." << endl;
+}
+
+// Files of a directory, in lexicographic order, or the path itself.
+void list_files(const string &path, std::vector<string> &files)
+{
+    DIR *dir = ::opendir(path.c_str());
+    if (dir == nullptr)
+    {
+        files.push_back(path);
+        return;
+    }
+    std::vector<string> names;
+    while (dirent *e = ::readdir(dir))
+    {
+        if (e->d_name[0] != '.')
+        {
+            names.push_back(path + '/' + e->d_name);
+        }
+    }
+    ::closedir(dir);
+    std::sort(names.begin(), names.end());
+    files.insert(files.end(), names.begin(), names.end());
+}
+
+// Appends the works of the "items" array, as raw JSON, to items.
+bool load_items(const string &path, std::vector<work> &items)
+{
+    std::ifstream in(path, std::ios::binary);
+    std::ostringstream contents;
+    contents << in.rdbuf();
+    const string text = contents.str();
+
+    size_t pos = text.find("\"items\"");
+    while (pos != string::npos)
+    {
+        size_t b = text.find_first_not_of(" \t\r\n:", pos + 7);
+        if (b != string::npos && text[b] == '[')
+        {
+            pos = b;
+            break;
+        }
+        pos = text.find("\"items\"", pos + 7);
+    }
+    if (pos == string::npos)
+    {
+        return false;
+    }
+
+    int    depth     = 0;
+    bool   in_string = false;
+    size_t begin     = 0;
+    for (size_t i = pos + 1; i < text.size(); ++i)
+    {
+        char c = text[i];
+        if (in_string)
+        {
+            if (c == '\\')
+            {
+                ++i;
+            }
+            else if (c == '"')
+            {
+                in_string = false;
+            }
+            continue;
+        }
+        switch (c)
+        {
+            case '"':
+                in_string = true;
+                break;
+            case '{':
+            case '[':
+                if (depth++ == 0)
+                {
+                    begin = i;
+                }
+                break;
+            case '}':
+            case ']':
+                if (depth == 0)
+                {
+                    return true;    // the end of "items"
+                }
+                if (--depth == 0)
+                {
+                    string json = text.substr(begin, i + 1 - begin);
+                    string date = indexed_date(json);
+                    items.push_back(work{ std::move(json), std::move(date) });
+                }
+                break;
+            default:
+                break;
+        }
+    }
+    return false;
+}
+
+// "indexed": {"date-parts": [[2022, 1, 31]], ...}
+string indexed_date(const string &item)
+{
+    size_t pos = item.find("\"indexed\"");
+    pos = pos == string::npos ? pos : item.find("\"date-parts\"", pos);
+    pos = pos == string::npos ? pos : item.find_first_of("0123456789", pos);
+    if (pos == string::npos)
+    {
+        return string();
+    }
+    int parts[3] = { 0, 1, 1 };
+    const char *p = item.c_str() + pos;
+    for (int i = 0; i < 3; ++i)
+    {
+        char *end;
+        parts[i] = static_cast<int>(std::strtol(p, &end, 10));
+        p = end;
+        while (*p == ' ' || *p == ',')
+        {
+            ++p;
+        }
+        if (*p < '0' || *p > '9')
+        {
+            break;
+        }
+    }
+    char date[16];
+    std::snprintf(date, sizeof(date), "%04d-%02d-%02d", parts[0], parts[1], parts[2]);
+    return date;
+}
+
+// The works the filter lets through; other filters than the index dates'
+// are ignored. Dates compare as strings, so that "2022" or "2022-01" work
+// as well as full dates.
+const std::vector<size_t> &select(const std::vector<work> &items,
+    const string &filter)
+{
+    static std::map<string, std::vector<size_t>> cache;
+    auto found = cache.find(filter);
+    if (found != cache.end())
+    {
+        return found->second;
+    }
+
+    string from, until;
+    size_t pos = 0;
+    while (pos <= filter.size())
+    {
+        size_t end = filter.find(',', pos);
+        end = end == string::npos ? filter.size() : end;
+        string f = filter.substr(pos, end - pos);
+        if (f.compare(0, 16, "from-index-date:") == 0)
+        {
+            from = f.substr(16);
+        }
+        else if (f.compare(0, 17, "until-index-date:") == 0)
+        {
+            until = f.substr(17);
+        }
+        pos = end + 1;
+    }
+
+    std::vector<size_t> &selected = cache[filter];
+    for (size_t i = 0; i < items.size(); ++i)
+    {
+        const string &d = items[i].indexed;
+        if ((from.empty() || d >= from) &&
+            (until.empty() || d.compare(0, until.size(), until) <= 0))
+        {
+            selected.push_back(i);
+        }
+    }
+    return selected;
+}
+
+string url_decode(const string &s)
+{
+    string out;
+    for (size_t i = 0; i < s.size(); ++i)
+    {
+        if (s[i] == '%' && i + 2 < s.size())
+        {
+            out += static_cast<char>(std::strtol(s.substr(i + 1, 2).c_str(), nullptr, 16));
+            i += 2;
+        }
+        else
+        {
+            out += s[i] == '+' ? ' ' : s[i];
+        }
+    }
+    return out;
+}
+
+string query_param(const string &target, const string &name)
+{
+    size_t q = target.find('?');
+    while (q != string::npos)
+    {
+        size_t end = target.find('&', q + 1);
+        string pair = target.substr(q + 1, end == string::npos ? string::npos : end - q - 1);
+        if (pair.compare(0, name.size() + 1, name + "=") == 0)
+        {
+            return url_decode(pair.substr(name.size() + 1));
+        }
+        q = end;
+    }
+    return string();
+}
+
+// The response to a request's head. A cursor is the offset of the page's
+// first work among the selected ones, after an "o"; without a cursor, the
+// first page is served.
+string respond(const string &request, const std::vector<work> &items,
+    const server_options &opts, bool throttled, bool &keep_alive)
+{
+    string target;
+    size_t sp = request.find(' ');
+    if (sp != string::npos)
+    {
+        target = request.substr(sp + 1, request.find(' ', sp + 1) - sp - 1);
+    }
+    string lower = request;
+    std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+    keep_alive = lower.find("connection: close") == string::npos;
+
+    string status = "200 OK";
+    string extra;
+    string body;
+
+    string cursor = query_param(target, "cursor");
+    size_t offset = cursor == "*" || cursor.empty() ? 0 :
+        cursor.size() > 1 && cursor[0] == 'o' ? std::strtoul(cursor.c_str() + 1, nullptr, 10) :
+        string::npos;
+
+    if (target.compare(0, 6, "/works") != 0)
+    {
+        status = "404 Not Found";
+        body   = "Resource not found.";
+    }
+    else if (throttled)
+    {
+        status = "429 Too Many Requests";
+        extra  = "Retry-After: 1\r\n";
+        body   = "Too many requests.";
+    }
+    else if (offset == string::npos)
+    {
+        status = "400 Bad Request";
+        body   = "{\"status\":\"failed\",\"message\":[{\"type\":\"cursor-invalid\"}]}";
+    }
+    else
+    {
+        string rows_param = query_param(target, "rows");
+        size_t rows = rows_param.empty() ? 20 : std::strtoul(rows_param.c_str(), nullptr, 10);
+        rows = std::min<size_t>(rows, opts.max_rows);
+
+        const std::vector<size_t> &selected = select(items,
+            query_param(target, "filter"));
+        size_t first = std::min(offset, selected.size());
+        size_t last  = std::min(first + rows, selected.size());
+
+        body = "{\"status\":\"ok\",\"message-type\":\"work-list\","
+            "\"message-version\":\"1.0.0\",\"message\":{\"facets\":{},"
+            "\"next-cursor\":\"o" + std::to_string(last) + "\","
+            "\"total-results\":" + std::to_string(selected.size()) + ",\"items\":[";
+        for (size_t i = first; i < last; ++i)
+        {
+            body += items[selected[i]].json;
+            body += i + 1 < last ? "," : "";
+        }
+        body += "],\"items-per-page\":" + std::to_string(rows) +
+            ",\"query\":{\"start-index\":0,\"search-terms\":null}}}";
+    }
+
+    string head = "HTTP/1.1 " + status + "\r\n"
+        "Content-Type: application/json\r\n"
+        "Content-Length: " + std::to_string(body.size()) + "\r\n";
+    if (opts.rate_limit > 0)
+    {
+        head += "X-Rate-Limit-Limit: " + std::to_string(opts.rate_limit) + "\r\n"
+            "X-Rate-Limit-Interval: 1s\r\n";
+    }
+    if (opts.concurrency > 0)
+    {
+        head += "X-Concurrency-Limit: " + std::to_string(opts.concurrency) + "\r\n";
+    }
+    head += extra;
+    head += keep_alive ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n";
+
+    return head + body;
+}
@@ -0,0 +1,278 @@
+/*
+ * Copyright (c) 2022 - present, GitHub: @cubter
+ *
+ * See COPYING.txt in the project root for license information.
+ */
+#ifndef NODE_MERGE_H
+#define NODE_MERGE_H
+
+#include "author.h"
+#include "author_resolver.h"
+#include "journal.h"
+#include "output_dictionary.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace metasci
+{
+// Multi-node ingest: a dump's shards are split between N nodes (machines, or
+// processes), each of which ingests its part on its own, and the nodes'
+// outputs are then merged into one.
+//
+// A shard goes to the node given by the hash of its file name, so that
+// every node picks its part of the same directory without talking to the
+// others, and a shard goes to the same node on every run. A node's output
+// is an ORC file like any other, numbered by the node's own counters, with
+// its dictionary beside it (see output_dictionary.h), by the node's IDs.
+//
+// Merging combines the dictionaries node by node, in the nodes' order:
+// subjects, journals & publishers by title, and authors the way the author
+// resolver merges those of a run's batches. Authors having ORCID are merged
+// by it; an author lacking ORCID is resolved against the earlier nodes' ones
+// in its block, by the features its dictionary keeps: it takes the ID of the
+// first it shares a co-author or an affiliation with, unless that one holds
+// an author of its own node already, two of which its resolver kept apart.
+// The result is a single run's as long as the links between authors don't
+// run through another node: two authors of a node that only share features
+// with a third node's stay apart, where a run that resolved the third one's
+// shard first would have merged them, the resolver never merging the authors
+// it already knows either. The merged IDs are numbered from 1 in the nodes'
+// order, and a node's article IDs are offset by the preceding nodes' highest
+// ones. Only the rows' IDs are then
+// rewritten (see orc_sink::copy_from). Each node has deduplicated its
+// articles by DOI; a DOI found on several nodes keeps the newest row (by
+// `updated`, then the earliest node's), and the other rows are dropped.
+
+// Parses "i/N", 0 <= i < N.
+inline bool parse_node_spec(const std::string &s, node_spec &spec)
+{
+    size_t slash = s.find('/');
+    if (slash == 0 || slash == std::string::npos || slash + 1 == s.size() ||
+        s.find_first_not_of("0123456789/") != std::string::npos ||
+        s.find('/', slash + 1) != std::string::npos || s.size() > 16)
+    {
+        return false;
+    }
+    unsigned long i = std::stoul(s.substr(0, slash));
+    unsigned long n = std::stoul(s.substr(slash + 1));
+    if (n == 0 || i >= n || n > std::numeric_limits<unsigned>::max())
+    {
+        return false;
+    }
+    spec.node  = static_cast<unsigned>(i);
+    spec.nodes = static_cast<unsigned>(n);
+    return true;
+}
+
+// The node a shard goes to: FNV-1a of the file's name, without the
+// directory, which may be mounted elsewhere on another node.
+inline unsigned node_of(const std::string &path, unsigned nodes)
+{
+    uint64_t h = 14695981039346656037ull;
+    for (size_t i = path.rfind('/') + 1; i < path.size(); ++i)
+    {
+        h ^= static_cast<unsigned char>(path[i]);
+        h *= 1099511628211ull;
+    }
+    return static_cast<unsigned>(h % nodes);
+}
+
+// Maps a node's IDs to the merged ones.
+struct node_remap
+{
+    int64_t                 article_offset = 0;
+    std::vector<author_id>  authors;    // by the node's ID; 0 if none
+    std::vector<subject_id> subjects;   // likewise
+    std::vector<int32_t>    journals;   // likewise
+
+    // Throw std::runtime_error if the node's dictionary lacks the ID.
+    int64_t author(int64_t id) const
+    {
+        return known(authors, id, "an author");
+    }
+    int64_t subject(int64_t id) const
+    {
+        return known(subjects, id, "a subject");
+    }
+    int64_t journal(int64_t id) const
+    {
+        return known(journals, id, "a journal");
+    }
+
+private:
+    template<typename Id>
+    static int64_t known(const std::vector<Id> &ids, int64_t id, const char *what)
+    {
+        if (id < 0 || static_cast<uint64_t>(id) >= ids.size() ||
+            ids[static_cast<size_t>(id)] == 0)
+        {
+            throw std::runtime_error(std::string(what) + "'s ID " +
+                std::to_string(id) + " is missing from the node's dictionary");
+        }
+        return ids[static_cast<size_t>(id)];
+    }
+};
+
+// Merges the nodes' dictionaries, which are to be in the nodes' order, into
+// merged, and fills in a remap per node.
+inline void merge_dictionaries(const std::vector<output_dictionary> &nodes,
+    output_dictionary &merged, std::vector<node_remap> &remaps)
+{
+    merged = output_dictionary();
+    remaps.assign(nodes.size(), node_remap());
+
+    std::unordered_map<std::string, subject_id> subject_by_title;
+    std::unordered_map<std::string, size_t>     journal_by_title;
+    std::unordered_map<std::string, int32_t>    publisher_by_title;
+    std::unordered_map<uint64_t, size_t>        author_by_orcid;
+    // The merged authors lacking ORCID: block key -> feature -> the authors
+    // (positions) having it; and the last node each one took an author of.
+    std::unordered_map<std::string,
+        std::unordered_map<std::string, std::vector<size_t>>> author_blocks;
+    std::vector<size_t>                         author_node;
+
+    // The node's IDs index the remaps' tables.
+    auto slot = [](auto &ids, int64_t id) -> auto &
+    {
+        if (id <= 0 || id > int64_t(1) << 31)
+        {
+            throw std::runtime_error("bad ID in a node's dictionary: " +
+                std::to_string(id));
+        }
+        if (static_cast<uint64_t>(id) >= ids.size())
+        {
+            ids.resize(static_cast<size_t>(id) + 1, 0);
+        }
+        return ids[static_cast<size_t>(id)];
+    };
+
+    int64_t article_offset = 0;
+    for (size_t n = 0; n < nodes.size(); ++n)
+    {
+        const output_dictionary &node  = nodes[n];
+        node_remap            &remap = remaps[n];
+
+        remap.article_offset = article_offset;
+        article_offset      += node.max_article_id;
+
+        for (const subject &s : node.subjects)
+        {
+            auto it = subject_by_title.emplace(s.get_title(),
+                static_cast<subject_id>(merged.subjects.size() + 1)).first;
+            if (static_cast<size_t>(it->second) == merged.subjects.size() + 1)
+            {
+                merged.subjects.emplace_back(it->second, s.get_title());
+            }
+            slot(remap.subjects, s.get_id()) = it->second;
+        }
+
+        for (const journal &j : node.journals)
+        {
+            auto it = journal_by_title.emplace(j.get_title(),
+                merged.journals.size()).first;
+            if (it->second == merged.journals.size())
+            {
+                auto p = publisher_by_title.emplace(j.get_publisher_title(),
+                    static_cast<int32_t>(publisher_by_title.size() + 1)).first;
+                merged.journals.emplace_back(
+                    static_cast<int32_t>(merged.journals.size() + 1),
+                    j.get_title(), p->second, j.get_publisher_title());
+            }
+            slot(remap.journals, j.get_id()) = merged.journals[it->second].get_id();
+        }
+
+        for (size_t i = 0; i < node.authors.size(); ++i)
+        {
+            const author                   &a        = node.authors[i];
+            const std::vector<std::string> &features = node.features_of(i);
+            size_t at = merged.authors.size();
+            if (a.has_orcid())
+            {
+                at = author_by_orcid.emplace(a.get_orcid().get_packed(),
+                    merged.authors.size()).first->second;
+            }
+            else
+            {
+                // The first author, by the features' order, that holds none
+                // of this node's.
+                auto &index = author_blocks[author_resolver::block_key(a)];
+                auto linked = [&]()
+                {
+                    for (const std::string &f : features)
+                    {
+                        auto it = index.find(f);
+                        if (it == index.end())
+                        {
+                            continue;
+                        }
+                        for (size_t known : it->second)
+                        {
+                            if (author_node[known] != n)
+                            {
+                                return known;
+                            }
+                        }
+                    }
+                    return merged.authors.size();
+                };
+                at = linked();
+                for (const std::string &f : features)
+                {
+                    std::vector<size_t> &having = index[f];
+                    if (std::find(having.begin(), having.end(), at) == having.end())
+                    {
+                        having.push_back(at);
+                    }
+                }
+            }
+
+            if (at == merged.authors.size())
+            {
+                merged.authors.push_back(a);
+                merged.authors.back().set_id(static_cast<author_id>(at + 1));
+                merged.features.push_back(features);
+                author_node.push_back(n);
+            }
+            else
+            {
+                author_node[at] = n;
+                std::vector<std::string> &into_features = merged.features[at];
+                for (const std::string &f : features)
+                {
+                    auto pos = std::lower_bound(into_features.begin(),
+                        into_features.end(), f);
+                    if (pos == into_features.end() || *pos != f)
+                    {
+                        into_features.insert(pos, f);
+                    }
+                }
+
+                // As the resolver does: the affiliations the author lacks.
+                author &into = merged.authors[at];
+                for (const std::string &aff : a.affiliations_ref())
+                {
+                    const str_vec &known = into.affiliations_ref();
+                    if (std::find(known.begin(), known.end(), aff) == known.end())
+                    {
+                        into.add_affiliation(aff);
+                    }
+                }
+            }
+            slot(remap.authors, a.get_id()) = merged.authors[at].get_id();
+        }
+    }
+
+    if (article_offset > INT32_MAX)
+    {
+        throw std::runtime_error("the nodes' articles overflow the IDs");
+    }
+    merged.max_article_id = static_cast<int32_t>(article_offset);
+};
+}
+#endif
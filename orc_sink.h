@@ -0,0 +1,499 @@
+/*
+ * Copyright (c) 2022 - present, GitHub: @cubter
+ *
+ * See COPYING.txt in the project root for license information.
+ */
+#ifndef ORC_SINK_H
+#define ORC_SINK_H
+
+#include "article.h"
+#include "compact_label.h"
+#include "id_set.h"
+
+#include <orc/OrcFile.hh>
+
+#include <algorithm>
+#include <list>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace metasci
+{
+// Writes articles to an ORC file. Strings aren't copied: the batch's string
+// columns point straight into the articles (and into the labels' pool), so
+// the articles must stay alive until `write` returns.
+//
+// Volumes and issues are written as an int column, null unless the value is
+// a number, plus a sparse string column for the rest (see compact_label.h).
+//
+// Rows of a file written earlier may be copied over as they are, which lets
+// a partition of the dataset be rewritten without parsing it back into
+// articles. Files written before columns were appended to the schema get
+// nulls in those columns. The IDs may be rewritten on the way, which lets
+// files numbered apart be merged (see node_merge.h).
+//
+// The sink notes the IDs its rows refer to, for the output's dictionary
+// (see output_dictionary.h).
+class orc_sink
+{
+public:
+    // The IDs a row holds: the article's own, and its authors', subjects' &
+    // journals'.
+    enum id_kind { article_ids, author_ids, subject_ids, journal_ids };
+
+    void write(const std::vector<article> &articles);
+    void close();
+
+    // Copies the rows of an existing file, except those for which 
+    // skip(doi, doi_length) is true. Returns the number of rows copied.
+    template<typename Skip>
+    uint64_t copy_from(const string &path, Skip &&skip);
+    // Same, but every ID of a copied row becomes map_id(id_kind, id).
+    template<typename Skip, typename MapId>
+    uint64_t copy_from(const string &path, Skip &&skip, MapId &&map_id);
+
+    // Calls f(doi, doi_length, updated) for every row of a file, in order,
+    // reading only those two columns.
+    template<typename F>
+    static void scan_dois(const string &path, F &&f);
+
+    // The IDs of the rows written or copied so far.
+    const referred_ids &ids() const { return referred; }
+
+    orc_sink(const string &path, const string_pool &labels,
+        uint64_t batch_size = 8192);
+    orc_sink(const orc_sink &other) = delete;
+    // Closing may throw; whoever needs the file complete calls close().
+    ~orc_sink()
+    {
+        try
+        {
+            close();
+        }
+        catch (...)
+        {
+        }
+    };
+
+    static const char *const schema;
+
+private:
+    // Columns' positions in the schema.
+    enum column : size_t
+    {
+        c_id, c_doi, c_title, c_type, c_score,
+        c_volume, c_volume_str, c_issue, c_issue_str,
+        c_ref_num, c_ref_by_num,
+        c_published_year, c_published_month, c_published_day,
+        c_authors_ids, c_subjects_ids, c_references, c_updated,
+        c_journals_ids, c_issued_year, c_issued_month, c_issued_day,
+        c_ct_numbers
+    };
+
+    template<typename Batch>
+    Batch &field(column c)
+    {
+        return dynamic_cast<Batch &>(*root->fields[c]);
+    }
+
+    void set_label(size_t row, compact_label l, column num, column str);
+    void set_date(size_t row, const date_vec &dates, column year);
+    void write_batch(const article *first, uint64_t n);
+    static void reset_batch(orc::ColumnVectorBatch &b);
+    static void copy_value(orc::ColumnVectorBatch *src, uint64_t from,
+        orc::ColumnVectorBatch &dst, uint64_t to);
+
+    const string_pool                   &labels;
+    uint64_t                            batch_size;
+    std::unique_ptr<orc::Type>          type;
+    std::unique_ptr<orc::OutputStream>  out;
+    std::unique_ptr<orc::Writer>        writer;
+    std::unique_ptr<orc::ColumnVectorBatch> batch;
+    orc::StructVectorBatch              *root;
+    std::unique_ptr<orc::ColumnVectorBatch> copy_batch;    // for copy_from
+    referred_ids                        referred;
+};
+
+const char *const orc_sink::schema =
+    "struct<id:int,doi:string,title:string,type:tinyint,score:int,"
+    "volume:int,volume_str:string,issue:int,issue_str:string,"
+    "ref_num:int,ref_by_num:int,"
+    "published_year:smallint,published_month:tinyint,published_day:tinyint,"
+    "authors_ids:array<int>,subjects_ids:array<smallint>,"
+    "references:array<string>,updated:bigint,journals_ids:array<int>,"
+    "issued_year:smallint,issued_month:tinyint,issued_day:tinyint,"
+    "ct_numbers:array<string>>";
+
+orc_sink::orc_sink(const string &path, const string_pool &pool,
+    uint64_t rows) :
+    labels(pool),
+    batch_size(rows),
+    type(orc::Type::buildTypeFromString(schema)),
+    out(orc::writeLocalFile(path))
+{
+    orc::WriterOptions options;
+    options.setCompression(orc::CompressionKind_ZSTD);
+
+    writer  = orc::createWriter(*type, out.get(), options);
+    batch   = writer->createRowBatch(batch_size);
+    root    = dynamic_cast<orc::StructVectorBatch *>(batch.get());
+};
+
+void orc_sink::close()
+{
+    if (writer)
+    {
+        writer->close();
+        writer.reset();
+    }
+};
+
+void orc_sink::write(const std::vector<article> &articles)
+{
+    for (size_t i = 0; i < articles.size(); i += batch_size)
+    {
+        uint64_t n = std::min<uint64_t>(batch_size, articles.size() - i);
+        write_batch(articles.data() + i, n);
+    }
+};
+
+template<typename Skip>
+uint64_t orc_sink::copy_from(const string &path, Skip &&skip)
+{
+    return copy_from(path, skip, [](id_kind, int64_t id) { return id; });
+};
+
+template<typename Skip, typename MapId>
+uint64_t orc_sink::copy_from(const string &path, Skip &&skip, MapId &&map_id)
+{
+    std::unique_ptr<orc::Reader> reader = 
+        orc::createReader(orc::readLocalFile(path), orc::ReaderOptions());
+    std::unique_ptr<orc::RowReader> rows = 
+        reader->createRowReader(orc::RowReaderOptions());
+    std::unique_ptr<orc::ColumnVectorBatch> in = rows->createRowBatch(batch_size);
+
+    if (!copy_batch)
+    {
+        copy_batch = writer->createRowBatch(batch_size);
+    }
+    auto &in_root  = dynamic_cast<orc::StructVectorBatch &>(*in);
+    auto &out_root = dynamic_cast<orc::StructVectorBatch &>(*copy_batch);
+    uint64_t copied = 0;
+
+    while (rows->next(*in))
+    {
+        auto &doi = dynamic_cast<orc::StringVectorBatch &>(*in_root.fields[c_doi]);
+        for (auto f : out_root.fields)
+        {
+            reset_batch(*f);
+        }
+
+        uint64_t n = 0;
+        for (uint64_t i = 0; i < in->numElements; ++i)
+        {
+            if (skip(static_cast<const char *>(doi.data[i]), 
+                static_cast<size_t>(doi.length[i])))
+            {
+                continue;
+            }
+            for (size_t f = 0; f < out_root.fields.size(); ++f)
+            {
+                copy_value(f < in_root.fields.size() ? in_root.fields[f] : nullptr,
+                    i, *out_root.fields[f], n);
+            }
+            ++n;
+        }
+
+        for (auto f : out_root.fields)
+        {
+            f->numElements = n;
+        }
+        out_root.numElements = n;
+
+        auto &ids = dynamic_cast<orc::LongVectorBatch &>(*out_root.fields[c_id]);
+        for (uint64_t i = 0; i < n; ++i)
+        {
+            if (!ids.hasNulls || ids.notNull[i])
+            {
+                ids.data[i] = map_id(article_ids, ids.data[i]);
+                referred.max_article_id = 
+                    std::max(referred.max_article_id, ids.data[i]);
+            }
+        }
+        for (auto kind : { author_ids, subject_ids, journal_ids })
+        {
+            column  c    = kind == author_ids  ? c_authors_ids :
+                           kind == subject_ids ? c_subjects_ids : c_journals_ids;
+            id_set &seen = kind == author_ids  ? referred.authors :
+                           kind == subject_ids ? referred.subjects : referred.journals;
+            auto &list = dynamic_cast<orc::ListVectorBatch &>(*out_root.fields[c]);
+            auto &el = dynamic_cast<orc::LongVectorBatch &>(*list.elements);
+            for (uint64_t e = 0; e < el.numElements; ++e)
+            {
+                if (!el.hasNulls || el.notNull[e])
+                {
+                    el.data[e] = map_id(kind, el.data[e]);
+                    seen.insert(el.data[e]);
+                }
+            }
+        }
+
+        // The strings point into the reader's batch, so they're written 
+        // before it's refilled.
+        if (n > 0)
+        {
+            writer->add(out_root);
+        }
+        copied += n;
+    }
+
+    return copied;
+};
+
+template<typename F>
+void orc_sink::scan_dois(const string &path, F &&f)
+{
+    std::unique_ptr<orc::Reader> reader = 
+        orc::createReader(orc::readLocalFile(path), orc::ReaderOptions());
+    orc::RowReaderOptions options;
+    options.include(std::list<std::string>{ "doi", "updated" });
+    std::unique_ptr<orc::RowReader> rows = reader->createRowReader(options);
+    std::unique_ptr<orc::ColumnVectorBatch> in = rows->createRowBatch(8192);
+
+    // Only the columns included, in the schema's order.
+    auto &in_root = dynamic_cast<orc::StructVectorBatch &>(*in);
+    while (rows->next(*in))
+    {
+        auto &doi     = dynamic_cast<orc::StringVectorBatch &>(*in_root.fields[0]);
+        auto &updated = dynamic_cast<orc::LongVectorBatch &>(*in_root.fields[1]);
+        for (uint64_t i = 0; i < in->numElements; ++i)
+        {
+            f(static_cast<const char *>(doi.data[i]), 
+                static_cast<size_t>(doi.length[i]), updated.data[i]);
+        }
+    }
+};
+
+void orc_sink::reset_batch(orc::ColumnVectorBatch &b)
+{
+    b.hasNulls    = false;
+    b.numElements = 0;
+    if (auto *list = dynamic_cast<orc::ListVectorBatch *>(&b))
+    {
+        list->offsets[0] = 0;
+        reset_batch(*list->elements);
+    }
+};
+
+// Copies a value of the columns the schema has: integers, strings and lists
+// of them. A missing source column (src == nullptr) gives a null.
+void orc_sink::copy_value(orc::ColumnVectorBatch *src, uint64_t from,
+    orc::ColumnVectorBatch &dst, uint64_t to)
+{
+    if (to >= dst.capacity)
+    {
+        dst.resize(std::max<uint64_t>(to + 1, dst.capacity * 2));
+    }
+
+    auto *dst_list = dynamic_cast<orc::ListVectorBatch *>(&dst);
+    bool is_null = src == nullptr || (src->hasNulls && !src->notNull[from]);
+
+    dst.notNull[to] = !is_null;
+    if (is_null)
+    {
+        dst.hasNulls = true;
+        if (dst_list != nullptr)
+        {
+            dst_list->offsets[to + 1] = dst_list->offsets[to];
+        }
+        return;
+    }
+
+    if (auto *l = dynamic_cast<orc::LongVectorBatch *>(src))
+    {
+        dynamic_cast<orc::LongVectorBatch &>(dst).data[to] = l->data[from];
+    }
+    else if (auto *s = dynamic_cast<orc::StringVectorBatch *>(src))
+    {
+        auto &d = dynamic_cast<orc::StringVectorBatch &>(dst);
+        d.data[to]   = s->data[from];
+        d.length[to] = s->length[from];
+    }
+    else if (auto *list = dynamic_cast<orc::ListVectorBatch *>(src))
+    {
+        if (dst_list == nullptr)
+        {
+            throw std::logic_error("orc_sink: columns' types differ");
+        }
+        int64_t at = dst_list->offsets[to];
+        for (int64_t e = list->offsets[from]; e < list->offsets[from + 1]; ++e)
+        {
+            copy_value(list->elements.get(), static_cast<uint64_t>(e), 
+                *dst_list->elements, static_cast<uint64_t>(at++));
+        }
+        dst_list->offsets[to + 1] = at;
+        dst_list->elements->numElements = static_cast<uint64_t>(at);
+    }
+    else
+    {
+        throw std::logic_error("orc_sink: unsupported column type");
+    }
+};
+
+// Exactly one of the two columns gets the value, the other one is null.
+void orc_sink::set_label(size_t row, compact_label l, column num, column str)
+{
+    auto &num_col = field<orc::LongVectorBatch>(num);
+    auto &str_col = field<orc::StringVectorBatch>(str);
+
+    num_col.notNull[row] = l.is_number();
+    str_col.notNull[row] = !l.empty() && !l.is_number();
+
+    if (l.is_number())
+    {
+        num_col.data[row] = l.get_number();
+    }
+    else if (!l.empty())
+    {
+        const string &s = labels.get(l.get_string_id());
+        str_col.data[row]   = const_cast<char *>(s.data());
+        str_col.length[row] = static_cast<int64_t>(s.size());
+    }
+    // The string column is null almost everywhere, and the numeric one is
+    // null wherever the string one isn't.
+    num_col.hasNulls = true;
+    str_col.hasNulls = true;
+};
+
+// The first date only.
+void orc_sink::set_date(size_t row, const date_vec &dates, column year)
+{
+    auto &y = field<orc::LongVectorBatch>(year);
+    auto &m = field<orc::LongVectorBatch>(static_cast<column>(year + 1));
+    auto &d = field<orc::LongVectorBatch>(static_cast<column>(year + 2));
+
+    bool has_date = !dates.empty();
+    y.notNull[row] = has_date;
+    m.notNull[row] = has_date;
+    d.notNull[row] = has_date;
+    if (has_date)
+    {
+        y.data[row] = dates.front().year;
+        m.data[row] = dates.front().month;
+        d.data[row] = dates.front().day;
+    }
+    y.hasNulls = true;
+    m.hasNulls = true;
+    d.hasNulls = true;
+};
+
+void orc_sink::write_batch(const article *first, uint64_t n)
+{
+    auto &authors_ids   = field<orc::ListVectorBatch>(c_authors_ids);
+    auto &subjects_ids  = field<orc::ListVectorBatch>(c_subjects_ids);
+    auto &journals_ids  = field<orc::ListVectorBatch>(c_journals_ids);
+    auto &references    = field<orc::ListVectorBatch>(c_references);
+    auto &ct_numbers    = field<orc::ListVectorBatch>(c_ct_numbers);
+
+    // Lists' elements are laid out one after another, so their columns are
+    // sized upfront.
+    uint64_t n_authors = 0, n_subjects = 0, n_journals = 0, n_refs = 0, n_cts = 0;
+    for (uint64_t i = 0; i < n; ++i)
+    {
+        n_authors   += first[i].authors_ids_ref().size();
+        n_subjects  += first[i].subjects_ids_ref().size();
+        n_journals  += first[i].journals_ref().size();
+        n_refs      += first[i].references_ref().size();
+        n_cts       += first[i].ct_numbers_ref().size();
+    }
+    authors_ids.elements->resize(n_authors);
+    subjects_ids.elements->resize(n_subjects);
+    journals_ids.elements->resize(n_journals);
+    references.elements->resize(n_refs);
+    ct_numbers.elements->resize(n_cts);
+
+    auto &authors_el    = dynamic_cast<orc::LongVectorBatch &>(*authors_ids.elements);
+    auto &subjects_el   = dynamic_cast<orc::LongVectorBatch &>(*subjects_ids.elements);
+    auto &journals_el   = dynamic_cast<orc::LongVectorBatch &>(*journals_ids.elements);
+    auto &refs_el       = dynamic_cast<orc::StringVectorBatch &>(*references.elements);
+    auto &cts_el        = dynamic_cast<orc::StringVectorBatch &>(*ct_numbers.elements);
+
+    auto set_string = [](orc::StringVectorBatch &col, uint64_t row, const string &s)
+    {
+        col.data[row]   = const_cast<char *>(s.data());
+        col.length[row] = static_cast<int64_t>(s.size());
+    };
+
+    uint64_t a = 0, s = 0, j = 0, r = 0, c = 0;
+    for (uint64_t i = 0; i < n; ++i)
+    {
+        const article &art = first[i];
+
+        field<orc::LongVectorBatch>(c_id).data[i]    = art.get_id();
+        set_string(field<orc::StringVectorBatch>(c_doi), i, art.doi_ref());
+        set_string(field<orc::StringVectorBatch>(c_title), i, art.title_ref());
+        field<orc::LongVectorBatch>(c_type).data[i]  = art.get_type();
+        field<orc::LongVectorBatch>(c_score).data[i] = art.get_score();
+        set_label(i, art.get_volume(), c_volume, c_volume_str);
+        set_label(i, art.get_issue(), c_issue, c_issue_str);
+        field<orc::LongVectorBatch>(c_ref_num).data[i]    = art.get_ref_num();
+        field<orc::LongVectorBatch>(c_ref_by_num).data[i] = art.get_ref_by_num();
+        field<orc::LongVectorBatch>(c_updated).data[i]    = art.get_updated();
+        set_date(i, art.published_ref(), c_published_year);
+        set_date(i, art.issued_ref(), c_issued_year);
+        referred.max_article_id = std::max<int64_t>(referred.max_article_id,
+            art.get_id());
+
+        authors_ids.offsets[i] = static_cast<int64_t>(a);
+        for (auto id : art.authors_ids_ref())
+        {
+            authors_el.data[a++] = id;
+            referred.authors.insert(id);
+        }
+        subjects_ids.offsets[i] = static_cast<int64_t>(s);
+        for (auto id : art.subjects_ids_ref())
+        {
+            subjects_el.data[s++] = id;
+            referred.subjects.insert(id);
+        }
+        journals_ids.offsets[i] = static_cast<int64_t>(j);
+        for (const journal &jour : art.journals_ref())
+        {
+            journals_el.data[j++] = jour.get_id();
+            referred.journals.insert(jour.get_id());
+        }
+        references.offsets[i] = static_cast<int64_t>(r);
+        for (const auto &ref : art.references_ref())
+        {
+            set_string(refs_el, r++, ref);
+        }
+        ct_numbers.offsets[i] = static_cast<int64_t>(c);
+        for (const auto &ct : art.ct_numbers_ref())
+        {
+            set_string(cts_el, c++, ct);
+        }
+    }
+    authors_ids.offsets[n]  = static_cast<int64_t>(a);
+    subjects_ids.offsets[n] = static_cast<int64_t>(s);
+    journals_ids.offsets[n] = static_cast<int64_t>(j);
+    references.offsets[n]   = static_cast<int64_t>(r);
+    ct_numbers.offsets[n]   = static_cast<int64_t>(c);
+
+    authors_el.numElements  = n_authors;
+    subjects_el.numElements = n_subjects;
+    journals_el.numElements = n_journals;
+    refs_el.numElements     = n_refs;
+    cts_el.numElements      = n_cts;
+
+    for (auto f : root->fields)
+    {
+        f->numElements = n;
+    }
+    root->numElements = n;
+
+    writer->add(*batch);
+};
+}
+#endif
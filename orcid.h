@@ -0,0 +1,203 @@
+/*
+ * Copyright (c) 2022 - present, GitHub: @cubter
+ *
+ * See COPYING.txt in the project root for license information.
+ */
+#ifndef ORCID_H
+#define ORCID_H
+
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <string>
+
+namespace metasci
+{
+using string = std::string;
+
+// ORCID packed into 64 bits.
+//
+// An ORCID is 16 characters: 15 digits plus a check character (0-9 or X),
+// written as 0000-0002-1825-0097. The 15 digits fit into 50 bits, so they're
+// stored as an integer shifted by 4, and the check value (0-10) takes the
+// lowest 4 bits. 0 means "no ORCID": the all-zero ORCID would need the check
+// digit 1, so it's never a valid packed value.
+class orcid
+{
+public:
+    using packed_t = uint64_t;
+
+    packed_t    get_packed() const  { return value; }
+    bool        empty() const       { return value == 0; }
+    inline string to_string() const;
+
+    // Parses either the bare form or the URL form (http(s)://orcid.org/...).
+    // Returns false if the input is malformed or the checksum doesn't match.
+    static inline bool parse(const char *s, size_t len, orcid &out);
+    static inline bool parse(const string &s, orcid &out);
+
+    bool operator==(const orcid &other) const { return value == other.value; }
+    bool operator!=(const orcid &other) const { return value != other.value; }
+    bool operator<(const orcid &other) const  { return value < other.value; }
+
+    orcid() : value(0) {};
+    explicit orcid(packed_t packed) : value(packed) {};
+
+private:
+    static inline bool    parse_4digits(const char *p, uint32_t &out);
+    static inline uint8_t check_value(const char *digits);
+
+    packed_t value;
+};
+
+// Parses 4 ASCII digits at once (SWAR). The word is built so that the first
+// character ends up in the lowest byte on any platform.
+inline bool orcid::parse_4digits(const char *p, uint32_t &out)
+{
+    uint32_t v;
+    std::memcpy(&v, p, 4);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap32(v);
+#endif
+    // All the bytes must be in 0x30..0x3F, so that subtracting '0' doesn't
+    // borrow, and below 10 afterwards.
+    if ((v & 0xF0F0F0F0u) != 0x30303030u)
+    {
+        return false;
+    }
+    v -= 0x30303030u;
+    if (((v + 0x06060606u) & 0xF0F0F0F0u) != 0)
+    {
+        return false;
+    }
+
+    v = (v * 10 + (v >> 8)) & 0x00FF00FFu;
+    out = (v * 100 + (v >> 16)) & 0x3FFFu;
+
+    return true;
+};
+
+// ISO 7064 11,2 check value of the 15 digits: 10 stands for X. The usual
+// loop `total = (total + d) * 2` is unrolled into a dot product with the
+// weights 2^(15-i) mod 11.
+inline uint8_t orcid::check_value(const char *digits)
+{
+    static const uint8_t weights[15] =
+        { 10, 5, 8, 4, 2, 1, 6, 3, 7, 9, 10, 5, 8, 4, 2 };
+    unsigned total = 0;
+
+    for (int i = 0; i < 15; ++i)
+    {
+        total += weights[i] * static_cast<unsigned>(digits[i] - '0');
+    }
+
+    return static_cast<uint8_t>((12 - total % 11) % 11);
+};
+
+inline bool orcid::parse(const char *s, size_t len, orcid &out)
+{
+    static const char host[] = "orcid.org/";
+    const size_t host_len = sizeof(host) - 1;
+    const size_t id_len = 19;   // 16 characters and 3 hyphens
+
+    if (len < id_len)
+    {
+        return false;
+    }
+
+    // Only the bare form or something ending with orcid.org/ is accepted.
+    size_t prefix = len - id_len;
+    if (prefix != 0 &&
+        (prefix < host_len ||
+        std::memcmp(s + prefix - host_len, host, host_len) != 0))
+    {
+        return false;
+    }
+
+    const char *id = s + prefix;
+    if (id[4] != '-' || id[9] != '-' || id[14] != '-')
+    {
+        return false;
+    }
+
+    // The last group is 3 digits and the check character.
+    char last[4] = { id[15], id[16], id[17], '0' };
+    uint32_t g0, g1, g2, g3;
+
+    if (!parse_4digits(id, g0) || !parse_4digits(id + 5, g1) ||
+        !parse_4digits(id + 10, g2) || !parse_4digits(last, g3))
+    {
+        return false;
+    }
+
+    char digits[15];
+    std::memcpy(digits, id, 4);
+    std::memcpy(digits + 4, id + 5, 4);
+    std::memcpy(digits + 8, id + 10, 4);
+    std::memcpy(digits + 12, id + 15, 3);
+
+    uint8_t check;
+    char c = id[18];
+    if (c >= '0' && c <= '9')   { check = static_cast<uint8_t>(c - '0'); }
+    else if (c == 'X' || c == 'x') { check = 10; }
+    else                        { return false; }
+
+    if (check != check_value(digits))
+    {
+        return false;
+    }
+
+    uint64_t number = g0 * 100000000000ull + g1 * 10000000ull + g2 * 1000ull +
+        g3 / 10;
+    out.value = number << 4 | check;
+
+    return true;
+};
+
+inline bool orcid::parse(const string &s, orcid &out)
+{
+    return parse(s.data(), s.size(), out);
+};
+
+// Returns the bare form, e.g. 0000-0002-1825-0097; empty if there's no ORCID.
+inline string orcid::to_string() const
+{
+    if (empty())
+    {
+        return string{};
+    }
+
+    string out(19, '-');
+    uint64_t number = value >> 4;
+    uint8_t  check  = value & 0xF;
+
+    out[18] = check == 10 ? 'X' : static_cast<char>('0' + check);
+    for (int i = 17; i >= 0; --i)
+    {
+        if (i == 4 || i == 9 || i == 14)
+        {
+            continue;
+        }
+        out[static_cast<size_t>(i)] = static_cast<char>('0' + number % 10);
+        number /= 10;
+    }
+
+    return out;
+};
+
+// Hasher to enable creation of unordered sets & maps. The packed values are
+// dense in the low bits, so they're mixed a bit.
+struct orcid_hasher
+{
+    size_t operator()(const orcid &o) const noexcept
+    {
+        uint64_t x = o.get_packed();
+        x ^= x >> 33;
+        x *= 0xFF51AFD7ED558CCDull;
+        x ^= x >> 33;
+
+        return static_cast<size_t>(x);
+    }
+};
+}
+#endif
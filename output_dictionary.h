@@ -0,0 +1,302 @@
+/*
+ * Copyright (c) 2022 - present, GitHub: @cubter
+ *
+ * See COPYING.txt in the project root for license information.
+ */
+#ifndef OUTPUT_DICTIONARY_H
+#define OUTPUT_DICTIONARY_H
+
+#include "article_record.h"
+#include "author.h"
+#include "checkpoint.h"
+#include "dictionaries.h"
+#include "id_set.h"
+#include "journal.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <vector>
+
+namespace metasci
+{
+// The part of a multi-node ingest a run does (see node_merge.h): node i of N.
+struct node_spec
+{
+    unsigned node  = 0;
+    unsigned nodes = 1;
+};
+
+// Dictionary of an ORC output. The rows hold only the IDs of the articles'
+// authors, subjects and journals; beside every output file (output.orc.dict)
+// lies the dictionary which names them: the subjects, the journals with their
+// publishers and the authors the rows refer to, and the rows' highest article
+// ID. The authors lacking ORCID come with the features the author resolver
+// matched them on, so that the authors of several outputs can be resolved
+// again. It's written once the ORC file is complete, and read back when
+// outputs are merged.
+class output_dictionary
+{
+public:
+    node_spec               spec;
+    int32_t                 max_article_id = 0;
+    std::vector<subject>    subjects;
+    std::vector<journal>    journals;
+    std::vector<author>     authors;
+    // By author, sorted; those past its end have none.
+    std::vector<std::vector<std::string>> features;
+
+    // Takes a copy of the entries of dicts which the output refers to.
+    // Throws std::runtime_error if the authors' table lacks one of them.
+    inline output_dictionary(const dictionaries &dicts, const referred_ids &ids,
+        node_spec spec = node_spec());
+    output_dictionary() {};
+
+    // Drops the entries which the output doesn't refer to, and takes the
+    // output's highest article ID.
+    inline void keep_only(const referred_ids &ids);
+
+    const std::vector<std::string> &features_of(size_t author_at) const
+    {
+        static const std::vector<std::string> none;
+        return author_at < features.size() ? features[author_at] : none;
+    }
+
+    // Writes the dictionary aside, flushes it to the disk, then renames it
+    // to path. Throws std::system_error.
+    inline void save(const std::string &path) const;
+    // Throws std::system_error if the file can't be read, and
+    // std::runtime_error if it's damaged.
+    static inline output_dictionary load(const std::string &path);
+
+    static std::string path_of(const std::string &output) { return output + ".dict"; }
+    static bool is_dictionary(const std::string &path)
+    {
+        return path.size() > 5 && path.compare(path.size() - 5, 5, ".dict") == 0;
+    }
+
+private:
+    static inline output_dictionary parse(const char *p, const char *end,
+        int version);
+};
+
+inline output_dictionary::output_dictionary(const dictionaries &dicts,
+    const referred_ids &ids, node_spec node) :
+    spec(node)
+{
+    if (ids.max_article_id > INT32_MAX)
+    {
+        throw std::runtime_error("article ID out of range: " +
+            std::to_string(ids.max_article_id));
+    }
+    max_article_id = static_cast<int32_t>(ids.max_article_id);
+
+    for (const subject &s : dicts.subjects)
+    {
+        if (ids.subjects.contains(s.get_id()))
+        {
+            subjects.push_back(s);
+        }
+    }
+    for (const journal &j : dicts.journals)
+    {
+        if (ids.journals.contains(j.get_id()))
+        {
+            journals.push_back(j);
+        }
+    }
+    // By ID, so that the file doesn't depend on the set's hashing.
+    std::sort(journals.begin(), journals.end(),
+        [](const journal &a, const journal &b) { return a.get_id() < b.get_id(); });
+
+    // The resolver's table is in the order of the IDs, from 1.
+    const std::vector<author> &table = dicts.resolver.authors();
+    std::vector<std::vector<std::string>> by_position = dicts.resolver.features();
+    ids.authors.for_each([&](int64_t id)
+    {
+        if (static_cast<uint64_t>(id) > table.size() ||
+            table[static_cast<size_t>(id - 1)].get_id() != id)
+        {
+            throw std::runtime_error("the authors' table lacks the ID " +
+                std::to_string(id));
+        }
+        authors.push_back(table[static_cast<size_t>(id - 1)]);
+        features.push_back(std::move(by_position[static_cast<size_t>(id - 1)]));
+    });
+};
+
+inline void output_dictionary::keep_only(const referred_ids &ids)
+{
+    subjects.erase(std::remove_if(subjects.begin(), subjects.end(),
+        [&](const subject &s) { return !ids.subjects.contains(s.get_id()); }),
+        subjects.end());
+    journals.erase(std::remove_if(journals.begin(), journals.end(),
+        [&](const journal &j) { return !ids.journals.contains(j.get_id()); }),
+        journals.end());
+    // The features go along with their authors.
+    features.resize(authors.size());
+    size_t kept = 0;
+    for (size_t i = 0; i < authors.size(); ++i)
+    {
+        if (ids.authors.contains(authors[i].get_id()))
+        {
+            authors[kept]  = std::move(authors[i]);
+            features[kept] = std::move(features[i]);
+            ++kept;
+        }
+    }
+    authors.resize(kept);
+    features.resize(kept);
+    max_article_id = static_cast<int32_t>(ids.max_article_id);
+};
+
+// The file: a magic, the node's spec & highest article ID, then the
+// subjects, journals & authors, each table prefixed by its length. Version 1
+// lacks the authors' features.
+inline void output_dictionary::save(const std::string &path) const
+{
+    using namespace record;
+
+    std::string buf = "MSNDICT2";
+    put_varint(buf, spec.node);
+    put_varint(buf, spec.nodes);
+    put_signed(buf, max_article_id);
+
+    put_varint(buf, subjects.size());
+    for (const subject &s : subjects)
+    {
+        put_signed(buf, s.get_id());
+        put_string(buf, s.get_title());
+    }
+    put_varint(buf, journals.size());
+    for (const journal &j : journals)
+    {
+        put_signed(buf, j.get_id());
+        put_string(buf, j.get_title());
+        put_signed(buf, j.get_publisher_id());
+        put_string(buf, j.get_publisher_title());
+    }
+    put_varint(buf, authors.size());
+    for (size_t i = 0; i < authors.size(); ++i)
+    {
+        const author &a = authors[i];
+        put_signed(buf, a.get_id());
+        put_string(buf, a.get_first_name());
+        put_string(buf, a.get_family_name());
+        put_varint(buf, (a.get_orcid().get_packed() << 1) |
+            static_cast<uint64_t>(a.is_authenticated_orcid()));
+        put_varint(buf, a.affiliations_ref().size());
+        for (const std::string &aff : a.affiliations_ref())
+        {
+            put_string(buf, aff);
+        }
+        put_varint(buf, features_of(i).size());
+        for (const std::string &f : features_of(i))
+        {
+            put_string(buf, f);
+        }
+    }
+
+    const std::string tmp = path + ".tmp";
+    std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+    out.write(buf.data(), static_cast<std::streamsize>(buf.size()));
+    out.close();
+    if (!out)
+    {
+        int err = errno;
+        std::remove(tmp.c_str());
+        throw std::system_error(err, std::generic_category(), path);
+    }
+    sync_path(tmp);
+    if (std::rename(tmp.c_str(), path.c_str()) != 0)
+    {
+        int err = errno;
+        std::remove(tmp.c_str());
+        throw std::system_error(err, std::generic_category(), path);
+    }
+};
+
+inline output_dictionary output_dictionary::load(const std::string &path)
+{
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+    {
+        throw std::system_error(errno, std::generic_category(), path);
+    }
+    std::ostringstream contents;
+    contents << in.rdbuf();
+    std::string buf = contents.str();
+    const bool v1 = buf.compare(0, 8, "MSNDICT1") == 0;
+    if (!v1 && buf.compare(0, 8, "MSNDICT2") != 0)
+    {
+        throw std::runtime_error(path + ": not an output's dictionary");
+    }
+
+    try
+    {
+        return parse(buf.data() + 8, buf.data() + buf.size(), v1 ? 1 : 2);
+    }
+    catch(const std::runtime_error &e)
+    {
+        throw std::runtime_error(path + ": " + e.what());
+    }
+};
+
+inline output_dictionary output_dictionary::parse(const char *p, const char *end,
+    int version)
+{
+    using namespace record;
+
+    output_dictionary d;
+    reader r{ p, end };
+    d.spec.node      = static_cast<unsigned>(r.varint());
+    d.spec.nodes     = static_cast<unsigned>(r.varint());
+    d.max_article_id = static_cast<int32_t>(r.signed_varint());
+
+    for (uint64_t n = r.varint(); n > 0; --n)
+    {
+        subject_id id = static_cast<subject_id>(r.signed_varint());
+        d.subjects.emplace_back(id, r.string());
+    }
+    for (uint64_t n = r.varint(); n > 0; --n)
+    {
+        int32_t     id           = static_cast<int32_t>(r.signed_varint());
+        std::string title        = r.string();
+        int32_t     publisher_id = static_cast<int32_t>(r.signed_varint());
+        d.journals.emplace_back(id, std::move(title), publisher_id, r.string());
+    }
+    for (uint64_t n = r.varint(); n > 0; --n)
+    {
+        author_id   id     = static_cast<author_id>(r.signed_varint());
+        std::string given  = r.string();
+        std::string family = r.string();
+        uint64_t    packed = r.varint();
+        author a(std::move(given), std::move(family), orcid(packed >> 1),
+            (packed & 1) != 0);
+        a.set_id(id);
+        for (uint64_t k = r.varint(); k > 0; --k)
+        {
+            a.add_affiliation(r.string());
+        }
+        d.authors.push_back(std::move(a));
+        d.features.emplace_back();
+        for (uint64_t k = version > 1 ? r.varint() : 0; k > 0; --k)
+        {
+            d.features.back().push_back(r.string());
+        }
+    }
+
+    if (r.p != r.end || d.spec.nodes == 0 || d.spec.node >= d.spec.nodes)
+    {
+        throw std::runtime_error("damaged dictionary");
+    }
+    return d;
+};
+}
+#endif
@@ -0,0 +1,316 @@
+/*
+ * Copyright (c) 2022 - present, GitHub: @cubter
+ *
+ * See COPYING.txt in the project root for license information.
+ */
+#ifndef PARSED_CACHE_H
+#define PARSED_CACHE_H
+
+#include "article.h"
+#include "article_record.h"
+#include "content_cache.h"
+#include "dictionaries.h"
+#include "log.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace metasci
+{
+// What the parser made of an input file, kept in the content cache, so that
+// an unchanged file isn't parsed (nor decompressed) again.
+//
+// An entry holds the file's articles as they come out of the parser: with
+// the authors unresolved, and everything which lives in the dictionaries
+// (journals, subjects, labels) by name, as the dictionaries' IDs are the
+// process's own. Loading an entry adds the names to the dictionaries, the
+// way parsing does, and numbers the articles anew. The parser's warnings are
+// kept too.
+//
+// The entry is columnar: every field of all the articles goes one after
+// another, each column prefixed by its length, so that alike values sit
+// together, for zstd's sake. The journals & subjects are kept once per
+// file, in tables of their own, the articles referring to them by their
+// position in the table.
+//
+// Entries are keyed by the file's content_hash(), the input's format and
+// parsed_cache_version, which is to be bumped whenever the parser changes
+// what it makes of an item. Stale entries are never looked up again, and
+// fall out of the cache in time.
+const uint32_t parsed_cache_version = 1;
+
+inline std::string parsed_cache_key(const char *data, size_t len,
+    const std::string &format)
+{
+    return "parsed v" + std::to_string(parsed_cache_version) + ' ' + format +
+        ' ' + content_hash(data, len);
+}
+
+namespace parsed_detail
+{
+enum column
+{
+    c_subjects_table,   // titles
+    c_journals_table,   // titles & publishers' titles
+    c_updated,
+    c_doi,
+    c_title,
+    c_type,
+    c_score,
+    c_volume,
+    c_issue,
+    c_ref_num,
+    c_ref_by_num,
+    c_published,        // dates
+    c_issued,           // dates
+    c_ct_numbers,       // strings
+    c_references,       // strings
+    c_subjects,         // positions in the subjects' table
+    c_journals,         // positions in the journals' table
+    c_authors,          // authors' numbers
+    c_author_names,     // given & family names
+    c_author_orcids,    // packed ORCID, shifted by 1, | authenticated
+    c_affiliations,     // strings, per author
+    c_logs,             // code, message, context
+    n_columns
+};
+}
+
+// Encodes the articles in [first, last) and the warnings in
+// [first_log, last_log) as an entry, into out.
+inline void encode_parsed(const article *first, const article *last,
+    const json_log *first_log, const json_log *last_log,
+    dictionaries &dicts, std::string &out)
+{
+    using namespace record;
+    using namespace parsed_detail;
+
+    std::string cols[n_columns];
+
+    // Subjects by their position in the table; journals by their address,
+    // as the articles refer to the dictionary's very own.
+    std::unordered_map<subject_id, size_t>      subject_at;
+    std::unordered_map<const journal *, size_t> journal_at;
+    std::vector<subject_id>                     subject_ids;
+    std::vector<const journal *>                journals;
+
+    for (const article *a = first; a != last; ++a)
+    {
+        put_signed(cols[c_updated], a->get_updated());
+        put_string(cols[c_doi], a->doi_ref());
+        put_string(cols[c_title], a->title_ref());
+        put_signed(cols[c_type], a->get_type());
+        put_signed(cols[c_score], a->get_score());
+        put_label(cols[c_volume], a->get_volume(), dicts.labels);
+        put_label(cols[c_issue], a->get_issue(), dicts.labels);
+        put_signed(cols[c_ref_num], a->get_ref_num());
+        put_signed(cols[c_ref_by_num], a->get_ref_by_num());
+        put_dates(cols[c_published], a->published_ref());
+        put_dates(cols[c_issued], a->issued_ref());
+        put_strings(cols[c_ct_numbers], a->ct_numbers_ref());
+        put_strings(cols[c_references], a->references_ref());
+
+        put_varint(cols[c_subjects], a->subjects_ids_ref().size());
+        for (subject_id id : a->subjects_ids_ref())
+        {
+            auto it = subject_at.emplace(id, subject_ids.size()).first;
+            if (it->second == subject_ids.size())
+            {
+                subject_ids.push_back(id);
+            }
+            put_varint(cols[c_subjects], it->second);
+        }
+        put_varint(cols[c_journals], a->journals_ref().size());
+        for (const journal &j : a->journals_ref())
+        {
+            auto it = journal_at.emplace(&j, journals.size()).first;
+            if (it->second == journals.size())
+            {
+                journals.push_back(&j);
+            }
+            put_varint(cols[c_journals], it->second);
+        }
+
+        put_varint(cols[c_authors], a->authors_ref().size());
+        for (const author &au : a->authors_ref())
+        {
+            put_string(cols[c_author_names], au.get_first_name());
+            put_string(cols[c_author_names], au.get_family_name());
+            put_varint(cols[c_author_orcids], (au.get_orcid().get_packed() << 1) |
+                static_cast<uint64_t>(au.is_authenticated_orcid()));
+            put_strings(cols[c_affiliations], au.affiliations_ref());
+        }
+    }
+
+    {
+        // The subjects may be added to by another thread's parsing.
+        std::lock_guard<std::mutex> lock(dicts.mutex);
+        put_varint(cols[c_subjects_table], subject_ids.size());
+        for (subject_id id : subject_ids)
+        {
+            auto it = std::find_if(dicts.subjects.begin(), dicts.subjects.end(),
+                [id](const subject &s) { return s.get_id() == id; });
+            put_string(cols[c_subjects_table],
+                it != dicts.subjects.end() ? it->get_title() : std::string());
+        }
+    }
+    put_varint(cols[c_journals_table], journals.size());
+    for (const journal *j : journals)
+    {
+        put_string(cols[c_journals_table], j->get_title());
+        put_string(cols[c_journals_table], j->get_publisher_title());
+    }
+
+    for (const json_log *l = first_log; l != last_log; ++l)
+    {
+        put_signed(cols[c_logs], l->get_message_code());
+        put_string(cols[c_logs], l->message_ref());
+        put_string(cols[c_logs], l->context_ref());
+    }
+
+    put_varint(out, parsed_cache_version);
+    put_varint(out, static_cast<uint64_t>(last - first));
+    put_varint(out, static_cast<uint64_t>(last_log - first_log));
+    for (const std::string &col : cols)
+    {
+        put_string(out, col);
+    }
+}
+
+// Decodes an entry, appending its articles & warnings to articles & logs,
+// and adding its journals, subjects & labels to the dictionaries. Throws
+// std::runtime_error if the entry is damaged, in which case nothing's been
+// appended.
+inline void decode_parsed(const char *data, size_t len, dictionaries &dicts,
+    std::vector<article> &articles, std::vector<json_log> &logs)
+{
+    using namespace record;
+    using namespace parsed_detail;
+
+    reader r{ data, data + len };
+    if (r.varint() != parsed_cache_version)
+    {
+        throw std::runtime_error("parsed entry of another version");
+    }
+    const uint64_t n_articles = r.varint();
+    const uint64_t n_logs     = r.varint();
+
+    reader cols[n_columns];
+    for (reader &col : cols)
+    {
+        size_t n;
+        col.p   = r.string_ref(n);
+        col.end = col.p + n;
+    }
+
+    std::vector<subject_id>                             subject_ids;
+    std::vector<std::reference_wrapper<const journal>>  journals;
+    {
+        std::lock_guard<std::mutex> lock(dicts.mutex);
+        for (uint64_t n = cols[c_subjects_table].varint(); n > 0; --n)
+        {
+            std::string title = cols[c_subjects_table].string();
+            auto it = std::find_if(dicts.subjects.begin(), dicts.subjects.end(),
+                [&](const subject &s) { return s.get_title() == title; });
+            if (it == dicts.subjects.end())
+            {
+                dicts.subjects.emplace_back(std::move(title));
+                it = dicts.subjects.end() - 1;
+            }
+            subject_ids.push_back(it->get_id());
+        }
+        for (uint64_t n = cols[c_journals_table].varint(); n > 0; --n)
+        {
+            std::string title     = cols[c_journals_table].string();
+            std::string publisher = cols[c_journals_table].string();
+            journals.emplace_back(*dicts.journals.emplace(std::move(title),
+                std::move(publisher)).first);
+        }
+    }
+
+    std::vector<article> decoded;
+    decoded.reserve(static_cast<size_t>(n_articles));
+    article::builder b;
+    for (uint64_t i = 0; i < n_articles; ++i)
+    {
+        b.updated_b    = cols[c_updated].signed_varint();
+        b.doi_b        = cols[c_doi].string();
+        b.title_b      = cols[c_title].string();
+        b.type_b       = static_cast<pub_type_id>(cols[c_type].signed_varint());
+        b.score_b      = static_cast<int32_t>(cols[c_score].signed_varint());
+        b.volume_b     = get_label(cols[c_volume], dicts.labels);
+        b.issue_b      = get_label(cols[c_issue], dicts.labels);
+        b.ref_num_b    = static_cast<int32_t>(cols[c_ref_num].signed_varint());
+        b.ref_by_num_b = static_cast<int32_t>(cols[c_ref_by_num].signed_varint());
+        get_dates(cols[c_published], b.published_b);
+        get_dates(cols[c_issued], b.issued_b);
+        get_strings(cols[c_ct_numbers], b.ct_numbers_b);
+        get_strings(cols[c_references], b.references_b);
+
+        for (uint64_t n = cols[c_subjects].varint(); n > 0; --n)
+        {
+            uint64_t at = cols[c_subjects].varint();
+            if (at >= subject_ids.size())
+            {
+                throw std::runtime_error("bad subject in a parsed entry");
+            }
+            b.subjects_ids_b.push_back(subject_ids[static_cast<size_t>(at)]);
+        }
+        for (uint64_t n = cols[c_journals].varint(); n > 0; --n)
+        {
+            uint64_t at = cols[c_journals].varint();
+            if (at >= journals.size())
+            {
+                throw std::runtime_error("bad journal in a parsed entry");
+            }
+            b.journals_b.push_back(journals[static_cast<size_t>(at)]);
+        }
+
+        for (uint64_t n = cols[c_authors].varint(); n > 0; --n)
+        {
+            std::string given  = cols[c_author_names].string();
+            std::string family = cols[c_author_names].string();
+            uint64_t    packed = cols[c_author_orcids].varint();
+            author au(std::move(given), std::move(family), orcid(packed >> 1),
+                (packed & 1) != 0);
+
+            str_vec affiliations;
+            get_strings(cols[c_affiliations], affiliations);
+            au.set_affiliations(std::move(affiliations));
+            b.authors_b.push_back(std::move(au));
+        }
+
+        decoded.push_back(b.build());
+    }
+
+    std::vector<json_log> decoded_logs;
+    decoded_logs.reserve(static_cast<size_t>(n_logs));
+    for (uint64_t i = 0; i < n_logs; ++i)
+    {
+        int16_t code        = static_cast<int16_t>(cols[c_logs].signed_varint());
+        std::string message = cols[c_logs].string();
+        decoded_logs.emplace_back(code, std::move(message), cols[c_logs].string());
+    }
+
+    for (const reader &col : cols)
+    {
+        if (col.p != col.end)
+        {
+            throw std::runtime_error("parsed entry's columns don't add up");
+        }
+    }
+
+    articles.insert(articles.end(), std::make_move_iterator(decoded.begin()),
+        std::make_move_iterator(decoded.end()));
+    logs.insert(logs.end(), std::make_move_iterator(decoded_logs.begin()),
+        std::make_move_iterator(decoded_logs.end()));
+}
+}
+#endif
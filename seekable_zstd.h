@@ -0,0 +1,209 @@
+/*
+ * Copyright (c) 2022 - present, GitHub: @cubter
+ *
+ * See COPYING.txt in the project root for license information.
+ */
+#ifndef SEEKABLE_ZSTD_H
+#define SEEKABLE_ZSTD_H
+
+#include "cbor_shard.h"
+#include "item_reader.h"
+
+#include <zstd/zstd.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace metasci
+{
+// Seekable shards: Crossref's dump re-packed as JSON Lines, one item per
+// line, compressed in independent zstd frames of a few MB, followed by a
+// seek table, in zstd's seekable format (contrib/seekable_format in zstd's
+// repository). Frames end at items' ends, so each one is a piece of JSON
+// Lines of its own: the frames of a shard are decompressed on several
+// cores, and an item is extracted by reading its frame only.
+//
+// A seekable shard is a plain zstd file too, the seek table being a
+// skippable frame: zstd -d turns it back into JSON Lines.
+//
+// The seek table: the skippable frame's magic & size, an entry per frame
+// (compressed & decompressed sizes, 4 bytes each), then the footer: the
+// number of frames (4 bytes), a descriptor (1 byte; no checksums) and the
+// seekable magic, all little-endian.
+const uint32_t zstd_skippable_magic = 0x184d2a5e;
+const uint32_t zstd_seekable_magic  = 0x8f92eab1;
+const size_t   zstd_seek_footer     = 9;
+
+struct zstd_frame
+{
+    uint64_t    c_offset;       // in the shard
+    uint64_t    d_offset;       // in the decompressed shard
+    uint32_t    c_size;
+    uint32_t    d_size;
+};
+
+namespace seekable_detail
+{
+inline uint32_t get_le32(const char *p)
+{
+    const unsigned char *u = reinterpret_cast<const unsigned char *>(p);
+    return static_cast<uint32_t>(u[0]) | static_cast<uint32_t>(u[1]) << 8 |
+        static_cast<uint32_t>(u[2]) << 16 | static_cast<uint32_t>(u[3]) << 24;
+}
+
+inline void put_le32(std::string &out, uint32_t v)
+{
+    for (int i = 0; i < 4; ++i)
+    {
+        out += static_cast<char>((v >> (8 * i)) & 0xff);
+    }
+}
+}
+
+// Only looks at the magic bytes at either end; read_seek_table() checks
+// the rest.
+inline bool is_seekable_zstd(const char *data, size_t len)
+{
+    return is_zstd(data, len) && len >= 8 + zstd_seek_footer &&
+        seekable_detail::get_le32(data + len - 4) == zstd_seekable_magic;
+}
+
+// Reads the seek table of a seekable shard into frames. Returns false if
+// the shard isn't one, or the table doesn't add up to the shard's size.
+inline bool read_seek_table(const char *data, size_t len,
+    std::vector<zstd_frame> &frames)
+{
+    using seekable_detail::get_le32;
+
+    frames.clear();
+    if (!is_seekable_zstd(data, len))
+    {
+        return false;
+    }
+    const char    *footer     = data + len - zstd_seek_footer;
+    const uint64_t n          = get_le32(footer);
+    const uint8_t  descriptor = static_cast<uint8_t>(footer[4]);
+    const size_t   entry_size = (descriptor & 0x80) != 0 ? 12 : 8;
+    const uint64_t table_size = 8 + n * entry_size + zstd_seek_footer;
+
+    if ((descriptor & 0x7c) != 0 || table_size > len)
+    {
+        return false;
+    }
+    const char *table = data + len - table_size;
+    if (get_le32(table) != zstd_skippable_magic ||
+        get_le32(table + 4) != table_size - 8)
+    {
+        return false;
+    }
+
+    uint64_t c_offset = 0;
+    uint64_t d_offset = 0;
+    frames.reserve(static_cast<size_t>(n));
+    for (const char *e = table + 8; e != footer; e += entry_size)
+    {
+        zstd_frame f{ c_offset, d_offset, get_le32(e), get_le32(e + 4) };
+        c_offset += f.c_size;
+        d_offset += f.d_size;
+        frames.push_back(f);
+    }
+    if (c_offset != len - table_size)
+    {
+        frames.clear();
+        return false;
+    }
+    return true;
+}
+
+// Decompresses a frame of a seekable shard into out, which has room for
+// the frame's d_size bytes. Returns false if the frame is corrupt.
+inline bool unzstd_frame(const char *frame, const zstd_frame &f, char *out)
+{
+    size_t n = ZSTD_decompress(out, f.d_size, frame, f.c_size);
+    return !ZSTD_isError(n) && n == f.d_size;
+}
+
+struct seekable_options
+{
+    size_t  frame_size = size_t(2) << 20;  // decompressed, give or take an item
+    int     level      = 9;
+};
+
+// Re-packs a Crossref JSON file (the envelope, or items one after another)
+// into a seekable shard, appended to out. An item's line breaks, which are
+// whitespace only, become spaces. Returns false if the input is malformed;
+// the items before the malformed one are kept.
+inline bool pack_seekable(const char *data, size_t len, item_reader::layout layout,
+    const seekable_options &opts, std::string &out)
+{
+    std::vector<std::pair<size_t, size_t>> items;
+    item_reader reader(layout);
+    bool ok = reader.find_items(data, len, items);
+
+    ZSTD_CCtx *cctx = ZSTD_createCCtx();
+    if (cctx == nullptr)
+    {
+        throw std::runtime_error("zstd: out of memory");
+    }
+
+    std::vector<std::pair<uint32_t, uint32_t>> sizes;     // compressed, not
+    std::string lines;
+    lines.reserve(opts.frame_size + (opts.frame_size >> 2));
+
+    auto flush = [&]()
+    {
+        const size_t at = out.size();
+        out.resize(at + ZSTD_compressBound(lines.size()));
+        size_t n = ZSTD_compressCCtx(cctx, &out[at], out.size() - at, lines.data(),
+            lines.size(), opts.level);
+        if (ZSTD_isError(n))
+        {
+            ZSTD_freeCCtx(cctx);
+            throw std::runtime_error(std::string("zstd: ") + ZSTD_getErrorName(n));
+        }
+        out.resize(at + n);
+        sizes.emplace_back(static_cast<uint32_t>(n), static_cast<uint32_t>(lines.size()));
+        lines.clear();
+    };
+
+    for (const auto &item : items)
+    {
+        const size_t at = lines.size();
+        lines.append(data + item.first, item.second - item.first);
+        std::replace(lines.begin() + static_cast<std::ptrdiff_t>(at), lines.end(),
+            '\n', ' ');
+        std::replace(lines.begin() + static_cast<std::ptrdiff_t>(at), lines.end(),
+            '\r', ' ');
+        lines += '\n';
+        if (lines.size() >= opts.frame_size)
+        {
+            flush();
+        }
+    }
+    // A shard has a frame at least, so that it starts as zstd files do.
+    if (!lines.empty() || sizes.empty())
+    {
+        flush();
+    }
+    ZSTD_freeCCtx(cctx);
+
+    using seekable_detail::put_le32;
+    put_le32(out, zstd_skippable_magic);
+    put_le32(out, static_cast<uint32_t>(sizes.size() * 8 + zstd_seek_footer));
+    for (const auto &s : sizes)
+    {
+        put_le32(out, s.first);
+        put_le32(out, s.second);
+    }
+    put_le32(out, static_cast<uint32_t>(sizes.size()));
+    out += '\0';
+    put_le32(out, zstd_seekable_magic);
+
+    return ok;
+}
+}
+#endif
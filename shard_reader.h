@@ -0,0 +1,541 @@
+/*
+ * Copyright (c) 2022 - present, GitHub: @cubter
+ *
+ * See COPYING.txt in the project root for license information.
+ */
+#ifndef SHARD_READER_H
+#define SHARD_READER_H
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#if defined(__linux__) && defined(__NR_io_uring_setup)
+    #define METASCI_IO_URING 1
+    #include <linux/io_uring.h>
+    #include <linux/stat.h>
+#endif
+
+namespace metasci
+{
+// A whole input file read into memory. `error` is the errno of the failed
+// open or read, 0 on success.
+struct shard
+{
+    std::string path;
+    std::string data;
+    int         error = 0;
+};
+
+// Reads many files (Crossref's dump shards) keeping up to queue_depth of
+// them in flight at once, so that the latency of the storage is paid once
+// per batch rather than once per file. The files are handed to the consumer
+// in the calling thread as soon as each one has been read, in the order of
+// completion; meanwhile, the reads of the others go on.
+//
+// Backends:
+//  - io_uring: opens, stats & reads are all submitted to the kernel's ring,
+//    talked to via raw syscalls (liburing isn't required);
+//  - threads: queue_depth threads doing blocking reads; used where io_uring
+//    is missing or forbidden (old kernels, seccomp, containers).
+class shard_reader
+{
+public:
+    enum backend { automatic, uring, threads };
+
+    // Calls on_shard(shard &) for every file. The consumer may move the
+    // data out of the shard.
+    template<typename OnShard>
+    void read(const std::vector<std::string> &paths, OnShard &&on_shard);
+
+    const char *backend_name() const
+    {
+        return kind == uring ? "io_uring" : "threads";
+    }
+
+    inline shard_reader(unsigned queue_depth = 64, backend b = automatic);
+    shard_reader(const shard_reader &other) = delete;
+    shard_reader &operator=(const shard_reader &other) = delete;
+    inline ~shard_reader();
+
+private:
+    static inline int read_file(const std::string &path, std::string &data);
+
+    template<typename OnShard>
+    void read_threads(const std::vector<std::string> &paths, OnShard &&on_shard);
+
+    unsigned    depth;
+    backend     kind;
+
+#ifdef METASCI_IO_URING
+    // Minimal io_uring: a submission & a completion ring, mapped from the
+    // kernel, with the usual acquire/release protocol on heads & tails.
+    struct ring
+    {
+        int             fd = -1;
+        unsigned        *sq_head, *sq_tail, *sq_mask, *sq_array;
+        unsigned        *cq_head, *cq_tail, *cq_mask;
+        io_uring_sqe    *sqes;
+        io_uring_cqe    *cqes;
+        void            *sq_ptr = nullptr, *cq_ptr = nullptr;
+        size_t          sq_size = 0, cq_size = 0, sqes_size = 0;
+        unsigned        to_submit = 0;
+
+        inline bool           setup(unsigned entries);
+        inline io_uring_sqe  *next_sqe();
+        inline bool           submit_and_wait();
+        inline void           teardown();
+    };
+
+    // A file being read: it's opened, stat'ed, then read in pieces.
+    struct slot
+    {
+        enum stage_t { opening, stating, reading } stage;
+        size_t          path_idx;
+        int             fd;
+        size_t          done;
+        struct statx    st;
+        shard           out;
+    };
+
+    template<typename OnShard>
+    void read_uring(const std::vector<std::string> &paths, OnShard &&on_shard);
+
+    ring    io;
+#endif
+};
+
+inline shard_reader::shard_reader(unsigned queue_depth, backend b) :
+    depth(std::max(1u, queue_depth)),
+    kind(b == automatic ? uring : b)
+{
+#ifdef METASCI_IO_URING
+    if (kind == uring && !io.setup(depth))
+    {
+        kind = threads;
+    }
+#else
+    kind = threads;
+#endif
+};
+
+inline shard_reader::~shard_reader()
+{
+#ifdef METASCI_IO_URING
+    io.teardown();
+#endif
+};
+
+template<typename OnShard>
+void shard_reader::read(const std::vector<std::string> &paths, OnShard &&on_shard)
+{
+#ifdef METASCI_IO_URING
+    if (kind == uring)
+    {
+        read_uring(paths, on_shard);
+        return;
+    }
+#endif
+    read_threads(paths, on_shard);
+};
+
+// Blocking read of a whole file. Returns errno or 0.
+inline int shard_reader::read_file(const std::string &path, std::string &data)
+{
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        return errno;
+    }
+
+    struct stat st;
+    if (::fstat(fd, &st) != 0)
+    {
+        int err = errno;
+        ::close(fd);
+        return err;
+    }
+
+    data.resize(static_cast<size_t>(st.st_size));
+    size_t done = 0;
+    while (done < data.size())
+    {
+        ssize_t n = ::read(fd, &data[done], data.size() - done);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            int err = n < 0 ? errno : EIO;
+            ::close(fd);
+            return err;
+        }
+        done += static_cast<size_t>(n);
+    }
+
+    ::close(fd);
+    return 0;
+};
+
+// Up to `depth` files are read at once, and at most `depth` read ones wait
+// for the consumer, which bounds the memory taken.
+template<typename OnShard>
+void shard_reader::read_threads(const std::vector<std::string> &paths,
+    OnShard &&on_shard)
+{
+    std::mutex              mutex;
+    std::condition_variable ready, space;
+    std::deque<shard>       done;
+    std::atomic<size_t>     next(0);
+    size_t                  n_threads = std::min<size_t>(depth, paths.size());
+
+    auto worker = [&]()
+    {
+        for (size_t i = next++; i < paths.size(); i = next++)
+        {
+            shard s;
+            s.path  = paths[i];
+            s.error = read_file(s.path, s.data);
+
+            std::unique_lock<std::mutex> lock(mutex);
+            space.wait(lock, [&]() { return done.size() < depth; });
+            done.push_back(std::move(s));
+            ready.notify_one();
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for (size_t t = 0; t < n_threads; ++t)
+    {
+        pool.emplace_back(worker);
+    }
+
+    for (size_t consumed = 0; consumed < paths.size(); ++consumed)
+    {
+        shard s;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            ready.wait(lock, [&]() { return !done.empty(); });
+            s = std::move(done.front());
+            done.pop_front();
+            space.notify_one();
+        }
+        on_shard(s);
+    }
+
+    for (auto &t : pool)
+    {
+        t.join();
+    }
+};
+
+#ifdef METASCI_IO_URING
+inline bool shard_reader::ring::setup(unsigned entries)
+{
+    io_uring_params p;
+    std::memset(&p, 0, sizeof(p));
+
+    int ring_fd = static_cast<int>(::syscall(__NR_io_uring_setup, entries, &p));
+    if (ring_fd < 0)
+    {
+        return false;
+    }
+    fd = ring_fd;
+
+    // All three operations appeared in 5.6; older kernels get the threads.
+    alignas(io_uring_probe) char probe_buf[sizeof(io_uring_probe) +
+        256 * sizeof(io_uring_probe_op)];
+    std::memset(probe_buf, 0, sizeof(probe_buf));
+    io_uring_probe *probe = reinterpret_cast<io_uring_probe *>(probe_buf);
+    if (::syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, 256) < 0 ||
+        probe->last_op < IORING_OP_READ ||
+        !(probe->ops[IORING_OP_OPENAT].flags & IO_URING_OP_SUPPORTED) ||
+        !(probe->ops[IORING_OP_STATX].flags & IO_URING_OP_SUPPORTED) ||
+        !(probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED))
+    {
+        teardown();
+        return false;
+    }
+
+    sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cq_size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    bool single_mmap = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single_mmap)
+    {
+        sq_size = cq_size = std::max(sq_size, cq_size);
+    }
+
+    sq_ptr = ::mmap(nullptr, sq_size, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (sq_ptr == MAP_FAILED)
+    {
+        sq_ptr = nullptr;
+        teardown();
+        return false;
+    }
+    cq_ptr = single_mmap ? sq_ptr : ::mmap(nullptr, cq_size,
+        PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    if (cq_ptr == MAP_FAILED)
+    {
+        cq_ptr = nullptr;
+        teardown();
+        return false;
+    }
+
+    sqes_size = p.sq_entries * sizeof(io_uring_sqe);
+    void *s = ::mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (s == MAP_FAILED)
+    {
+        sqes_size = 0;
+        teardown();
+        return false;
+    }
+    sqes = static_cast<io_uring_sqe *>(s);
+
+    char *sq = static_cast<char *>(sq_ptr);
+    char *cq = static_cast<char *>(cq_ptr);
+    sq_head  = reinterpret_cast<unsigned *>(sq + p.sq_off.head);
+    sq_tail  = reinterpret_cast<unsigned *>(sq + p.sq_off.tail);
+    sq_mask  = reinterpret_cast<unsigned *>(sq + p.sq_off.ring_mask);
+    sq_array = reinterpret_cast<unsigned *>(sq + p.sq_off.array);
+    cq_head  = reinterpret_cast<unsigned *>(cq + p.cq_off.head);
+    cq_tail  = reinterpret_cast<unsigned *>(cq + p.cq_off.tail);
+    cq_mask  = reinterpret_cast<unsigned *>(cq + p.cq_off.ring_mask);
+    cqes     = reinterpret_cast<io_uring_cqe *>(cq + p.cq_off.cqes);
+
+    return true;
+};
+
+inline io_uring_sqe *shard_reader::ring::next_sqe()
+{
+    unsigned tail  = *sq_tail;
+    unsigned index = tail & *sq_mask;
+    io_uring_sqe *sqe = &sqes[index];
+
+    std::memset(sqe, 0, sizeof(*sqe));
+    sq_array[index] = index;
+    __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ++to_submit;
+
+    return sqe;
+};
+
+// Submits the queued entries and waits for at least one completion.
+inline bool shard_reader::ring::submit_and_wait()
+{
+    for (;;)
+    {
+        long r = ::syscall(__NR_io_uring_enter, fd, to_submit, 1,
+            IORING_ENTER_GETEVENTS, nullptr, 0);
+        if (r >= 0)
+        {
+            to_submit -= static_cast<unsigned>(r);
+            return true;
+        }
+        if (errno != EINTR)
+        {
+            return false;
+        }
+    }
+};
+
+inline void shard_reader::ring::teardown()
+{
+    if (sqes_size > 0)
+    {
+        ::munmap(sqes, sqes_size);
+        sqes_size = 0;
+    }
+    if (cq_ptr != nullptr && cq_ptr != sq_ptr)
+    {
+        ::munmap(cq_ptr, cq_size);
+    }
+    if (sq_ptr != nullptr)
+    {
+        ::munmap(sq_ptr, sq_size);
+    }
+    sq_ptr = cq_ptr = nullptr;
+    if (fd >= 0)
+    {
+        ::close(fd);
+        fd = -1;
+    }
+};
+
+template<typename OnShard>
+void shard_reader::read_uring(const std::vector<std::string> &paths,
+    OnShard &&on_shard)
+{
+    // A single read is capped, so huge files don't hit the kernel's limit.
+    const size_t max_read = size_t(1) << 30;
+
+    std::vector<slot>   slots(depth);
+    std::vector<size_t> free_slots;
+    size_t              next_path = 0;
+    size_t              in_flight = 0;
+
+    for (size_t i = depth; i-- > 0; )
+    {
+        free_slots.push_back(i);
+    }
+
+    auto submit_read = [&](size_t si)
+    {
+        slot &s = slots[si];
+        io_uring_sqe *sqe = io.next_sqe();
+        sqe->opcode     = IORING_OP_READ;
+        sqe->fd         = s.fd;
+        sqe->addr       = reinterpret_cast<uint64_t>(&s.out.data[s.done]);
+        sqe->len        = static_cast<uint32_t>(
+            std::min(max_read, s.out.data.size() - s.done));
+        sqe->off        = s.done;
+        sqe->user_data  = si;
+    };
+
+    auto finish = [&](size_t si, int error)
+    {
+        slot &s = slots[si];
+        if (s.stage != slot::opening && s.fd >= 0)
+        {
+            ::close(s.fd);
+        }
+        s.out.error = error;
+        on_shard(s.out);
+        s.out = shard();
+        free_slots.push_back(si);
+        --in_flight;
+    };
+
+    while (next_path < paths.size() || in_flight > 0)
+    {
+        // Keeping the queue full.
+        while (next_path < paths.size() && !free_slots.empty())
+        {
+            size_t si = free_slots.back();
+            free_slots.pop_back();
+
+            slot &s     = slots[si];
+            s.stage     = slot::opening;
+            s.path_idx  = next_path++;
+            s.fd        = -1;
+            s.done      = 0;
+            s.out.path  = paths[s.path_idx];
+
+            io_uring_sqe *sqe = io.next_sqe();
+            sqe->opcode     = IORING_OP_OPENAT;
+            sqe->fd         = AT_FDCWD;
+            sqe->addr       = reinterpret_cast<uint64_t>(paths[s.path_idx].c_str());
+            sqe->open_flags = O_RDONLY;
+            sqe->user_data  = si;
+            ++in_flight;
+        }
+
+        if (!io.submit_and_wait())
+        {
+            // The ring is broken; what's left is read the old way.
+            for (size_t si = 0; si < slots.size(); ++si)
+            {
+                if (std::find(free_slots.begin(), free_slots.end(), si) ==
+                    free_slots.end())
+                {
+                    finish(si, read_file(slots[si].out.path, slots[si].out.data));
+                }
+            }
+            for (; next_path < paths.size(); ++next_path)
+            {
+                shard s;
+                s.path  = paths[next_path];
+                s.error = read_file(s.path, s.data);
+                on_shard(s);
+            }
+            return;
+        }
+
+        unsigned head = *io.cq_head;
+        unsigned tail = __atomic_load_n(io.cq_tail, __ATOMIC_ACQUIRE);
+
+        for (; head != tail; ++head)
+        {
+            const io_uring_cqe &cqe = io.cqes[head & *io.cq_mask];
+            size_t si = static_cast<size_t>(cqe.user_data);
+            int    res = cqe.res;
+            slot   &s = slots[si];
+
+            if (res < 0)
+            {
+                finish(si, -res);
+                continue;
+            }
+
+            switch (s.stage)
+            {
+                case slot::opening:
+                {
+                    s.fd    = res;
+                    s.stage = slot::stating;
+
+                    io_uring_sqe *sqe = io.next_sqe();
+                    sqe->opcode     = IORING_OP_STATX;
+                    sqe->fd         = s.fd;
+                    sqe->addr       = reinterpret_cast<uint64_t>("");
+                    sqe->len        = STATX_SIZE;
+                    sqe->statx_flags = AT_EMPTY_PATH;
+                    sqe->off        = reinterpret_cast<uint64_t>(&s.st);
+                    sqe->user_data  = si;
+                    break;
+                }
+                case slot::stating:
+                    s.stage = slot::reading;
+                    s.out.data.resize(static_cast<size_t>(s.st.stx_size));
+                    if (s.out.data.empty())
+                    {
+                        finish(si, 0);
+                    }
+                    else
+                    {
+                        submit_read(si);
+                    }
+                    break;
+
+                case slot::reading:
+                    if (res == 0)
+                    {
+                        // The file has shrunk since it was stat'ed.
+                        finish(si, EIO);
+                        break;
+                    }
+                    s.done += static_cast<size_t>(res);
+                    if (s.done == s.out.data.size())
+                    {
+                        finish(si, 0);
+                    }
+                    else
+                    {
+                        submit_read(si);
+                    }
+                    break;
+            }
+        }
+
+        __atomic_store_n(io.cq_head, head, __ATOMIC_RELEASE);
+    }
+};
+#endif
+}
+#endif
@@ -0,0 +1,238 @@
+/*
+ * Copyright (c) 2022 - present, GitHub: @cubter
+ *
+ * See COPYING.txt in the project root for license information.
+ */
+#ifndef STRING_SORT_H
+#define STRING_SORT_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace metasci
+{
+// Sorting of string keys: a stable MSD radix sort.
+//
+// Comparison sorts compare DOIs over and over from their first byte,
+// although DOIs share long prefixes ("10.1016/j."). MSD radix sort looks at
+// every byte of a key once or so: the items are distributed into buckets by
+// the byte at the current depth, then every bucket is sorted on the next
+// byte. Keys ending at the depth make a bucket of their own, before all the
+// others; bytes every item shares are skipped without moving anything.
+// Small buckets go to an insertion sort comparing the keys from the depth
+// on. The items are moved, not the keys, so an item should be small: a
+// pointer to the key and whatever the caller needs.
+//
+// The sort is stable: items with equal keys keep their order. With several
+// threads, the biggest buckets are split first, one level at a time, and
+// the rest are sorted in parallel.
+//
+// key(const T &) must return std::pair<const char *, size_t>.
+namespace string_sort_detail
+{
+const size_t insertion_threshold = 32;
+
+template<typename T, typename Key>
+inline int byte_at(const T &item, size_t depth, Key &key)
+{
+    std::pair<const char *, size_t> k = key(item);
+    return depth < k.second ? static_cast<unsigned char>(k.first[depth]) + 1 : 0;
+}
+
+template<typename T, typename Key>
+void insertion_sort(T *first, T *last, size_t depth, Key &key)
+{
+    for (T *i = first + 1; i < last; ++i)
+    {
+        T item = std::move(*i);
+        std::pair<const char *, size_t> k = key(item);
+        T *j = i;
+
+        while (j > first)
+        {
+            std::pair<const char *, size_t> prev = key(*(j - 1));
+            size_t n = std::min(prev.second, k.second) - std::min(depth,
+                std::min(prev.second, k.second));
+            int c = n == 0 ? 0 : std::memcmp(prev.first + depth, k.first + depth, n);
+            if (c < 0 || (c == 0 && prev.second <= k.second))
+            {
+                break;
+            }
+            *j = std::move(*(j - 1));
+            --j;
+        }
+        *j = std::move(item);
+    }
+}
+
+// Distributes [first, last) by the byte at depth, through tmp; bucket_end
+// gets every bucket's end. Returns false if all the items share the byte,
+// in which case nothing's moved. The bytes are read once, into oracle, as
+// reading a key is a cache miss more often than not.
+template<typename T, typename Key>
+bool distribute(T *first, T *last, T *tmp, size_t depth, Key &key,
+    size_t (&bucket_end)[257], std::vector<uint16_t> &oracle)
+{
+    const size_t n = static_cast<size_t>(last - first);
+    size_t count[257] = {};
+
+    oracle.resize(std::max(oracle.size(), n));
+    for (size_t i = 0; i < n; ++i)
+    {
+        oracle[i] = static_cast<uint16_t>(byte_at(first[i], depth, key));
+        ++count[oracle[i]];
+    }
+    if (count[oracle[0]] == n)
+    {
+        return false;
+    }
+
+    size_t pos = 0;
+    for (size_t b = 0; b < 257; ++b)
+    {
+        size_t c = count[b];
+        count[b] = pos;
+        pos += c;
+        bucket_end[b] = pos;
+    }
+    for (size_t i = 0; i < n; ++i)
+    {
+        tmp[count[oracle[i]]++] = std::move(first[i]);
+    }
+    std::move(tmp, tmp + n, first);
+
+    return true;
+}
+
+template<typename T, typename Key>
+void msd_sort(T *first, T *last, T *tmp, size_t depth, Key &key,
+    std::vector<uint16_t> &oracle)
+{
+    while (static_cast<size_t>(last - first) > insertion_threshold)
+    {
+        size_t ends[257];
+        if (!distribute(first, last, tmp, depth, key, ends, oracle))
+        {
+            // All the keys end here, or go on with the same byte.
+            if (oracle[0] == 0)
+            {
+                return;
+            }
+            ++depth;
+            continue;
+        }
+
+        // Bucket 0 holds the keys ending at depth, all equal.
+        size_t begin = ends[0];
+        for (size_t b = 1; b < 257; ++b)
+        {
+            if (ends[b] - begin > 1)
+            {
+                msd_sort(first + begin, first + ends[b], tmp + begin, depth + 1,
+                    key, oracle);
+            }
+            begin = ends[b];
+        }
+        return;
+    }
+    insertion_sort(first, last, depth, key);
+}
+}
+
+template<typename T, typename Key>
+void string_sort(T *first, T *last, Key key, unsigned threads = 1)
+{
+    using namespace string_sort_detail;
+
+    const size_t n = static_cast<size_t>(last - first);
+    if (n < 2)
+    {
+        return;
+    }
+    std::vector<T>          tmp(n);
+    std::vector<uint16_t>   oracle;
+
+    if (threads <= 1 || n < (size_t(1) << 16))
+    {
+        msd_sort(first, last, tmp.data(), 0, key, oracle);
+        return;
+    }
+
+    // Splits buckets bigger than a share of the work, then hands the
+    // buckets to the threads, the biggest first.
+    struct task
+    {
+        size_t first;
+        size_t last;
+        size_t depth;
+    };
+    const size_t share = n / (threads * 8) + 1;
+    std::vector<task> pending{ task{ 0, n, 0 } };
+    std::vector<task> tasks;
+
+    while (!pending.empty())
+    {
+        task t = pending.back();
+        pending.pop_back();
+
+        if (t.last - t.first <= share)
+        {
+            tasks.push_back(t);
+            continue;
+        }
+
+        size_t ends[257];
+        if (!distribute(first + t.first, first + t.last, tmp.data() + t.first,
+            t.depth, key, ends, oracle))
+        {
+            if (oracle[0] != 0)
+            {
+                pending.push_back(task{ t.first, t.last, t.depth + 1 });
+            }
+            continue;
+        }
+        size_t begin = ends[0];
+        for (size_t b = 1; b < 257; ++b)
+        {
+            if (ends[b] - begin > 1)
+            {
+                pending.push_back(task{ t.first + begin, t.first + ends[b], t.depth + 1 });
+            }
+            begin = ends[b];
+        }
+    }
+
+    std::sort(tasks.begin(), tasks.end(), [](const task &a, const task &b)
+    {
+        return a.last - a.first > b.last - b.first;
+    });
+
+    std::atomic<size_t> next{ 0 };
+    std::vector<std::thread> pool;
+    for (unsigned i = 0; i < threads; ++i)
+    {
+        pool.emplace_back([&]
+        {
+            // Each thread's key accessor, in case it keeps state.
+            Key k = key;
+            std::vector<uint16_t> own_oracle;
+            for (size_t t = next++; t < tasks.size(); t = next++)
+            {
+                msd_sort(first + tasks[t].first, first + tasks[t].last,
+                    tmp.data() + tasks[t].first, tasks[t].depth, k, own_oracle);
+            }
+        });
+    }
+    for (auto &t : pool)
+    {
+        t.join();
+    }
+}
+}
+#endif
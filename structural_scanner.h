@@ -0,0 +1,247 @@
+/*
+ * Copyright (c) 2022 - present, GitHub: @cubter
+ *
+ * See COPYING.txt in the project root for license information.
+ */
+#ifndef STRUCTURAL_SCANNER_H
+#define STRUCTURAL_SCANNER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+    #define METASCI_X86 1
+    #include <immintrin.h>
+#endif
+
+namespace metasci
+{
+// Stage 1 of the JSON parsing, simdjson-style: the input is classified 64
+// bytes at a time into bitmasks of quotes, backslashes and structural
+// characters ({}[]:,), and the positions of the structural characters lying
+// outside of strings are handed to a visitor. Opening & closing quotes are
+// reported as well, so the visitor can tell keys and string values apart.
+//
+// The classification kernel is picked at runtime: AVX2, SSE4.2 or scalar.
+// Escapes are resolved with plain bit operations on the backslash mask, which
+// is nearly always empty.
+
+// Bitmasks of a single 64-byte block; bit i stands for byte i.
+struct block_masks
+{
+    uint64_t quote;
+    uint64_t backslash;
+    uint64_t op;        // { } [ ] : ,
+};
+
+namespace simd
+{
+inline void classify_scalar(const char *p, block_masks &m)
+{
+    m = block_masks{ 0, 0, 0 };
+
+    for (size_t i = 0; i < 64; ++i)
+    {
+        uint64_t bit = uint64_t(1) << i;
+        switch (p[i])
+        {
+            case '"':  m.quote |= bit;      break;
+            case '\\': m.backslash |= bit;  break;
+            case '{': case '}': case '[': case ']': case ':': case ',':
+                m.op |= bit;
+                break;
+            default:
+                break;
+        }
+    }
+};
+
+#ifdef METASCI_X86
+// SSE4.2: the structural characters are matched as a set by PCMPESTRM.
+__attribute__((target("sse4.2")))
+inline void classify_sse42(const char *p, block_masks &m)
+{
+    const __m128i set     = _mm_setr_epi8('{', '}', '[', ']', ':', ',',
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i quote   = _mm_set1_epi8('"');
+    const __m128i bslash  = _mm_set1_epi8('\\');
+
+    m = block_masks{ 0, 0, 0 };
+
+    for (int i = 0; i < 4; ++i)
+    {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 16 * i));
+        int shift = 16 * i;
+
+        __m128i ops = _mm_cmpestrm(set, 6, chunk, 16,
+            _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY | _SIDD_BIT_MASK);
+
+        m.op |= uint64_t(static_cast<uint16_t>(_mm_cvtsi128_si32(ops))) << shift;
+        m.quote |= uint64_t(static_cast<uint16_t>(
+            _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, quote)))) << shift;
+        m.backslash |= uint64_t(static_cast<uint16_t>(
+            _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, bslash)))) << shift;
+    }
+};
+
+// AVX2: '[' and ']' differ from '{' and '}' by the 0x20 bit only, so the
+// brackets take two comparisons instead of four.
+__attribute__((target("avx2")))
+inline void classify_avx2(const char *p, block_masks &m)
+{
+    const __m256i lower   = _mm256_set1_epi8(0x20);
+    const __m256i lbrace  = _mm256_set1_epi8('{');
+    const __m256i rbrace  = _mm256_set1_epi8('}');
+    const __m256i colon   = _mm256_set1_epi8(':');
+    const __m256i comma   = _mm256_set1_epi8(',');
+    const __m256i quote   = _mm256_set1_epi8('"');
+    const __m256i bslash  = _mm256_set1_epi8('\\');
+
+    m = block_masks{ 0, 0, 0 };
+
+    for (int i = 0; i < 2; ++i)
+    {
+        __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + 32 * i));
+        __m256i folded = _mm256_or_si256(chunk, lower);
+        int shift = 32 * i;
+
+        __m256i ops = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(folded, lbrace),
+                _mm256_cmpeq_epi8(folded, rbrace)),
+            _mm256_or_si256(_mm256_cmpeq_epi8(chunk, colon),
+                _mm256_cmpeq_epi8(chunk, comma)));
+
+        m.op |= uint64_t(static_cast<uint32_t>(_mm256_movemask_epi8(ops))) << shift;
+        m.quote |= uint64_t(static_cast<uint32_t>(
+            _mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, quote)))) << shift;
+        m.backslash |= uint64_t(static_cast<uint32_t>(
+            _mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, bslash)))) << shift;
+    }
+};
+#endif
+}
+
+class structural_scanner
+{
+public:
+    using classify_fn = void (*)(const char *, block_masks &);
+
+    // Calls visit(position, character) for every structural character, in
+    // order. The visitor may return false to stop the scan.
+    template<typename Visitor>
+    void scan(const char *data, size_t len, Visitor &&visit) const;
+
+    const char *kernel_name() const { return name; }
+
+    inline structural_scanner();
+
+private:
+    static inline uint64_t prefix_xor(uint64_t x);
+    static inline uint64_t find_escaped(uint64_t backslash, uint64_t &carry);
+
+    classify_fn classify;
+    const char  *name;
+};
+
+inline structural_scanner::structural_scanner()
+{
+    classify = simd::classify_scalar;
+    name = "scalar";
+#ifdef METASCI_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        classify = simd::classify_avx2;
+        name = "avx2";
+    }
+    else if (__builtin_cpu_supports("sse4.2"))
+    {
+        classify = simd::classify_sse42;
+        name = "sse4.2";
+    }
+#endif
+};
+
+// Bit i of the result is the XOR of bits 0..i of x: it's set for the bytes
+// from an opening quote up to (not including) the closing one.
+inline uint64_t structural_scanner::prefix_xor(uint64_t x)
+{
+    x ^= x << 1;
+    x ^= x << 2;
+    x ^= x << 4;
+    x ^= x << 8;
+    x ^= x << 16;
+    x ^= x << 32;
+
+    return x;
+};
+
+// Returns the mask of the characters escaped by a backslash. `carry` tells
+// whether the previous block ended with an unpaired backslash.
+inline uint64_t structural_scanner::find_escaped(uint64_t backslash,
+    uint64_t &carry)
+{
+    uint64_t escaped = carry;
+
+    // A backslash escaped by the previous block's one doesn't escape anything.
+    backslash &= ~carry;
+    carry = 0;
+
+    while (backslash != 0)
+    {
+        int i = __builtin_ctzll(backslash);
+        if (i == 63)
+        {
+            carry = 1;
+            break;
+        }
+        escaped |= uint64_t(1) << (i + 1);
+        // The escaped character may be a backslash itself.
+        backslash &= ~(uint64_t(3) << i);
+    }
+
+    return escaped;
+};
+
+template<typename Visitor>
+void structural_scanner::scan(const char *data, size_t len, Visitor &&visit) const
+{
+    uint64_t escape_carry = 0;
+    uint64_t prev_in_string = 0;
+    char     tail[64];
+
+    for (size_t base = 0; base < len; base += 64)
+    {
+        const char *block = data + base;
+
+        // The last, partial block is padded with spaces.
+        if (len - base < 64)
+        {
+            std::memset(tail, ' ', 64);
+            std::memcpy(tail, block, len - base);
+            block = tail;
+        }
+
+        block_masks m;
+        classify(block, m);
+
+        uint64_t quotes = m.quote & ~find_escaped(m.backslash, escape_carry);
+        uint64_t in_string = prefix_xor(quotes) ^ prev_in_string;
+        prev_in_string = static_cast<uint64_t>(static_cast<int64_t>(in_string) >> 63);
+
+        uint64_t structurals = (m.op & ~in_string) | quotes;
+
+        while (structurals != 0)
+        {
+            size_t pos = base + static_cast<size_t>(__builtin_ctzll(structurals));
+            if (!visit(pos, data[pos]))
+            {
+                return;
+            }
+            structurals &= structurals - 1;
+        }
+    }
+};
+}
+#endif
@@ -0,0 +1,114 @@
+/*
+ * Copyright (c) 2022 - present, GitHub: @cubter
+ *
+ * See COPYING.txt in the project root for license information.
+ */
+#include "test.h"
+
+#include "arena.h"
+#include "article.h"
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+using metasci::arena_allocator;
+using metasci::arena_vector;
+using metasci::article;
+using metasci::monotonic_arena;
+
+namespace
+{
+// Allocations are aligned and apart, an oversized one gets a block of its
+// own, and after a reset the blocks are filled again without new ones.
+void allocates()
+{
+    monotonic_arena arena(4096);
+    std::vector<char *> got;
+    for (size_t i = 0; i < 500; ++i)
+    {
+        const size_t align = size_t(1) << (i % 5);
+        char *p = static_cast<char *>(arena.allocate(i % 37 + 1, align));
+        CHECK(reinterpret_cast<uintptr_t>(p) % align == 0);
+        std::memset(p, static_cast<int>(i), i % 37 + 1);
+        got.push_back(p);
+    }
+    bool intact = true;
+    for (size_t i = 0; i < got.size(); ++i)
+    {
+        for (size_t j = 0; j < i % 37 + 1; ++j)
+        {
+            intact = intact && got[i][j] == static_cast<char>(i);
+        }
+    }
+    CHECK(intact);
+
+    void *big = arena.allocate(100000, 64);
+    CHECK(reinterpret_cast<uintptr_t>(big) % 64 == 0);
+    const size_t capacity = arena.capacity();
+    CHECK(capacity >= 100000 + 500 * 19);
+
+    arena.reset();
+    for (size_t i = 0; i < 500; ++i)
+    {
+        arena.allocate(i % 37 + 1, size_t(1) << (i % 5));
+    }
+    arena.allocate(100000, 64);
+    CHECK(arena.capacity() == capacity);
+}
+
+// Containers grow in the arena, or on the heap without one.
+void containers()
+{
+    monotonic_arena arena;
+    arena_vector<std::string> in_arena{ arena_allocator<std::string>(arena) };
+    arena_vector<std::string> on_heap;
+    for (int i = 0; i < 1000; ++i)
+    {
+        in_arena.push_back(std::to_string(i));
+        on_heap.push_back(std::to_string(i));
+    }
+    CHECK(std::vector<std::string>(in_arena.begin(), in_arena.end()) ==
+        std::vector<std::string>(on_heap.begin(), on_heap.end()));
+    CHECK(in_arena.get_allocator().get_arena() == &arena);
+    CHECK(on_heap.get_allocator().get_arena() == nullptr);
+    CHECK(arena.capacity() > 0);
+}
+
+// An article built in the arena outlives its reset, and its builder is used
+// again for the next item.
+void builds()
+{
+    monotonic_arena arena;
+    article::builder b(arena);
+    std::vector<article> built;
+    for (int i = 0; i < 3; ++i)
+    {
+        b.doi_b = "10.1/" + std::to_string(i);
+        for (int r = 0; r < 100; ++r)
+        {
+            b.references_b.push_back("10.2/" + std::to_string(i * 100 + r));
+        }
+        b.subjects_ids_b.push_back(static_cast<metasci::subject_id>(i));
+        built.push_back(b.build());
+        CHECK(b.references_b.empty() && b.subjects_ids_b.empty());
+        arena.reset();
+    }
+    for (int i = 0; i < 3; ++i)
+    {
+        const metasci::str_vec &refs = built[static_cast<size_t>(i)].references_ref();
+        CHECK(refs.size() == 100 && refs[99] == "10.2/" + std::to_string(i * 100 + 99));
+        CHECK(built[static_cast<size_t>(i)].subjects_ids_ref() ==
+            std::vector<metasci::subject_id>{ static_cast<metasci::subject_id>(i) });
+    }
+}
+}
+
+int main()
+{
+    allocates();
+    containers();
+    builds();
+    return test::report();
+}
@@ -0,0 +1,201 @@
+/*
+ * Copyright (c) 2022 - present, GitHub: @cubter
+ *
+ * See COPYING.txt in the project root for license information.
+ */
+#include "test.h"
+
+#include "async_api_connector.h"
+
+#include <nlohmann/json.hpp>
+
+#include <chrono>
+#include <csignal>
+#include <fstream>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using metasci::api_page;
+using metasci::async_api_connector;
+using metasci::content_cache;
+
+namespace
+{
+const size_t n_works = 600;
+
+// The mock server (mock_crossref_server.cpp) in a process of its own,
+// serving a dump's works on a free port, till it's destroyed.
+class mock_server
+{
+public:
+    std::string url() const
+    {
+        return "http://127.0.0.1:" + std::to_string(port) + "/works";
+    }
+
+    mock_server(const std::string &dump)
+    {
+        int s = ::socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in addr{};
+        addr.sin_family      = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t len = sizeof(addr);
+        ::bind(s, reinterpret_cast<sockaddr *>(&addr), sizeof(addr));
+        ::getsockname(s, reinterpret_cast<sockaddr *>(&addr), &len);
+        port = ntohs(addr.sin_port);
+        ::close(s);
+
+        const std::string p = std::to_string(port);
+        pid = ::fork();
+        if (pid == 0)
+        {
+            ::execl(MOCK_CROSSREF_SERVER, MOCK_CROSSREF_SERVER, "-p", p.c_str(),
+                "-r", "1000", dump.c_str(), static_cast<char *>(nullptr));
+            ::_exit(127);
+        }
+
+        // Up once it takes connections.
+        for (int i = 0; i < 500; ++i)
+        {
+            s = ::socket(AF_INET, SOCK_STREAM, 0);
+            bool up = ::connect(s, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == 0;
+            ::close(s);
+            if (up)
+            {
+                return;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        test::fail(__FILE__, __LINE__, "the mock server isn't up");
+    }
+    mock_server(const mock_server &other) = delete;
+    mock_server &operator=(const mock_server &other) = delete;
+    ~mock_server()
+    {
+        ::kill(pid, SIGTERM);
+        ::waitpid(pid, nullptr, 0);
+    }
+
+private:
+    uint16_t    port = 0;
+    pid_t       pid  = -1;
+};
+
+// A dump of works indexed over the first ten days of 2024.
+std::string dump(const std::string &path)
+{
+    std::ofstream out(path);
+    out << "{\"status\":\"ok\",\"message\":{\"items\":[";
+    for (size_t i = 0; i < n_works; ++i)
+    {
+        out << (i == 0 ? "" : ",") << "{\"DOI\":\"10.5555/" << i << "\","
+            "\"indexed\":{\"date-parts\":[[2024,1," << 1 + i % 10 << "]]},"
+            "\"title\":[\"Work " << i << "\"]}";
+    }
+    out << "]}}";
+    return path;
+}
+
+using works = std::map<std::string, std::map<std::string, int>>;
+
+// The works of every query, each with how many times it came.
+works harvest(async_api_connector &connector, const std::vector<std::string> &queries,
+    async_api_connector::stats &st)
+{
+    works got;
+    st = connector.harvest(queries, [&](api_page &page)
+    {
+        CHECK(page.error.empty());
+        if (!page.error.empty())
+        {
+            return;
+        }
+        const nlohmann::json message = nlohmann::json::parse(
+            page.body.substr(page.message_begin, page.message_len));
+        for (const nlohmann::json &item : message.at("items"))
+        {
+            ++got[page.query][item.at("DOI").get<std::string>()];
+        }
+    });
+    return got;
+}
+
+bool each_once(const std::map<std::string, int> &dois, size_t n)
+{
+    for (const auto &d : dois)
+    {
+        if (d.second != 1)
+        {
+            return false;
+        }
+    }
+    return dois.size() == n;
+}
+
+// Every query is walked to its end, its works coming once each, however
+// many pages are kept waiting; a walk that's done is replayed from the
+// cache, even once the server is gone.
+void walks()
+{
+    test::scratch_dir dir;
+    content_cache cache(dir / "cache");
+    std::vector<std::string> queries;
+    async_api_connector::stats st;
+    {
+        mock_server server(dump(dir / "dump.json"));
+        queries = { server.url(),
+            server.url() + "?filter=from-index-date:2024-01-01,until-index-date:2024-01-03",
+            server.url() + "?filter=from-index-date:2024-01-09" };
+
+        for (unsigned max_pages : { 1u, 16u })
+        {
+            async_api_connector::options opts;
+            opts.rows      = 50;
+            opts.in_flight = 4;
+            opts.max_pages = max_pages;
+            opts.cache     = max_pages == 16 ? &cache : nullptr;
+            async_api_connector connector(opts);
+
+            works got = harvest(connector, queries, st);
+            CHECK(each_once(got[queries[0]], n_works));
+            CHECK(each_once(got[queries[1]], 3 * n_works / 10));
+            CHECK(each_once(got[queries[2]], 2 * n_works / 10));
+            CHECK(st.cached == 0 && st.pages > n_works / 50);
+        }
+    }
+
+    async_api_connector::options opts;
+    opts.rows        = 50;
+    opts.cache       = &cache;
+    opts.max_retries = 0;
+    async_api_connector connector(opts);
+    works got = harvest(connector, queries, st);
+    CHECK(each_once(got[queries[0]], n_works));
+    CHECK(each_once(got[queries[2]], 2 * n_works / 10));
+    CHECK(st.requests == 0 && st.cached == st.pages);
+
+    // Another page size is another walk, and there's no one to answer it.
+    opts.rows = 100;
+    async_api_connector uncached(opts);
+    bool failed = false;
+    uncached.harvest({ queries[0] }, [&](api_page &page)
+    {
+        failed = failed || !page.error.empty();
+    });
+    CHECK(failed);
+}
+}
+
+int main()
+{
+    walks();
+    return test::report();
+}
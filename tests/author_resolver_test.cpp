@@ -0,0 +1,152 @@
+/*
+ * Copyright (c) 2022 - present, GitHub: @cubter
+ *
+ * See COPYING.txt in the project root for license information.
+ */
+#include "test.h"
+
+#include "author_resolver.h"
+
+#include <string>
+#include <vector>
+
+using metasci::article;
+using metasci::author;
+using metasci::author_resolver;
+using metasci::orcid;
+
+namespace
+{
+author person(const std::string &given, const std::string &family,
+    const std::string &id = "", const std::string &affiliation = "")
+{
+    orcid o;
+    if (!id.empty() && !orcid::parse(id, o))
+    {
+        test::fail(__FILE__, __LINE__, ("bad ORCID " + id).c_str());
+    }
+    author a(given, family, o, false);
+    if (!affiliation.empty())
+    {
+        a.add_affiliation(affiliation);
+    }
+    return a;
+}
+
+article paper(const std::string &doi, const std::vector<author> &authors)
+{
+    article::builder b;
+    b.doi_b = doi;
+    for (const author &a : authors)
+    {
+        b.authors_b.push_back(a);
+    }
+    return b.build();
+}
+
+// Authors having ORCID are merged by it, whatever their names.
+void by_orcid()
+{
+    author_resolver r(2);
+    std::vector<article> batch;
+    batch.push_back(paper("10.1/a",
+        { person("Josiah", "Carberry", "0000-0002-1825-0097") }));
+    batch.push_back(paper("10.1/b",
+        { person("J.", "Carberry", "0000-0002-1825-0097") }));
+    batch.push_back(paper("10.1/c",
+        { person("Josiah", "Carberry", "0000-0001-5109-3700") }));
+    r.resolve(batch);
+
+    CHECK(r.authors().size() == 2);
+    CHECK(batch[0].authors_ids_ref() == batch[1].authors_ids_ref());
+    CHECK(batch[0].authors_ids_ref() != batch[2].authors_ids_ref());
+    for (size_t i = 0; i < r.authors().size(); ++i)
+    {
+        CHECK(r.authors()[i].get_id() == static_cast<int32_t>(i + 1));
+    }
+}
+
+// Namesakes lacking ORCID are one person if they share an affiliation,
+// unless they're in the same article.
+void by_features()
+{
+    author_resolver r(2);
+    std::vector<article> batch;
+    batch.push_back(paper("10.1/a", { person("Ann", "Lee", "", "Univ. of X") }));
+    batch.push_back(paper("10.1/b", { person("A.", "Lee", "", "Univ. of X") }));
+    batch.push_back(paper("10.1/c", { person("Ann", "Lee", "", "Univ. of Y") }));
+    batch.push_back(paper("10.1/d", { person("Ann", "Lee", "", "Univ. of X"),
+        person("Alan", "Lee", "", "Univ. of X") }));
+    r.resolve(batch);
+
+    CHECK(batch[0].authors_ids_ref() == batch[1].authors_ids_ref());
+    CHECK(batch[0].authors_ids_ref() != batch[2].authors_ids_ref());
+    CHECK(batch[3].authors_ids_ref().size() == 2);
+    CHECK(batch[3].authors_ids_ref()[0] != batch[3].authors_ids_ref()[1]);
+}
+
+// A later batch is resolved against the authors of the earlier ones, and
+// a resolver restored from the changes it's reported resolves alike.
+void across_batches()
+{
+    author::restore_max_id(0);
+    author_resolver first(2);
+    first.track_changes();
+    std::vector<article> batch;
+    batch.push_back(paper("10.1/a", { person("Ann", "Lee", "", "Univ. of X") }));
+    batch.push_back(paper("10.1/b", { person("Bo", "Chen", "0000-0002-1825-0097") }));
+    first.resolve(batch);
+
+    std::vector<std::pair<author, std::vector<std::string>>> changes;
+    first.for_each_change([&](const author &a, const std::vector<std::string> &f)
+    {
+        changes.emplace_back(a, f);
+    });
+    CHECK(changes.size() == 2);
+
+    author_resolver restored(2);
+    for (const auto &c : changes)
+    {
+        restored.restore(c.first, c.second);
+    }
+    CHECK(restored.authors().size() == first.authors().size());
+    CHECK_THROWS(restored.restore(person("Out", "Of Order"), {}));
+
+    auto next_batch = []
+    {
+        std::vector<article> b;
+        b.push_back(paper("10.1/c", { person("A.", "Lee", "", "Univ. of X") }));
+        b.push_back(paper("10.1/d", { person("Bo", "Chen", "0000-0002-1825-0097") }));
+        b.push_back(paper("10.1/e", { person("Cy", "Diaz") }));
+        return b;
+    };
+    const int32_t max_id = author::max_id();
+    std::vector<article> next  = next_batch();
+    std::vector<article> again = next_batch();
+    first.resolve(next);
+    author::restore_max_id(max_id);
+    restored.resolve(again);
+
+    CHECK(next[0].authors_ids_ref() == batch[0].authors_ids_ref());
+    CHECK(next[1].authors_ids_ref() == batch[1].authors_ids_ref());
+    CHECK(first.authors().size() == 3);
+    for (size_t i = 0; i < next.size(); ++i)
+    {
+        CHECK(next[i].authors_ids_ref() == again[i].authors_ids_ref());
+    }
+
+    // Only the authors lacking ORCID have features.
+    const std::vector<std::vector<std::string>> features = first.features();
+    CHECK(features == restored.features());
+    CHECK(features.size() == 3 && features[0].empty() &&
+        features[1] == std::vector<std::string>{ "a:univofx" } && features[2].empty());
+}
+}
+
+int main()
+{
+    by_orcid();
+    by_features();
+    across_batches();
+    return test::report();
+}
@@ -0,0 +1,204 @@
+/*
+ * Copyright (c) 2022 - present, GitHub: @cubter
+ *
+ * See COPYING.txt in the project root for license information.
+ */
+#include "test.h"
+
+#include "cbor_shard.h"
+#include "fast_json.h"
+
+#include <nlohmann/json.hpp>
+
+#include <random>
+#include <string>
+#include <vector>
+
+using metasci::cbor_item_reader;
+using metasci::fast_json;
+using metasci::item_reader;
+
+namespace
+{
+// A random value of every kind CBOR's writer makes: integers of every
+// width and sign, floats, strings of every length's head, nested
+// containers, empty ones.
+nlohmann::json random_value(std::mt19937_64 &rng, int depth)
+{
+    switch (rng() % (depth > 3 ? 6 : 8))
+    {
+        case 0: return nullptr;
+        case 1: return rng() % 2 == 0;
+        case 2: return static_cast<int64_t>(rng()) >> (rng() % 64);
+        case 3: return rng() >> (rng() % 64);
+        case 4: return static_cast<double>(static_cast<int64_t>(rng())) / 1e6;
+        case 5: return std::string(rng() % 300, static_cast<char>('a' + rng() % 26)) +
+            "\xc3\xa9";
+        case 6:
+        {
+            nlohmann::json a = nlohmann::json::array();
+            for (size_t n = rng() % 5; n > 0; --n)
+            {
+                a.push_back(random_value(rng, depth + 1));
+            }
+            return a;
+        }
+        default:
+        {
+            nlohmann::json o = nlohmann::json::object();
+            for (size_t n = rng() % 5; n > 0; --n)
+            {
+                o["k" + std::to_string(rng() % 10)] = random_value(rng, depth + 1);
+            }
+            return o;
+        }
+    }
+}
+
+// An envelope of items, each with the fields f0..f4.
+std::string envelope(std::mt19937_64 &rng, size_t n, std::vector<nlohmann::json> &items)
+{
+    nlohmann::json e;
+    e["status"] = "ok";
+    e["items"]  = nlohmann::json::array();
+    for (size_t i = 0; i < n; ++i)
+    {
+        nlohmann::json item = nlohmann::json::object();
+        for (int f = 0; f < 5; ++f)
+        {
+            item["f" + std::to_string(f)] = random_value(rng, 1);
+        }
+        items.push_back(item);
+        e["items"].push_back(item);
+    }
+    return e.dump();
+}
+
+// Only the fields asked for, of the items.
+std::vector<nlohmann::json> selected(const std::vector<nlohmann::json> &items,
+    const std::vector<std::string> &fields)
+{
+    std::vector<nlohmann::json> out;
+    for (const nlohmann::json &item : items)
+    {
+        nlohmann::json o = nlohmann::json::object();
+        for (const std::string &f : fields)
+        {
+            o[f] = item.at(f);
+        }
+        out.push_back(o);
+    }
+    return out;
+}
+
+// A shard, compressed and decompressed, gives the items' fields asked for
+// as parsing the text does, to either DOM.
+void round_trip()
+{
+    std::mt19937_64 rng(9);
+    std::vector<nlohmann::json> items;
+    const std::string text = envelope(rng, 200, items);
+
+    std::string cbor, packed, unpacked;
+    CHECK(metasci::transcode_to_cbor<nlohmann::json>(text.data(), text.size(),
+        item_reader::envelope, cbor));
+    CHECK(metasci::is_cbor(cbor.data(), cbor.size()));
+    CHECK(!metasci::is_cbor(text.data(), text.size()));
+
+    metasci::zstd_compress(cbor, 3, packed);
+    CHECK(metasci::is_zstd(packed.data(), packed.size()));
+    CHECK(metasci::unzstd(packed.data(), packed.size(), unpacked));
+    CHECK(unpacked == cbor);
+
+    for (const std::vector<std::string> &fields : std::vector<std::vector<std::string>>{
+        { "f0", "f1", "f2", "f3", "f4" }, { "f3" }, { "f4", "f1" } })
+    {
+        const std::vector<nlohmann::json> expected = selected(items, fields);
+
+        std::vector<nlohmann::json> got;
+        cbor_item_reader<nlohmann::json> n(fields);
+        CHECK(n.read(cbor.data(), cbor.size(), [&](nlohmann::json &item)
+        {
+            got.push_back(item);
+        }));
+        CHECK(got == expected);
+
+        got.clear();
+        cbor_item_reader<fast_json> f(fields);
+        CHECK(f.read(cbor.data(), cbor.size(), [&](fast_json &item)
+        {
+            got.push_back(nlohmann::json::parse(item.dump()));
+        }));
+        CHECK(got == expected);
+    }
+}
+
+// Items one after another, and frames one after another, read alike.
+void bare_and_frames()
+{
+    const std::string text = "{\"f0\":1}\n{\"f0\":[2]}\n";
+    std::string cbor, packed, more, unpacked;
+    CHECK(metasci::transcode_to_cbor<nlohmann::json>(text.data(), text.size(),
+        item_reader::bare, cbor));
+
+    metasci::zstd_compress(cbor.substr(0, 5), 3, packed);
+    metasci::zstd_compress(cbor.substr(5), 3, more);
+    packed += more;
+    CHECK(metasci::unzstd(packed.data(), packed.size(), unpacked));
+    CHECK(unpacked == cbor);
+
+    std::vector<std::string> got;
+    cbor_item_reader<nlohmann::json> r({ "f0" });
+    CHECK(r.read(cbor.data(), cbor.size(), [&](nlohmann::json &item)
+    {
+        got.push_back(item.dump());
+    }));
+    CHECK(got == (std::vector<std::string>{ "{\"f0\":1}", "{\"f0\":[2]}" }));
+}
+
+// Damaged input is refused, and says why.
+void damaged()
+{
+    std::mt19937_64 rng(1);
+    std::vector<nlohmann::json> items;
+    const std::string text = envelope(rng, 20, items);
+    std::string cbor, packed, unpacked;
+    metasci::transcode_to_cbor<nlohmann::json>(text.data(), text.size(),
+        item_reader::envelope, cbor);
+    metasci::zstd_compress(cbor, 3, packed);
+
+    CHECK(!metasci::unzstd(packed.data(), packed.size() - 1, unpacked));
+
+    cbor_item_reader<nlohmann::json> r({ "f0" });
+    for (size_t len : { size_t(0), size_t(1), cbor.size() / 2, cbor.size() - 1 })
+    {
+        CHECK(!r.read(cbor.data(), len, [](nlohmann::json &) {}));
+        CHECK(!r.error().empty());
+    }
+    CHECK(!r.read((cbor + '\0').data(), cbor.size() + 1, [](nlohmann::json &) {}));
+
+    std::string other;
+    nlohmann::json::to_cbor(nlohmann::json{ { "elsewhere", 1 } }, other);
+    CHECK(!r.read(other.data(), other.size(), [](nlohmann::json &) {}));
+    other.clear();
+    nlohmann::json::to_cbor(nlohmann::json::array({ 1, 2 }), other);
+    CHECK(!r.read(other.data(), other.size(), [](nlohmann::json &) {}));
+
+    // The items before a malformed one are kept.
+    const std::string bad = R"({"items":[{"f0":1},{"f0":tru}]})";
+    cbor.clear();
+    CHECK(!metasci::transcode_to_cbor<nlohmann::json>(bad.data(), bad.size(),
+        item_reader::envelope, cbor));
+    size_t n = 0;
+    CHECK(r.read(cbor.data(), cbor.size(), [&](nlohmann::json &) { ++n; }));
+    CHECK(n == 1);
+}
+}
+
+int main()
+{
+    round_trip();
+    bare_and_frames();
+    damaged();
+    return test::report();
+}
@@ -0,0 +1,179 @@
+/*
+ * Copyright (c) 2022 - present, GitHub: @cubter
+ *
+ * See COPYING.txt in the project root for license information.
+ */
+#include "test.h"
+
+#include "checkpoint.h"
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+using metasci::article;
+using metasci::author;
+using metasci::checkpoint_journal;
+using metasci::dictionaries;
+using metasci::file_stamp;
+using metasci::journal;
+using metasci::orcid;
+using metasci::publisher;
+using metasci::subject;
+
+namespace
+{
+// What a restarted run starts from: no IDs given yet.
+void restart()
+{
+    article::restore_max_id(0);
+    author::restore_max_id(0);
+    journal::restore_max_id(0);
+    publisher::restore_max_id(0);
+    subject::restore_max_id(0);
+}
+
+article paper(const std::string &doi, const std::string &family,
+    const std::string &id = "")
+{
+    orcid o;
+    if (!id.empty())
+    {
+        orcid::parse(id, o);
+    }
+    article::builder b;
+    b.doi_b = doi;
+    b.authors_b.push_back(author("Ann\tM.", family, o, false));
+    b.authors_b.back().add_affiliation("Univ. of X\\Y");
+    return b.build();
+}
+
+// Fills the dictionaries as parsing a file would.
+void parse_file(dictionaries &dicts, const std::string &tag)
+{
+    dicts.subjects.emplace_back("Subject " + tag);
+    dicts.journals.emplace("Journal " + tag, "Publisher\n" + tag);
+    dicts.labels.intern("Suppl. " + tag);
+
+    std::vector<article> batch;
+    batch.push_back(paper("10.1/" + tag, "Lee " + tag,
+        tag == "a" ? "0000-0002-1825-0097" : ""));
+    batch.push_back(paper("10.2/" + tag, "Chen " + tag));
+    dicts.resolver.resolve(batch);
+}
+
+// What's been committed is restored on reopening: the files done, the
+// dictionaries with the same IDs, and the IDs' counters.
+void round_trip()
+{
+    test::scratch_dir dir;
+    const file_stamp a { 100, 1000 }, b { 200, 2000 };
+
+    restart();
+    int32_t max_author = 0, max_journal = 0;
+    {
+        dictionaries dicts;
+        checkpoint_journal j(dir / "journal", dicts);
+        CHECK(j.completed() == 0);
+        parse_file(dicts, "a");
+        j.commit("in/a.json", a, "out/a.orc", 2);
+        parse_file(dicts, "b");
+        j.commit("in/b\tc.json", b, "out/b.orc", 2);
+        max_author  = author::max_id();
+        max_journal = journal::max_id();
+    }
+
+    restart();
+    dictionaries dicts;
+    checkpoint_journal j(dir / "journal", dicts);
+    CHECK(j.completed() == 2);
+    CHECK(j.is_done("in/a.json", a));
+    CHECK(j.is_done("in/b\tc.json", b));
+    CHECK(!j.is_done("in/a.json", b));
+    CHECK(!j.is_done("in/c.json", a));
+
+    CHECK(dicts.subjects.size() == 2);
+    CHECK(dicts.journals.size() == 2);
+    CHECK(dicts.labels.size() == 2 && dicts.labels.get(1) == "Suppl. b");
+    CHECK(dicts.resolver.authors().size() == 4);
+    for (const journal &jo : dicts.journals)
+    {
+        CHECK(jo.get_publisher_title().compare(0, 10, "Publisher\n") == 0);
+    }
+    CHECK(author::max_id() == max_author);
+    CHECK(journal::max_id() == max_journal);
+
+    // The next file's authors are resolved against the restored ones, and
+    // its new entries get the next IDs.
+    std::vector<article> batch;
+    batch.push_back(paper("10.1/c", "Lee a", "0000-0002-1825-0097"));
+    batch.push_back(paper("10.1/d", "Diaz"));
+    dicts.resolver.resolve(batch);
+    CHECK(dicts.resolver.authors().size() == 5);
+    CHECK(batch[0].authors_ids_ref().size() == 1 &&
+        batch[0].authors_ids_ref()[0] <= max_author);
+    CHECK(author::max_id() == max_author + 1);
+}
+
+// A record torn by a crash is dropped, and the journal goes on after the
+// last complete one.
+void torn_tail()
+{
+    test::scratch_dir dir;
+    const file_stamp a { 100, 1000 }, b { 200, 2000 };
+
+    restart();
+    {
+        dictionaries dicts;
+        checkpoint_journal j(dir / "journal", dicts);
+        parse_file(dicts, "a");
+        j.commit("in/a.json", a, "out/a.orc", 2);
+    }
+    {
+        // The crash: a record without its "end", the last line half-written.
+        std::ofstream out(dir / "journal", std::ios::app | std::ios::binary);
+        out << "file\tin/b.json\t200\t2000\tout/b.orc\t2\nsubject\t9\tLo";
+    }
+
+    restart();
+    {
+        dictionaries dicts;
+        checkpoint_journal j(dir / "journal", dicts);
+        CHECK(j.completed() == 1);
+        CHECK(!j.is_done("in/b.json", b));
+        CHECK(dicts.subjects.size() == 1);
+
+        parse_file(dicts, "b");
+        j.commit("in/b.json", b, "out/b.orc", 2);
+    }
+
+    restart();
+    dictionaries dicts;
+    checkpoint_journal j(dir / "journal", dicts);
+    CHECK(j.completed() == 2);
+    CHECK(j.is_done("in/a.json", a) && j.is_done("in/b.json", b));
+    CHECK(dicts.subjects.size() == 2);
+    CHECK(dicts.resolver.authors().size() == 4);
+}
+
+// A complete record that can't be understood is an error, not a tear.
+void corrupt()
+{
+    test::scratch_dir dir;
+    {
+        std::ofstream out(dir / "journal", std::ios::binary);
+        out << "file\tin/a.json\t100\t1000\tout/a.orc\t2\nbogus\t1\nend\n";
+    }
+    restart();
+    dictionaries dicts;
+    CHECK_THROWS(checkpoint_journal(dir / "journal", dicts));
+}
+}
+
+int main()
+{
+    round_trip();
+    torn_tail();
+    corrupt();
+    return test::report();
+}
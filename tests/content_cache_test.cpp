@@ -0,0 +1,149 @@
+/*
+ * Copyright (c) 2022 - present, GitHub: @cubter
+ *
+ * See COPYING.txt in the project root for license information.
+ */
+#include "test.h"
+
+#include "content_cache.h"
+
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+using metasci::content_cache;
+
+namespace
+{
+// Data that doesn't compress, so that the entries' sizes are known.
+std::string noise(size_t len, unsigned seed)
+{
+    std::mt19937 rng(seed);
+    std::string s(len, '\0');
+    for (char &c : s)
+    {
+        c = static_cast<char>(rng());
+    }
+    return s;
+}
+
+bool exists(const std::string &path)
+{
+    struct stat st;
+    return ::stat(path.c_str(), &st) == 0;
+}
+
+void hashes()
+{
+    const std::string a = noise(1000, 1);
+    std::string b = a;
+    b[999] ^= 1;
+    CHECK(metasci::content_hash(a.data(), a.size()).size() == 32);
+    CHECK(metasci::content_hash(a.data(), a.size()) ==
+        metasci::content_hash(a.data(), a.size()));
+    CHECK(metasci::content_hash(a.data(), a.size()) !=
+        metasci::content_hash(b.data(), b.size()));
+    CHECK(metasci::content_hash("a", 1) != metasci::content_hash("a\0", 2));
+    CHECK(metasci::content_hash("", 0) != metasci::content_hash("\0", 1));
+}
+
+// What's put is got back, in this run and the next, unless its entry is
+// damaged.
+void round_trip()
+{
+    test::scratch_dir dir;
+    const std::string path = dir / "cache";
+    const std::string page = "{\"items\":[" + std::string(10000, ' ') + "]}";
+    size_t size = 0;
+    {
+        content_cache cache(path);
+        std::string out;
+        CHECK(!cache.get("https://api/works?cursor=*", out));
+        CHECK(!cache.contains("https://api/works?cursor=*"));
+
+        cache.put("https://api/works?cursor=*", page);
+        cache.put("empty", std::string());
+        cache.put("replaced", "old");
+        cache.put("replaced", "new");
+        CHECK(cache.contains("https://api/works?cursor=*"));
+        CHECK(cache.get("https://api/works?cursor=*", out) && out == page);
+        CHECK(cache.get("empty", out) && out.empty());
+        CHECK(cache.get("replaced", out) && out == "new");
+        CHECK(cache.hits() == 3);
+        size = cache.size();
+    }
+
+    content_cache cache(path);
+    std::string out;
+    CHECK(cache.size() == size);
+    CHECK(cache.get("https://api/works?cursor=*", out) && out == page);
+
+    // Cut short.
+    const std::string entry = path + '/' + metasci::content_hash("replaced", 8) + ".zst";
+    CHECK(::truncate(entry.c_str(), 20) == 0);
+    CHECK(!cache.get("replaced", out));
+}
+
+// Past the cap, the least recently used entries go first, till the cache
+// is down to 90% of it.
+void eviction()
+{
+    test::scratch_dir dir;
+    content_cache::options opts;
+    opts.max_bytes = 100 << 10;
+    content_cache cache(dir / "cache", opts);
+
+    for (unsigned i = 0; i < 8; ++i)
+    {
+        cache.put("k" + std::to_string(i), noise(10 << 10, i));
+    }
+    std::string out;
+    CHECK(cache.get("k0", out));    // used since
+
+    for (unsigned i = 8; i < 12; ++i)
+    {
+        cache.put("k" + std::to_string(i), noise(10 << 10, i));
+    }
+    CHECK(cache.size() <= opts.max_bytes);
+    CHECK(cache.contains("k0") && cache.contains("k11"));
+    CHECK(!cache.contains("k1") && !cache.contains("k2"));
+    CHECK(cache.get("k0", out) && out == noise(10 << 10, 0));
+}
+
+// Leftovers of interrupted writes go once they're old; newer ones may be
+// another process's writes still.
+void leftovers()
+{
+    test::scratch_dir dir;
+    const std::string path = dir / "cache";
+    {
+        content_cache cache(path);
+        cache.put("k", "v");
+    }
+    const std::string old   = path + '/' + std::string(32, 'a') + ".zst.tmp.1.0";
+    const std::string fresh = path + '/' + std::string(32, 'b') + ".zst.tmp.1.1";
+    std::ofstream(old) << "half";
+    std::ofstream(fresh) << "half";
+    struct timeval times[2] = { { 1000000000, 0 }, { 1000000000, 0 } };
+    CHECK(::utimes(old.c_str(), times) == 0);
+
+    content_cache cache(path);
+    std::string out;
+    CHECK(!exists(old) && exists(fresh));
+    CHECK(cache.get("k", out) && out == "v");
+}
+}
+
+int main()
+{
+    hashes();
+    round_trip();
+    eviction();
+    leftovers();
+    return test::report();
+}
@@ -0,0 +1,277 @@
+/*
+ * Copyright (c) 2022 - present, GitHub: @cubter
+ *
+ * See COPYING.txt in the project root for license information.
+ */
+#include "test.h"
+
+#include "dataset_updater.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+using metasci::article;
+using metasci::dataset_updater;
+using metasci::dictionaries;
+using metasci::orc_sink;
+
+namespace
+{
+std::string doi(int i)
+{
+    return "10.1/" + std::to_string(i);
+}
+
+// A work whose title is title_len random letters, which don't compress.
+article work(const std::string &d, int64_t updated, size_t title_len = 8)
+{
+    static std::mt19937 rng(7);
+    article::builder b;
+    b.doi_b     = d;
+    b.updated_b = updated;
+    for (size_t i = 0; i < title_len; ++i)
+    {
+        b.title_b.push_back(static_cast<char>('a' + rng() % 26));
+    }
+    return b.build();
+}
+
+// The generations of the partition's segments, oldest first.
+std::vector<uint64_t> generations(const std::string &dir, unsigned p)
+{
+    std::vector<uint64_t> out;
+    DIR *d = ::opendir(dir.c_str());
+    if (d == nullptr)
+    {
+        return out;
+    }
+    while (const dirent *e = ::readdir(d))
+    {
+        const std::string   name = e->d_name;
+        unsigned            part;
+        unsigned long long  generation;
+        int                 end = 0;
+        if (std::sscanf(name.c_str(), "part-%5u-%8llu.orc%n", &part, &generation,
+            &end) == 2 && static_cast<size_t>(end) == name.size() && part == p)
+        {
+            out.push_back(generation);
+        }
+    }
+    ::closedir(d);
+    std::sort(out.begin(), out.end());
+    return out;
+}
+
+std::string segment(const std::string &dir, unsigned p, uint64_t generation)
+{
+    char name[48];
+    std::snprintf(name, sizeof(name), "/part-%05u-%08llu.orc", p,
+        static_cast<unsigned long long>(generation));
+    return dir + name;
+}
+
+bool exists(const std::string &path)
+{
+    struct stat st;
+    return ::stat(path.c_str(), &st) == 0;
+}
+
+struct row
+{
+    int64_t updated;
+    int64_t id;
+
+    bool operator==(const row &other) const
+    {
+        return updated == other.updated && id == other.id;
+    }
+};
+using rows = std::map<std::string, row>;
+
+// A segment's rows by DOI; a DOI found twice is kept as "dup".
+rows rows_of(const std::string &path, const test::scratch_dir &scratch)
+{
+    std::vector<std::pair<std::string, row>> in_order;
+    orc_sink::scan_dois(path, [&](const char *d, size_t len, int64_t updated)
+    {
+        in_order.emplace_back(std::string(d, len), row{ updated, 0 });
+    });
+
+    // The rows' IDs come through a copy, in the same order.
+    size_t at = 0;
+    metasci::string_pool labels;
+    orc_sink copy(scratch / "copy.orc", labels);
+    copy.copy_from(path, [](const char *, size_t) { return false; },
+        [&](orc_sink::id_kind kind, int64_t id)
+        {
+            if (kind == orc_sink::article_ids && at < in_order.size())
+            {
+                in_order[at++].second.id = id;
+            }
+            return id;
+        });
+    copy.close();
+
+    rows out;
+    for (const auto &r : in_order)
+    {
+        if (!out.emplace(r.first, r.second).second)
+        {
+            out["dup"] = r.second;
+        }
+    }
+    return out;
+}
+
+// The rows of every partition's segments of the generation.
+rows rows_of(const std::string &dir, unsigned n_partitions, uint64_t generation,
+    const test::scratch_dir &scratch)
+{
+    rows out;
+    for (unsigned p = 0; p < n_partitions; ++p)
+    {
+        const std::vector<uint64_t> gens = generations(dir, p);
+        if (std::find(gens.begin(), gens.end(), generation) != gens.end())
+        {
+            const rows part = rows_of(segment(dir, p, generation), scratch);
+            out.insert(part.begin(), part.end());
+        }
+    }
+    return out;
+}
+
+// An older or equal version of a stored DOI is stale, a newer one replaces
+// it and keeps its ID, and a DOI found twice in a delta is upserted once,
+// in its newest version. Each upsert is a generation of segments.
+void upserts()
+{
+    test::scratch_dir dir;
+    dictionaries dicts;
+    const std::string data = dir / "data";
+    std::map<std::string, int32_t> ids;
+    {
+        dataset_updater updater(data, dicts, 4, 4);
+        std::vector<article> delta;
+        for (int i = 0; i < 20; ++i)
+        {
+            delta.push_back(work(doi(i), 100));
+            ids[doi(i)] = delta.back().get_id();
+        }
+        dataset_updater::stats st = updater.upsert(std::move(delta));
+        CHECK(st.received == 20 && st.upserted == 20 && st.stale == 0);
+        CHECK(st.partitions > 1 && st.merges == 0);
+
+        delta.clear();
+        delta.push_back(work(doi(0), 50));
+        delta.push_back(work(doi(1), 100));
+        delta.push_back(work(doi(2), 200));
+        delta.push_back(work("10.1/New", 100));
+        delta.push_back(work(doi(3), 160));
+        delta.push_back(work(doi(3), 150));
+        const int32_t new_id = delta[3].get_id();
+        st = updater.upsert(std::move(delta));
+        CHECK(st.received == 6 && st.upserted == 3 && st.stale == 3);
+
+        CHECK(rows_of(data, 4, 1, dir).size() == 20);
+        CHECK(rows_of(data, 4, 2, dir) == (rows{
+            { doi(2), row{ 200, ids[doi(2)] } },
+            { doi(3), row{ 160, ids[doi(3)] } },
+            { "10.1/New", row{ 100, new_id } } }));
+    }
+}
+
+// Past max_segments, a partition's newest segments are merged into the
+// newest one's place, the superseded rows dropped; an older segment bigger
+// than those is left alone. Reopened, the dataset drops what an interrupted
+// upsert left aside, and goes on from the newest generation.
+void merges()
+{
+    test::scratch_dir dir;
+    dictionaries dicts;
+    const std::string data = dir / "data";
+    std::map<std::string, int32_t> ids;
+    {
+        dataset_updater updater(data, dicts, 1, 3);
+        std::vector<article> delta;
+        for (int i = 0; i < 2000; ++i)
+        {
+            delta.push_back(work(doi(i), 100, 200));
+            ids[doi(i)] = delta.back().get_id();
+        }
+        updater.upsert(std::move(delta));
+
+        for (const auto &version : { std::make_pair(0, 200), std::make_pair(0, 300) })
+        {
+            delta.clear();
+            delta.push_back(work(doi(version.first), version.second));
+            CHECK(updater.upsert(std::move(delta)).merges == 0);
+        }
+        CHECK(generations(data, 0) == (std::vector<uint64_t>{ 1, 2, 3 }));
+
+        delta.clear();
+        delta.push_back(work(doi(1), 300));
+        CHECK(updater.upsert(std::move(delta)).merges == 1);
+        CHECK(generations(data, 0) == (std::vector<uint64_t>{ 1, 4 }));
+        CHECK(!exists(segment(data, 0, 2) + ".dict") && exists(segment(data, 0, 4) + ".dict"));
+        CHECK(rows_of(segment(data, 0, 4), dir) == (rows{
+            { doi(0), row{ 300, ids[doi(0)] } },
+            { doi(1), row{ 300, ids[doi(1)] } } }));
+        CHECK(rows_of(segment(data, 0, 1), dir).size() == 2000);
+    }
+
+    // What a crash amid an upsert leaves.
+    std::ofstream(segment(data, 0, 9) + ".tmp") << "partial";
+    std::ofstream(segment(data, 0, 4) + ".dict.tmp") << "partial";
+    {
+        dataset_updater updater(data, dicts, 1, 3);
+        CHECK(!exists(segment(data, 0, 9) + ".tmp"));
+        CHECK(!exists(segment(data, 0, 4) + ".dict.tmp"));
+
+        std::vector<article> delta;
+        delta.push_back(work(doi(0), 300));
+        delta.push_back(work(doi(5), 400));
+        dataset_updater::stats st = updater.upsert(std::move(delta));
+        CHECK(st.upserted == 1 && st.stale == 1);
+        CHECK(generations(data, 0) == (std::vector<uint64_t>{ 1, 4, 5 }));
+        CHECK(rows_of(segment(data, 0, 5), dir) == (rows{
+            { doi(5), row{ 400, ids[doi(5)] } } }));
+    }
+}
+
+// A dataset isn't opened with fewer partitions than it was made with.
+void partitions()
+{
+    test::scratch_dir dir;
+    dictionaries dicts;
+    const std::string data = dir / "data";
+    {
+        dataset_updater updater(data, dicts, 4);
+        std::vector<article> delta;
+        for (int i = 0; i < 40; ++i)
+        {
+            delta.push_back(work(doi(i), 100));
+        }
+        updater.upsert(std::move(delta));
+    }
+    CHECK(!generations(data, 2).empty() || !generations(data, 3).empty());
+    CHECK_THROWS(dataset_updater(data, dicts, 2));
+    dataset_updater reopened(data, dicts, 4);
+}
+}
+
+int main()
+{
+    upserts();
+    merges();
+    partitions();
+    return test::report();
+}
@@ -0,0 +1,141 @@
+/*
+ * Copyright (c) 2022 - present, GitHub: @cubter
+ *
+ * See COPYING.txt in the project root for license information.
+ */
+#include "test.h"
+
+#include "doi_dedup.h"
+
+#include <cctype>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+
+using metasci::article;
+using metasci::dictionaries;
+using metasci::doi_deduplicator;
+
+namespace
+{
+const int n_dois     = 5000;
+const int n_versions = 20000;
+
+// The versions, a batch at a time: DOIs in either case, `updated` stamps
+// that tie often, and titles telling the versions apart.
+std::vector<std::vector<article>> versions()
+{
+    std::mt19937 rng(5);
+    std::vector<std::vector<article>> batches(1);
+    for (int i = 0; i < n_versions; ++i)
+    {
+        std::string doi = "10.1000/Work-" + std::to_string(rng() % n_dois);
+        if (rng() % 2 == 0)
+        {
+            for (char &c : doi)
+            {
+                c = static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
+            }
+        }
+        article::builder b;
+        b.doi_b     = doi;
+        b.updated_b = static_cast<int64_t>(rng() % 4);
+        b.title_b   = std::to_string(i);
+        if (batches.back().size() == 1000)
+        {
+            batches.emplace_back();
+        }
+        batches.back().push_back(b.build());
+    }
+    return batches;
+}
+
+// Of each DOI's versions, the newest, the last one on a tie: DOI to title.
+std::map<std::string, std::string> newest()
+{
+    std::map<std::string, std::pair<int64_t, std::string>> best;
+    for (const auto &batch : versions())
+    {
+        for (const article &a : batch)
+        {
+            auto res = best.emplace(metasci::normalize_doi(a.doi_ref().data(),
+                a.doi_ref().size()), std::make_pair(a.get_updated(), a.title_ref()));
+            if (!res.second && res.first->second.first <= a.get_updated())
+            {
+                res.first->second = std::make_pair(a.get_updated(), a.title_ref());
+            }
+        }
+    }
+    std::map<std::string, std::string> out;
+    for (const auto &kv : best)
+    {
+        out[kv.first] = kv.second.second;
+    }
+    return out;
+}
+
+void keep(std::map<std::string, std::string> &kept, const article &a)
+{
+    const std::string doi = metasci::normalize_doi(a.doi_ref().data(),
+        a.doi_ref().size());
+    CHECK(kept.emplace(doi, a.title_ref()).second);
+}
+
+// The same versions are kept whether the buffers spill or not, and whether
+// the spilled partitions are split or not.
+void dedup(size_t memory_bytes, unsigned threads, bool records)
+{
+    test::scratch_dir dir;
+    const std::string spill_dir = dir / "spill";
+    const std::map<std::string, std::string> expected = newest();
+
+    dictionaries dicts;
+    std::map<std::string, std::string> kept;
+    doi_deduplicator::stats st;
+    {
+        doi_deduplicator dedup(spill_dir, dicts, memory_bytes, 8, threads);
+        for (auto &batch : versions())
+        {
+            dedup.add(std::move(batch));
+        }
+        if (records)
+        {
+            const metasci::journal_index journals;
+            st = dedup.finish_records([&](const char *rec, size_t len)
+            {
+                keep(kept, metasci::decode_article(rec, len, dicts.labels,
+                    journals));
+            });
+        }
+        else
+        {
+            st = dedup.finish([&](std::vector<article> &articles)
+            {
+                for (const article &a : articles)
+                {
+                    keep(kept, a);
+                }
+            });
+        }
+    }
+
+    CHECK(st.received == static_cast<size_t>(n_versions));
+    CHECK(st.unique == expected.size());
+    CHECK(kept == expected);
+    CHECK((st.spills > 0) == (memory_bytes < (size_t(1) << 20)));
+
+    struct stat s;
+    CHECK(::stat(spill_dir.c_str(), &s) != 0);
+}
+}
+
+int main()
+{
+    dedup(size_t(1) << 30, 4, false);
+    dedup(size_t(64) << 10, 4, false);
+    dedup(size_t(64) << 10, 1, true);
+    return test::report();
+}
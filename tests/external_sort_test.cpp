@@ -0,0 +1,109 @@
+/*
+ * Copyright (c) 2022 - present, GitHub: @cubter
+ *
+ * See COPYING.txt in the project root for license information.
+ */
+#include "test.h"
+
+#include "external_sort.h"
+
+#include <algorithm>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+using metasci::external_sorter;
+
+namespace
+{
+// Keys sharing long prefixes, many of them equal, some empty; a record is
+// its number.
+std::vector<std::pair<std::string, std::string>> input(size_t n)
+{
+    std::mt19937 rng(3);
+    std::vector<std::pair<std::string, std::string>> out;
+    for (size_t i = 0; i < n; ++i)
+    {
+        std::string key;
+        if (rng() % 50 != 0)
+        {
+            key = "10.10" + std::to_string(rng() % 20) + "/j." +
+                std::string(rng() % 3, 'x') + std::to_string(rng() % 500);
+        }
+        out.emplace_back(key, std::to_string(i));
+    }
+    return out;
+}
+
+// The records come out in the keys' order, the equal keys' ones in the
+// order they went in, whether sorted in memory or merged from runs, in
+// one pass or several.
+void sorts(size_t memory_bytes, unsigned threads, size_t max_fan_in)
+{
+    test::scratch_dir dir;
+    const std::string spill_dir = dir / "spill";
+    auto records = input(20000);
+
+    std::vector<std::string> sorted;
+    external_sorter::stats st;
+    {
+        external_sorter sorter(spill_dir, memory_bytes, threads, max_fan_in);
+        for (const auto &r : records)
+        {
+            sorter.add(r.first, r.second.data(), r.second.size());
+        }
+        st = sorter.finish([&](const char *rec, size_t len)
+        {
+            sorted.emplace_back(rec, len);
+        });
+    }
+
+    std::stable_sort(records.begin(), records.end(),
+        [](const std::pair<std::string, std::string> &a,
+            const std::pair<std::string, std::string> &b)
+        {
+            return a.first < b.first;
+        });
+    CHECK(st.records == records.size());
+    CHECK(sorted.size() == records.size());
+    for (size_t i = 0; i < sorted.size() && i < records.size(); ++i)
+    {
+        CHECK(sorted[i] == records[i].second);
+    }
+    CHECK((st.runs > 0) == (memory_bytes < (size_t(1) << 20)));
+
+    struct stat s;
+    CHECK(::stat(spill_dir.c_str(), &s) != 0);
+}
+
+// A run cut short is an error, not the end of the records.
+void corrupt()
+{
+    test::scratch_dir dir;
+    const std::string spill_dir = dir / "spill";
+    external_sorter sorter(spill_dir, 16 << 10, 1);
+    for (const auto &r : input(5000))
+    {
+        sorter.add(r.first, r.second.data(), r.second.size());
+    }
+
+    const std::string run = spill_dir + "/run-000000.sort";
+    struct stat s;
+    CHECK(::stat(run.c_str(), &s) == 0);
+    CHECK(::truncate(run.c_str(), s.st_size / 2) == 0);
+    CHECK_THROWS(sorter.finish([](const char *, size_t) {}));
+}
+}
+
+int main()
+{
+    sorts(size_t(1) << 30, 4, 256);
+    sorts(size_t(32) << 10, 4, 256);
+    sorts(size_t(32) << 10, 2, 3);
+    corrupt();
+    return test::report();
+}
@@ -0,0 +1,146 @@
+/*
+ * Copyright (c) 2022 - present, GitHub: @cubter
+ *
+ * See COPYING.txt in the project root for license information.
+ */
+#include "test.h"
+
+#include "fast_json.h"
+
+#include <nlohmann/json.hpp>
+
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using metasci::block_pool;
+using metasci::fast_json;
+
+namespace
+{
+// A DOM parses, reads and dumps like nlohmann's std::map-based one.
+void like_nlohmann()
+{
+    const char *text = R"({"title":["A"],"DOI":"10.1/x","author":[{"given":"G",
+        "family":"F","affiliation":[]}],"issued":{"date-parts":[[2020,1,2]]},
+        "z":null,"a":1.5,"m":{"b":true,"a":false},"DOI2":"dup"})";
+
+    fast_json      f = fast_json::parse(text);
+    nlohmann::json n = nlohmann::json::parse(text);
+    CHECK(f.dump() == n.dump());
+    CHECK(f["author"][0]["family"] == "F");
+    CHECK(f.at("issued")["date-parts"][0][1] == 1);
+    CHECK(f.count("missing") == 0);
+    CHECK_THROWS(f.at("missing"));
+
+    // Keys stay sorted, however they're added.
+    f["0"] = 0;
+    f["zz"] = 2;
+    f["DOI"] = "10.1/y";
+    f.erase("z");
+    n["0"] = 0;
+    n["zz"] = 2;
+    n["DOI"] = "10.1/y";
+    n.erase("z");
+    CHECK(f.dump() == n.dump());
+    CHECK(fast_json::parse(f.dump()) == f);
+
+    fast_json copy = f;
+    copy["m"]["c"] = "new";
+    CHECK(copy != f);
+    CHECK(f["m"].size() == 2 && copy["m"].size() == 3);
+
+    std::vector<uint8_t> cbor = fast_json::to_cbor(f);
+    CHECK(fast_json::from_cbor(cbor) == f);
+}
+
+// Blocks of every size, allocated by a thread and freed by another, are
+// reused rather than piling up.
+long resident_kb()
+{
+    std::ifstream statm("/proc/self/statm");
+    long size = 0, resident = 0;
+    statm >> size >> resident;
+    return resident * 4;
+}
+
+void cross_thread_frees()
+{
+    std::mutex                                  mutex;
+    std::condition_variable                     cv;
+    std::deque<std::pair<void *, size_t>>       queue;
+    bool                                        done = false;
+
+    std::thread consumer([&]
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true)
+        {
+            cv.wait(lock, [&] { return !queue.empty() || done; });
+            if (queue.empty())
+            {
+                return;
+            }
+            std::pair<void *, size_t> block = queue.front();
+            queue.pop_front();
+            cv.notify_all();
+            lock.unlock();
+            CHECK(static_cast<unsigned char *>(block.first)[0] ==
+                static_cast<unsigned char>(block.second));
+            block_pool::deallocate(block.first, block.second);
+            lock.lock();
+        }
+    });
+
+    std::mt19937 rng(3);
+    long before = 0;
+    for (int round = 0; round < 30; ++round)
+    {
+        // A producer of its own every round: its cache goes back on exit.
+        std::thread producer([&]
+        {
+            for (int i = 0; i < 20000; ++i)
+            {
+                size_t n = 1 + rng() % 4096;
+                void *p = block_pool::allocate(n);
+                std::memset(p, static_cast<unsigned char>(n), n);
+                std::lock_guard<std::mutex> lock(mutex);
+                queue.emplace_back(p, n);
+                cv.notify_all();
+            }
+        });
+        producer.join();
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.wait(lock, [&] { return queue.empty(); });
+        }
+        if (round == 4)
+        {
+            before = resident_kb();
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        done = true;
+        cv.notify_all();
+    }
+    consumer.join();
+
+    // 30 rounds of up to 80 MB each.
+    CHECK(resident_kb() - before < 64 * 1024);
+}
+}
+
+int main()
+{
+    like_nlohmann();
+    cross_thread_frees();
+    return test::report();
+}
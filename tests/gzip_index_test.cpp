@@ -0,0 +1,223 @@
+/*
+ * Copyright (c) 2022 - present, GitHub: @cubter
+ *
+ * See COPYING.txt in the project root for license information.
+ */
+#include "test.h"
+
+#include "gzip.h"
+#include "gzip_index.h"
+#include "seekable_zstd.h"
+
+#include <zlib.h>
+
+#include <cctype>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+using metasci::file_stamp;
+using metasci::gzip_index;
+using metasci::item_reader;
+
+namespace
+{
+const size_t n_items = 3000;
+
+std::string doi_of(size_t i)
+{
+    return i == 7 ? "10.5555/a/b-7" : "10.5555/Item-" + std::to_string(i);
+}
+
+// An envelope of items spread over lines, with text that doesn't compress
+// to nothing, so that the checkpoints are far apart in the shard.
+std::string envelope()
+{
+    std::mt19937 rng(17);
+    std::string s = "{\"items\":[\n";
+    for (size_t i = 0; i < n_items; ++i)
+    {
+        std::string doi = doi_of(i);
+        if (i == 7)
+        {
+            doi = "10.5555\\/a\\/b-7";      // escaped, as JSON allows
+        }
+        std::string text;
+        for (size_t n = 50 + rng() % 300; n > 0; --n)
+        {
+            text += static_cast<char>('a' + rng() % 26);
+        }
+        s += (i == 0 ? "" : ",\n");
+        s += "{\"title\":[\"" + text + "\"],\n \"DOI\":\"" + doi + "\",\"n\":" +
+            std::to_string(i) + "}";
+    }
+    s += "\n]}";
+    return s;
+}
+
+// The items' text, in order.
+std::vector<std::string> items_of(const std::string &s, item_reader::layout layout)
+{
+    std::vector<std::pair<size_t, size_t>> bounds;
+    item_reader reader(layout);
+    CHECK(reader.find_items(s.data(), s.size(), bounds));
+    std::vector<std::string> out;
+    for (const auto &b : bounds)
+    {
+        out.push_back(s.substr(b.first, b.second - b.first));
+    }
+    return out;
+}
+
+std::string gzip(const std::string &s)
+{
+    z_stream zs{};
+    deflateInit2(&zs, 6, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY);
+    std::string out(deflateBound(&zs, static_cast<uLong>(s.size())), '\0');
+    zs.next_in   = reinterpret_cast<Bytef *>(const_cast<char *>(s.data()));
+    zs.avail_in  = static_cast<uInt>(s.size());
+    zs.next_out  = reinterpret_cast<Bytef *>(&out[0]);
+    zs.avail_out = static_cast<uInt>(out.size());
+    CHECK(deflate(&zs, Z_FINISH) == Z_STREAM_END);
+    out.resize(zs.total_out);
+    deflateEnd(&zs);
+    return out;
+}
+
+void write_file(const std::string &path, const std::string &data)
+{
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out << data;
+}
+
+// Every item is found by its DOI, in either case, and extracted as it is
+// in the shard; a DOI the shard lacks gives nothing.
+void extracts_all(const gzip_index &index, const std::string &shard,
+    const std::vector<std::string> &items)
+{
+    CHECK(index.items() == items.size());
+    int fd = ::open(shard.c_str(), O_RDONLY);
+    CHECK(fd >= 0);
+
+    std::string item;
+    for (size_t i = 0; i < items.size(); i += (i < 20 ? 1 : 97))
+    {
+        std::string doi = doi_of(i);
+        if (i % 2 == 0)
+        {
+            for (char &c : doi)
+            {
+                c = static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
+            }
+        }
+        bool found = false;
+        for (const gzip_index::location &at : index.find(doi))
+        {
+            CHECK(index.extract(fd, at, item));
+            found = found || item == items[i];
+        }
+        CHECK(found);
+    }
+    CHECK(index.find("10.5555/none").empty());
+    ::close(fd);
+}
+
+// A gzip'ed shard's items are extracted from the checkpoints, before and
+// after the index is saved and loaded; the index isn't used for another
+// version of the shard, or once it's damaged.
+void gzip_shards()
+{
+    test::scratch_dir dir;
+    const std::string text  = envelope();
+    const std::string shard = dir / "shard.json.gz";
+    const std::string gz    = gzip(text);
+    write_file(shard, gz);
+
+    std::string unpacked;
+    CHECK(metasci::is_gzip(gz.data(), gz.size()));
+    CHECK(metasci::gunzip(gz.data(), gz.size(), unpacked) && unpacked == text);
+    CHECK(metasci::gunzip((gz + gz).data(), 2 * gz.size(), unpacked) &&
+        unpacked == text + text);
+    CHECK(!metasci::gunzip(gz.data(), gz.size() / 2, unpacked));
+
+    file_stamp stamp;
+    CHECK(metasci::stamp_file(shard, stamp));
+    gzip_index::options opts;
+    opts.span = 16 << 10;
+    const gzip_index built = gzip_index::build(gz.data(), gz.size(), stamp, opts);
+    const std::vector<std::string> items = items_of(text, item_reader::envelope);
+    extracts_all(built, shard, items);
+
+    const std::string idx = gzip_index::path_of(shard);
+    CHECK(gzip_index::is_index(idx) && !gzip_index::is_index(shard));
+    built.save(idx);
+    gzip_index loaded;
+    CHECK(gzip_index::load(idx, stamp, loaded));
+    extracts_all(loaded, shard, items);
+
+    file_stamp other = stamp;
+    ++other.mtime_ns;
+    CHECK(!gzip_index::load(idx, other, loaded));
+    CHECK(!gzip_index::load(dir / "none.idx", stamp, loaded));
+
+    std::string saved;
+    {
+        std::ifstream in(idx, std::ios::binary);
+        saved.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+    write_file(idx, saved.substr(0, saved.size() / 2));
+    CHECK(!gzip_index::load(idx, stamp, loaded));
+
+    // A shard cut short can't be indexed.
+    CHECK_THROWS(gzip_index::build(gz.data(), gz.size() / 2, stamp, opts));
+}
+
+// A seekable shard's items are extracted from their frames.
+void seekable_shards()
+{
+    test::scratch_dir dir;
+    const std::string text  = envelope();
+    const std::string shard = dir / "shard.jsonl.zst";
+
+    metasci::seekable_options sopts;
+    sopts.frame_size = 32 << 10;
+    std::string packed;
+    CHECK(metasci::pack_seekable(text.data(), text.size(), item_reader::envelope,
+        sopts, packed));
+    write_file(shard, packed);
+
+    file_stamp stamp;
+    CHECK(metasci::stamp_file(shard, stamp));
+    const gzip_index built = gzip_index::build(packed.data(), packed.size(), stamp,
+        gzip_index::options());
+
+    // The items are lines, their line breaks made spaces.
+    std::vector<std::string> items = items_of(text, item_reader::envelope);
+    for (std::string &item : items)
+    {
+        for (char &c : item)
+        {
+            c = c == '\n' ? ' ' : c;
+        }
+    }
+    extracts_all(built, shard, items);
+
+    built.save(gzip_index::path_of(shard));
+    gzip_index loaded;
+    CHECK(gzip_index::load(gzip_index::path_of(shard), stamp, loaded));
+    extracts_all(loaded, shard, items);
+}
+}
+
+int main()
+{
+    gzip_shards();
+    seekable_shards();
+    return test::report();
+}
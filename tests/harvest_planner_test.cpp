@@ -0,0 +1,151 @@
+/*
+ * Copyright (c) 2022 - present, GitHub: @cubter
+ *
+ * See COPYING.txt in the project root for license information.
+ */
+#include "test.h"
+
+#include "harvest_planner.h"
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using metasci::async_api_connector;
+using metasci::content_cache;
+using metasci::harvest_partition;
+using metasci::harvest_planner;
+
+namespace
+{
+// Nothing listens there: a count that isn't in the cache fails at once.
+const std::string query = "http://127.0.0.1:1/works?filter=type:journal-article";
+const int64_t     n_days = 40;
+
+// The works indexed on a day of the period: none for ten days, too many to
+// fit a partition on one of them.
+size_t works_on(int64_t day)
+{
+    return day >= 10 && day < 20 ? 0 : day == 30 ? 5000 : 100;
+}
+
+void dates()
+{
+    int64_t day = 0;
+    CHECK(harvest_planner::parse_date("1970-01-01", day) && day == 0);
+    CHECK(harvest_planner::parse_date("2000-03-01", day) && day == 11017);
+    CHECK(harvest_planner::parse_date("1969-12-31", day) && day == -1);
+    for (int64_t d = -800; d < 20000; d += 7)
+    {
+        CHECK(harvest_planner::parse_date(harvest_planner::format_date(d), day) &&
+            day == d);
+    }
+    CHECK(harvest_planner::format_date(11016) == "2000-02-29");
+
+    for (const char *bad : { "", "2000", "2000-13-01", "2000-00-10", "2000-01-32",
+        "2000-01-01x", "01/01/2000" })
+    {
+        CHECK(!harvest_planner::parse_date(bad, day));
+    }
+}
+
+void index_dates()
+{
+    const std::string dates = "from-index-date:2020-01-01,until-index-date:2020-01-31";
+    auto with = [](const std::string &q)
+    {
+        return harvest_planner::with_index_dates(q, "2020-01-01", "2020-01-31");
+    };
+    CHECK(with("https://api/works") == "https://api/works?filter=" + dates);
+    CHECK(with("https://api/works?mailto=a") == "https://api/works?mailto=a&filter=" + dates);
+    CHECK(with("https://api/works?filter=type:book") ==
+        "https://api/works?filter=type:book," + dates);
+    CHECK(with("https://api/works?filter=type:book&mailto=a") ==
+        "https://api/works?filter=type:book," + dates + "&mailto=a");
+    CHECK(with("https://api/works?prefilter=x&filter=type:book") ==
+        "https://api/works?prefilter=x&filter=type:book," + dates);
+}
+
+// The counts of every range of the period, as the connector caches a rows=0
+// query's single page (see async_api_connector::cache_key).
+void count_all(content_cache &cache, int64_t first)
+{
+    for (int64_t a = 0; a < n_days; ++a)
+    {
+        size_t works = 0;
+        for (int64_t b = a; b < n_days; ++b)
+        {
+            works += works_on(b);
+            const std::string q = harvest_planner::with_index_dates(query,
+                harvest_planner::format_date(first + a),
+                harvest_planner::format_date(first + b));
+            cache.put("GET " + q + " rows=0 pages", "1");
+            cache.put("GET " + q + " rows=0 0", "{\"status\":\"ok\",\"message\":"
+                "{\"total-results\":" + std::to_string(works) + ",\"items\":[]}}");
+        }
+    }
+}
+
+// The period is cut till every range holds no more than the target, a
+// single day aside; empty ranges are dropped, and what's left is in order,
+// with all the works.
+void plans()
+{
+    test::scratch_dir dir;
+    content_cache cache(dir / "cache");
+    int64_t first = 0;
+    CHECK(harvest_planner::parse_date("2020-02-10", first));
+    count_all(cache, first);
+
+    async_api_connector::options api;
+    api.cache       = &cache;
+    api.max_retries = 0;
+    harvest_planner::options opts;
+    opts.target_works = 1000;
+    opts.max_split    = 4;
+    harvest_planner planner(api, opts);
+
+    const std::vector<harvest_partition> parts = planner.plan(query,
+        harvest_planner::format_date(first),
+        harvest_planner::format_date(first + n_days - 1));
+    CHECK(parts.size() > 3);
+
+    size_t total = 0, expected = 0;
+    int64_t last = first - 1;
+    for (const harvest_partition &p : parts)
+    {
+        int64_t from = 0, until = 0;
+        CHECK(harvest_planner::parse_date(p.from, from));
+        CHECK(harvest_planner::parse_date(p.until, until));
+        CHECK(from > last && until >= from);
+        CHECK(p.works <= opts.target_works || from == until);
+        CHECK(p.works > 0);
+        CHECK(p.query == harvest_planner::with_index_dates(query, p.from, p.until));
+        for (int64_t d = last + 1; d < from; ++d)
+        {
+            CHECK(works_on(d - first) == 0);
+        }
+        last   = until;
+        total += p.works;
+    }
+    for (int64_t d = 0; d < n_days; ++d)
+    {
+        expected += works_on(d);
+    }
+    CHECK(total == expected);
+    CHECK(last == first + n_days - 1);
+
+    // Bad dates, and a count that can't be had.
+    CHECK_THROWS(planner.plan(query, "2020-02-10", "2020-02-09"));
+    CHECK_THROWS(planner.plan(query, "2020-02-10", "soon"));
+    CHECK_THROWS(planner.plan(query, "2019-01-01", "2019-01-31"));
+}
+}
+
+int main()
+{
+    dates();
+    index_dates();
+    plans();
+    return test::report();
+}
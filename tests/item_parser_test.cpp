@@ -0,0 +1,344 @@
+/*
+ * Copyright (c) 2022 - present, GitHub: @cubter
+ *
+ * See COPYING.txt in the project root for license information.
+ */
+#include "test.h"
+
+#include "fast_json.h"
+#include "item_parser.h"
+
+#include <algorithm>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using metasci::article;
+using metasci::author;
+using metasci::dictionaries;
+using metasci::json_log;
+using metasci::journal;
+using metasci::publication_type;
+using metasci::subject;
+using metasci::subject_id;
+using json = metasci::fast_json;
+
+namespace
+{
+// A work as Crossref gives it; a journal has a single publisher, journals
+// being told apart by the title alone. Some are odd: one lacks its title,
+// one has an issue of the wrong type, and every fifth one's title looks like
+// the end of an item and the start of another.
+std::string item(size_t i)
+{
+    const std::string n = std::to_string(i);
+    std::string title = "Work " + n;
+    if (i % 5 == 1)
+    {
+        title += " \\\"}, {\\\"DOI\\\": \\\"10.9/fake\\\"}, {\\\"title\\\": [\\\"";
+    }
+
+    std::string s = "{\"DOI\":\"10.1/" + n + "\",";
+    if (i != 13)
+    {
+        s += "\"title\":[\"" + title + "\"],";
+    }
+    s += "\"publisher\":\"Publisher " + std::to_string(i % 4 % 3) + "\","
+        "\"container-title\":[\"Journal " + std::to_string(i % 4) + "\"],"
+        "\"type\":\"" + (i % 2 == 0 ? "journal-article" : "book") + "\","
+        "\"subject\":[\"Subject " + std::to_string(i % 6) + "\",\"Subject " +
+            std::to_string((i + 1) % 6) + "\"],"
+        "\"author\":[{\"given\":\"G\",\"family\":\"F " + std::to_string(i % 9) +
+            "\",\"affiliation\":[\"Aff " + std::to_string(i % 2) + "\"]}],"
+        "\"issue\":" +
+            (i == 27 ? "5" : "\"" + (i % 4 == 0 ? "Suppl. " + n : n) + "\"") + ","
+        "\"volume\":\"12\","
+        "\"issued\":{\"date-parts\":[[2020," + std::to_string(1 + i % 12) + ",1]]},"
+        "\"indexed\":{\"timestamp\":" + std::to_string(1600000000000 + i) + "},"
+        "\"unused\":{\"nested\":[{\"a\":\"]}\"},[1,{\"b\":[]}]]},"
+        "\"reference\":[";
+    // One item much larger than the others.
+    const size_t refs = i == 40 ? 2000 : 1 + i % 3;
+    for (size_t r = 0; r < refs; ++r)
+    {
+        s += (r == 0 ? "" : ",") + std::string("{\"DOI\":\"10.2/") + n + "-" +
+            std::to_string(r) + "\"}";
+    }
+    return s + "]}";
+}
+
+// The items in an envelope, here and there separated by blanks.
+std::string envelope(size_t n)
+{
+    std::string s = "{\"status\":\"ok\",\"message-type\":\"work-list\",\"items\":[";
+    for (size_t i = 0; i < n; ++i)
+    {
+        s += i == 0 ? "" : i % 7 == 0 ? ",\n  " : ",";
+        s += item(i);
+    }
+    return s + "],\"next-cursor\":\"x\"}";
+}
+
+void fill(dictionaries &dicts)
+{
+    dicts.publication_types = std::vector<publication_type>
+    {
+        publication_type("book"),
+        publication_type("journal-article")
+    };
+}
+
+// What an article holds, by name rather than by the dictionaries' IDs, which
+// follow the order in which the items have been parsed.
+std::string describe(const article &a, const dictionaries &dicts)
+{
+    std::ostringstream out;
+    out << a.doi_ref() << '|' << a.title_ref() << '|' << a.get_updated() << '|'
+        << a.get_volume().to_string(dicts.labels) << '|'
+        << a.get_issue().to_string(dicts.labels) << '|';
+    for (size_t t = 0; t < dicts.publication_types.size(); ++t)
+    {
+        if (dicts.publication_types[t].get_id() == a.get_type())
+        {
+            out << "type " << t;
+        }
+    }
+    for (const journal &j : a.journals_ref())
+    {
+        out << '|' << j.get_title() << " / " << j.get_publisher_title();
+    }
+    for (subject_id id : a.subjects_ids_ref())
+    {
+        for (const subject &s : dicts.subjects)
+        {
+            if (s.get_id() == id)
+            {
+                out << '|' << s.get_title();
+            }
+        }
+    }
+    for (const author &au : a.authors_ref())
+    {
+        out << '|' << au.get_first_name() << ' ' << au.get_family_name();
+        for (const std::string &aff : au.affiliations_ref())
+        {
+            out << ", " << aff;
+        }
+    }
+    for (const metasci::date &d : a.issued_ref())
+    {
+        out << '|' << d.year << '-' << int(d.month) << '-' << int(d.day);
+    }
+    for (const std::string &r : a.references_ref())
+    {
+        out << '|' << r;
+    }
+    return out.str();
+}
+
+// A parse's result: whether the input was well-formed, the articles and
+// logs in order, and the dictionaries' names, in any order.
+struct parsed
+{
+    bool                        ok = false;
+    std::vector<std::string>    articles;
+    std::vector<std::string>    logs;
+    std::vector<std::string>    subjects;
+    std::vector<std::string>    journals;
+    size_t                      labels = 0;
+
+    bool operator==(const parsed &other) const
+    {
+        return ok == other.ok && articles == other.articles &&
+            logs == other.logs && subjects == other.subjects &&
+            journals == other.journals && labels == other.labels;
+    }
+};
+
+parsed summarize(bool ok, const std::vector<article> &articles,
+    const std::vector<json_log> &logs, const dictionaries &dicts)
+{
+    parsed out;
+    out.ok = ok;
+    for (const article &a : articles)
+    {
+        out.articles.push_back(describe(a, dicts));
+    }
+    for (const json_log &l : logs)
+    {
+        out.logs.push_back(std::to_string(static_cast<int>(l.get_message_code())) +
+            ' ' + l.message_ref() + " @ " + l.context_ref());
+    }
+    for (const subject &s : dicts.subjects)
+    {
+        out.subjects.push_back(s.get_title());
+    }
+    for (const journal &j : dicts.journals)
+    {
+        out.journals.push_back(j.get_title() + " / " + j.get_publisher_title());
+    }
+    std::sort(out.subjects.begin(), out.subjects.end());
+    std::sort(out.journals.begin(), out.journals.end());
+    out.labels = dicts.labels.size();
+    return out;
+}
+
+// threads == 0: the single-threaded parser, which -j 1 uses.
+parsed parse(const std::string &input, unsigned threads)
+{
+    dictionaries dicts;
+    fill(dicts);
+    std::vector<json_log> logs;
+    std::vector<article>  articles;
+
+    bool ok = threads == 0 ?
+        metasci::parse_crossref_buffer<json>(input.data(), input.size(), logs,
+            dicts, articles) :
+        metasci::parse_crossref_buffer_parallel<json>(input.data(), input.size(),
+            threads, logs, dicts, articles);
+    return summarize(ok, articles, logs, dicts);
+}
+
+parsed parse_jsonl(const std::string &input, unsigned threads, size_t &malformed)
+{
+    dictionaries dicts;
+    fill(dicts);
+    std::vector<json_log> logs;
+    std::vector<article>  articles;
+
+    malformed = metasci::parse_crossref_jsonl<json>(input.data(), input.size(),
+        threads, logs, dicts, articles);
+    return summarize(true, articles, logs, dicts);
+}
+
+// However many threads parse the envelope, and however its items are cut
+// into ranges -- down to an item a range, or a range past the large item --
+// the articles, the logs and the dictionaries come out the same as with a
+// single thread.
+void parallel()
+{
+    const std::string input = envelope(120);
+    const parsed single = parse(input, 0);
+    CHECK(single.ok);
+    CHECK(single.articles.size() == 119);
+    CHECK(single.subjects.size() == 6 && single.journals.size() == 4);
+    CHECK(single.logs.size() == 2);
+
+    for (unsigned threads : { 1u, 2u, 3u, 8u, 200u })
+    {
+        CHECK(parse(input, threads) == single);
+    }
+
+    // The articles don't depend on where the input is cut: the items of a
+    // truncated envelope, up to the cut one, are parsed the same either way.
+    for (size_t cut : { input.size() / 3, input.size() - 2 })
+    {
+        const std::string truncated = input.substr(0, cut);
+        const parsed expected = parse(truncated, 0);
+        CHECK(!expected.ok);
+        CHECK(parse(truncated, 4) == expected);
+    }
+}
+
+// A file is cut on its lines' boundaries, into as many chunks as asked for
+// if it has the lines, of about the same size; a line longer than a chunk
+// stays whole.
+void chunks()
+{
+    std::string even;
+    for (size_t i = 0; i < 100; ++i)
+    {
+        even += "0123456789\n";
+    }
+    std::vector<size_t> b = metasci::jsonl_chunks(even.data(), even.size(), 8);
+    CHECK(b.size() == 9 && b.front() == 0 && b.back() == even.size());
+    for (size_t k = 1; k < b.size(); ++k)
+    {
+        CHECK(b[k] - b[k - 1] >= even.size() / 8 - 11 &&
+            b[k] - b[k - 1] <= even.size() / 8 + 11);
+    }
+
+    std::string uneven;
+    for (size_t i = 0; i < 50; ++i)
+    {
+        uneven += std::string(i == 20 ? 5000 : 1 + i % 37, 'x') + "\n";
+    }
+    uneven += "the last line, without a newline";
+    for (size_t n : { 1, 2, 8, 64, 1000 })
+    {
+        b = metasci::jsonl_chunks(uneven.data(), uneven.size(), n);
+        CHECK(b.size() >= 2 && b.size() <= n + 1);
+        CHECK(b.front() == 0 && b.back() == uneven.size());
+        for (size_t k = 1; k + 1 < b.size(); ++k)
+        {
+            CHECK(b[k] > b[k - 1] && uneven[b[k] - 1] == '\n');
+        }
+    }
+    CHECK(metasci::jsonl_chunks("", 0, 8) == (std::vector<size_t>{ 0, 0 }));
+}
+
+// JSON Lines make the same articles as an envelope of the same items,
+// whatever the threads, with blank lines, CRLF endings and no newline after
+// the last line; chunks' ends fall inside lines, the large item's above all.
+// A malformed line is counted, logged with the byte it starts at, and
+// skipped.
+void jsonl()
+{
+    const char *const bad[] = { "{\"DOI\":\"10.9/cut\",\"title\":[\"Cut", "[1,2]",
+        "{\"DOI\":\"10.9/a\"} {\"DOI\":\"10.9/b\"}", "not JSON" };
+    std::string input;
+    std::vector<std::string> bad_at;
+    for (size_t i = 0; i < 60; ++i)
+    {
+        input += item(i) + (i % 3 == 0 ? "\r\n" : "\n");
+        if (i % 10 == 4)
+        {
+            input += "\n  \t\r\n\r\n\n";
+        }
+        if (i % 15 == 7)
+        {
+            bad_at.push_back("line at byte " + std::to_string(input.size()));
+            input += bad[i / 15] + std::string("\n");
+        }
+    }
+    input += item(60);
+
+    const parsed envelope_parsed = parse(envelope(61), 0);
+    CHECK(envelope_parsed.articles.size() == 60);
+
+    const std::string malformed_log =
+        std::to_string(static_cast<int>(metasci::log_code::malformed_input)) +
+        " malformed line: ";
+    for (unsigned threads : { 1u, 2u, 3u, 16u })
+    {
+        size_t malformed = 0;
+        parsed got = parse_jsonl(input, threads, malformed);
+        CHECK(malformed == 4);
+
+        // The lines' logs, apart from the items'.
+        std::vector<std::string> item_logs, at;
+        for (const std::string &l : got.logs)
+        {
+            if (l.compare(0, malformed_log.size(), malformed_log) == 0)
+            {
+                at.push_back(l.substr(l.find(" @ ") + 3));
+            }
+            else
+            {
+                item_logs.push_back(l);
+            }
+        }
+        CHECK(at == bad_at);
+        got.logs = item_logs;
+        CHECK(got == envelope_parsed);
+    }
+}
+}
+
+int main()
+{
+    parallel();
+    chunks();
+    jsonl();
+    return test::report();
+}
@@ -0,0 +1,213 @@
+/*
+ * Copyright (c) 2022 - present, GitHub: @cubter
+ *
+ * See COPYING.txt in the project root for license information.
+ */
+#include "test.h"
+
+#include "item_reader.h"
+#include "structural_scanner.h"
+
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+using metasci::item_reader;
+using metasci::item_view;
+using metasci::structural_scanner;
+
+namespace
+{
+// The structural characters outside of strings, and the quotes, found a
+// byte at a time.
+std::vector<std::pair<size_t, char>> structurals(const std::string &s)
+{
+    std::vector<std::pair<size_t, char>> out;
+    bool in_string = false;
+    for (size_t i = 0; i < s.size(); ++i)
+    {
+        char c = s[i];
+        if (in_string)
+        {
+            if (c == '\\')
+            {
+                ++i;
+            }
+            else if (c == '"')
+            {
+                in_string = false;
+                out.emplace_back(i, c);
+            }
+        }
+        else if (c == '"')
+        {
+            in_string = true;
+            out.emplace_back(i, c);
+        }
+        else if (c == '{' || c == '}' || c == '[' || c == ']' || c == ':' || c == ',')
+        {
+            out.emplace_back(i, c);
+        }
+    }
+    return out;
+}
+
+// Random text of structural characters and strings, whose contents hold
+// structural characters, escaped quotes and runs of backslashes.
+std::string random_text(std::mt19937 &rng)
+{
+    static const char *const outside[] = { "{", "}", "[", "]", ":", ",", " ", "1" };
+    static const char *const inside[]  = { "a", "{", "]", ":", ",", "\\\\",
+        "\\\"", "\\\\\\\"", "\\n" };
+    std::string s;
+    const size_t len = 1 + rng() % 300;
+    while (s.size() < len)
+    {
+        if (rng() % 4 != 0)
+        {
+            s += outside[rng() % 8];
+            continue;
+        }
+        s += '"';
+        for (size_t n = rng() % 80; n > 0; --n)
+        {
+            s += inside[rng() % 9];
+        }
+        s += '"';
+    }
+    return s;
+}
+
+// Whatever the kernel, the scanner finds what a byte-wise scan does, with
+// escapes, runs of backslashes and strings across the 64-byte blocks.
+void scanner()
+{
+    std::mt19937 rng(11);
+    structural_scanner scanner;
+
+    for (int i = 0; i < 2000; ++i)
+    {
+        const std::string s = random_text(rng);
+        std::vector<std::pair<size_t, char>> found;
+        scanner.scan(s.data(), s.size(), [&](size_t pos, char c)
+        {
+            found.emplace_back(pos, c);
+            return true;
+        });
+        CHECK(found == structurals(s));
+    }
+
+#ifdef METASCI_X86
+    const char alphabet[] = "{}[]:,\"\\\\\\ab 1";
+    for (int i = 0; i < 2000; ++i)
+    {
+        char block[64];
+        for (char &c : block)
+        {
+            c = i % 2 == 0 ? alphabet[rng() % (sizeof(alphabet) - 1)] :
+                static_cast<char>(rng());
+        }
+        metasci::block_masks scalar, sse, avx;
+        metasci::simd::classify_scalar(block, scalar);
+        metasci::simd::classify_sse42(block, sse);
+        CHECK(sse.quote == scalar.quote && sse.backslash == scalar.backslash &&
+            sse.op == scalar.op);
+        if (__builtin_cpu_supports("avx2"))
+        {
+            metasci::simd::classify_avx2(block, avx);
+            CHECK(avx.quote == scalar.quote && avx.backslash == scalar.backslash &&
+                avx.op == scalar.op);
+        }
+    }
+#endif
+}
+
+bool reads(item_reader::layout l, const std::string &s, size_t items)
+{
+    item_reader r(l);
+    size_t n = 0;
+    bool ok = r.read(s.data(), s.size(), [&](const item_view &) { ++n; });
+    return ok && n == items;
+}
+
+bool refuses(item_reader::layout l, const std::string &s)
+{
+    item_reader r(l);
+    return !r.read(s.data(), s.size(), [](const item_view &) {});
+}
+
+void layouts()
+{
+    CHECK(reads(item_reader::envelope, R"({"items":[{"a":1},{"b":[2]}],"x":{}})", 2));
+    CHECK(reads(item_reader::envelope, " \n{\"items\":[{\"a\":\"]}\"}]}\n", 1));
+    CHECK(reads(item_reader::bare, "{\"a\":1}\n{\"b\":2}\r\n\n", 2));
+    CHECK(reads(item_reader::bare, "", 0));
+    CHECK(reads(item_reader::list, "{\"a\":1},\n {\"b\":2}", 2));
+
+    CHECK(refuses(item_reader::envelope, R"({"status":"ok"})"));
+    CHECK(refuses(item_reader::envelope, R"({"items":[{"a":1}]} x)"));
+    CHECK(refuses(item_reader::envelope, R"({"items":[{"a":1}]}{})"));
+    CHECK(refuses(item_reader::envelope, R"({"items":[{"a":1]]})"));
+    CHECK(refuses(item_reader::envelope, R"({"items":[{"a":1}}})"));
+    CHECK(refuses(item_reader::envelope, R"({"items":[{"a":1})"));
+    CHECK(refuses(item_reader::bare, "{\"a\":1} tail"));
+    CHECK(refuses(item_reader::bare, "{\"a\":1},{\"b\":2}"));
+    CHECK(refuses(item_reader::bare, "x{\"a\":1}"));
+    CHECK(refuses(item_reader::bare, "{\"a\":[1}]"));
+    CHECK(refuses(item_reader::bare, "{\"a\":\"1}"));
+    CHECK(refuses(item_reader::bare, "\"s\""));
+    CHECK(refuses(item_reader::list, "{\"a\":1} {\"b\":2}"));
+    CHECK(refuses(item_reader::list, "{\"a\":1},,{\"b\":2}"));
+    CHECK(refuses(item_reader::list, "{\"a\":1},"));
+    CHECK(refuses(item_reader::list, ",{\"a\":1}"));
+}
+
+// An item's top-level fields are cut out raw, and find_items() gives the
+// same items' bounds.
+void fields()
+{
+    const std::string s = R"({"items":[ {"DOI" : "10.1/a", "author":[{"n":"x,y"}],
+        "n": 12 }, {"DOI":"10.1/b"} ]})";
+    std::vector<std::vector<std::pair<std::string, std::string>>> got;
+    std::vector<std::pair<size_t, size_t>> bounds;
+
+    item_reader r;
+    CHECK(r.read(s.data(), s.size(), [&](const item_view &item)
+    {
+        got.emplace_back();
+        for (const auto &f : item.fields)
+        {
+            got.back().emplace_back(std::string(f.key, f.key_len),
+                std::string(f.value, f.value_len));
+        }
+        bounds.emplace_back(static_cast<size_t>(item.begin - s.data()),
+            static_cast<size_t>(item.begin - s.data()) + item.size);
+    }));
+
+    CHECK(got.size() == 2);
+    if (got.size() == 2)
+    {
+        using fields = std::vector<std::pair<std::string, std::string>>;
+        CHECK(got[0] == (fields{ { "DOI", "\"10.1/a\"" },
+            { "author", "[{\"n\":\"x,y\"}]" }, { "n", "12" } }));
+        CHECK(got[1] == (fields{ { "DOI", "\"10.1/b\"" } }));
+    }
+
+    std::vector<std::pair<size_t, size_t>> found;
+    CHECK(r.find_items(s.data(), s.size(), found));
+    CHECK(found == bounds);
+    for (const auto &b : found)
+    {
+        CHECK(s[b.first] == '{' && s[b.second - 1] == '}');
+    }
+}
+}
+
+int main()
+{
+    scanner();
+    layouts();
+    fields();
+    return test::report();
+}
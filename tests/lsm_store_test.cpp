@@ -0,0 +1,261 @@
+/*
+ * Copyright (c) 2022 - present, GitHub: @cubter
+ *
+ * See COPYING.txt in the project root for license information.
+ */
+#include "test.h"
+
+#include "article_record.h"
+#include "lsm_store.h"
+
+#include <chrono>
+#include <fstream>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+using metasci::article;
+using metasci::compact_label;
+using metasci::journal;
+using metasci::journal_uset;
+using metasci::lsm_store;
+using metasci::string_pool;
+
+namespace
+{
+// Every field of an article survives its record, whatever the labels' pool
+// of the reader, and a truncated record or one referring to an unknown
+// journal is refused.
+void records()
+{
+    journal_uset journals;
+    const journal &j1 = *journals.emplace("Journal A", "Publisher A").first;
+    const journal &j2 = *journals.emplace("Journal B", "Publisher B").first;
+    string_pool labels;
+
+    article::builder b;
+    b.doi_b        = "10.1000/xyz-1";
+    b.title_b      = "On \"records\"\n";
+    b.type_b       = 7;
+    b.score_b      = -3;
+    b.volume_b     = compact_label::encode("12", labels);
+    b.issue_b      = compact_label::encode("Suppl. 2", labels);
+    b.ref_num_b    = 2;
+    b.ref_by_num_b = 300000;
+    b.updated_b    = 1650000000000;
+    b.published_b.push_back(metasci::date{ 2021, 5, 0 });
+    b.published_b.push_back(metasci::date{ 2020, 12, 31 });
+    b.issued_b.push_back(metasci::date{ 2021, 6, 1 });
+    b.ct_numbers_b.push_back("NCT0001");
+    b.references_b.push_back("10.1/r1");
+    b.references_b.push_back("");
+    b.journals_b.push_back(std::cref(j2));
+    b.journals_b.push_back(std::cref(j1));
+    b.subjects_ids_b.push_back(4);
+    article a = b.build(42);
+    a.set_authors_ids({ 7, -1, 1 << 30 });
+
+    std::string rec;
+    metasci::encode_article(a, labels, rec);
+
+    string_pool other;
+    const metasci::journal_index index = metasci::index_journals(journals);
+    article d = metasci::decode_article(rec.data(), rec.size(), other, index);
+    CHECK(d.get_id() == 42 && d.get_updated() == a.get_updated());
+    CHECK(d.doi_ref() == a.doi_ref() && d.title_ref() == a.title_ref());
+    CHECK(d.get_volume().get_number() == 12);
+    CHECK(d.get_issue().to_string(other) == "Suppl. 2");
+    CHECK(d.authors_ids_ref() == a.authors_ids_ref());
+    CHECK(d.journals_ref().size() == 2 && d.journals_ref()[0].get().get_id() ==
+        j2.get_id());
+
+    std::string again;
+    metasci::encode_article(d, other, again);
+    CHECK(again == rec);
+
+    int32_t  id = 0, journal_id = 0;
+    int64_t  updated = 0;
+    uint16_t year = 0;
+    std::string doi;
+    metasci::peek_article(rec.data(), rec.size(), id, updated);
+    CHECK(id == 42 && updated == a.get_updated());
+    metasci::peek_sort_fields(rec.data(), rec.size(), doi, year, journal_id);
+    CHECK(doi == a.doi_ref() && year == 2021 && journal_id == j2.get_id());
+
+    for (size_t len = 0; len < rec.size(); ++len)
+    {
+        CHECK_THROWS(metasci::decode_article(rec.data(), len, other, index));
+    }
+    CHECK_THROWS(metasci::decode_article(rec.data(), rec.size(), other,
+        metasci::journal_index()));
+}
+
+std::string key_of(int i)
+{
+    char key[32];
+    std::snprintf(key, sizeof(key), "10.%04d/%d", i % 1000, i);
+    return key;
+}
+
+std::string value_of(int i, int version)
+{
+    return std::to_string(version) + ':' + std::string(static_cast<size_t>(i % 50), 'v');
+}
+
+lsm_store::options small()
+{
+    lsm_store::options opts;
+    opts.memtable_bytes = 16 << 10;
+    opts.block_bytes    = 1 << 10;
+    opts.max_runs       = 3;
+    opts.wal_options.fsync = false;
+    return opts;
+}
+
+// Checks that the store holds expected, and nothing else.
+void check_contents(lsm_store &store, const std::map<std::string, std::string> &expected)
+{
+    std::string value;
+    for (const auto &kv : expected)
+    {
+        CHECK(store.get(kv.first, value) && value == kv.second);
+    }
+    CHECK(!store.get("10.9999/none", value));
+
+    using entries = std::vector<std::pair<std::string, std::string>>;
+    entries scanned;
+    store.scan([&](const std::string &key, const std::string &value)
+    {
+        scanned.emplace_back(key, value);
+    });
+    CHECK(scanned == entries(expected.begin(), expected.end()));
+}
+
+// Overwritten keys spread over many runs, merged by compaction, give their
+// latest values, before and after reopening.
+void runs()
+{
+    test::scratch_dir dir;
+    std::map<std::string, std::string> expected;
+    {
+        lsm_store store(dir / "store", small());
+        for (int version = 0; version < 3; ++version)
+        {
+            for (int i = version * 1000; i < 6000; ++i)
+            {
+                store.put(key_of(i), value_of(i, version));
+                expected[key_of(i)] = value_of(i, version);
+            }
+        }
+        check_contents(store, expected);
+
+        // Compaction runs in the background.
+        for (int i = 0; i < 1000 && store.runs() > 3; ++i)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        CHECK(store.runs() >= 1 && store.runs() <= 3);
+    }
+
+    lsm_store store(dir / "store", small());
+    check_contents(store, expected);
+}
+
+// The puts a crashed process has synced are replayed from its logs, and
+// the leftovers of an interrupted flush are removed.
+void crash()
+{
+    test::scratch_dir dir;
+    const std::string path = dir / "store";
+
+    pid_t pid = ::fork();
+    if (pid == 0)
+    {
+        lsm_store store(path, small());
+        for (int i = 0; i < 3000; ++i)
+        {
+            store.put(key_of(i), value_of(i, 0));
+        }
+        store.put(key_of(0), value_of(0, 1));
+        store.sync();
+        ::_exit(0);     // no flush, no destructor
+    }
+    int status = 0;
+    ::waitpid(pid, &status, 0);
+    CHECK(WIFEXITED(status));
+
+    {
+        std::ofstream stray(path + "/run-999999.sst");
+        stray << "half a run";
+    }
+
+    std::map<std::string, std::string> expected;
+    for (int i = 0; i < 3000; ++i)
+    {
+        expected[key_of(i)] = value_of(i, 0);
+    }
+    expected[key_of(0)] = value_of(0, 1);
+
+    lsm_store store(path, small());
+    check_contents(store, expected);
+    CHECK(!std::ifstream(path + "/run-999999.sst"));
+}
+
+// A damaged run is an error, not missing data.
+void corrupt()
+{
+    test::scratch_dir dir;
+    const std::string path = dir / "store";
+    lsm_store::options opts = small();
+    opts.memtable_bytes = size_t(1) << 20;
+    {
+        lsm_store store(path, opts);
+        for (int i = 0; i < 100; ++i)
+        {
+            store.put(key_of(i), value_of(i, 0));
+        }
+    }
+
+    std::string run;
+    {
+        std::ifstream manifest(path + "/MANIFEST");
+        std::string line;
+        while (std::getline(manifest, line))
+        {
+            if (line.compare(0, 4, "run-") == 0)
+            {
+                run = path + '/' + line;
+            }
+        }
+    }
+    CHECK(!run.empty());
+
+    // The first block's frame header.
+    {
+        std::fstream f(run, std::ios::in | std::ios::out | std::ios::binary);
+        f.write("\0\0\0\0", 4);
+    }
+    {
+        lsm_store store(path, opts);
+        std::string value;
+        CHECK_THROWS(store.get(key_of(0), value));
+    }
+
+    // A run cut short.
+    CHECK(::truncate(run.c_str(), 10) == 0);
+    CHECK_THROWS(lsm_store(path, opts));
+}
+}
+
+int main()
+{
+    records();
+    runs();
+    crash();
+    corrupt();
+    return test::report();
+}
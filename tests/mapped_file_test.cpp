@@ -0,0 +1,79 @@
+/*
+ * Copyright (c) 2022 - present, GitHub: @cubter
+ *
+ * See COPYING.txt in the project root for license information.
+ */
+#include "test.h"
+
+#include "mapped_file.h"
+
+#include <fstream>
+#include <random>
+#include <string>
+#include <system_error>
+
+using metasci::mapped_file;
+
+namespace
+{
+std::string noise(size_t len, unsigned seed)
+{
+    std::mt19937 rng(seed);
+    std::string s(len, '\0');
+    for (char &c : s)
+    {
+        c = static_cast<char>(rng());
+    }
+    return s;
+}
+
+std::string written(const std::string &path, const std::string &data)
+{
+    std::ofstream(path, std::ios::binary | std::ios::trunc) << data;
+    return path;
+}
+
+// A file is seen whole, a small one as it is, a big one mapped at a huge
+// page's boundary; an empty one is an empty buffer.
+void maps()
+{
+    test::scratch_dir dir;
+    for (size_t len : { size_t(1), size_t(4095), size_t(100000), (size_t(5) << 20) + 3 })
+    {
+        const std::string data = noise(len, static_cast<unsigned>(len));
+        mapped_file f(written(dir / "file", data));
+        CHECK(f.size() == len);
+        CHECK(std::string(f.data(), f.size()) == data);
+    }
+
+    mapped_file empty(written(dir / "empty", ""));
+    CHECK(empty.size() == 0);
+    CHECK_THROWS(mapped_file(dir / "none"));
+}
+
+// The pages before an offset are given back as the parsing goes on; what's
+// after it stays readable.
+void releases()
+{
+    test::scratch_dir dir;
+    const std::string data = noise((size_t(3) << 20) + 12345, 5);
+    mapped_file f(written(dir / "file", data));
+
+    bool same = true;
+    for (size_t at = 0; at < data.size(); at += 100003)
+    {
+        f.release(at);
+        same = same && std::string(f.data() + at, data.size() - at) == data.substr(at);
+        f.release(at / 2);  // behind what's gone already
+    }
+    CHECK(same);
+    f.release(data.size() + 1);
+}
+}
+
+int main()
+{
+    maps();
+    releases();
+    return test::report();
+}
@@ -0,0 +1,90 @@
+#!/bin/sh
+#
+# Copyright (c) 2022 - present, GitHub: @cubter
+#
+# See COPYING.txt in the project root for license information.
+#
+# Runs a multi-node ingest (see node_merge.h) as several local processes,
+# merges their outputs, and checks that the merge holds one article per DOI
+# and the same authors as a single process's ingest of the same shards, and
+# that every output has its dictionary.
+#
+# Usage: multi_node.sh <metaSci> <work_dir> [<nodes>]
+set -eu
+
+bin=$1
+work=$2
+nodes=${3:-4}
+shards=8
+
+fail()
+{
+    echo "multi_node: $*" >&2
+    exit 1
+}
+
+rm -rf "$work"
+mkdir -p "$work/shards" "$work/nodes"
+
+# Every shard has 50 works. The first 15 DOIs recur in every shard, newer
+# in the later ones, so that the nodes share them; the others are the
+# shard's own. A work's first author is the shard's; the second, lacking
+# ORCID, is one of five found in every shard, by their affiliation, so that
+# the nodes' authors are only the same by the features they keep.
+s=0
+while [ $s -lt $shards ]; do
+    awk -v s=$s 'BEGIN {
+        printf "{\"status\":\"ok\",\"message-type\":\"work-list\",\"items\":["
+        for (i = 0; i < 50; ++i) {
+            doi = i < 15 ? sprintf("10.5555/Shared-%d", i) : sprintf("10.5555/s%d-%d", s, i)
+            printf "%s{\"DOI\":\"%s\",\"title\":[\"%s, shard %d\"],", \
+                (i > 0 ? "," : ""), doi, doi, s
+            printf "\"publisher\":\"Publisher %d\",\"container-title\":[\"Journal %d\"],", \
+                i % 3, i % 5
+            printf "\"type\":\"journal-article\",\"subject\":[\"Subject %d\"],", i % 4
+            printf "\"author\":[{\"given\":\"G%d\",\"family\":\"F%d\",", i, s
+            printf "\"affiliation\":[],\"sequence\":\"first\"},"
+            printf "{\"given\":\"Ann\",\"family\":\"Common %d\",", i % 5
+            printf "\"affiliation\":[\"University %d\"],", i % 5
+            printf "\"sequence\":\"additional\"}],"
+            printf "\"indexed\":{\"timestamp\":%.0f}}", 1600000000000 + s * 1000 + i
+        }
+        printf "]}\n"
+    }' > "$work/shards/shard-$s.json"
+    s=$((s + 1))
+done
+expected=$((15 + shards * 35))
+
+"$bin" "$work/shards" "$work/single.orc" 2> "$work/single.log" ||
+    fail "the single ingest failed; see $work/single.log"
+single=$(sed -n 's/^Wrote \([0-9]*\) articles.*/\1/p' "$work/single.log")
+[ "$single" = "$expected" ] ||
+    fail "the single ingest wrote '$single' articles, not $expected"
+single_authors=$(sed -n 's/^Wrote .*, by \([0-9]*\) authors.*/\1/p' "$work/single.log")
+[ -n "$single_authors" ] || fail "the single ingest tells no authors' count"
+
+pids=
+i=0
+while [ $i -lt "$nodes" ]; do
+    "$bin" --shard "$i/$nodes" "$work/shards" "$work/nodes/node-$i.orc" \
+        2> "$work/node-$i.log" &
+    pids="$pids $!"
+    i=$((i + 1))
+done
+for pid in $pids; do
+    wait "$pid" || fail "a node failed; see $work/node-*.log"
+done
+
+"$bin" --merge "$work/nodes" "$work/merged.orc" 2> "$work/merge.log" ||
+    fail "the merge failed; see $work/merge.log"
+merged=$(sed -n 's/^Merged \([0-9]*\) articles.*/\1/p' "$work/merge.log")
+[ "$merged" = "$expected" ] ||
+    fail "the merge holds '$merged' articles, not $expected"
+merged_authors=$(sed -n 's/^Merged .*; \([0-9]*\) authors,.*/\1/p' "$work/merge.log")
+[ "$merged_authors" = "$single_authors" ] ||
+    fail "the merge holds '$merged_authors' authors, the single ingest $single_authors"
+
+for orc in "$work/single.orc" "$work/merged.orc" "$work"/nodes/node-*.orc; do
+    [ -s "$orc.dict" ] || fail "$orc has no dictionary"
+done
+echo "multi_node: $nodes nodes merged into $merged articles by $merged_authors authors"
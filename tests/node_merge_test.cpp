@@ -0,0 +1,144 @@
+/*
+ * Copyright (c) 2022 - present, GitHub: @cubter
+ *
+ * See COPYING.txt in the project root for license information.
+ */
+#include "test.h"
+
+#include "node_merge.h"
+
+#include <string>
+#include <vector>
+
+using metasci::author;
+using metasci::journal;
+using metasci::node_remap;
+using metasci::node_spec;
+using metasci::orcid;
+using metasci::output_dictionary;
+using metasci::subject;
+
+namespace
+{
+void node_specs()
+{
+    node_spec spec;
+    CHECK(metasci::parse_node_spec("0/1", spec) && spec.node == 0 && spec.nodes == 1);
+    CHECK(metasci::parse_node_spec("3/4", spec) && spec.node == 3 && spec.nodes == 4);
+
+    for (const char *bad : { "", "4/4", "0/0", "/4", "1/", "1", "-1/4", "a/4",
+        "1/2/3", "1 /4", "0/4294967296", "00000000000000001/2" })
+    {
+        CHECK(!metasci::parse_node_spec(bad, spec));
+    }
+}
+
+// A shard goes to a node by its name alone, the same every time, and the
+// nodes get about as many shards each.
+void shards_to_nodes()
+{
+    CHECK(metasci::node_of("/a/0001.json.gz", 4) ==
+        metasci::node_of("/elsewhere/0001.json.gz", 4));
+    CHECK(metasci::node_of("0001.json.gz", 4) ==
+        metasci::node_of("/a/0001.json.gz", 4));
+    CHECK(metasci::node_of("/a/0001.json.gz", 1) == 0);
+
+    std::vector<int> per_node(4, 0);
+    for (int i = 0; i < 4000; ++i)
+    {
+        unsigned n = metasci::node_of("/dump/" + std::to_string(i) + ".json.gz", 4);
+        CHECK(n < 4);
+        ++per_node[n < 4 ? n : 0];
+    }
+    for (int n : per_node)
+    {
+        CHECK(n > 800 && n < 1200);
+    }
+}
+
+author person(int32_t id, const std::string &family, const std::string &id_orcid,
+    const std::string &affiliation)
+{
+    orcid o;
+    if (!id_orcid.empty())
+    {
+        orcid::parse(id_orcid, o);
+    }
+    author a("A.", family, o, false);
+    a.set_id(id);
+    a.add_affiliation(affiliation);
+    return a;
+}
+
+// Entries are merged by title, authors by ORCID or by a shared feature, in
+// the nodes' order, never two of a node; the articles' IDs follow on.
+void dictionaries()
+{
+    std::vector<output_dictionary> nodes(2);
+    nodes[0].max_article_id = 10;
+    nodes[0].subjects.emplace_back(1, "Math");
+    nodes[0].subjects.emplace_back(2, "Biology");
+    nodes[0].journals.emplace_back(1, "Journal A", 1, "Publisher X");
+    nodes[0].journals.emplace_back(2, "Journal B", 2, "Publisher Y");
+    nodes[0].authors.push_back(person(1, "Carberry", "0000-0002-1825-0097", "Univ. 1"));
+    nodes[0].authors.push_back(person(2, "Lee", "", "Univ. 1"));
+    nodes[0].features = { {}, { "a:univ1" } };
+
+    nodes[1].max_article_id = 5;
+    nodes[1].subjects.emplace_back(1, "Biology");
+    nodes[1].subjects.emplace_back(3, "Chemistry");
+    nodes[1].journals.emplace_back(1, "Journal B", 1, "Publisher Y");
+    nodes[1].journals.emplace_back(2, "Journal C", 2, "Publisher X");
+    nodes[1].authors.push_back(person(1, "Lee", "", "Univ. 1"));
+    nodes[1].authors.push_back(person(2, "Carberry", "0000-0002-1825-0097", "Univ. 2"));
+    nodes[1].authors.push_back(person(3, "Lee", "", "Univ. 1"));
+    nodes[1].authors.push_back(person(4, "Lee", "", "Univ. 3"));
+    nodes[1].features = { { "a:univ1", "c:carberry|a" }, {}, { "a:univ1" }, { "a:univ3" } };
+
+    output_dictionary merged;
+    std::vector<node_remap> remaps;
+    metasci::merge_dictionaries(nodes, merged, remaps);
+
+    CHECK(merged.max_article_id == 15);
+    CHECK(remaps.size() == 2);
+    CHECK(remaps[0].article_offset == 0 && remaps[1].article_offset == 10);
+
+    CHECK(merged.subjects.size() == 3);
+    CHECK(remaps[0].subject(1) == 1 && remaps[0].subject(2) == 2);
+    CHECK(remaps[1].subject(1) == 2 && remaps[1].subject(3) == 3);
+
+    CHECK(merged.journals.size() == 3);
+    CHECK(remaps[1].journal(1) == remaps[0].journal(2));
+    CHECK(remaps[1].journal(2) == 3);
+    CHECK(merged.journals[2].get_title() == "Journal C" &&
+        merged.journals[2].get_publisher_id() == merged.journals[0].get_publisher_id());
+
+    CHECK(merged.authors.size() == 4);
+    CHECK(remaps[1].author(2) == remaps[0].author(1));
+    CHECK(remaps[0].author(2) == 2 && remaps[1].author(1) == 2);
+    CHECK(remaps[1].author(3) == 3 && remaps[1].author(4) == 4);
+    CHECK(merged.features_of(1) == (std::vector<std::string>{ "a:univ1", "c:carberry|a" }));
+    CHECK(merged.authors[0].affiliations_ref() ==
+        (metasci::str_vec{ "Univ. 1", "Univ. 2" }));
+    for (size_t i = 0; i < merged.authors.size(); ++i)
+    {
+        CHECK(merged.authors[i].get_id() == static_cast<int32_t>(i + 1));
+    }
+
+    // IDs the node's dictionary lacks.
+    CHECK_THROWS(remaps[1].subject(2));
+    CHECK_THROWS(remaps[0].author(99));
+    CHECK_THROWS(remaps[0].journal(-1));
+
+    nodes[1].subjects.emplace_back(0, "Bad");
+    CHECK_THROWS(metasci::merge_dictionaries(nodes, merged, remaps));
+}
+}
+
+int main()
+{
+    node_specs();
+    shards_to_nodes();
+    dictionaries();
+    return test::report();
+}
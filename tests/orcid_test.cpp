@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) 2022 - present, GitHub: @cubter
+ *
+ * See COPYING.txt in the project root for license information.
+ */
+#include "test.h"
+
+#include "orcid.h"
+
+#include <random>
+#include <string>
+
+using metasci::orcid;
+
+namespace
+{
+// ISO 7064 11,2, the way ORCID's documentation computes it.
+char check_char(const std::string &digits)
+{
+    int total = 0;
+    for (char c : digits)
+    {
+        total = (total + (c - '0')) * 2;
+    }
+    int result = (12 - total % 11) % 11;
+    return result == 10 ? 'X' : static_cast<char>('0' + result);
+}
+
+std::string format(const std::string &digits, char check)
+{
+    return digits.substr(0, 4) + '-' + digits.substr(4, 4) + '-' +
+        digits.substr(8, 4) + '-' + digits.substr(12, 3) + check;
+}
+
+void known()
+{
+    orcid o;
+    CHECK(orcid::parse("0000-0002-1825-0097", o));
+    CHECK(o.to_string() == "0000-0002-1825-0097");
+    CHECK(orcid::parse("https://orcid.org/0000-0002-1825-0097", o));
+    CHECK(o.to_string() == "0000-0002-1825-0097");
+    CHECK(orcid::parse("http://orcid.org/0000-0001-5109-3700", o));
+    CHECK(o.to_string() == "0000-0001-5109-3700");
+
+    CHECK(!orcid::parse("0000-0002-1825-0098", o));     // checksum
+    CHECK(!orcid::parse("0000-0002-1825-009", o));
+    CHECK(!orcid::parse("0000 0002 1825 0097", o));
+    CHECK(!orcid::parse("0000-0002-1825-00a7", o));
+    CHECK(!orcid::parse("https://example.org/0000-0002-1825-0097", o));
+    CHECK(orcid().empty() && orcid().to_string().empty());
+}
+
+// Every valid ORCID, the X check character too, packs and unpacks to
+// itself, and no other check character is accepted.
+void round_trip()
+{
+    std::mt19937_64 rng(7);
+    size_t with_x = 0;
+    for (int i = 0; i < 20000; ++i)
+    {
+        std::string digits;
+        for (int d = 0; d < 15; ++d)
+        {
+            digits += static_cast<char>('0' + rng() % 10);
+        }
+        const char check = check_char(digits);
+        with_x += check == 'X';
+
+        orcid o;
+        CHECK(orcid::parse(format(digits, check), o));
+        CHECK(!o.empty());
+        CHECK(o.to_string() == format(digits, check));
+        CHECK(orcid(o.get_packed()) == o);
+
+        const char wrong = check == 'X' ? '0' : check == '9' ? 'X' :
+            static_cast<char>(check + 1);
+        CHECK(!orcid::parse(format(digits, wrong), o));
+    }
+    CHECK(with_x > 0);
+}
+}
+
+int main()
+{
+    known();
+    round_trip();
+    return test::report();
+}
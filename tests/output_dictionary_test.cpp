@@ -0,0 +1,217 @@
+/*
+ * Copyright (c) 2022 - present, GitHub: @cubter
+ *
+ * See COPYING.txt in the project root for license information.
+ */
+#include "test.h"
+
+#include "compact_label.h"
+#include "output_dictionary.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+using metasci::article;
+using metasci::author;
+using metasci::author_id;
+using metasci::compact_label;
+using metasci::journal;
+using metasci::orcid;
+using metasci::output_dictionary;
+using metasci::referred_ids;
+using metasci::string_pool;
+using metasci::subject;
+
+namespace
+{
+// Numbers are kept as such, anything else goes to the pool; either way, the
+// label reads back as it was written.
+void labels()
+{
+    string_pool pool;
+    for (const char *s : { "", "0", "7", "123456789", "1234567890", "01", "3-4",
+        "Suppl 2", "-1", "3-4" })
+    {
+        compact_label l = compact_label::encode(s, pool);
+        CHECK(l.to_string(pool) == s);
+        CHECK(l.empty() == (*s == '\0'));
+    }
+    CHECK(compact_label::encode("42", pool).is_number());
+    CHECK(compact_label::encode("42", pool).get_number() == 42);
+    CHECK(!compact_label::encode("042", pool).is_number());
+    CHECK(pool.size() == 6);    // "3-4" once
+}
+
+void fill(metasci::dictionaries &dicts)
+{
+    for (int i = 1; i <= 4; ++i)
+    {
+        dicts.subjects.emplace_back(static_cast<metasci::subject_id>(i),
+            "Subject " + std::to_string(i));
+        dicts.journals.emplace(i, "Journal " + std::to_string(i), i % 2 + 1,
+            "Publisher " + std::to_string(i % 2 + 1));
+    }
+
+    orcid o;
+    orcid::parse("0000-0002-1825-0097", o);
+    std::vector<article> batch;
+    for (int i = 0; i < 4; ++i)
+    {
+        article::builder b;
+        b.doi_b = "10.1/" + std::to_string(i);
+        author a("Given", "Family " + std::to_string(i), i == 2 ? o : orcid(),
+            i == 2);
+        a.add_affiliation("Affiliation " + std::to_string(i));
+        a.add_affiliation("Elsewhere");
+        b.authors_b.push_back(a);
+        batch.push_back(b.build());
+    }
+    author::restore_max_id(0);
+    dicts.resolver.resolve(batch);
+}
+
+// A dictionary holds the entries its output refers to, and reads back as
+// it was written.
+void round_trip(const test::scratch_dir &dir)
+{
+    metasci::dictionaries dicts;
+    fill(dicts);
+
+    referred_ids ids;
+    ids.max_article_id = 1234;
+    ids.subjects.insert(2);
+    ids.subjects.insert(4);
+    ids.journals.insert(3);
+    // The one having ORCID, and another.
+    author_id with_orcid = 0;
+    for (const author &a : dicts.resolver.authors())
+    {
+        if (a.has_orcid())
+        {
+            with_orcid = a.get_id();
+        }
+    }
+    const author_id other = with_orcid == 1 ? 2 : 1;
+    ids.authors.insert(with_orcid);
+    ids.authors.insert(other);
+
+    output_dictionary d(dicts, ids, metasci::node_spec{ 1, 3 });
+    CHECK(d.subjects.size() == 2 && d.journals.size() == 1 && d.authors.size() == 2);
+    // The resolver's features of the one lacking ORCID: "Family i" is at
+    // "Affiliation i" & "Elsewhere".
+    CHECK(d.features.size() == 2);
+    for (size_t i = 0; i < d.authors.size(); ++i)
+    {
+        const std::string n = d.authors[i].get_family_name().substr(7);
+        CHECK(d.features_of(i) == (d.authors[i].has_orcid() ?
+            std::vector<std::string>() :
+            std::vector<std::string>{ "a:affiliation" + n, "a:elsewhere" }));
+    }
+
+    const std::string path = output_dictionary::path_of(dir / "out.orc");
+    CHECK(output_dictionary::is_dictionary(path));
+    d.save(path);
+    output_dictionary back = output_dictionary::load(path);
+
+    CHECK(back.spec.node == 1 && back.spec.nodes == 3);
+    CHECK(back.max_article_id == 1234);
+    CHECK(back.subjects.size() == 2);
+    for (size_t i = 0; i < back.subjects.size() && i < d.subjects.size(); ++i)
+    {
+        CHECK(back.subjects[i].get_id() == d.subjects[i].get_id());
+        CHECK(back.subjects[i].get_title() == d.subjects[i].get_title());
+    }
+    CHECK(back.journals.size() == 1);
+    if (back.journals.size() == 1)
+    {
+        const journal &j = back.journals[0];
+        CHECK(j.get_id() == 3 && j.get_title() == "Journal 3");
+        CHECK(j.get_publisher_id() == 2 && j.get_publisher_title() == "Publisher 2");
+    }
+    CHECK(back.authors.size() == 2);
+    for (size_t i = 0; i < back.authors.size() && i < d.authors.size(); ++i)
+    {
+        const author &a = back.authors[i];
+        const author &b = d.authors[i];
+        CHECK(a.get_id() == b.get_id());
+        CHECK(a.get_first_name() == b.get_first_name());
+        CHECK(a.get_family_name() == b.get_family_name());
+        CHECK(a.get_orcid() == b.get_orcid());
+        CHECK(a.is_authenticated_orcid() == b.is_authenticated_orcid());
+        CHECK(a.affiliations_ref() == b.affiliations_ref());
+        CHECK(back.features_of(i) == d.features_of(i));
+    }
+    CHECK(std::count_if(back.authors.begin(), back.authors.end(),
+        [](const author &a) { return a.has_orcid(); }) == 1);
+
+    referred_ids fewer;
+    fewer.max_article_id = 10;
+    fewer.authors.insert(other);
+    back.keep_only(fewer);
+    CHECK(back.subjects.empty() && back.journals.empty());
+    CHECK(back.authors.size() == 1 && back.authors[0].get_id() == other);
+    CHECK(back.features.size() == 1 && !back.features_of(0).empty());
+    CHECK(back.max_article_id == 10);
+
+    // An author the resolver's table lacks.
+    referred_ids unknown;
+    unknown.authors.insert(99);
+    CHECK_THROWS(output_dictionary(dicts, unknown));
+
+    // A dictionary of the first version, which had no features, still loads.
+    referred_ids no_authors;
+    no_authors.subjects.insert(1);
+    output_dictionary(dicts, no_authors).save(path);
+    std::ifstream in(path, std::ios::binary);
+    std::string bytes((std::istreambuf_iterator<char>(in)),
+        std::istreambuf_iterator<char>());
+    in.close();
+    std::ofstream(path, std::ios::binary | std::ios::trunc) << "MSNDICT1" <<
+        bytes.substr(8);
+    back = output_dictionary::load(path);
+    CHECK(back.subjects.size() == 1 && back.authors.empty() && back.features.empty());
+}
+
+// A damaged dictionary is refused rather than misread.
+void damaged(const test::scratch_dir &dir)
+{
+    metasci::dictionaries dicts;
+    fill(dicts);
+    referred_ids ids;
+    ids.max_article_id = 5;
+    ids.authors.insert(1);
+    ids.subjects.insert(1);
+    const std::string path = dir / "damaged.orc.dict";
+    output_dictionary(dicts, ids).save(path);
+
+    std::ifstream in(path, std::ios::binary);
+    std::string bytes((std::istreambuf_iterator<char>(in)),
+        std::istreambuf_iterator<char>());
+    in.close();
+
+    for (size_t len : { size_t(0), size_t(4), size_t(9), bytes.size() - 1 })
+    {
+        std::ofstream(path, std::ios::binary | std::ios::trunc).write(bytes.data(),
+            static_cast<std::streamsize>(len));
+        CHECK_THROWS(output_dictionary::load(path));
+    }
+    std::ofstream(path, std::ios::binary | std::ios::trunc) << bytes << 'x';
+    CHECK_THROWS(output_dictionary::load(path));
+    std::ofstream(path, std::ios::binary | std::ios::trunc) << "NOTADICT" <<
+        bytes.substr(8);
+    CHECK_THROWS(output_dictionary::load(path));
+    CHECK_THROWS(output_dictionary::load(dir / "missing.dict"));
+}
+}
+
+int main()
+{
+    test::scratch_dir dir;
+    labels();
+    round_trip(dir);
+    damaged(dir);
+    return test::report();
+}
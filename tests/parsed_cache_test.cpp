@@ -0,0 +1,147 @@
+/*
+ * Copyright (c) 2022 - present, GitHub: @cubter
+ *
+ * See COPYING.txt in the project root for license information.
+ */
+#include "test.h"
+
+#include "parsed_cache.h"
+
+#include <string>
+#include <vector>
+
+using metasci::article;
+using metasci::author;
+using metasci::compact_label;
+using metasci::dictionaries;
+using metasci::journal;
+using metasci::json_log;
+using metasci::orcid;
+using metasci::subject_id;
+
+namespace
+{
+// A file's articles as the parser makes them, their entries added to dicts.
+std::vector<article> parsed(dictionaries &dicts)
+{
+    dicts.subjects.emplace_back("Math");
+    dicts.subjects.emplace_back("Biology");
+    const subject_id math = dicts.subjects[dicts.subjects.size() - 2].get_id();
+    const subject_id bio  = dicts.subjects.back().get_id();
+    const journal &ja = *dicts.journals.emplace("Journal A", "Publisher X").first;
+    const journal &jb = *dicts.journals.emplace("Journal B", "Publisher Y").first;
+
+    std::vector<article> out;
+    for (int i = 0; i < 3; ++i)
+    {
+        article::builder b;
+        b.doi_b        = "10.1/" + std::to_string(i);
+        b.title_b      = i == 1 ? "" : "Title " + std::to_string(i);
+        b.updated_b    = 1000 + i;
+        b.type_b       = static_cast<metasci::pub_type_id>(i);
+        b.score_b      = -i;
+        b.volume_b     = compact_label::encode(i == 0 ? "12" : "Suppl. 1", dicts.labels);
+        b.ref_by_num_b = 7 * i;
+        b.published_b.push_back(metasci::date{ 2020, static_cast<uint8_t>(i), 1 });
+        b.references_b.push_back("10.2/" + std::to_string(i));
+        b.subjects_ids_b.push_back(i == 2 ? math : bio);
+        b.journals_b.push_back(std::cref(i == 0 ? ja : jb));
+        if (i != 1)
+        {
+            b.journals_b.push_back(std::cref(ja));
+        }
+
+        orcid o;
+        orcid::parse("0000-0002-1825-0097", o);
+        b.authors_b.push_back(author("Josiah", "Carberry", o, true));
+        b.authors_b.back().add_affiliation("Brown University");
+        b.authors_b.push_back(author("", "Lee" + std::to_string(i), orcid(), false));
+        out.push_back(b.build());
+    }
+    return out;
+}
+
+std::string encode(const std::vector<article> &articles,
+    const std::vector<json_log> &logs, dictionaries &dicts)
+{
+    std::string out;
+    metasci::encode_parsed(articles.data(), articles.data() + articles.size(),
+        logs.data(), logs.data() + logs.size(), dicts, out);
+    return out;
+}
+
+// An entry made in one process is loaded in another, whose dictionaries
+// differ: the names are looked up or added, and the articles come out the
+// same.
+void round_trip()
+{
+    dictionaries first;
+    const std::vector<article> articles = parsed(first);
+    std::vector<json_log> logs;
+    logs.emplace_back(metasci::log_code::invalid_orcid, "bad ORCID", "10.1/0");
+    logs.emplace_back(metasci::log_code::malformed_input, "malformed");
+    const std::string entry = encode(articles, logs, first);
+
+    dictionaries second;
+    second.subjects.emplace_back("Chemistry");
+    second.subjects.emplace_back("Biology");
+    second.journals.emplace("Journal B", "Publisher Y");
+    second.labels.intern("Other");
+
+    std::vector<article> loaded;
+    std::vector<json_log> loaded_logs;
+    metasci::decode_parsed(entry.data(), entry.size(), second, loaded, loaded_logs);
+
+    CHECK(loaded.size() == articles.size());
+    CHECK(second.subjects.size() == 3);
+    CHECK(second.journals.size() == 2);
+    CHECK(encode(loaded, loaded_logs, second) == entry);
+    if (loaded.size() == 3)
+    {
+        CHECK(loaded[1].get_volume().to_string(second.labels) == "Suppl. 1");
+        CHECK(loaded[2].authors_ref()[0].is_authenticated_orcid());
+        CHECK(loaded[2].authors_ref()[0].affiliations_ref() ==
+            articles[2].authors_ref()[0].affiliations_ref());
+        CHECK(loaded[0].journals_ref()[0].get().get_title() == "Journal A");
+    }
+    CHECK(loaded_logs.size() == 2 && loaded_logs[0].context_ref() == "10.1/0" &&
+        loaded_logs[1].get_message_code() == metasci::log_code::malformed_input);
+}
+
+// A damaged entry, or one of another version, adds nothing.
+void damaged()
+{
+    dictionaries dicts;
+    const std::string entry = encode(parsed(dicts), {}, dicts);
+
+    std::vector<article> loaded;
+    std::vector<json_log> logs;
+    for (size_t len = 0; len < entry.size(); len += 7)
+    {
+        CHECK_THROWS(metasci::decode_parsed(entry.data(), len, dicts, loaded, logs));
+    }
+    std::string other = entry;
+    ++other[0];
+    CHECK_THROWS(metasci::decode_parsed(other.data(), other.size(), dicts, loaded, logs));
+    CHECK(loaded.empty() && logs.empty());
+}
+
+void keys()
+{
+    const std::string a = "{\"items\":[]}", b = "{\"items\":[] }";
+    CHECK(metasci::parsed_cache_key(a.data(), a.size(), "json") ==
+        metasci::parsed_cache_key(a.data(), a.size(), "json"));
+    CHECK(metasci::parsed_cache_key(a.data(), a.size(), "json") !=
+        metasci::parsed_cache_key(a.data(), a.size(), "jsonl"));
+    CHECK(metasci::parsed_cache_key(a.data(), a.size(), "json") !=
+        metasci::parsed_cache_key(b.data(), b.size(), "json"));
+}
+}
+
+int main()
+{
+    round_trip();
+    damaged();
+    keys();
+    return test::report();
+}
@@ -0,0 +1,152 @@
+/*
+ * Copyright (c) 2022 - present, GitHub: @cubter
+ *
+ * See COPYING.txt in the project root for license information.
+ */
+#include "test.h"
+
+#include "seekable_zstd.h"
+
+#include <random>
+#include <string>
+#include <vector>
+
+using metasci::item_reader;
+using metasci::seekable_options;
+using metasci::zstd_frame;
+
+namespace
+{
+// Items one after another, some spread over lines; lines is what a shard
+// holds of them.
+std::string items(size_t n, std::string &lines)
+{
+    std::mt19937 rng(23);
+    std::string s;
+    for (size_t i = 0; i < n; ++i)
+    {
+        std::string text(rng() % 2000, static_cast<char>('a' + rng() % 26));
+        std::string item = "{\"DOI\":\"10.1/" + std::to_string(i) + "\",\r\n\"t\":\"" +
+            text + "\"}";
+        s += item + "\n";
+        item[item.find('\r')]  = ' ';
+        item[item.find('\n')]  = ' ';
+        lines += item + '\n';
+    }
+    return s;
+}
+
+// A shard decompresses whole, its seek table skipped, and frame by frame,
+// every frame ending at an item's end.
+void round_trip()
+{
+    std::string lines;
+    const std::string text = items(1000, lines);
+
+    seekable_options opts;
+    opts.frame_size = 64 << 10;
+    std::string shard;
+    CHECK(metasci::pack_seekable(text.data(), text.size(), item_reader::bare,
+        opts, shard));
+    CHECK(metasci::is_seekable_zstd(shard.data(), shard.size()));
+
+    std::string whole;
+    CHECK(metasci::unzstd(shard.data(), shard.size(), whole));
+    CHECK(whole == lines);
+
+    std::vector<zstd_frame> frames;
+    CHECK(metasci::read_seek_table(shard.data(), shard.size(), frames));
+    CHECK(frames.size() > 4);
+
+    std::string joined;
+    for (const zstd_frame &f : frames)
+    {
+        CHECK(f.d_offset == joined.size());
+        CHECK(f.d_size >= opts.frame_size || &f == &frames.back());
+        std::string frame(f.d_size, '\0');
+        CHECK(metasci::unzstd_frame(shard.data() + f.c_offset, f, &frame[0]));
+        CHECK(!frame.empty() && frame.back() == '\n');
+        joined += frame;
+    }
+    CHECK(joined == lines);
+
+    // The envelope is re-packed alike.
+    std::string envelope = "{\"items\":[" + text + "]}";
+    for (size_t at = 0; (at = envelope.find("}\n{", at)) != std::string::npos; at += 3)
+    {
+        envelope.replace(at, 3, "},{");
+    }
+    std::string other;
+    CHECK(metasci::pack_seekable(envelope.data(), envelope.size(),
+        item_reader::envelope, opts, other));
+    CHECK(metasci::unzstd(other.data(), other.size(), whole) && whole == lines);
+}
+
+// An empty input makes a shard of an empty frame; a malformed one keeps
+// the items before the malformed one.
+void edges()
+{
+    std::string shard, whole;
+    std::vector<zstd_frame> frames;
+    CHECK(metasci::pack_seekable("", 0, item_reader::bare, seekable_options(), shard));
+    CHECK(metasci::read_seek_table(shard.data(), shard.size(), frames));
+    CHECK(frames.size() == 1 && frames[0].d_size == 0);
+
+    const std::string bad = "{\"a\":1}\n{\"a\":[}\n";
+    shard.clear();
+    CHECK(!metasci::pack_seekable(bad.data(), bad.size(), item_reader::bare,
+        seekable_options(), shard));
+    CHECK(metasci::unzstd(shard.data(), shard.size(), whole) && whole == "{\"a\":1}\n");
+}
+
+// A damaged seek table, or a plain zstd file, isn't taken for a shard's.
+void damaged()
+{
+    std::string lines;
+    const std::string text = items(200, lines);
+    seekable_options opts;
+    opts.frame_size = 16 << 10;
+    std::string shard;
+    metasci::pack_seekable(text.data(), text.size(), item_reader::bare, opts, shard);
+
+    std::vector<zstd_frame> frames;
+    CHECK(metasci::read_seek_table(shard.data(), shard.size(), frames));
+    const size_t n = frames.size();
+
+    std::string plain;
+    metasci::zstd_compress(lines, 3, plain);
+    CHECK(!metasci::is_seekable_zstd(plain.data(), plain.size()));
+    CHECK(!metasci::read_seek_table(plain.data(), plain.size(), frames));
+
+    // A frame's compressed size, off by one.
+    std::string bad = shard;
+    const size_t entry = bad.size() - metasci::zstd_seek_footer - 8 * n;
+    ++bad[entry];
+    CHECK(!metasci::read_seek_table(bad.data(), bad.size(), frames));
+    CHECK(frames.empty());
+
+    // The number of frames.
+    bad = shard;
+    ++bad[bad.size() - metasci::zstd_seek_footer];
+    CHECK(!metasci::read_seek_table(bad.data(), bad.size(), frames));
+
+    // Cut short.
+    CHECK(!metasci::read_seek_table(shard.data(), shard.size() - 1, frames));
+
+    // A frame cut short is refused on its own.
+    CHECK(metasci::read_seek_table(shard.data(), shard.size(), frames));
+    std::string frame(frames[1].d_size, '\0');
+    CHECK(metasci::unzstd_frame(shard.data() + frames[1].c_offset, frames[1], &frame[0]));
+    zstd_frame shorter = frames[1];
+    --shorter.c_size;
+    CHECK(!metasci::unzstd_frame(shard.data() + shorter.c_offset, shorter, &frame[0]));
+}
+}
+
+int main()
+{
+    round_trip();
+    edges();
+    damaged();
+    return test::report();
+}
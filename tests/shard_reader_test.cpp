@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) 2022 - present, GitHub: @cubter
+ *
+ * See COPYING.txt in the project root for license information.
+ */
+#include "test.h"
+
+#include "shard_reader.h"
+
+#include <cerrno>
+#include <fstream>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+using metasci::shard;
+using metasci::shard_reader;
+
+namespace
+{
+std::string noise(size_t len, unsigned seed)
+{
+    std::mt19937 rng(seed);
+    std::string s(len, '\0');
+    for (char &c : s)
+    {
+        c = static_cast<char>(rng());
+    }
+    return s;
+}
+
+// Every file is handed over once, whole, with whichever backend and however
+// many files are in flight; a missing one comes with its errno.
+void reads(shard_reader::backend b, unsigned depth)
+{
+    test::scratch_dir dir;
+    std::map<std::string, std::string> files;
+    std::vector<std::string> paths;
+    for (unsigned i = 0; i < 40; ++i)
+    {
+        const size_t len = i == 0 ? 0 : i % 7 == 0 ? (size_t(1) << 20) + i : 1000 * i + 3;
+        const std::string path = dir / ("shard" + std::to_string(i));
+        files[path] = noise(len, i);
+        std::ofstream(path, std::ios::binary) << files[path];
+        paths.push_back(path);
+    }
+    paths.push_back(dir / "none");
+
+    shard_reader reader(depth, b);
+    CHECK(b == shard_reader::automatic ||
+        (b == shard_reader::threads) == (reader.backend_name() == std::string("threads")));
+
+    std::map<std::string, int> seen;
+    reader.read(paths, [&](shard &s)
+    {
+        ++seen[s.path];
+        if (s.path == paths.back())
+        {
+            CHECK(s.error == ENOENT);
+        }
+        else
+        {
+            CHECK(s.error == 0 && s.data == files[s.path]);
+        }
+    });
+    CHECK(seen.size() == paths.size());
+    for (const auto &p : seen)
+    {
+        CHECK(p.second == 1);
+    }
+
+    // The reader is used again.
+    size_t n = 0;
+    reader.read(std::vector<std::string>(paths.begin(), paths.begin() + 3),
+        [&](shard &) { ++n; });
+    reader.read(std::vector<std::string>(), [&](shard &) { ++n; });
+    CHECK(n == 3);
+}
+}
+
+int main()
+{
+    for (unsigned depth : { 1u, 4u, 64u })
+    {
+        reads(shard_reader::automatic, depth);
+        reads(shard_reader::threads, depth);
+    }
+    return test::report();
+}
@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) 2022 - present, GitHub: @cubter
+ *
+ * See COPYING.txt in the project root for license information.
+ */
+#include "test.h"
+
+#include "string_sort.h"
+
+#include <algorithm>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+using metasci::string_sort;
+
+namespace
+{
+// Sorts the keys' indexes with string_sort() and with std::stable_sort, and
+// checks they agree, equal keys' indexes included.
+void agrees(const std::vector<std::string> &keys, unsigned threads)
+{
+    std::vector<size_t> sorted(keys.size()), expected(keys.size());
+    for (size_t i = 0; i < keys.size(); ++i)
+    {
+        sorted[i] = expected[i] = i;
+    }
+
+    string_sort(sorted.data(), sorted.data() + sorted.size(), [&](size_t i)
+    {
+        return std::pair<const char *, size_t>(keys[i].data(), keys[i].size());
+    }, threads);
+    std::stable_sort(expected.begin(), expected.end(), [&](size_t a, size_t b)
+    {
+        return keys[a] < keys[b];
+    });
+    CHECK(sorted == expected);
+}
+
+std::vector<std::string> random_bytes(std::mt19937 &rng, size_t n, size_t max_len)
+{
+    std::vector<std::string> keys(n);
+    for (std::string &k : keys)
+    {
+        k.resize(rng() % (max_len + 1));
+        for (char &c : k)
+        {
+            c = static_cast<char>(rng());     // 0x00 & 0xff included
+        }
+    }
+    return keys;
+}
+
+// DOIs: long shared prefixes, prefixes of each other, duplicates.
+std::vector<std::string> dois(std::mt19937 &rng, size_t n)
+{
+    std::vector<std::string> keys(n);
+    for (std::string &k : keys)
+    {
+        k = "10.1016/j." + std::string(rng() % 4, 'a') +
+            std::to_string(rng() % (n / 4 + 1));
+        if (rng() % 10 == 0)
+        {
+            k.resize(rng() % k.size());
+        }
+    }
+    return keys;
+}
+
+void sorts()
+{
+    std::mt19937 rng(42);
+    for (size_t n : { 0, 1, 2, 15, 16, 17, 100, 5000 })
+    {
+        agrees(random_bytes(rng, n, 6), 1);
+        agrees(dois(rng, n), 1);
+    }
+    agrees(std::vector<std::string>(1000, "10.1/same"), 1);
+    agrees(std::vector<std::string>(1000, ""), 1);
+}
+
+// Big enough for the buckets to be split among the threads.
+void sorts_in_parallel()
+{
+    std::mt19937 rng(7);
+    agrees(dois(rng, 200000), 4);
+    agrees(random_bytes(rng, 100000, 3), 3);
+    agrees(std::vector<std::string>(100000, "10.1/same"), 4);
+}
+}
+
+int main()
+{
+    sorts();
+    sorts_in_parallel();
+    return test::report();
+}
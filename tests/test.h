@@ -0,0 +1,116 @@
+/*
+ * Copyright (c) 2022 - present, GitHub: @cubter
+ *
+ * See COPYING.txt in the project root for license information.
+ */
+#ifndef METASCI_TEST_H
+#define METASCI_TEST_H
+
+#include "article.h"
+#include "author.h"
+#include "journal.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <string>
+
+#include <ftw.h>
+#include <unistd.h>
+
+// Every test is a program of its own, run by ctest (see CMakeLists.txt):
+// it includes the headers it tests, calls its checks from main(), and
+// returns test::report(), which is non-zero if any check has failed.
+
+// The IDs' counters, which crossref_parser.cpp defines for metaSci.
+int32_t metasci::journal::max_id_                       = 0;
+std::atomic<int32_t> metasci::article::max_id_{0};
+int32_t metasci::publisher::max_id_                     = 0;
+int32_t metasci::author::max_id_                        = 0;
+metasci::subject_id metasci::subject::max_id_           = 0;
+metasci::pub_type_id metasci::publication_type::max_id_ = 0;
+
+namespace test
+{
+inline int &failures()
+{
+    static int n = 0;
+    return n;
+}
+
+inline void fail(const char *file, int line, const char *what)
+{
+    std::cerr << file << ':' << line << ": " << what << std::endl;
+    ++failures();
+}
+
+inline int report()
+{
+    if (failures() > 0)
+    {
+        std::cerr << failures() << " check(s) failed" << std::endl;
+    }
+    return failures() > 0 ? 1 : 0;
+}
+
+// A directory of its own for a test's files, removed with them at the end.
+class scratch_dir
+{
+public:
+    const std::string &path() const { return dir; }
+    std::string operator/(const std::string &name) const { return dir + '/' + name; }
+
+    scratch_dir()
+    {
+        char name[] = "/tmp/metasci-test-XXXXXX";
+        if (::mkdtemp(name) == nullptr)
+        {
+            std::perror("mkdtemp");
+            std::exit(2);
+        }
+        dir = name;
+    };
+    scratch_dir(const scratch_dir &other) = delete;
+    ~scratch_dir()
+    {
+        ::nftw(dir.c_str(), [](const char *path, const struct stat *, int,
+            struct FTW *) { return std::remove(path); }, 16, FTW_DEPTH | FTW_PHYS);
+    };
+
+private:
+    std::string dir;
+};
+}
+
+#define CHECK(cond)                                                         \
+    do                                                                      \
+    {                                                                       \
+        if (!(cond))                                                        \
+        {                                                                   \
+            test::fail(__FILE__, __LINE__, "CHECK(" #cond ") failed");      \
+        }                                                                   \
+    }                                                                       \
+    while (0)
+
+#define CHECK_THROWS(expr)                                                  \
+    do                                                                      \
+    {                                                                       \
+        bool thrown = false;                                                \
+        try                                                                 \
+        {                                                                   \
+            expr;                                                           \
+        }                                                                   \
+        catch(const std::exception &)                                       \
+        {                                                                   \
+            thrown = true;                                                  \
+        }                                                                   \
+        if (!thrown)                                                        \
+        {                                                                   \
+            test::fail(__FILE__, __LINE__, #expr " didn't throw");          \
+        }                                                                   \
+    }                                                                       \
+    while (0)
+#endif
@@ -0,0 +1,183 @@
+/*
+ * Copyright (c) 2022 - present, GitHub: @cubter
+ *
+ * See COPYING.txt in the project root for license information.
+ */
+#include "test.h"
+
+#include "wal.h"
+
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using metasci::write_ahead_log;
+
+namespace
+{
+std::string record(int writer, int i)
+{
+    return std::to_string(writer) + ':' + std::to_string(i) +
+        std::string(static_cast<size_t>(i % 97), 'x');
+}
+
+std::vector<std::string> replayed(const std::string &path)
+{
+    std::vector<std::string> out;
+    size_t n = write_ahead_log::replay(path, [&](const char *data, size_t len)
+    {
+        out.emplace_back(data, len);
+    });
+    CHECK(n == out.size());
+    return out;
+}
+
+uint64_t size_of(const std::string &path)
+{
+    struct stat st;
+    return ::stat(path.c_str(), &st) == 0 ? static_cast<uint64_t>(st.st_size) : 0;
+}
+
+// Records appended by several threads at once are all replayed, each
+// thread's in its order.
+void round_trip()
+{
+    test::scratch_dir dir;
+    const std::string path = dir / "log";
+    CHECK(replayed(path).empty());
+
+    const int writers = 4, per_writer = 5000;
+    {
+        write_ahead_log::options opts;
+        opts.sync_bytes = 4096;
+        opts.fsync      = false;
+        write_ahead_log log(path, opts);
+
+        std::vector<std::thread> threads;
+        for (int w = 0; w < writers; ++w)
+        {
+            threads.emplace_back([&log, w]
+            {
+                for (int i = 0; i < per_writer; ++i)
+                {
+                    uint64_t end = log.append(record(w, i));
+                    if (i % 1000 == 0)
+                    {
+                        log.wait(end);
+                    }
+                }
+            });
+        }
+        for (auto &t : threads)
+        {
+            t.join();
+        }
+        log.sync();
+    }
+
+    std::vector<int> next(writers, 0);
+    std::vector<std::string> records = replayed(path);
+    CHECK(records.size() == static_cast<size_t>(writers * per_writer));
+    for (const std::string &r : records)
+    {
+        int w = r[0] - '0';
+        CHECK(r == record(w, next[static_cast<size_t>(w)]++));
+    }
+}
+
+// What's been synced survives the process's crash; a tail torn by it is
+// cut off, and appending goes on after the last intact record.
+void crash()
+{
+    test::scratch_dir dir;
+    const std::string path = dir / "log";
+
+    pid_t pid = ::fork();
+    if (pid == 0)
+    {
+        write_ahead_log log(path);
+        for (int i = 0; i < 1000; ++i)
+        {
+            log.append(record(0, i));
+        }
+        log.sync();
+        for (int i = 1000; i < 1100; ++i)
+        {
+            log.append(record(0, i));
+        }
+        ::_exit(0);     // no destructor: the rest may or may not be written
+    }
+    int status = 0;
+    ::waitpid(pid, &status, 0);
+    CHECK(WIFEXITED(status));
+
+    std::vector<std::string> records = replayed(path);
+    CHECK(records.size() >= 1000 && records.size() <= 1100);
+    for (size_t i = 0; i < records.size(); ++i)
+    {
+        CHECK(records[i] == record(0, static_cast<int>(i)));
+    }
+
+    // A write torn in the middle of the last record.
+    const uint64_t intact = size_of(path);
+    {
+        std::ofstream out(path, std::ios::app | std::ios::binary);
+        const std::string last = record(0, 1);
+        const uint32_t len = 100;
+        out.write(reinterpret_cast<const char *>(&len), 4);
+        out.write("\0\0\0\0", 4);
+        out << last;
+    }
+    CHECK(replayed(path).size() == records.size());
+    CHECK(size_of(path) == intact);
+
+    {
+        write_ahead_log log(path);
+        log.append(std::string("after"));
+        log.sync();
+    }
+    std::vector<std::string> again = replayed(path);
+    CHECK(again.size() == records.size() + 1 && again.back() == "after");
+}
+
+// Replaying stops at a record that doesn't match its checksum.
+void corrupt()
+{
+    test::scratch_dir dir;
+    const std::string path = dir / "log";
+    {
+        write_ahead_log log(path);
+        for (int i = 0; i < 10; ++i)
+        {
+            log.append(record(0, i));
+        }
+    }
+
+    // The payload of the fourth record.
+    size_t pos = 0;
+    for (int i = 0; i < 3; ++i)
+    {
+        pos += 8 + record(0, i).size();
+    }
+    {
+        std::fstream f(path, std::ios::in | std::ios::out | std::ios::binary);
+        f.seekp(static_cast<std::streamoff>(pos + 8));
+        f.put('?');
+    }
+    CHECK(replayed(path).size() == 3);
+    CHECK(size_of(path) == pos);
+}
+}
+
+int main()
+{
+    round_trip();
+    crash();
+    corrupt();
+    return test::report();
+}
@@ -0,0 +1,330 @@
+/*
+ * Copyright (c) 2022 - present, GitHub: @cubter
+ *
+ * See COPYING.txt in the project root for license information.
+ */
+#ifndef WAL_H
+#define WAL_H
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace metasci
+{
+// Append-only write-ahead log with group commit.
+//
+// append() only copies the record into a buffer; a background thread
+// writes out whatever has piled up with a single write() and a single
+// fsync, so all the records appended meanwhile, from whatever threads,
+// become durable together. The buffer is written once it holds sync_bytes,
+// or sync_interval_ms after its first record, or as soon as someone waits
+// for durability (sync()). Without fsync, the records reach the page cache
+// only: they survive the process's crash, but not the system's.
+//
+// A record is its length, the CRC-32 of its payload, and the payload.
+// Replaying stops at the first record that's torn or doesn't match its
+// checksum, and the log is truncated there.
+class write_ahead_log
+{
+public:
+    struct options
+    {
+        size_t      sync_bytes          = size_t(1) << 20;
+        unsigned    sync_interval_ms    = 10;
+        bool        fsync               = true;
+    };
+
+    // Returns the record's end in the log, to be waited for with wait().
+    // Blocks if the background thread is far behind. Throws what the last
+    // write failed with.
+    uint64_t append(const char *data, size_t len);
+    uint64_t append(const std::string &s) { return append(s.data(), s.size()); }
+
+    // Blocks till everything up to pos is durable.
+    void wait(uint64_t pos);
+    // Blocks till everything appended so far is durable.
+    void sync();
+
+    // Calls on_record(data, len) for every intact record of the log at
+    // path, if it exists, and cuts off whatever follows them. Returns the
+    // number of records.
+    template<typename F>
+    static size_t replay(const std::string &path, F on_record);
+
+    // Appends to the log, creating it if need be. Throws std::system_error.
+    write_ahead_log(const std::string &file, const options &o);
+    explicit write_ahead_log(const std::string &file) :
+        write_ahead_log(file, options()) {};
+    write_ahead_log(const write_ahead_log &other) = delete;
+    write_ahead_log &operator=(const write_ahead_log &other) = delete;
+    // Syncs what's left, as far as it can.
+    ~write_ahead_log();
+
+private:
+    void background();
+
+    std::string     path;
+    options         opts;
+    int             fd = -1;
+
+    std::mutex              mutex;
+    std::condition_variable work_cv;
+    std::condition_variable done_cv;
+
+    std::string         pending;
+    uint64_t            appended = 0;   // log's size with the pending records
+    uint64_t            durable  = 0;
+    uint64_t            wanted   = 0;   // what waiters are waiting for
+    bool                stopping = false;
+    std::exception_ptr  error;
+
+    std::thread         worker;
+};
+
+write_ahead_log::write_ahead_log(const std::string &file, const options &o) :
+    path(file),
+    opts(o)
+{
+    fd = ::open(path.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        throw std::system_error(errno, std::generic_category(), path);
+    }
+
+    struct stat st;
+    if (::fstat(fd, &st) != 0)
+    {
+        int err = errno;
+        ::close(fd);
+        throw std::system_error(err, std::generic_category(), path);
+    }
+    appended = durable = static_cast<uint64_t>(st.st_size);
+
+    worker = std::thread(&write_ahead_log::background, this);
+};
+
+write_ahead_log::~write_ahead_log()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    work_cv.notify_all();
+    worker.join();
+    ::close(fd);
+};
+
+uint64_t write_ahead_log::append(const char *data, size_t len)
+{
+    unsigned char header[8];
+    uint32_t n   = static_cast<uint32_t>(len);
+    uint32_t crc = static_cast<uint32_t>(crc32(0, reinterpret_cast<const Bytef *>(data),
+        static_cast<uInt>(len)));
+    std::memcpy(header, &n, 4);
+    std::memcpy(header + 4, &crc, 4);
+
+    std::unique_lock<std::mutex> lock(mutex);
+
+    // Back pressure: the buffer doesn't grow past a few groups.
+    done_cv.wait(lock, [&]
+    {
+        return pending.size() < 4 * opts.sync_bytes || error;
+    });
+    if (error)
+    {
+        std::rethrow_exception(error);
+    }
+
+    bool was_empty = pending.empty();
+    pending.append(reinterpret_cast<const char *>(header), sizeof(header));
+    pending.append(data, len);
+    appended += sizeof(header) + len;
+
+    if (was_empty || pending.size() >= opts.sync_bytes)
+    {
+        work_cv.notify_one();
+    }
+    return appended;
+};
+
+void write_ahead_log::wait(uint64_t pos)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+
+    if (durable < pos && !error)
+    {
+        wanted = std::max(wanted, pos);
+        work_cv.notify_one();
+        done_cv.wait(lock, [&] { return durable >= pos || error; });
+    }
+    if (error)
+    {
+        std::rethrow_exception(error);
+    }
+};
+
+void write_ahead_log::sync()
+{
+    uint64_t pos;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        pos = appended;
+    }
+    wait(pos);
+};
+
+void write_ahead_log::background()
+{
+    using clock = std::chrono::steady_clock;
+
+    std::unique_lock<std::mutex> lock(mutex);
+    std::string group;
+
+    while (true)
+    {
+        work_cv.wait(lock, [&] { return stopping || !pending.empty(); });
+
+        // Let the group fill up, unless someone's waiting already.
+        auto deadline = clock::now() + std::chrono::milliseconds(opts.sync_interval_ms);
+        work_cv.wait_until(lock, deadline, [&]
+        {
+            return stopping || pending.size() >= opts.sync_bytes || wanted > durable;
+        });
+
+        if (pending.empty() || error)
+        {
+            if (stopping)
+            {
+                break;
+            }
+            // After a failure, appending rethrows and nothing's written.
+            pending.clear();
+            continue;
+        }
+
+        group.swap(pending);
+        pending.clear();
+        uint64_t end = appended;
+        done_cv.notify_all();   // room in the buffer
+        lock.unlock();
+
+        std::exception_ptr failure;
+        size_t written = 0;
+        while (written < group.size())
+        {
+            ssize_t n = ::write(fd, group.data() + written, group.size() - written);
+            if (n < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (n < 0)
+            {
+                failure = std::make_exception_ptr(
+                    std::system_error(errno, std::generic_category(), path));
+                break;
+            }
+            written += static_cast<size_t>(n);
+        }
+        if (!failure && opts.fsync && ::fdatasync(fd) != 0)
+        {
+            failure = std::make_exception_ptr(
+                std::system_error(errno, std::generic_category(), path));
+        }
+
+        lock.lock();
+        if (failure)
+        {
+            error = failure;
+        }
+        else
+        {
+            durable = end;
+        }
+        done_cv.notify_all();
+    }
+};
+
+template<typename F>
+size_t write_ahead_log::replay(const std::string &path, F on_record)
+{
+    int fd = ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+    if (fd < 0)
+    {
+        if (errno == ENOENT)
+        {
+            return 0;
+        }
+        throw std::system_error(errno, std::generic_category(), path);
+    }
+
+    std::string log;
+    char buf[1 << 16];
+    while (true)
+    {
+        ssize_t n = ::read(fd, buf, sizeof(buf));
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n < 0)
+        {
+            int err = errno;
+            ::close(fd);
+            throw std::system_error(err, std::generic_category(), path);
+        }
+        if (n == 0)
+        {
+            break;
+        }
+        log.append(buf, static_cast<size_t>(n));
+    }
+
+    size_t pos = 0;
+    size_t n_records = 0;
+    while (log.size() - pos >= 8)
+    {
+        uint32_t len, crc;
+        std::memcpy(&len, log.data() + pos, 4);
+        std::memcpy(&crc, log.data() + pos + 4, 4);
+        if (len > log.size() - pos - 8)
+        {
+            break;
+        }
+
+        const char *data = log.data() + pos + 8;
+        if (crc32(0, reinterpret_cast<const Bytef *>(data), len) != crc)
+        {
+            break;
+        }
+        on_record(data, static_cast<size_t>(len));
+        pos += 8 + len;
+        ++n_records;
+    }
+
+    int r = pos < log.size() ? ::ftruncate(fd, static_cast<off_t>(pos)) : 0;
+    int err = errno;
+    ::close(fd);
+    if (r != 0)
+    {
+        throw std::system_error(err, std::generic_category(), path);
+    }
+
+    return n_records;
+};
+}
+#endif